@@ -55,7 +55,19 @@ document.addEventListener('DOMContentLoaded', function() {
                 nextMovementCountdown: document.getElementById('next-movement-countdown'),
                 randomDelayCheckbox: document.getElementById('random-delay'),
                 movementTrailCheckbox: document.getElementById('movement-trail'),
-                speedValue: document.getElementById('speed-value')
+                inputIdleResumeInput: document.getElementById('input-idle-resume'),
+                speedValue: document.getElementById('speed-value'),
+                profileRows: document.getElementById('profile-rows'),
+                addProfileButton: document.getElementById('add-profile'),
+                saveProfilesButton: document.getElementById('save-profiles'),
+                profilesStatus: document.getElementById('profiles-status'),
+                scheduleEnabledCheckbox: document.getElementById('schedule-enabled'),
+                scheduleRows: document.getElementById('schedule-rows'),
+                addScheduleButton: document.getElementById('add-schedule-window'),
+                saveScheduleButton: document.getElementById('save-schedule'),
+                scheduleSaveStatus: document.getElementById('schedule-save-status'),
+                clockStatus: document.getElementById('clock-status'),
+                scheduleStatus: document.getElementById('schedule-status')
               };
               
               // Verify all required elements exist for jiggler page
@@ -94,6 +106,12 @@ document.addEventListener('DOMContentLoaded', function() {
     // Auto-save timer
     let saveTimer = null;
     
+    // Profile and schedule window limits, as reported by /api/config
+    let maxProfiles = 4;
+    let maxScheduleWindows = 8;
+    const dayNames = ['Mon', 'Tue', 'Wed', 'Thu', 'Fri', 'Sat', 'Sun'];
+    let scheduleRowId = 0; // Keeps day button ids unique
+    
     // Function to initialize all jiggler-specific functionality
     function initializeJiggler() {
       // Update movement size value display
@@ -184,10 +202,320 @@ document.addEventListener('DOMContentLoaded', function() {
       if (jigglerElements.testButton) {
         jigglerElements.testButton.addEventListener('click', testMovement);
       }
+      if (jigglerElements.addProfileButton) {
+        jigglerElements.addProfileButton.addEventListener('click', () => addProfileRow());
+      }
+      if (jigglerElements.saveProfilesButton) {
+        jigglerElements.saveProfilesButton.addEventListener('click', saveProfiles);
+      }
+      if (jigglerElements.addScheduleButton) {
+        jigglerElements.addScheduleButton.addEventListener('click', () => addScheduleRow());
+      }
+      if (jigglerElements.saveScheduleButton) {
+        jigglerElements.saveScheduleButton.addEventListener('click', saveSchedule);
+      }
+      
+      // The device has no clock of its own until SNTP answers
+      syncClock();
+    }
+    
+    // Send this browser's time and UTC offset to the device
+    async function syncClock() {
+      try {
+        await fetch('/api/time', {
+          method: 'POST',
+          headers: {
+            'Content-Type': 'application/json'
+          },
+          credentials: 'same-origin',
+          body: JSON.stringify({
+            epoch: Math.floor(Date.now() / 1000),
+            utc_offset: -new Date().getTimezoneOffset()
+          })
+        });
+      } catch (error) {
+        console.error("Clock sync error:", error);
+      }
+    }
+    
+    // Add one schedule window row, Monday to Friday 08:00-18:00 for a new one
+    function addScheduleRow(entry) {
+      const rows = jigglerElements.scheduleRows;
+      if (!rows || rows.children.length >= maxScheduleWindows) return;
+      entry = entry || { days: 0x1f, start: 8 * 60, end: 18 * 60 };
+      
+      const row = document.createElement('tr');
+      const id = scheduleRowId++;
+      const days = dayNames.map((day, index) => `
+        <input type="checkbox" class="btn-check schedule-day" id="schedule-day-${id}-${index}" autocomplete="off">
+        <label class="btn btn-sm btn-outline-info" for="schedule-day-${id}-${index}">${day}</label>`).join('');
+      row.innerHTML = `
+        <td class="text-nowrap">${days}</td>
+        <td><input type="time" class="form-control form-control-sm schedule-start"></td>
+        <td><input type="time" class="form-control form-control-sm schedule-end"></td>
+        <td><button type="button" class="btn btn-sm btn-outline-danger schedule-remove"><i class="bi bi-trash"></i></button></td>`;
+      
+      row.querySelectorAll('.schedule-day').forEach((box, index) => {
+        box.checked = !!(entry.days & (1 << index));
+      });
+      row.querySelector('.schedule-start').value = minutesToTime(entry.start);
+      row.querySelector('.schedule-end').value = minutesToTime(entry.end);
+      row.querySelector('.schedule-remove').addEventListener('click', () => {
+        row.remove();
+        updateScheduleButtons();
+      });
+      
+      rows.appendChild(row);
+      updateScheduleButtons();
+    }
+    
+    function renderSchedule(config) {
+      if (!jigglerElements.scheduleRows) return;
+      if (jigglerElements.scheduleEnabledCheckbox) {
+        jigglerElements.scheduleEnabledCheckbox.checked = !!config.schedule_enabled;
+      }
+      jigglerElements.scheduleRows.innerHTML = '';
+      (config.schedule || []).forEach(entry => addScheduleRow(entry));
+      updateScheduleButtons();
+    }
+    
+    function updateScheduleButtons() {
+      if (jigglerElements.addScheduleButton && jigglerElements.scheduleRows) {
+        jigglerElements.addScheduleButton.disabled = jigglerElements.scheduleRows.children.length >= maxScheduleWindows;
+      }
+    }
+    
+    // Clock source and next activation from /api/status
+    function updateScheduleStatus(data) {
+      if (jigglerElements.clockStatus && data.clock) {
+        jigglerElements.clockStatus.textContent = data.clock.local_time
+          ? `${data.clock.local_time} (${data.clock.source})`
+          : 'not set';
+      }
+      if (!jigglerElements.scheduleStatus || !data.schedule) return;
+      const schedule = data.schedule;
+      const when = epoch => new Date(epoch * 1000).toLocaleString([], { weekday: 'short', hour: '2-digit', minute: '2-digit' });
+      if (!schedule.enabled) {
+        jigglerElements.scheduleStatus.textContent = 'Schedule off, jiggling at all hours';
+      } else if (schedule.active) {
+        jigglerElements.scheduleStatus.textContent = schedule.next_change
+          ? `Inside work hours until ${when(schedule.next_change)}`
+          : 'Inside work hours';
+      } else {
+        jigglerElements.scheduleStatus.textContent = schedule.next_activation
+          ? `Off hours, next activation ${when(schedule.next_activation)}`
+          : 'Off hours, no window ahead';
+      }
+    }
+    
+    // Save the switch and the whole window list
+    async function saveSchedule() {
+      const status = jigglerElements.scheduleSaveStatus;
+      try {
+        const schedule = [];
+        for (const row of jigglerElements.scheduleRows.children) {
+          let days = 0;
+          row.querySelectorAll('.schedule-day').forEach((box, index) => {
+            if (box.checked) days |= 1 << index;
+          });
+          if (!days) throw new Error('Pick at least one day for every window');
+          schedule.push({
+            days: days,
+            start: timeToMinutes(row.querySelector('.schedule-start').value),
+            end: timeToMinutes(row.querySelector('.schedule-end').value)
+          });
+        }
+        
+        const response = await fetch('/api/config', {
+          method: 'POST',
+          headers: {
+            'Content-Type': 'application/json'
+          },
+          credentials: 'same-origin',
+          body: JSON.stringify({
+            schedule_enabled: jigglerElements.scheduleEnabledCheckbox.checked,
+            schedule: schedule
+          })
+        });
+        const result = await response.json().catch(() => ({}));
+        if (!response.ok) {
+          throw new Error(result.message || 'Failed to save schedule');
+        }
+        
+        if (status) {
+          status.innerHTML = '<i class="bi bi-check-circle-fill text-success"></i> Saved';
+          setTimeout(() => { status.innerHTML = ''; }, 3000);
+        }
+        addToLog('Schedule saved');
+        checkLastMovement();
+      } catch (error) {
+        console.error("Schedule save error:", error);
+        if (status) status.textContent = error.message;
+        addToLog('Error: ' + error.message);
+      }
+    }
+    
+    function minutesToTime(minutes) {
+      return `${String(Math.floor(minutes / 60)).padStart(2, '0')}:${String(minutes % 60).padStart(2, '0')}`;
+    }
+    
+    function timeToMinutes(value) {
+      const [hours, minutes] = (value || '00:00').split(':').map(Number);
+      return (hours || 0) * 60 + (minutes || 0);
+    }
+    
+    // Add one editable profile row, with defaults for a new profile
+    function addProfileRow(profile) {
+      const rows = jigglerElements.profileRows;
+      if (!rows || rows.children.length >= maxProfiles) return;
+      profile = profile || {
+        name: `profile${rows.children.length + 1}`,
+        enabled: true,
+        move_interval: 600,
+        jitter: 20,
+        movement_pattern: 'linear',
+        movement_size: 10,
+        movement_speed: 1000,
+        window_start: 0,
+        window_end: 0
+      };
+      
+      const row = document.createElement('tr');
+      row.innerHTML = `
+        <td><input class="form-check-input profile-enabled" type="checkbox"></td>
+        <td><input type="text" class="form-control form-control-sm profile-name" maxlength="15" style="min-width: 7rem"></td>
+        <td><input type="number" class="form-control form-control-sm profile-interval" min="1" max="86400" step="1"></td>
+        <td><input type="number" class="form-control form-control-sm profile-jitter" min="0" max="50" step="1"></td>
+        <td><select class="form-select form-select-sm profile-pattern"></select></td>
+        <td><input type="number" class="form-control form-control-sm profile-size" min="1" max="400" step="1"></td>
+        <td><input type="number" class="form-control form-control-sm profile-speed" min="1" max="3000" step="1"></td>
+        <td><input type="time" class="form-control form-control-sm profile-start"></td>
+        <td><input type="time" class="form-control form-control-sm profile-end"></td>
+        <td class="profile-next text-nowrap">-</td>
+        <td><button type="button" class="btn btn-sm btn-outline-danger profile-remove"><i class="bi bi-trash"></i></button></td>`;
+      
+      // Same choices as the main pattern list, installed files included
+      const select = row.querySelector('.profile-pattern');
+      select.innerHTML = jigglerElements.movementPatternSelect.innerHTML;
+      select.value = profile.movement_pattern;
+      row.querySelector('.profile-enabled').checked = !!profile.enabled;
+      row.querySelector('.profile-name').value = profile.name;
+      row.querySelector('.profile-interval').value = profile.move_interval;
+      row.querySelector('.profile-jitter').value = profile.jitter;
+      row.querySelector('.profile-size').value = profile.movement_size;
+      row.querySelector('.profile-speed').value = profile.movement_speed;
+      row.querySelector('.profile-start').value = minutesToTime(profile.window_start);
+      row.querySelector('.profile-end').value = minutesToTime(profile.window_end);
+      row.querySelector('.profile-remove').addEventListener('click', () => {
+        row.remove();
+        updateProfileButtons();
+      });
+      
+      rows.appendChild(row);
+      updateProfileButtons();
+    }
+    
+    function renderProfiles(profiles) {
+      if (!jigglerElements.profileRows) return;
+      jigglerElements.profileRows.innerHTML = '';
+      profiles.forEach(profile => addProfileRow(profile));
+      updateProfileButtons();
+    }
+    
+    function updateProfileButtons() {
+      if (jigglerElements.addProfileButton && jigglerElements.profileRows) {
+        jigglerElements.addProfileButton.disabled = jigglerElements.profileRows.children.length >= maxProfiles;
+      }
+    }
+    
+    // Show each profile's countdown from the /api/status deadlines
+    function updateProfileCountdowns(profiles, uptime) {
+      if (!jigglerElements.profileRows) return;
+      for (const row of jigglerElements.profileRows.children) {
+        const name = row.querySelector('.profile-name').value;
+        const status = profiles.find(profile => profile.name === name);
+        const cell = row.querySelector('.profile-next');
+        if (!status || !status.next_move_time) {
+          cell.textContent = '-';
+          continue;
+        }
+        const remaining = Math.max(0, status.next_move_time - uptime);
+        cell.textContent = `${Math.floor(remaining / 60000)}:${Math.floor((remaining % 60000) / 1000).toString().padStart(2, '0')}`;
+      }
+    }
+    
+    // Save the whole profile list, it replaces the one on the device
+    async function saveProfiles() {
+      const status = jigglerElements.profilesStatus;
+      try {
+        const profiles = [];
+        for (const row of jigglerElements.profileRows.children) {
+          profiles.push({
+            name: row.querySelector('.profile-name').value.trim(),
+            enabled: row.querySelector('.profile-enabled').checked,
+            move_interval: parseInt(row.querySelector('.profile-interval').value),
+            jitter: parseInt(row.querySelector('.profile-jitter').value) || 0,
+            movement_pattern: row.querySelector('.profile-pattern').value,
+            movement_size: parseInt(row.querySelector('.profile-size').value),
+            movement_speed: parseInt(row.querySelector('.profile-speed').value),
+            window_start: timeToMinutes(row.querySelector('.profile-start').value),
+            window_end: timeToMinutes(row.querySelector('.profile-end').value)
+          });
+        }
+        
+        const response = await fetch('/api/config', {
+          method: 'POST',
+          headers: {
+            'Content-Type': 'application/json'
+          },
+          credentials: 'same-origin',
+          body: JSON.stringify({ profiles: profiles })
+        });
+        const result = await response.json().catch(() => ({}));
+        if (!response.ok) {
+          throw new Error(result.message || 'Failed to save profiles');
+        }
+        
+        if (status) {
+          status.innerHTML = '<i class="bi bi-check-circle-fill text-success"></i> Saved';
+          setTimeout(() => { status.innerHTML = ''; }, 3000);
+        }
+        addToLog(`Saved ${profiles.length} profile(s)`);
+        checkLastMovement();
+      } catch (error) {
+        console.error("Profile save error:", error);
+        if (status) status.textContent = error.message;
+        addToLog('Error: ' + error.message);
+      }
+    }
+    
+    // Add installed pattern files to the pattern list
+    async function loadPatterns() {
+      const select = jigglerElements.movementPatternSelect;
+      if (!select) return;
+      try {
+        const response = await fetch('/api/patterns', {
+          credentials: 'same-origin'
+        });
+        if (!response.ok) return;
+        
+        const data = await response.json();
+        for (const pattern of data.patterns || []) {
+          if (pattern.builtin || select.querySelector(`option[value="${pattern.name}"]`)) continue;
+          const option = document.createElement('option');
+          option.value = pattern.name;
+          option.textContent = `${pattern.name} (file, ${pattern.steps} steps)`;
+          select.appendChild(option);
+        }
+      } catch (error) {
+        console.error("Pattern list error:", error);
+      }
     }
     
     // Load configuration
     async function loadConfig() {
+      // The saved pattern may be an installed file, list those first
+      await loadPatterns();
       try {
         const response = await fetch('/api/config', {
           credentials: 'same-origin'
@@ -233,6 +561,12 @@ document.addEventListener('DOMContentLoaded', function() {
           // New features (with defaults if not in config yet)
           if (jigglerElements.randomDelayCheckbox) jigglerElements.randomDelayCheckbox.checked = !!config.random_delay;
           if (jigglerElements.movementTrailCheckbox) jigglerElements.movementTrailCheckbox.checked = !!config.movement_trail;
+          if (jigglerElements.inputIdleResumeInput) jigglerElements.inputIdleResumeInput.value = config.input_idle_resume ?? 5;
+          
+          maxProfiles = config.max_profiles || maxProfiles;
+          renderProfiles(config.profiles || []);
+          maxScheduleWindows = config.max_schedule_windows || maxScheduleWindows;
+          renderSchedule(config);
           
           // Update last movement time
           checkLastMovement();
@@ -257,6 +591,8 @@ document.addEventListener('DOMContentLoaded', function() {
         if (response.ok) {
           const data = await response.json();
           deviceInfo.jigglerEnabled = !!data.jiggler_enabled;
+          updateProfileCountdowns(data.profiles || [], data.uptime_seconds * 1000);
+          updateScheduleStatus(data);
           
           if (data && data.last_move_time) {
             // Get current device uptime in milliseconds
@@ -391,6 +727,7 @@ document.addEventListener('DOMContentLoaded', function() {
         // New feature values
         const randomDelay = jigglerElements.randomDelayCheckbox ? jigglerElements.randomDelayCheckbox.checked : false;
         const movementTrail = jigglerElements.movementTrailCheckbox ? jigglerElements.movementTrailCheckbox.checked : false;
+        const inputIdleResume = jigglerElements.inputIdleResumeInput ? parseInt(jigglerElements.inputIdleResumeInput.value) : 5;
         
         // Validate input
         if (isNaN(moveInterval) || moveInterval < 1) {
@@ -408,6 +745,11 @@ document.addEventListener('DOMContentLoaded', function() {
           return;
         }
         
+        if (isNaN(inputIdleResume) || inputIdleResume < 0 || inputIdleResume > 3600) {
+          showStatus('Touchpad idle time must be between 0 and 3600 seconds', false);
+          return;
+        }
+        
         const config = {
           jiggler_enabled: jigglerEnabled,
           movement_pattern: movementPattern,
@@ -415,7 +757,8 @@ document.addEventListener('DOMContentLoaded', function() {
           movement_size: movementSize,
           movement_speed: movementSpeed,
           random_delay: randomDelay,
-          movement_trail: movementTrail
+          movement_trail: movementTrail,
+          input_idle_resume: inputIdleResume
         };
         
         // For backward compatibility with old versions
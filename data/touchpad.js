@@ -14,6 +14,12 @@ document.addEventListener('DOMContentLoaded', function() {
     const logoutButton = document.getElementById('logout-button');
     const touchpadEnabled = document.getElementById('touchpad-enabled');
     const touchpadContainer = document.getElementById('touchpad-container');
+    const latencyDiv = document.getElementById('latency');
+    const macroName = document.getElementById('macro-name');
+    const macroRecord = document.getElementById('macro-record');
+    const macroStop = document.getElementById('macro-stop');
+    const macroPlay = document.getElementById('macro-play');
+    const macroState = document.getElementById('macro-state');
     
     // Touchpad state
     let isTracking = false;
@@ -25,14 +31,39 @@ document.addEventListener('DOMContentLoaded', function() {
     let touchStartY = 0;
     const touchThreshold = 3;
     
-    // Scroll state
+    // Scroll state. Distances are in wheel detents, fractions allowed; the
+    // device spreads each scroll over glide_ms in fine-grained reports.
     let scrollInterval = null;
-    const scrollRepeatDelay = 150;
+    const scrollRepeatMs = 100;
+    const pixelsPerDetent = 40;       // Two-finger travel for one detent at sensitivity 5
+    const flickGlideMs = 600;
+    const flickMinSpeed = 0.3;        // px/ms at lift-off that counts as a flick
+    let isScrolling = false;
+    let scrollLastX = 0;
+    let scrollLastY = 0;
+    let scrollLastTime = 0;
+    let scrollPendingX = 0;
+    let scrollPendingY = 0;
+    let scrollVelocityX = 0;
+    let scrollVelocityY = 0;
+    let lastScroll = 0;
+    let wheelPending = 0;
     
     // Drag state
     let isDragging = false;
     let leftButtonPressed = false;
     
+    // Latency probe: every input carries a sequence ID that the device echoes.
+    // The ack leaves once the input is queued for the HID sender, so the
+    // round trip ends at the queue; the device-side time up to the HID report
+    // comes from /api/metrics/latency.
+    let inputSeq = 0;
+    const roundTrips = [];
+    const roundTripWindow = 100;
+    let lastInputTime = 0;
+    let deviceLatency = '';
+    const deviceLatencyPollMs = 2000;
+    
     // Handle touchpad toggle
     if (touchpadEnabled) {
       touchpadEnabled.addEventListener('change', function() {
@@ -93,6 +124,65 @@ document.addEventListener('DOMContentLoaded', function() {
       };
     }
     
+    // Post an input event and record its round trip when the device echoes the sequence ID
+    async function sendInput(path, payload) {
+      inputSeq = (inputSeq % 0xFFFFFFFF) + 1;
+      const seq = inputSeq;
+      const started = performance.now();
+      
+      const response = await fetch(path, {
+        method: 'POST',
+        headers: { 'Content-Type': 'application/json' },
+        credentials: 'same-origin',
+        body: JSON.stringify({ ...payload, seq })
+      });
+      const result = await response.json().catch(() => ({}));
+      lastInputTime = Date.now();
+      if (result.seq === seq) {
+        recordRoundTrip(performance.now() - started);
+      }
+      if (response.status === 503) {
+        showStatus('Device busy, input dropped', false);
+      }
+    }
+    
+    // Keep a rolling window of round trips and show its percentiles
+    function recordRoundTrip(ms) {
+      roundTrips.push(ms);
+      if (roundTrips.length > roundTripWindow) roundTrips.shift();
+      if (!latencyDiv) return;
+      
+      showLatency();
+    }
+    
+    function showLatency() {
+      if (!latencyDiv || roundTrips.length === 0) return;
+      const sorted = [...roundTrips].sort((a, b) => a - b);
+      const percentile = p => sorted[Math.min(sorted.length - 1, Math.floor(sorted.length * p))];
+      latencyDiv.textContent = `Round trip to enqueue: p50 ${percentile(0.5).toFixed(1)} ms, ` +
+        `p99 ${percentile(0.99).toFixed(1)} ms (last ${sorted.length})` + deviceLatency;
+    }
+    
+    // While the touchpad is in use, fetch the device's receive-to-HID-report
+    // time, which includes the sender stage the round trip cannot see
+    async function pollDeviceLatency() {
+      if (!latencyDiv || Date.now() - lastInputTime > deviceLatencyPollMs * 2) return;
+      try {
+        const response = await fetch('/api/metrics/latency', { credentials: 'same-origin' });
+        if (!response.ok) return;
+        const metrics = await response.json();
+        const total = metrics.stages && metrics.stages.total;
+        const send = metrics.stages && metrics.stages.hid_send;
+        if (!total || total.count === 0) return;
+        deviceLatency = ` · on device to HID sent: p50 ${(total.p50_us / 1000).toFixed(2)} ms, ` +
+          `p99 ${(total.p99_us / 1000).toFixed(2)} ms (HID send p99 ${(send.p99_us / 1000).toFixed(2)} ms)`;
+        showLatency();
+      } catch (error) {
+        console.error("Error fetching device latency:", error);
+      }
+    }
+    setInterval(pollDeviceLatency, deviceLatencyPollMs);
+    
     // Send mouse movement to server
     async function sendMouseMove(x, y) {
       try {
@@ -100,12 +190,7 @@ document.addEventListener('DOMContentLoaded', function() {
         if (now - lastMove < moveThrottleMs) return;
         lastMove = now;
         
-        await fetch('/api/touchpad/move', {
-          method: 'POST',
-          headers: { 'Content-Type': 'application/json' },
-          credentials: 'same-origin',
-          body: JSON.stringify({ x, y })
-        });
+        await sendInput('/api/touchpad/move', { x, y });
       } catch (error) {
         console.error("Error sending mouse movement:", error);
         showStatus('Connection error', false);
@@ -115,12 +200,7 @@ document.addEventListener('DOMContentLoaded', function() {
     // Send mouse click to server
     async function sendMouseClick(button, clickType = 'single') {
       try {
-        await fetch('/api/touchpad/click', {
-          method: 'POST',
-          headers: { 'Content-Type': 'application/json' },
-          credentials: 'same-origin',
-          body: JSON.stringify({ button, clickType })
-        });
+        await sendInput('/api/touchpad/click', { button, clickType });
       } catch (error) {
         console.error("Error sending mouse click:", error);
         showStatus('Connection error', false);
@@ -130,29 +210,20 @@ document.addEventListener('DOMContentLoaded', function() {
     // Send mouse button state to server
     async function sendMouseButtonState(button, state) {
       try {
-        await fetch('/api/touchpad/button', {
-          method: 'POST',
-          headers: { 'Content-Type': 'application/json' },
-          credentials: 'same-origin',
-          body: JSON.stringify({ button, state })
-        });
+        await sendInput('/api/touchpad/button', { button, state });
       } catch (error) {
         console.error("Error sending mouse button state:", error);
         showStatus('Connection error', false);
       }
     }
     
-    // Send mouse scroll to server
-    async function sendMouseScroll(amount) {
+    // Send mouse scroll to server: wheel positive scrolls up, pan positive right
+    async function sendMouseScroll(wheel, pan = 0, glideMs = scrollRepeatMs) {
       try {
-        const scrollMultiplier = 300;
-        const scaledAmount = amount * scrollMultiplier;
-        
-        await fetch('/api/touchpad/scroll', {
-          method: 'POST',
-          headers: { 'Content-Type': 'application/json' },
-          credentials: 'same-origin',
-          body: JSON.stringify({ amount: scaledAmount })
+        await sendInput('/api/touchpad/scroll', {
+          wheel: Math.round(wheel * 1000) / 1000,
+          pan: Math.round(pan * 1000) / 1000,
+          glide_ms: Math.round(glideMs)
         });
       } catch (error) {
         console.error("Error sending mouse scroll:", error);
@@ -204,9 +275,25 @@ document.addEventListener('DOMContentLoaded', function() {
       
       document.addEventListener('touchend', function(e) {
         // Always handle touchend to prevent stuck states
+        if (isScrolling && e.touches.length < 2) {
+          endScrollGesture();
+        }
         stopTracking(e);
       }, { passive: false });
       
+      // A mouse wheel or laptop touchpad over the pad scrolls the device too
+      touchpad.addEventListener('wheel', function(e) {
+        if (!touchpadEnabled || !touchpadEnabled.checked) return;
+        e.preventDefault();
+        const pixelsPerUnit = e.deltaMode === 1 ? 3 : e.deltaMode === 2 ? 0.1 : 100;
+        wheelPending -= e.deltaY / pixelsPerUnit;
+        const now = Date.now();
+        if (now - lastScroll < moveThrottleMs) return;
+        lastScroll = now;
+        sendMouseScroll(wheelPending, 0, moveThrottleMs * 2);
+        wheelPending = 0;
+      }, { passive: false });
+      
       // Button event handlers
       if (leftClick) {
         leftClick.addEventListener('mousedown', function(e) {
@@ -258,50 +345,50 @@ document.addEventListener('DOMContentLoaded', function() {
       if (scrollUp) {
         scrollUp.addEventListener('mousedown', function() {
           if (!touchpadEnabled || !touchpadEnabled.checked) return;
-          sendMouseScroll(-10);
+          sendMouseScroll(1);
           scrollUp.classList.add('active');
           
           if (scrollInterval) clearInterval(scrollInterval);
           scrollInterval = setInterval(() => {
-            sendMouseScroll(-10);
-          }, 100);
+            sendMouseScroll(1);
+          }, scrollRepeatMs);
         });
         
         scrollUp.addEventListener('touchstart', function(e) {
           if (!touchpadEnabled || !touchpadEnabled.checked) return;
           e.preventDefault();
-          sendMouseScroll(-10);
+          sendMouseScroll(1);
           scrollUp.classList.add('active');
           
           if (scrollInterval) clearInterval(scrollInterval);
           scrollInterval = setInterval(() => {
-            sendMouseScroll(-10);
-          }, 100);
+            sendMouseScroll(1);
+          }, scrollRepeatMs);
         });
       }
       
       if (scrollDown) {
         scrollDown.addEventListener('mousedown', function() {
           if (!touchpadEnabled || !touchpadEnabled.checked) return;
-          sendMouseScroll(10);
+          sendMouseScroll(-1);
           scrollDown.classList.add('active');
           
           if (scrollInterval) clearInterval(scrollInterval);
           scrollInterval = setInterval(() => {
-            sendMouseScroll(10);
-          }, 100);
+            sendMouseScroll(-1);
+          }, scrollRepeatMs);
         });
         
         scrollDown.addEventListener('touchstart', function(e) {
           if (!touchpadEnabled || !touchpadEnabled.checked) return;
           e.preventDefault();
-          sendMouseScroll(10);
+          sendMouseScroll(-1);
           scrollDown.classList.add('active');
           
           if (scrollInterval) clearInterval(scrollInterval);
           scrollInterval = setInterval(() => {
-            sendMouseScroll(10);
-          }, 100);
+            sendMouseScroll(-1);
+          }, scrollRepeatMs);
         });
       }
       
@@ -329,6 +416,12 @@ document.addEventListener('DOMContentLoaded', function() {
       e.preventDefault();
       e.stopPropagation();
       
+      // Two fingers scroll instead of moving the pointer
+      if (e.touches.length >= 2) {
+        startScrollGesture(e);
+        return;
+      }
+      
       // Get position for tracking
       const pos = getEventPosition(e);
       touchStartX = pos.x;
@@ -338,6 +431,79 @@ document.addEventListener('DOMContentLoaded', function() {
       startTracking(e);
     }
     
+    // Midpoint of the first two touches, relative to the touchpad
+    function getScrollPosition(e) {
+      const rect = touchpad.getBoundingClientRect();
+      return {
+        x: (e.touches[0].clientX + e.touches[1].clientX) / 2 - rect.left,
+        y: (e.touches[0].clientY + e.touches[1].clientY) / 2 - rect.top
+      };
+    }
+    
+    // Begin a two-finger scroll
+    function startScrollGesture(e) {
+      isTracking = false;
+      isScrolling = true;
+      if (cursorIndicator) {
+        cursorIndicator.style.display = 'none';
+      }
+      const pos = getScrollPosition(e);
+      scrollLastX = pos.x;
+      scrollLastY = pos.y;
+      scrollLastTime = performance.now();
+      scrollPendingX = 0;
+      scrollPendingY = 0;
+      scrollVelocityX = 0;
+      scrollVelocityY = 0;
+    }
+    
+    // Follow the fingers: content moves with them, like a phone or laptop
+    // touchpad. Travel is collected between sends and the finger speed is
+    // smoothed for the flick at lift-off.
+    function scrollTracking(e) {
+      if (e.touches.length < 2) return;
+      const pos = getScrollPosition(e);
+      const now = performance.now();
+      const dx = pos.x - scrollLastX;
+      const dy = pos.y - scrollLastY;
+      const dt = Math.max(1, now - scrollLastTime);
+      scrollLastX = pos.x;
+      scrollLastY = pos.y;
+      scrollLastTime = now;
+      scrollPendingX += dx;
+      scrollPendingY += dy;
+      scrollVelocityX = 0.7 * scrollVelocityX + 0.3 * dx / dt;
+      scrollVelocityY = 0.7 * scrollVelocityY + 0.3 * dy / dt;
+      
+      if (Date.now() - lastScroll < moveThrottleMs) return;
+      lastScroll = Date.now();
+      const perDetent = pixelsPerDetent * 5 / getSensitivity();
+      sendMouseScroll(scrollPendingY / perDetent, -scrollPendingX / perDetent, moveThrottleMs * 2);
+      scrollPendingX = 0;
+      scrollPendingY = 0;
+    }
+    
+    // Lift-off: send what is left, plus the flick as a single glide that
+    // covers the distance the fingers would travel while slowing to a stop
+    function endScrollGesture() {
+      isScrolling = false;
+      const perDetent = pixelsPerDetent * 5 / getSensitivity();
+      let wheel = scrollPendingY / perDetent;
+      let pan = -scrollPendingX / perDetent;
+      let glideMs = moveThrottleMs * 2;
+      if (performance.now() - scrollLastTime < 100 &&
+          Math.hypot(scrollVelocityX, scrollVelocityY) > flickMinSpeed) {
+        wheel += scrollVelocityY * flickGlideMs / 2 / perDetent;
+        pan -= scrollVelocityX * flickGlideMs / 2 / perDetent;
+        glideMs = flickGlideMs;
+      }
+      if (wheel !== 0 || pan !== 0) {
+        sendMouseScroll(wheel, pan, glideMs);
+      }
+      scrollPendingX = 0;
+      scrollPendingY = 0;
+    }
+    
     // Start tracking mouse/touch movement
     function startTracking(e) {
       e.preventDefault();
@@ -359,6 +525,11 @@ document.addEventListener('DOMContentLoaded', function() {
     
     // Track mouse/touch movement
     function moveTracking(e) {
+      if (isScrolling) {
+        e.preventDefault();
+        scrollTracking(e);
+        return;
+      }
       if (!isTracking && !isDragging && !leftButtonPressed) return;
       e.preventDefault();
       e.stopPropagation();
@@ -493,9 +664,86 @@ document.addEventListener('DOMContentLoaded', function() {
       }
     }
     
+    // Post a macro command and report the outcome
+    async function sendMacro(path, payload) {
+      try {
+        const response = await fetch(path, {
+          method: 'POST',
+          headers: { 'Content-Type': 'application/json' },
+          credentials: 'same-origin',
+          body: JSON.stringify(payload || {})
+        });
+        const result = await response.json().catch(() => ({}));
+        if (!response.ok) {
+          showStatus(result.message || 'Macro request failed', false);
+        }
+        return response.ok ? result : null;
+      } catch (error) {
+        showStatus('Macro request failed: ' + error.message, false);
+        return null;
+      }
+    }
+    
+    // The device saves a stopped macro in the background; poll for the outcome
+    async function macroResult() {
+      for (let attempt = 0; attempt < 50; attempt++) {
+        try {
+          const response = await fetch('/api/macro/result', { credentials: 'same-origin' });
+          if (response.status !== 202) {
+            const result = await response.json().catch(() => ({}));
+            if (!response.ok) {
+              showStatus(result.message || 'Macro was not saved', false);
+            }
+            return response.ok ? result : null;
+          }
+        } catch (error) {
+          showStatus('Macro request failed: ' + error.message, false);
+          return null;
+        }
+        await new Promise(resolve => setTimeout(resolve, 100));
+      }
+      showStatus('Macro is still being saved', false);
+      return null;
+    }
+    
+    function setupMacros() {
+      if (!macroRecord || !macroStop || !macroPlay) return;
+      
+      macroRecord.addEventListener('click', async function() {
+        if (await sendMacro('/api/macro/record')) {
+          macroRecord.disabled = true;
+          macroStop.disabled = false;
+          if (macroState) macroState.textContent = 'Recording... use the touchpad, then Stop & Save.';
+        }
+      });
+      
+      macroStop.addEventListener('click', async function() {
+        if (!await sendMacro('/api/macro/stop', { name: macroName ? macroName.value.trim() : '' })) return;
+        macroRecord.disabled = false;
+        macroStop.disabled = true;
+        const result = await macroResult();
+        if (!result) {
+          if (macroState) macroState.textContent = '';
+          return;
+        }
+        if (macroState) {
+          macroState.textContent = `Saved ${result.name}: ${result.instructions} instructions, ` +
+            `${(result.duration_ms / 1000).toFixed(1)} s` + (result.truncated ? ' (truncated)' : '');
+        }
+      });
+      
+      macroPlay.addEventListener('click', async function() {
+        const name = macroName ? macroName.value.trim() : '';
+        if (await sendMacro('/api/macro/play', { name })) {
+          showStatus(`Playing ${name}`, true);
+        }
+      });
+    }
+    
     // Initialize
     checkAuth();
     setupTouchpad();
+    setupMacros();
     
   } catch (error) {
     console.error("Initialization error:", error);
@@ -0,0 +1,28 @@
+// Jittered jiggle intervals for jiggla
+// The scheduler draws one jittered interval per movement cycle and keeps it
+// as an absolute deadline. The draw lives here so the host tests in
+// test/test_interval can check its distribution on a virtual clock.
+//
+// Like trace.h this header has no Arduino dependencies. The random source is
+// passed in: `long random(long low, long high)` returning a uniform value in
+// [low, high), as Arduino's random() does.
+
+#ifndef JIGGLE_INTERVAL_H
+#define JIGGLE_INTERVAL_H
+
+#include <stdint.h>
+
+#define RANDOM_DELAY_SPREAD_PERMILLE 300 // random_delay: +/-30%
+
+// Scale `interval` by a permille factor drawn uniformly from
+// [1000 - spread, 1000 + spread] in 0.1% steps; spread 0 returns it unchanged
+template <typename Random>
+uint32_t jitterInterval(uint32_t interval, uint32_t spread_permille, Random&& random) {
+  if (spread_permille == 0) {
+    return interval;
+  }
+  long permille = random(1000L - (long)spread_permille, 1000L + (long)spread_permille + 1);
+  return (uint32_t)((uint64_t)interval * (uint64_t)permille / 1000);
+}
+
+#endif // JIGGLE_INTERVAL_H
@@ -0,0 +1,352 @@
+// Binary movement pattern files for jiggla
+// A pattern is a header followed by segments; each segment is a run of
+// (dx, dy) steps sharing one step duration. The firmware streams the file
+// during playback, so every installed pattern costs the same few bytes of RAM
+// however long it is.
+//
+// Like trace.h this header has no Arduino dependencies so host tools can
+// write and check pattern files with the same code. tools/jpat.cpp turns a
+// list of points into a pattern file with patternEncode().
+//
+// Layout, little-endian:
+//   header   "JPAT", version u8, flags u8 (0), segment_count u16,
+//            step_count u32, duration_units u32
+//   segment  step_count u16, step_units u16, encoding u8, reserved u8 (0),
+//            followed by step_count deltas
+// Deltas are int8 pairs (PATTERN_ENCODING_INT8) or zigzag LEB128 varint pairs
+// (PATTERN_ENCODING_VARINT). Positions are in file units, PATTERN_FILE_UNIT
+// of which equal the configured movement size. After each step the player
+// waits step_units / duration_units of the movement speed; the step_units of
+// all steps must add up to duration_units.
+
+#ifndef PATTERN_FILE_H
+#define PATTERN_FILE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define PATTERN_FILE_VERSION 1
+#define PATTERN_FILE_HEADER_SIZE 16
+#define PATTERN_SEGMENT_HEADER_SIZE 6
+#define PATTERN_FILE_UNIT 100         // File units per movement size
+#define PATTERN_FILE_MAX_SIZE 16384   // Bytes
+#define PATTERN_FILE_MAX_STEPS 8192
+#define PATTERN_FILE_MAX_SEGMENTS 1024
+#define PATTERN_FILE_MAX_COORD 10000  // Bound on |x| and |y|, keeps scaling within 32 bits
+
+static const uint8_t PATTERN_FILE_MAGIC[4] = { 'J', 'P', 'A', 'T' };
+
+enum PatternEncoding : uint8_t {
+  PATTERN_ENCODING_INT8 = 0,
+  PATTERN_ENCODING_VARINT = 1,
+};
+
+struct PatternFileHeader {
+  uint8_t version;
+  uint8_t flags;
+  uint16_t segment_count;
+  uint32_t step_count;
+  uint32_t duration_units;
+};
+
+struct PatternSegment {
+  uint16_t step_count;
+  uint16_t step_units; // Duration of each step in this segment
+  uint8_t encoding;
+};
+
+// Readers take a byte source whose `int read()` returns the next byte, or -1
+// at the end of the input.
+
+template <typename Source>
+bool patternReadU16(Source& source, uint16_t& value) {
+  int low = source.read();
+  int high = source.read();
+  if (low < 0 || high < 0) {
+    return false;
+  }
+  value = (uint16_t)(low | (high << 8));
+  return true;
+}
+
+template <typename Source>
+bool patternReadU32(Source& source, uint32_t& value) {
+  uint16_t low, high;
+  if (!patternReadU16(source, low) || !patternReadU16(source, high)) {
+    return false;
+  }
+  value = (uint32_t)low | ((uint32_t)high << 16);
+  return true;
+}
+
+template <typename Source>
+bool patternReadHeader(Source& source, PatternFileHeader& header) {
+  for (int i = 0; i < 4; i++) {
+    if (source.read() != PATTERN_FILE_MAGIC[i]) {
+      return false;
+    }
+  }
+  int version = source.read();
+  int flags = source.read();
+  if (version != PATTERN_FILE_VERSION || flags != 0) {
+    return false;
+  }
+  header.version = (uint8_t)version;
+  header.flags = (uint8_t)flags;
+  return patternReadU16(source, header.segment_count) &&
+         patternReadU32(source, header.step_count) &&
+         patternReadU32(source, header.duration_units);
+}
+
+template <typename Source>
+bool patternReadSegment(Source& source, PatternSegment& segment) {
+  if (!patternReadU16(source, segment.step_count) || !patternReadU16(source, segment.step_units)) {
+    return false;
+  }
+  int encoding = source.read();
+  int reserved = source.read();
+  if (encoding < 0 || encoding > PATTERN_ENCODING_VARINT || reserved != 0) {
+    return false;
+  }
+  segment.encoding = (uint8_t)encoding;
+  return true;
+}
+
+// Zigzag LEB128, at most 3 bytes (21 bits is plenty for one step)
+template <typename Source>
+bool patternReadVarint(Source& source, int32_t& value) {
+  uint32_t raw = 0;
+  for (int shift = 0; shift < 21; shift += 7) {
+    int byte = source.read();
+    if (byte < 0) {
+      return false;
+    }
+    raw |= (uint32_t)(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) {
+      value = (int32_t)(raw >> 1) ^ -(int32_t)(raw & 1);
+      return true;
+    }
+  }
+  return false;
+}
+
+template <typename Source>
+bool patternReadDelta(Source& source, uint8_t encoding, int32_t& dx, int32_t& dy) {
+  if (encoding == PATTERN_ENCODING_VARINT) {
+    return patternReadVarint(source, dx) && patternReadVarint(source, dy);
+  }
+  int x = source.read();
+  int y = source.read();
+  if (x < 0 || y < 0) {
+    return false;
+  }
+  dx = (int8_t)x;
+  dy = (int8_t)y;
+  return true;
+}
+
+// Read a whole file and check it against the limits above. Returns NULL when
+// the file is valid, otherwise a short description of the first problem.
+template <typename Source>
+const char* patternValidate(Source& source, PatternFileHeader& header) {
+  if (!patternReadHeader(source, header)) {
+    return "Not a version 1 pattern file";
+  }
+  if (header.segment_count == 0 || header.segment_count > PATTERN_FILE_MAX_SEGMENTS) {
+    return "Bad segment count";
+  }
+  if (header.step_count == 0 || header.step_count > PATTERN_FILE_MAX_STEPS) {
+    return "Bad step count";
+  }
+  if (header.duration_units == 0) {
+    return "Zero duration";
+  }
+  uint32_t steps = 0;
+  uint64_t units = 0;
+  int32_t x = 0;
+  int32_t y = 0;
+  for (uint16_t s = 0; s < header.segment_count; s++) {
+    PatternSegment segment;
+    if (!patternReadSegment(source, segment)) {
+      return "Truncated or malformed segment header";
+    }
+    steps += segment.step_count;
+    if (steps > header.step_count) {
+      return "More steps than the header declares";
+    }
+    units += (uint64_t)segment.step_count * segment.step_units;
+    for (uint16_t i = 0; i < segment.step_count; i++) {
+      int32_t dx, dy;
+      if (!patternReadDelta(source, segment.encoding, dx, dy)) {
+        return "Truncated or malformed step";
+      }
+      x += dx;
+      y += dy;
+      if (x > PATTERN_FILE_MAX_COORD || x < -PATTERN_FILE_MAX_COORD ||
+          y > PATTERN_FILE_MAX_COORD || y < -PATTERN_FILE_MAX_COORD) {
+        return "Position out of range";
+      }
+    }
+  }
+  if (steps != header.step_count) {
+    return "Fewer steps than the header declares";
+  }
+  if (units != header.duration_units) {
+    return "Step durations do not add up to the header duration";
+  }
+  if (source.read() >= 0) {
+    return "Trailing data after the last segment";
+  }
+  return NULL;
+}
+
+// Writers for host tools; each returns the number of bytes stored in `out`
+
+inline size_t patternWriteU16(uint8_t* out, uint16_t value) {
+  out[0] = (uint8_t)value;
+  out[1] = (uint8_t)(value >> 8);
+  return 2;
+}
+
+inline size_t patternWriteU32(uint8_t* out, uint32_t value) {
+  patternWriteU16(out, (uint16_t)value);
+  patternWriteU16(out + 2, (uint16_t)(value >> 16));
+  return 4;
+}
+
+inline size_t patternWriteHeader(uint8_t* out, const PatternFileHeader& header) {
+  for (int i = 0; i < 4; i++) {
+    out[i] = PATTERN_FILE_MAGIC[i];
+  }
+  out[4] = PATTERN_FILE_VERSION;
+  out[5] = 0;
+  patternWriteU16(out + 6, header.segment_count);
+  patternWriteU32(out + 8, header.step_count);
+  patternWriteU32(out + 12, header.duration_units);
+  return PATTERN_FILE_HEADER_SIZE;
+}
+
+inline size_t patternWriteSegment(uint8_t* out, const PatternSegment& segment) {
+  patternWriteU16(out, segment.step_count);
+  patternWriteU16(out + 2, segment.step_units);
+  out[4] = segment.encoding;
+  out[5] = 0;
+  return PATTERN_SEGMENT_HEADER_SIZE;
+}
+
+inline size_t patternWriteVarint(uint8_t* out, int32_t value) {
+  uint32_t raw = ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+  size_t length = 0;
+  do {
+    uint8_t byte = raw & 0x7f;
+    raw >>= 7;
+    out[length++] = raw != 0 ? (byte | 0x80) : byte;
+  } while (raw != 0);
+  return length;
+}
+
+// At most 6 bytes; int8 deltas must fit in [-128, 127]
+inline size_t patternWriteDelta(uint8_t* out, uint8_t encoding, int32_t dx, int32_t dy) {
+  if (encoding == PATTERN_ENCODING_VARINT) {
+    size_t length = patternWriteVarint(out, dx);
+    return length + patternWriteVarint(out + length, dy);
+  }
+  out[0] = (uint8_t)(int8_t)dx;
+  out[1] = (uint8_t)(int8_t)dy;
+  return 2;
+}
+
+// One step of a path: the absolute position reached, in file units, and how
+// long to wait there
+struct PatternPoint {
+  int32_t x;
+  int32_t y;
+  uint16_t units;
+};
+
+inline bool patternFitsInt8(int32_t value) {
+  return value >= -128 && value <= 127;
+}
+
+// Encode a path starting from (0, 0). Consecutive steps with the same units
+// share a segment, stored as int8 deltas when they all fit. Returns the file
+// length, or 0 with `error` set when the path breaks a limit above or does
+// not fit in `capacity` bytes.
+inline size_t patternEncode(const PatternPoint* points, size_t count, uint8_t* out, size_t capacity,
+                            const char** error) {
+  *error = NULL;
+  if (count == 0 || count > PATTERN_FILE_MAX_STEPS) {
+    *error = "Bad step count";
+    return 0;
+  }
+  for (size_t i = 0; i < count; i++) {
+    if (points[i].units == 0) {
+      *error = "Zero step duration";
+      return 0;
+    }
+    if (points[i].x > PATTERN_FILE_MAX_COORD || points[i].x < -PATTERN_FILE_MAX_COORD ||
+        points[i].y > PATTERN_FILE_MAX_COORD || points[i].y < -PATTERN_FILE_MAX_COORD) {
+      *error = "Position out of range";
+      return 0;
+    }
+  }
+  if (capacity < PATTERN_FILE_HEADER_SIZE) {
+    *error = "File too large";
+    return 0;
+  }
+
+  size_t length = PATTERN_FILE_HEADER_SIZE;
+  uint16_t segments = 0;
+  uint32_t duration = 0;
+  size_t start = 0;
+  while (start < count) {
+    size_t end = start + 1;
+    while (end < count && points[end].units == points[start].units) {
+      end++;
+    }
+    PatternSegment segment;
+    segment.step_count = (uint16_t)(end - start);
+    segment.step_units = points[start].units;
+    segment.encoding = PATTERN_ENCODING_INT8;
+    for (size_t i = start; i < end; i++) {
+      int32_t px = i > 0 ? points[i - 1].x : 0;
+      int32_t py = i > 0 ? points[i - 1].y : 0;
+      if (!patternFitsInt8(points[i].x - px) || !patternFitsInt8(points[i].y - py)) {
+        segment.encoding = PATTERN_ENCODING_VARINT;
+        break;
+      }
+    }
+    if (segments == PATTERN_FILE_MAX_SEGMENTS) {
+      *error = "Too many segments";
+      return 0;
+    }
+    if (capacity - length < PATTERN_SEGMENT_HEADER_SIZE) {
+      *error = "File too large";
+      return 0;
+    }
+    length += patternWriteSegment(out + length, segment);
+    for (size_t i = start; i < end; i++) {
+      if (capacity - length < 6) {
+        *error = "File too large";
+        return 0;
+      }
+      int32_t px = i > 0 ? points[i - 1].x : 0;
+      int32_t py = i > 0 ? points[i - 1].y : 0;
+      length += patternWriteDelta(out + length, segment.encoding, points[i].x - px, points[i].y - py);
+    }
+    segments++;
+    duration += (uint32_t)segment.step_count * segment.step_units;
+    start = end;
+  }
+
+  PatternFileHeader header;
+  header.version = PATTERN_FILE_VERSION;
+  header.flags = 0;
+  header.segment_count = segments;
+  header.step_count = (uint32_t)count;
+  header.duration_units = duration;
+  patternWriteHeader(out, header);
+  return length;
+}
+
+#endif // PATTERN_FILE_H
@@ -0,0 +1,285 @@
+// Movement scripts for jiggla
+// A script is a small register program ("move, wait, scroll, click, repeat N
+// times with jitter") run by a sandboxed interpreter. Scripts are verified
+// once when installed; the interpreter then trusts the code and runs a fixed
+// number of instructions per call, so it never allocates, never indexes out
+// of bounds and hands control back to the scheduler regularly.
+//
+// Like trace.h this header has no Arduino dependencies; the host assembler in
+// tools/jasm.cpp uses it to encode, check and dry-run scripts.
+//
+// File layout, little-endian: "JSCR", version u8, flags u8 (0),
+// instruction_count u16, then 4-byte instructions: op u8, a u8, imm s16.
+// There are SCRIPT_REGISTERS int32 registers; the runner presets the last two
+// (see SCRIPT_REG_SIZE and SCRIPT_REG_SPEED). Arithmetic wraps.
+//
+//   HALT                 end of script
+//   SET     ra, imm      ra = imm
+//   ADD     ra, imm      ra += imm
+//   MUL     ra, imm      ra *= imm
+//   DIV     ra, imm      ra /= imm (imm != 0, truncates toward zero)
+//   MOV     ra, rb       ra = rb (rb in imm)
+//   ADDR    ra, rb       ra += rb
+//   RAND    ra, imm      ra = uniform random in [0, imm]
+//   MOVE    ra, rb       move the pointer by (ra, rb), each clamped to int8
+//   MOVEI   x, y         move by immediates (x in the low byte, y in the high)
+//   PRESS   mask         press buttons (a = button mask)
+//   RELEASE mask         release buttons
+//   SCROLL  ra           scroll by ra, clamped to int8
+//   SCROLLI imm          scroll by imm (int8)
+//   WAIT    imm          wait imm ms (0-32767)
+//   WAITR   ra           wait ra ms, clamped to [0, SCRIPT_MAX_WAIT_MS]
+//   LOOP    ra, target   if --ra > 0 jump to instruction index target
+//   JMP     target       jump to instruction index target
+
+#ifndef SCRIPT_VM_H
+#define SCRIPT_VM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SCRIPT_FILE_VERSION 1
+#define SCRIPT_FILE_HEADER_SIZE 8
+#define SCRIPT_INSTRUCTION_SIZE 4
+#define SCRIPT_MAX_INSTRUCTIONS 1024  // Room for a recorded touchpad session
+#define SCRIPT_REGISTERS 8
+#define SCRIPT_REG_SIZE 6      // Preset to the movement size in pixels
+#define SCRIPT_REG_SPEED 7     // Preset to the movement speed in ms
+#define SCRIPT_MAX_WAIT_MS 60000
+#define SCRIPT_BUTTON_MASK 0x1f
+
+static const uint8_t SCRIPT_FILE_MAGIC[4] = { 'J', 'S', 'C', 'R' };
+
+enum ScriptOp : uint8_t {
+  SCRIPT_OP_HALT,
+  SCRIPT_OP_SET,
+  SCRIPT_OP_ADD,
+  SCRIPT_OP_MUL,
+  SCRIPT_OP_DIV,
+  SCRIPT_OP_MOV,
+  SCRIPT_OP_ADDR,
+  SCRIPT_OP_RAND,
+  SCRIPT_OP_MOVE,
+  SCRIPT_OP_MOVEI,
+  SCRIPT_OP_PRESS,
+  SCRIPT_OP_RELEASE,
+  SCRIPT_OP_SCROLL,
+  SCRIPT_OP_SCROLLI,
+  SCRIPT_OP_WAIT,
+  SCRIPT_OP_WAITR,
+  SCRIPT_OP_LOOP,
+  SCRIPT_OP_JMP,
+  SCRIPT_OP_COUNT
+};
+
+struct ScriptInstruction {
+  uint8_t op;
+  uint8_t a;
+  int16_t imm;
+};
+
+enum ScriptStatus : uint8_t {
+  SCRIPT_YIELD, // Instruction budget used up, call again
+  SCRIPT_WAIT,  // Call again after wait_ms
+  SCRIPT_DONE,  // Reached HALT
+};
+
+struct ScriptVM {
+  int32_t regs[SCRIPT_REGISTERS];
+  uint16_t pc;
+  uint8_t buttons;   // Held buttons, for the runner to release if the script stops early
+  uint32_t wait_ms;  // Set when scriptRun() returns SCRIPT_WAIT
+  uint32_t executed; // Instructions run so far
+};
+
+// Byte sources have `int read()` returning the next byte or -1 at the end,
+// as in pattern_file.h
+
+template <typename Source>
+bool scriptReadHeader(Source& source, uint16_t& count) {
+  for (int i = 0; i < 4; i++) {
+    if (source.read() != SCRIPT_FILE_MAGIC[i]) {
+      return false;
+    }
+  }
+  int version = source.read();
+  int flags = source.read();
+  int low = source.read();
+  int high = source.read();
+  if (version != SCRIPT_FILE_VERSION || flags != 0 || low < 0 || high < 0) {
+    return false;
+  }
+  count = (uint16_t)(low | (high << 8));
+  return true;
+}
+
+template <typename Source>
+bool scriptReadInstruction(Source& source, ScriptInstruction& instruction) {
+  int op = source.read();
+  int a = source.read();
+  int low = source.read();
+  int high = source.read();
+  if (op < 0 || a < 0 || low < 0 || high < 0) {
+    return false;
+  }
+  instruction.op = (uint8_t)op;
+  instruction.a = (uint8_t)a;
+  instruction.imm = (int16_t)(uint16_t)(low | (high << 8));
+  return true;
+}
+
+// Check one instruction of a `count` long program. Everything the
+// interpreter relies on is established here: opcodes, register numbers,
+// jump targets, button masks and divisors.
+inline const char* scriptCheckInstruction(const ScriptInstruction& in, uint16_t index, uint16_t count) {
+  bool reg_a = in.a < SCRIPT_REGISTERS;
+  bool reg_b = in.imm >= 0 && in.imm < SCRIPT_REGISTERS;
+  bool target = in.imm >= 0 && in.imm < count;
+  bool ok;
+  switch (in.op) {
+    case SCRIPT_OP_HALT: ok = in.a == 0 && in.imm == 0; break;
+    case SCRIPT_OP_SET:
+    case SCRIPT_OP_ADD:
+    case SCRIPT_OP_MUL: ok = reg_a; break;
+    case SCRIPT_OP_DIV: ok = reg_a && in.imm != 0; break;
+    case SCRIPT_OP_MOV:
+    case SCRIPT_OP_ADDR:
+    case SCRIPT_OP_MOVE: ok = reg_a && reg_b; break;
+    case SCRIPT_OP_RAND: ok = reg_a && in.imm >= 0; break;
+    case SCRIPT_OP_MOVEI: ok = in.a == 0; break;
+    case SCRIPT_OP_PRESS:
+    case SCRIPT_OP_RELEASE: ok = in.a != 0 && (in.a & ~SCRIPT_BUTTON_MASK) == 0 && in.imm == 0; break;
+    case SCRIPT_OP_SCROLL:
+    case SCRIPT_OP_WAITR: ok = reg_a && in.imm == 0; break;
+    case SCRIPT_OP_SCROLLI: ok = in.a == 0 && in.imm >= -128 && in.imm <= 127; break;
+    case SCRIPT_OP_WAIT: ok = in.a == 0 && in.imm >= 0; break;
+    case SCRIPT_OP_LOOP: ok = reg_a && target; break;
+    case SCRIPT_OP_JMP: ok = in.a == 0 && target; break;
+    default: return "Unknown opcode";
+  }
+  if (!ok) {
+    return "Bad operand";
+  }
+  if (index == count - 1 && in.op != SCRIPT_OP_HALT && in.op != SCRIPT_OP_JMP) {
+    return "Script must end with HALT or JMP";
+  }
+  return NULL;
+}
+
+// Read and verify a whole script file without buffering it. Returns NULL
+// when valid, otherwise a short description of the first problem.
+template <typename Source>
+const char* scriptValidate(Source& source, uint16_t& count) {
+  if (!scriptReadHeader(source, count)) {
+    return "Not a version 1 script file";
+  }
+  if (count == 0 || count > SCRIPT_MAX_INSTRUCTIONS) {
+    return "Bad instruction count";
+  }
+  for (uint16_t i = 0; i < count; i++) {
+    ScriptInstruction instruction;
+    if (!scriptReadInstruction(source, instruction)) {
+      return "Truncated script";
+    }
+    const char* error = scriptCheckInstruction(instruction, i, count);
+    if (error != NULL) {
+      return error;
+    }
+  }
+  if (source.read() >= 0) {
+    return "Trailing data after the last instruction";
+  }
+  return NULL;
+}
+
+inline int8_t scriptClamp8(int32_t value) {
+  return (int8_t)(value < -127 ? -127 : value > 127 ? 127 : value);
+}
+
+// Run verified code for at most `budget` instructions. Host provides
+// move(int8_t, int8_t), press(uint8_t), release(uint8_t), scroll(int8_t) and
+// random(uint32_t max) returning a value in [0, max].
+template <typename Host>
+ScriptStatus scriptRun(ScriptVM& vm, const ScriptInstruction* code, uint32_t budget, Host& host) {
+  int32_t* r = vm.regs;
+  for (uint32_t n = 0; n < budget; n++) {
+    const ScriptInstruction in = code[vm.pc++];
+    vm.executed++;
+    switch (in.op) {
+      case SCRIPT_OP_HALT:
+        vm.pc--;
+        return SCRIPT_DONE;
+      case SCRIPT_OP_SET: r[in.a] = in.imm; break;
+      case SCRIPT_OP_ADD: r[in.a] = (int32_t)((uint32_t)r[in.a] + (uint32_t)in.imm); break;
+      case SCRIPT_OP_MUL: r[in.a] = (int32_t)((uint32_t)r[in.a] * (uint32_t)in.imm); break;
+      case SCRIPT_OP_DIV: r[in.a] = (int32_t)((int64_t)r[in.a] / in.imm); break;
+      case SCRIPT_OP_MOV: r[in.a] = r[in.imm]; break;
+      case SCRIPT_OP_ADDR: r[in.a] = (int32_t)((uint32_t)r[in.a] + (uint32_t)r[in.imm]); break;
+      case SCRIPT_OP_RAND: r[in.a] = (int32_t)host.random((uint32_t)in.imm); break;
+      case SCRIPT_OP_MOVE: host.move(scriptClamp8(r[in.a]), scriptClamp8(r[in.imm])); break;
+      case SCRIPT_OP_MOVEI: host.move((int8_t)(in.imm & 0xff), (int8_t)(in.imm >> 8)); break;
+      case SCRIPT_OP_PRESS:
+        vm.buttons |= in.a;
+        host.press(in.a);
+        break;
+      case SCRIPT_OP_RELEASE:
+        vm.buttons &= ~in.a;
+        host.release(in.a);
+        break;
+      case SCRIPT_OP_SCROLL: host.scroll(scriptClamp8(r[in.a])); break;
+      case SCRIPT_OP_SCROLLI: host.scroll((int8_t)in.imm); break;
+      case SCRIPT_OP_WAIT:
+        vm.wait_ms = (uint32_t)in.imm;
+        return SCRIPT_WAIT;
+      case SCRIPT_OP_WAITR:
+        vm.wait_ms = r[in.a] < 0 ? 0 : r[in.a] > SCRIPT_MAX_WAIT_MS ? SCRIPT_MAX_WAIT_MS : (uint32_t)r[in.a];
+        return SCRIPT_WAIT;
+      case SCRIPT_OP_LOOP:
+        if (--r[in.a] > 0) {
+          vm.pc = (uint16_t)in.imm;
+        }
+        break;
+      case SCRIPT_OP_JMP: vm.pc = (uint16_t)in.imm; break;
+    }
+  }
+  return SCRIPT_YIELD;
+}
+
+// Run one slice for a runner that sleeps between calls: at most `budget`
+// instructions, carrying on through zero-length waits. Returns SCRIPT_DONE,
+// or SCRIPT_WAIT with a wait_ms of at least 1. A used-up budget waits 1 ms,
+// so "WAIT 0" in a loop cannot keep the runner from sleeping.
+template <typename Host>
+ScriptStatus scriptRunSlice(ScriptVM& vm, const ScriptInstruction* code, uint32_t budget, Host& host) {
+  uint32_t start = vm.executed;
+  while (vm.executed - start < budget) {
+    ScriptStatus status = scriptRun(vm, code, budget - (vm.executed - start), host);
+    if (status == SCRIPT_DONE || (status == SCRIPT_WAIT && vm.wait_ms > 0)) {
+      return status;
+    }
+  }
+  vm.wait_ms = 1;
+  return SCRIPT_WAIT;
+}
+
+// Encoding for host tools; returns the number of bytes stored in `out`
+inline size_t scriptWriteHeader(uint8_t* out, uint16_t count) {
+  for (int i = 0; i < 4; i++) {
+    out[i] = SCRIPT_FILE_MAGIC[i];
+  }
+  out[4] = SCRIPT_FILE_VERSION;
+  out[5] = 0;
+  out[6] = (uint8_t)count;
+  out[7] = (uint8_t)(count >> 8);
+  return SCRIPT_FILE_HEADER_SIZE;
+}
+
+inline size_t scriptWriteInstruction(uint8_t* out, const ScriptInstruction& instruction) {
+  out[0] = instruction.op;
+  out[1] = instruction.a;
+  out[2] = (uint8_t)((uint16_t)instruction.imm);
+  out[3] = (uint8_t)((uint16_t)instruction.imm >> 8);
+  return SCRIPT_INSTRUCTION_SIZE;
+}
+
+#endif // SCRIPT_VM_H
@@ -0,0 +1,220 @@
+// Hierarchical timer wheel for jiggla
+// Four levels of 64 slots over 1 ms ticks: level 0 holds timers due within
+// 64 ticks, level 1 within 64^2 and so on up to 64^4 ticks (~4.6 hours).
+// Timers further out are parked at the edge and re-armed when they get
+// there. Higher levels cascade into lower ones as time reaches their slots,
+// as in the classic Linux kernel timer wheel.
+//
+// Every level keeps a bitmap of occupied slots, so finding the next tick
+// with work is a rotate and a count-trailing-zeros per level, whatever the
+// number of timers. Timers live in a fixed array and are linked into their
+// slot by index, so nothing is allocated.
+//
+// Like trace.h this header has no Arduino dependencies. Tick arithmetic
+// wraps like millis(); 64^4 divides 2^32, so slot positions survive the wrap.
+
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define TIMER_WHEEL_LEVELS 4
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_SPAN (1UL << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)) // Ticks
+#ifndef TIMER_WHEEL_MAX_TIMERS
+#define TIMER_WHEEL_MAX_TIMERS 8  // At most 32, timerWheelAdvance() returns a bitmask
+#endif
+#define TIMER_WHEEL_NONE 0xff
+
+struct WheelTimer {
+  uint32_t expires; // Requested deadline
+  uint8_t next;     // Slot list links, TIMER_WHEEL_NONE at the ends
+  uint8_t prev;
+  uint8_t slot;     // level * TIMER_WHEEL_SLOTS + slot index
+  bool armed;
+};
+
+struct TimerWheel {
+  uint32_t now; // Next tick to process
+  uint64_t occupied[TIMER_WHEEL_LEVELS];
+  uint8_t heads[TIMER_WHEEL_LEVELS * TIMER_WHEEL_SLOTS];
+  WheelTimer timers[TIMER_WHEEL_MAX_TIMERS];
+};
+
+inline void timerWheelInit(TimerWheel& wheel, uint32_t now) {
+  wheel.now = now;
+  for (int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+    wheel.occupied[level] = 0;
+  }
+  for (int i = 0; i < TIMER_WHEEL_LEVELS * TIMER_WHEEL_SLOTS; i++) {
+    wheel.heads[i] = TIMER_WHEEL_NONE;
+  }
+  for (int i = 0; i < TIMER_WHEEL_MAX_TIMERS; i++) {
+    wheel.timers[i].armed = false;
+  }
+}
+
+inline void timerWheelUnlink(TimerWheel& wheel, uint8_t id) {
+  WheelTimer& timer = wheel.timers[id];
+  if (timer.prev != TIMER_WHEEL_NONE) {
+    wheel.timers[timer.prev].next = timer.next;
+  } else {
+    wheel.heads[timer.slot] = timer.next;
+    if (timer.next == TIMER_WHEEL_NONE) {
+      wheel.occupied[timer.slot / TIMER_WHEEL_SLOTS] &= ~(1ULL << (timer.slot % TIMER_WHEEL_SLOTS));
+    }
+  }
+  if (timer.next != TIMER_WHEEL_NONE) {
+    wheel.timers[timer.next].prev = timer.prev;
+  }
+}
+
+// Link an armed timer into the slot for its deadline, relative to wheel.now
+inline void timerWheelPlace(TimerWheel& wheel, uint8_t id) {
+  WheelTimer& timer = wheel.timers[id];
+  uint32_t delta = timer.expires - wheel.now;
+  uint32_t at = timer.expires;
+  if ((int32_t)delta < 0) {
+    delta = 0;
+    at = wheel.now;
+  } else if (delta >= TIMER_WHEEL_SPAN) {
+    delta = TIMER_WHEEL_SPAN - 1;
+    at = wheel.now + delta;
+  }
+  int level = 0;
+  while (level < TIMER_WHEEL_LEVELS - 1 && delta >= (1UL << (TIMER_WHEEL_BITS * (level + 1)))) {
+    level++;
+  }
+  uint8_t slot = (uint8_t)(level * TIMER_WHEEL_SLOTS + ((at >> (TIMER_WHEEL_BITS * level)) & (TIMER_WHEEL_SLOTS - 1)));
+  timer.slot = slot;
+  timer.prev = TIMER_WHEEL_NONE;
+  timer.next = wheel.heads[slot];
+  if (timer.next != TIMER_WHEEL_NONE) {
+    wheel.timers[timer.next].prev = id;
+  }
+  wheel.heads[slot] = id;
+  wheel.occupied[level] |= 1ULL << (slot % TIMER_WHEEL_SLOTS);
+}
+
+// Arm (or re-arm) timer `id` for tick `expires`
+inline void timerWheelSet(TimerWheel& wheel, uint8_t id, uint32_t expires) {
+  if (wheel.timers[id].armed) {
+    timerWheelUnlink(wheel, id);
+  }
+  wheel.timers[id].expires = expires;
+  wheel.timers[id].armed = true;
+  timerWheelPlace(wheel, id);
+}
+
+inline void timerWheelCancel(TimerWheel& wheel, uint8_t id) {
+  if (wheel.timers[id].armed) {
+    timerWheelUnlink(wheel, id);
+    wheel.timers[id].armed = false;
+  }
+}
+
+// Offset from `index` to the next occupied slot, wrapping; bitmap must be non-zero
+inline uint32_t timerWheelNextSlot(uint64_t bitmap, uint32_t index) {
+  uint64_t rotated = index == 0 ? bitmap : (bitmap >> index) | (bitmap << (TIMER_WHEEL_SLOTS - index));
+  return (uint32_t)__builtin_ctzll(rotated);
+}
+
+// First tick at or after wheel.now that has work: a level 0 slot to fire or a
+// higher slot to cascade. False when no timer is armed.
+inline bool timerWheelNextWork(const TimerWheel& wheel, uint32_t& tick) {
+  bool found = false;
+  uint32_t best = 0;
+  for (int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+    if (wheel.occupied[level] == 0) {
+      continue;
+    }
+    // Level n slots are visited on multiples of 64^n ticks
+    uint32_t shift = TIMER_WHEEL_BITS * level;
+    uint32_t step = 1UL << shift;
+    uint32_t base = (wheel.now + step - 1) & ~(step - 1);
+    uint32_t index = (base >> shift) & (TIMER_WHEEL_SLOTS - 1);
+    uint32_t at = base + (timerWheelNextSlot(wheel.occupied[level], index) << shift);
+    if (!found || (int32_t)(at - best) < 0) {
+      best = at;
+      found = true;
+    }
+  }
+  tick = best;
+  return found;
+}
+
+// Earliest requested deadline among armed timers; a scan, meant for status
+// reports and power decisions rather than the scheduler itself
+inline bool timerWheelEarliest(const TimerWheel& wheel, uint32_t& tick) {
+  bool found = false;
+  for (int i = 0; i < TIMER_WHEEL_MAX_TIMERS; i++) {
+    const WheelTimer& timer = wheel.timers[i];
+    if (timer.armed && (!found || (int32_t)(timer.expires - tick) < 0)) {
+      tick = timer.expires;
+      found = true;
+    }
+  }
+  return found;
+}
+
+// Move every timer of one higher-level slot down to where it now belongs
+inline void timerWheelCascade(TimerWheel& wheel, int level, uint32_t index) {
+  uint8_t slot = (uint8_t)(level * TIMER_WHEEL_SLOTS + index);
+  uint8_t id = wheel.heads[slot];
+  wheel.heads[slot] = TIMER_WHEEL_NONE;
+  wheel.occupied[level] &= ~(1ULL << index);
+  while (id != TIMER_WHEEL_NONE) {
+    uint8_t next = wheel.timers[id].next;
+    timerWheelPlace(wheel, id);
+    id = next;
+  }
+}
+
+// Process tick wheel.now: cascade the slots that start here, then fire level 0
+inline uint32_t timerWheelTick(TimerWheel& wheel) {
+  for (int level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+    uint32_t below = (wheel.now >> (TIMER_WHEEL_BITS * (level - 1))) & (TIMER_WHEEL_SLOTS - 1);
+    if (below != 0) {
+      break;
+    }
+    timerWheelCascade(wheel, level, (wheel.now >> (TIMER_WHEEL_BITS * level)) & (TIMER_WHEEL_SLOTS - 1));
+  }
+  uint32_t fired = 0;
+  uint32_t index = wheel.now & (TIMER_WHEEL_SLOTS - 1);
+  uint8_t id = wheel.heads[index];
+  wheel.heads[index] = TIMER_WHEEL_NONE;
+  wheel.occupied[0] &= ~(1ULL << index);
+  while (id != TIMER_WHEEL_NONE) {
+    WheelTimer& timer = wheel.timers[id];
+    uint8_t next = timer.next;
+    if ((int32_t)(timer.expires - wheel.now) > 0) {
+      timerWheelPlace(wheel, id); // Parked at the edge, not due yet
+    } else {
+      timer.armed = false;
+      fired |= 1UL << id;
+    }
+    id = next;
+  }
+  wheel.now++;
+  return fired;
+}
+
+// Run the wheel up to and including tick `now`, skipping ticks without
+// work. Returns a bitmask of the timer ids that fired; those are disarmed.
+inline uint32_t timerWheelAdvance(TimerWheel& wheel, uint32_t now) {
+  uint32_t fired = 0;
+  uint32_t tick;
+  while ((int32_t)(now - wheel.now) >= 0) {
+    if (!timerWheelNextWork(wheel, tick) || (int32_t)(tick - now) > 0) {
+      wheel.now = now + 1;
+      break;
+    }
+    wheel.now = tick;
+    fired |= timerWheelTick(wheel);
+  }
+  return fired;
+}
+
+#endif // TIMER_WHEEL_H
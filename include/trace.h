@@ -0,0 +1,264 @@
+// Timeline tracing for jiggla
+// Begin/end/instant/counter events go into a fixed RAM ring and are exported
+// as Chrome trace-event JSON (chrome://tracing, ui.perfetto.dev).
+//
+// The header has no Arduino dependencies so host tools can record and export
+// traces the same way. Include it everywhere, and in exactly one source file
+// define TRACE_IMPLEMENTATION first to instantiate the ring.
+//
+// Timestamps are microseconds from esp_timer (std::chrono on the host). The
+// CPU cycle counter is not used: its rate follows the clock governor and it
+// wraps every ~18 s at 240 MHz.
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+
+#if defined(ESP_PLATFORM)
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#else
+#include <chrono>
+#include <functional>
+#include <thread>
+#endif
+
+#ifndef TRACE_RING_SIZE
+#define TRACE_RING_SIZE 256 // Events, power of two
+#endif
+#define TRACE_MAX_THREADS 12
+
+enum TracePhase : uint8_t {
+  TRACE_BEGIN = 'B',
+  TRACE_END = 'E',
+  TRACE_INSTANT = 'i',
+  TRACE_COUNTER = 'C',
+};
+
+// Names must be string literals or otherwise outlive the ring
+struct TraceEvent {
+  uint32_t timestamp_us; // Wraps after ~71 minutes; exported relative to the oldest event
+  const char* name;
+  int32_t value;         // Counter value
+  uint8_t thread;        // Index into the thread table
+  uint8_t phase;
+};
+
+struct TraceThread {
+  std::atomic<uintptr_t> id;
+  char name[16];
+};
+
+struct TraceState {
+  TraceEvent events[TRACE_RING_SIZE];
+  std::atomic<uint32_t> head;   // Next event index to hand out
+  std::atomic<bool> paused;     // Set while exporting so the ring holds still
+  std::atomic<uint32_t> exports;  // Exports started, numbers each one
+  std::atomic<uint32_t> exporter; // Number of the running export, 0 when none
+  TraceThread threads[TRACE_MAX_THREADS];
+};
+
+extern TraceState trace_state;
+
+inline uint32_t traceNow() {
+#if defined(ESP_PLATFORM)
+  return (uint32_t)esp_timer_get_time();
+#else
+  using namespace std::chrono;
+  return (uint32_t)duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+// Small per-thread index; a task gets a slot (and its name) the first time it traces
+inline uint8_t traceThread() {
+#if defined(ESP_PLATFORM)
+  uintptr_t id = (uintptr_t)xTaskGetCurrentTaskHandle();
+#else
+  uintptr_t id = (uintptr_t)std::hash<std::thread::id>()(std::this_thread::get_id()) | 1;
+#endif
+  for (uint8_t i = 0; i < TRACE_MAX_THREADS; i++) {
+    uintptr_t current = trace_state.threads[i].id.load(std::memory_order_acquire);
+    if (current == id) {
+      return i;
+    }
+    if (current == 0) {
+      uintptr_t expected = 0;
+      if (trace_state.threads[i].id.compare_exchange_strong(expected, id)) {
+#if defined(ESP_PLATFORM)
+        strncpy(trace_state.threads[i].name, pcTaskGetName(NULL), sizeof(trace_state.threads[i].name) - 1);
+#else
+        snprintf(trace_state.threads[i].name, sizeof(trace_state.threads[i].name), "thread %u", i);
+#endif
+        return i;
+      }
+      if (expected == id) {
+        return i;
+      }
+    }
+  }
+  return TRACE_MAX_THREADS - 1; // Table full, share the last slot
+}
+
+inline void traceEvent(uint8_t phase, const char* name, int32_t value = 0) {
+  if (trace_state.paused.load(std::memory_order_relaxed)) {
+    return;
+  }
+  uint32_t index = trace_state.head.fetch_add(1, std::memory_order_relaxed);
+  TraceEvent& event = trace_state.events[index % TRACE_RING_SIZE];
+  event.timestamp_us = traceNow();
+  event.name = name;
+  event.value = value;
+  event.thread = traceThread();
+  event.phase = phase;
+}
+
+inline void traceBegin(const char* name) { traceEvent(TRACE_BEGIN, name); }
+inline void traceEnd(const char* name) { traceEvent(TRACE_END, name); }
+inline void traceInstant(const char* name) { traceEvent(TRACE_INSTANT, name); }
+inline void traceCounter(const char* name, int32_t value) { traceEvent(TRACE_COUNTER, name, value); }
+
+// Begin/end pair for the enclosing scope
+struct TraceScope {
+  const char* name;
+  explicit TraceScope(const char* scope_name) : name(scope_name) { traceBegin(name); }
+  ~TraceScope() { traceEnd(name); }
+};
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(name)
+
+// Incremental JSON export: call traceExport() until it returns 0. Recording
+// is paused from traceExportBegin() until the export completes; a caller
+// that abandons an export must call traceExportEnd() itself. One export runs
+// at a time, and ending one twice or late leaves a newer export alone.
+struct TraceExport {
+  uint32_t id;      // From traceExportBegin(), passed to traceExportEnd()
+  int stage;        // 0 header, 1 thread names, 2 events, 3 footer, 4 done
+  uint32_t index;   // Position within the stage
+  uint32_t end;     // One past the newest event
+  uint32_t origin_us; // Timestamp of the oldest event, exported as 0
+  bool need_comma;
+  char line[160];
+  size_t length;
+  size_t offset;
+};
+
+// False while another export holds the ring
+inline bool traceExportBegin(TraceExport& cursor) {
+  memset(&cursor, 0, sizeof(cursor));
+  uint32_t id = trace_state.exports.fetch_add(1) + 1;
+  if (id == 0) {
+    id = trace_state.exports.fetch_add(1) + 1; // 0 means no export
+  }
+  uint32_t idle = 0;
+  if (!trace_state.exporter.compare_exchange_strong(idle, id)) {
+    return false;
+  }
+  cursor.id = id;
+  trace_state.paused.store(true);
+  return true;
+}
+
+inline void traceExportEnd(uint32_t id) {
+  if (id != 0 && trace_state.exporter.load() == id) {
+    trace_state.paused.store(false); // Before the release, so a new export's pause sticks
+    trace_state.exporter.store(0);
+  }
+}
+
+// Produce the next JSON fragment into cursor.line, false when done
+inline bool traceExportLine(TraceExport& cursor) {
+  while (true) {
+    const char* comma = cursor.need_comma ? "," : "";
+    switch (cursor.stage) {
+      case 0:
+        cursor.end = trace_state.head.load();
+        cursor.index = cursor.end > TRACE_RING_SIZE ? cursor.end - TRACE_RING_SIZE : 0;
+        cursor.origin_us = trace_state.events[cursor.index % TRACE_RING_SIZE].timestamp_us;
+        cursor.index = 0;
+        cursor.length = snprintf(cursor.line, sizeof(cursor.line), "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+        cursor.stage = 1;
+        return true;
+      case 1:
+        if (cursor.index >= TRACE_MAX_THREADS) {
+          cursor.stage = 2;
+          cursor.index = cursor.end > TRACE_RING_SIZE ? cursor.end - TRACE_RING_SIZE : 0;
+          continue;
+        }
+        if (trace_state.threads[cursor.index].id.load() == 0) {
+          cursor.index++;
+          continue;
+        }
+        cursor.length = snprintf(cursor.line, sizeof(cursor.line),
+                                 "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}\n",
+                                 comma, (unsigned)cursor.index, trace_state.threads[cursor.index].name);
+        cursor.index++;
+        cursor.need_comma = true;
+        return true;
+      case 2: {
+        if (cursor.index == cursor.end) {
+          cursor.stage = 3;
+          continue;
+        }
+        const TraceEvent& event = trace_state.events[cursor.index % TRACE_RING_SIZE];
+        unsigned long ts = (unsigned long)(event.timestamp_us - cursor.origin_us);
+        if (event.phase == TRACE_COUNTER) {
+          cursor.length = snprintf(cursor.line, sizeof(cursor.line),
+                                   "%s{\"name\":\"%s\",\"ph\":\"C\",\"ts\":%lu,\"pid\":1,\"tid\":%u,\"args\":{\"value\":%ld}}\n",
+                                   comma, event.name, ts, (unsigned)event.thread, (long)event.value);
+        } else {
+          cursor.length = snprintf(cursor.line, sizeof(cursor.line),
+                                   "%s{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%lu,\"pid\":1,\"tid\":%u%s}\n",
+                                   comma, event.name, event.phase, ts, (unsigned)event.thread,
+                                   event.phase == TRACE_INSTANT ? ",\"s\":\"t\"" : "");
+        }
+        cursor.index++;
+        cursor.need_comma = true;
+        return true;
+      }
+      case 3:
+        cursor.length = snprintf(cursor.line, sizeof(cursor.line), "]}\n");
+        cursor.stage = 4;
+        return true;
+      default:
+        return false;
+    }
+  }
+}
+
+// Copy up to max_len bytes of the export into buffer; 0 once finished
+inline size_t traceExport(TraceExport& cursor, uint8_t* buffer, size_t max_len) {
+  size_t written = 0;
+  while (written < max_len) {
+    if (cursor.offset >= cursor.length) {
+      if (!traceExportLine(cursor)) {
+        traceExportEnd(cursor.id);
+        break;
+      }
+      if (cursor.length >= sizeof(cursor.line)) {
+        cursor.length = sizeof(cursor.line) - 1;
+      }
+      cursor.offset = 0;
+    }
+    size_t chunk = cursor.length - cursor.offset;
+    if (chunk > max_len - written) {
+      chunk = max_len - written;
+    }
+    memcpy(buffer + written, cursor.line + cursor.offset, chunk);
+    cursor.offset += chunk;
+    written += chunk;
+  }
+  return written;
+}
+
+#ifdef TRACE_IMPLEMENTATION
+TraceState trace_state;
+#endif
+
+#endif // TRACE_H
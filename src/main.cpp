@@ -17,69 +17,511 @@
 #include <SPIFFS.h>
 #include <FS.h>
 #include <math.h>
+#include <atomic>
+#include <type_traits>
 #include <Update.h>
+#include <Preferences.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+#include <esp_sntp.h>
+#include <sys/time.h>
+#include <esp_heap_caps.h>
+#if CONFIG_PM_ENABLE
+#include <esp_pm.h>
+#endif
+#define TRACE_IMPLEMENTATION
+#include "trace.h"
+#include "pattern_file.h"
+#include "script_vm.h"
+#include "timer_wheel.h"
+#include "jiggle_interval.h"
 
-// Define a simpler debug approach for ESP32-S2/S3 in USB mode
-// In this mode, we don't have Serial, so we use a no-op debug for now
-#define DEBUG(x) do {} while(0)
-#define DEBUGF(x, ...) do {} while(0)
+// In USB mode there is no Serial, so log records go to a RAM ring that
+// /api/logs streams out. Formatting is deferred: a record keeps the format
+// string pointer and the raw arguments, strings are copied in. Arguments are
+// not even evaluated when their level is off.
+enum LogLevel { LOG_LEVEL_NONE, LOG_LEVEL_ERROR, LOG_LEVEL_WARN, LOG_LEVEL_INFO, LOG_LEVEL_DEBUG, LOG_LEVEL_VERBOSE };
+volatile uint8_t log_level = LOG_LEVEL_INFO;
+
+#define LOG_AT(level, ...) do { if ((level) <= log_level) logWrite((level), __VA_ARGS__); } while (0)
+#define LOG_ERROR(...) LOG_AT(LOG_LEVEL_ERROR, __VA_ARGS__)
+#define LOG_WARN(...) LOG_AT(LOG_LEVEL_WARN, __VA_ARGS__)
+#define LOG_INFO(...) LOG_AT(LOG_LEVEL_INFO, __VA_ARGS__)
+#define DEBUG(x) LOG_AT(LOG_LEVEL_DEBUG, x)
+#define DEBUGF(...) LOG_AT(LOG_LEVEL_DEBUG, __VA_ARGS__)
+
+#ifndef LOG_RING_SIZE
+#define LOG_RING_SIZE 64 // Records, power of two
+#endif
+const int LOG_MAX_ARGS = 8;   // 32-bit slots, 64-bit values take two
+const int LOG_TEXT_SIZE = 52; // Copied string arguments
+
+struct LogRecord {
+  uint32_t timestamp_ms;
+  const char* format;
+  uint8_t level;
+  uint8_t arg_count;
+  uint8_t text_used;
+  uint32_t args[LOG_MAX_ARGS];
+  char text[LOG_TEXT_SIZE];
+};
+
+// A slot's sequence is 0 while it is being written and index + 1 once
+// published, so readers can tell stale, torn and overwritten records apart
+struct LogSlot {
+  std::atomic<uint32_t> sequence;
+  LogRecord record;
+};
+LogSlot log_ring[LOG_RING_SIZE];
+std::atomic<uint32_t> log_head(0); // Next record index to hand out
+
+// Argument capture is picked by type: integers by value, strings by copy
+inline void captureLogValue(LogRecord& record, uint32_t value) {
+  if (record.arg_count < LOG_MAX_ARGS) {
+    record.args[record.arg_count++] = value;
+  }
+}
+
+inline void captureLogArg(LogRecord& record, const char* value) {
+  uint8_t offset = record.text_used;
+  if (value != NULL && offset < LOG_TEXT_SIZE) {
+    size_t length = strlcpy(record.text + offset, value, LOG_TEXT_SIZE - offset);
+    record.text_used = min((size_t)LOG_TEXT_SIZE, offset + length + 1);
+  }
+  captureLogValue(record, value != NULL && offset < LOG_TEXT_SIZE ? offset : UINT32_MAX);
+}
+
+inline void captureLogArg(LogRecord& record, const String& value) {
+  captureLogArg(record, value.c_str());
+}
+
+inline void captureLogArg(LogRecord& record, double value) {
+  float narrow = value;
+  uint32_t bits;
+  memcpy(&bits, &narrow, sizeof(bits));
+  captureLogValue(record, bits);
+}
+
+template<typename T>
+inline typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value>::type
+captureLogArg(LogRecord& record, T value) {
+  uint64_t wide = (uint64_t)(int64_t)value;
+  captureLogValue(record, (uint32_t)wide);
+  if (sizeof(T) > 4) {
+    captureLogValue(record, (uint32_t)(wide >> 32));
+  }
+}
+
+inline void publishLogRecord(const LogRecord& record) {
+  uint32_t index = log_head.fetch_add(1);
+  LogSlot& slot = log_ring[index % LOG_RING_SIZE];
+  slot.sequence.store(0, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  slot.record = record;
+  slot.sequence.store(index + 1, std::memory_order_release);
+}
+
+template<typename... Args>
+void logWrite(uint8_t level, const char* format, const Args&... args) {
+  LogRecord record;
+  record.timestamp_ms = millis();
+  record.format = format;
+  record.level = level;
+  record.arg_count = 0;
+  record.text_used = 0;
+  int expand[] = { 0, (captureLogArg(record, args), 0)... };
+  (void)expand;
+  publishLogRecord(record);
+}
+
+// Messages built at run time (DEBUG("..." + path)) are copied as text
+inline void logWrite(uint8_t level, const String& message) {
+  logWrite(level, "%s", message);
+}
 
 // Include credentials (not tracked by git)
 #include "../credentials.h"
 
-// Default configuration - will be overridden by settings.json if it exists
-const char* default_ssid = DEFAULT_AP_SSID;
-const char* default_password = DEFAULT_AP_PASSWORD;
-const char* default_hostname = DEFAULT_HOSTNAME;
-const char* default_username = DEFAULT_WEB_USERNAME;
-const char* default_auth_password = DEFAULT_WEB_PASSWORD;
-const int default_webport = DEFAULT_WEB_PORT; // Keep as const for default value
-
-// Current settings that can be modified at runtime
-char* current_ssid = strdup(default_ssid);
-char* current_password = strdup(default_password);
-char* current_hostname = strdup(default_hostname);
-char* current_username = strdup(default_username);
-char* current_auth_password = strdup(default_auth_password);
-int current_webport = default_webport;
 const IPAddress default_ip(192, 168, 4, 1);
 
-// Preferred WiFi network
-const char* preferred_ssid = WIFI_SSID;
-const char* preferred_password = WIFI_PASSWORD;
+// Preferred WiFi network timeouts
 const int wifi_connect_timeout = 10000; // 10 seconds timeout for WiFi connection
+const int wifi_fast_connect_timeout = 3000; // Direct association to a cached BSSID should be quick
+const int wifi_disconnect_timeout = 1000; // Wait for the DISCONNECTED event of a timed out attempt
+const unsigned long wifi_cached_lease_ms = 30 * 60 * 1000; // Run on a cached address this long, then ask DHCP again
+
+// Mouse movement settings
+const int PATTERN_NAME_LEN = 32;
+
+// Extra jiggle profiles run alongside the main settings, each on its own
+// timer and only inside its time-of-day window
+const int MAX_PROFILES = 4;
+const int PROFILE_NAME_LEN = 16;
+const int MAX_PROFILE_JITTER = 50; // Percent of the interval
+struct JiggleProfile {
+  char name[PROFILE_NAME_LEN];
+  bool enabled;
+  int move_interval; // Milliseconds between movements
+  char movement_pattern[PATTERN_NAME_LEN];
+  int movement_size;
+  int movement_speed;
+  int jitter;        // Random interval variation, +/- percent
+  int window_start;  // Minutes after local midnight; start == end means all day
+  int window_end;    // Exclusive, may wrap past midnight
+};
+
+// Weekly work-hours schedule: when enabled, the jiggler only runs inside
+// these windows
+const int MAX_SCHEDULE_WINDOWS = 8;
+const int MINUTES_PER_DAY = 24 * 60;
+const int MINUTES_PER_WEEK = 7 * MINUTES_PER_DAY;
+struct ScheduleWindow {
+  uint8_t days;   // Days the window opens, bit 0 = Monday .. bit 6 = Sunday
+  uint16_t start; // Minutes after local midnight
+  uint16_t end;   // Exclusive; at or before start runs past midnight, equal = 24 hours
+};
+
+struct MotionConfig {
+  int move_interval; // Milliseconds between movements
+  int movement_size; // Movement size (replaces separate X and Y)
+  int movement_speed; // Total milliseconds for a complete movement pattern (1-3000 range)
+  bool jiggler_enabled;
+  char movement_pattern[PATTERN_NAME_LEN];
+  bool random_delay; // Randomize delay between movements
+  bool movement_trail; // Create a movement trail
+  unsigned long input_idle_resume; // Touchpad silence (ms) before the jiggler may move again
+  JiggleProfile profiles[MAX_PROFILES];
+  int profile_count;
+  bool schedule_enabled;
+  ScheduleWindow schedule[MAX_SCHEDULE_WINDOWS];
+  int schedule_count;
+};
+
+// Defaults: 4 minutes, linear pattern, enabled
+MotionConfig motion_config = { 4 * 60 * 1000, 5, 2000, true, "linear", false, false, 5000 };
+const unsigned long max_input_idle_resume = 3600000;
+
+// motion_config is owned by the web server task, which publishes a copy after
+// every change. The motion engine in loop() takes the latest published copy
+// through a triple buffer: publishing and reading are a single atomic
+// exchange, nobody waits and a snapshot is never modified while in use.
+const uint32_t MOTION_CONFIG_FRESH = 4; // Flag in motion_config_middle: unread snapshot
+MotionConfig motion_config_buffers[3];
+std::atomic<uint32_t> motion_config_middle(1);
+uint32_t motion_config_back = 0;  // Owned by the writer
+uint32_t motion_config_front = 2; // Owned by the reader
+volatile bool move_requested = false; // Immediate movement requested via the API
+
+// A pattern to run once right away (/api/macro/play). The web server task
+// fills play_pattern only while play_requested is false.
+char play_pattern[PATTERN_NAME_LEN];
+std::atomic<bool> play_requested(false);
+
+// Live input always wins over the jiggler. Touchpad input gives
+// motion_preempt, which ends a running pattern at its next step wait (the
+// wait blocks on the semaphore), and holds the jiggler off until the touchpad
+// has been idle for input_idle_resume.
+SemaphoreHandle_t motion_preempt = NULL;
+volatile unsigned long last_live_input = 0; // millis() of the latest touchpad input, 0 = none
+unsigned long seen_live_input = 0;          // Motion engine: last input already accounted for
+bool pattern_preempted = false;             // Motion engine: the running pattern was cut short
 
-// STA mode customizable credentials (loaded from settings)
-char* sta_ssid = strdup(preferred_ssid);
-char* sta_password = strdup(preferred_password);
-
-// Default mouse movement settings
-int move_interval = 4 * 60 * 1000; // 4 minutes in milliseconds
-int movement_size = 5; // Default movement size (replaces separate X and Y)
-int movement_speed = 2000; // Total milliseconds for a complete movement pattern (1-3000 range)
-bool jiggler_enabled = true; // Default state is enabled
-char* movement_pattern = strdup("linear"); // Default movement pattern
-bool random_delay = false; // Randomize delay between movements
-bool movement_trail = false; // Create a movement trail
 const int CIRCLE_STEPS = 100; // Number of steps to complete a circle (increased for smoothness)
 const int LINE_STEPS = 50;    // Number of steps for a straight line
 const int RECT_STEPS = 200;   // Number of steps for rectangle (50 per side)
 const int TRIANGLE_STEPS = 150; // Number of steps for triangle (50 per side)
 const int ZIGZAG_STEPS = 150;  // Number of steps for zig-zag
 
+// Movement patterns by name
+struct PatternEntry {
+  const char* name;
+  const char* trace_name;
+  void (*run)(int size, int speed);
+};
+void moveMouseLinear(int size, int speed);
+void moveMouseCircular(int size, int speed);
+void moveMouseRectangle(int size, int speed);
+void moveMouseTriangle(int size, int speed);
+void moveMouseZigzag(int size, int speed);
+const PatternEntry patterns[] = {
+  { "linear", "pattern:linear", moveMouseLinear }, // Default
+  { "circular", "pattern:circular", moveMouseCircular },
+  { "rectangle", "pattern:rectangle", moveMouseRectangle },
+  { "triangle", "pattern:triangle", moveMouseTriangle },
+  { "zigzag", "pattern:zigzag", moveMouseZigzag },
+};
+const int PATTERN_COUNT = sizeof(patterns) / sizeof(patterns[0]);
+
+// Installed pattern files: paths (/patterns/<name>.jpat, pattern_file.h) and
+// scripts (/patterns/<name>.jvm, script_vm.h), indexed at boot and on
+// upload. Only the web server task changes the index (uploads, deletes and
+// installing a recorded macro), and only while holding motion_mutex, so the
+// motion engine never sees an entry change under a running pattern and the
+// web server task can read it without a lock. A running script only holds
+// motion_mutex between its waits, so it keeps its own copy of the name. A
+// free slot has an empty name.
+enum PatternFileKind : uint8_t {
+  PATTERN_FILE_PATH,
+  PATTERN_FILE_SCRIPT,
+};
+const char* pattern_dir = "/patterns/";
+const char* const pattern_extensions[] = { ".jpat", ".jvm" }; // By PatternFileKind
+const char* pattern_upload_path = "/patterns/.upload";
+const int PATTERN_FILE_NAME_MAX = 16; // SPIFFS paths are limited to 31 characters
+const int MAX_PATTERN_FILES = 8;
+struct PatternFileEntry {
+  char name[PATTERN_FILE_NAME_MAX + 1];
+  PatternFileKind kind;
+  uint16_t segment_count;  // Paths only
+  uint32_t step_count;     // Steps of a path, instructions of a script
+  uint32_t duration_units; // Paths only
+  uint32_t size;
+};
+PatternFileEntry pattern_files[MAX_PATTERN_FILES];
+
+// Scripts run on the motion engine a slice of SCRIPT_TICK_BUDGET
+// instructions at a time, waiting at least 1 ms between slices. A script is
+// cut off after its WAITs added up once plus SCRIPT_RUN_MARGIN_MS, and never
+// before SCRIPT_MIN_RUN_MS, so a recorded macro always plays to the end. The
+// code is loaded into script_code (4 KB) for the run; motion_mutex holders
+// only. A script gives motion_mutex back while it waits, so uploads and
+// deletes go through during a long run; script_loads tells it when the
+// benchmark reloaded script_code meanwhile.
+const uint32_t SCRIPT_TICK_BUDGET = 64;
+const uint32_t SCRIPT_MIN_RUN_MS = 30000;
+const uint32_t SCRIPT_RUN_MARGIN_MS = 2000;
+const uint32_t SCRIPT_BENCH_MAX_INSTRUCTIONS = 4096; // Benchmark runs have no waits to end a loop
+ScriptInstruction script_code[SCRIPT_MAX_INSTRUCTIONS];
+uint32_t script_loads = 0;
+
+// Buffered byte source over a SPIFFS file for the pattern_file.h readers
+struct PatternFileSource {
+  File file;
+  uint8_t buffer[64];
+  size_t length;
+  size_t offset;
+  int read() {
+    if (offset >= length) {
+      length = file.read(buffer, sizeof(buffer));
+      offset = 0;
+      if (length == 0 || length > sizeof(buffer)) {
+        length = 0;
+        return -1;
+      }
+    }
+    return buffer[offset++];
+  }
+};
+
+// The one pattern upload in flight, streamed to pattern_upload_path
+struct PatternUpload {
+  AsyncWebServerRequest* owner;
+  File file;
+  char filename[PATTERN_NAME_LEN];
+  size_t size;
+  bool too_large;
+  bool failed;
+};
+PatternUpload pattern_upload;
+
+// Spacing between HID reports while a pattern runs, per pattern. Linear 1 ms
+// buckets: step delays are a few to a few tens of ms, and jitter of a
+// millisecond or two is what we are looking for.
+const int STEP_BUCKETS = 64;
+struct StepHistogram {
+  uint32_t buckets[STEP_BUCKETS + 1]; // Last one counts intervals of 64 ms and more
+  uint32_t count;
+  uint64_t sum_us;
+  uint32_t min_us;
+  uint32_t max_us;
+};
+StepHistogram step_histograms[PATTERN_COUNT + MAX_PATTERN_FILES]; // Built-ins, then pattern file slots
+int step_pattern = -1;        // Pattern currently running on the motion engine
+int64_t step_last_report_us = 0;
+volatile bool step_reset_requested = false; // Cleared by the motion engine, which owns the histograms
+
 // File paths
 const char* config_file = "/config.json";
 const char* settings_file = "/settings.json";
 
-// USB Mouse
-USBHIDMouse Mouse;
+// USB Mouse. The stock USBHIDMouse reports whole wheel detents only, so the
+// firmware brings its own descriptor: a Resolution Multiplier feature in
+// front of Wheel and of AC Pan. Hosts that understand it (Windows, Linux)
+// set it on enumeration and then read each wheel unit as 1/12 of a detent;
+// others (macOS) leave it at 0 and keep whole detents.
+const uint8_t HIRES_SCROLL_MULTIPLIER = 12; // Divides SCROLL_UNITS_PER_DETENT
+const uint8_t HIRES_WHEEL_FEATURE = 0x03;   // Bits of the feature byte, one 2-bit field each
+const uint8_t HIRES_PAN_FEATURE = 0x0c;
+
+static const uint8_t hires_mouse_report_descriptor[] = {
+  0x05, 0x01,                     // Usage Page (Generic Desktop)
+  0x09, 0x02,                     // Usage (Mouse)
+  0xa1, 0x01,                     // Collection (Application)
+  0x85, HID_REPORT_ID_MOUSE,      //   Report ID
+  0x09, 0x01,                     //   Usage (Pointer)
+  0xa1, 0x00,                     //   Collection (Physical)
+  0x05, 0x09,                     //     Usage Page (Button)
+  0x19, 0x01, 0x29, 0x05,         //     Usage (Button 1..5)
+  0x15, 0x00, 0x25, 0x01,         //     Logical (0..1)
+  0x95, 0x05, 0x75, 0x01,         //     5 x 1 bit
+  0x81, 0x02,                     //     Input (Data, Var, Abs)
+  0x95, 0x01, 0x75, 0x03,         //     1 x 3 bits
+  0x81, 0x03,                     //     Input (Const) padding
+  0x05, 0x01,                     //     Usage Page (Generic Desktop)
+  0x09, 0x30, 0x09, 0x31,         //     Usage (X, Y)
+  0x15, 0x81, 0x25, 0x7f,         //     Logical (-127..127)
+  0x95, 0x02, 0x75, 0x08,         //     2 x 8 bits
+  0x81, 0x06,                     //     Input (Data, Var, Rel)
+  0xa1, 0x02,                     //     Collection (Logical)
+  0x09, 0x48,                     //       Usage (Resolution Multiplier)
+  0x15, 0x00, 0x25, 0x01,         //       Logical (0..1)
+  0x35, 0x01, 0x45, HIRES_SCROLL_MULTIPLIER, // Physical (1..12)
+  0x95, 0x01, 0x75, 0x02,         //       1 x 2 bits
+  0xb1, 0x02,                     //       Feature (Data, Var, Abs)
+  0x35, 0x00, 0x45, 0x00,         //       Physical (0..0)
+  0x09, 0x38,                     //       Usage (Wheel)
+  0x15, 0x81, 0x25, 0x7f,         //       Logical (-127..127)
+  0x95, 0x01, 0x75, 0x08,         //       1 x 8 bits
+  0x81, 0x06,                     //       Input (Data, Var, Rel)
+  0xc0,                           //     End Collection
+  0xa1, 0x02,                     //     Collection (Logical)
+  0x09, 0x48,                     //       Usage (Resolution Multiplier)
+  0x15, 0x00, 0x25, 0x01,         //       Logical (0..1)
+  0x35, 0x01, 0x45, HIRES_SCROLL_MULTIPLIER, // Physical (1..12)
+  0x95, 0x01, 0x75, 0x02,         //       1 x 2 bits
+  0xb1, 0x02,                     //       Feature (Data, Var, Abs)
+  0x35, 0x00, 0x45, 0x00,         //       Physical (0..0)
+  0x75, 0x04,                     //       1 x 4 bits
+  0xb1, 0x03,                     //       Feature (Const) padding
+  0x05, 0x0c,                     //       Usage Page (Consumer)
+  0x0a, 0x38, 0x02,               //       Usage (AC Pan)
+  0x15, 0x81, 0x25, 0x7f,         //       Logical (-127..127)
+  0x95, 0x01, 0x75, 0x08,         //       1 x 8 bits
+  0x81, 0x06,                     //       Input (Data, Var, Rel)
+  0xc0,                           //     End Collection
+  0xc0,                           //   End Collection
+  0xc0,                           // End Collection
+};
+
+class HiResMouse : public USBHIDDevice {
+public:
+  HiResMouse() : _buttons(0), _feature(0) {
+    static bool registered = false;
+    if (!registered) {
+      registered = true;
+      USBHID::addDevice(this, sizeof(hires_mouse_report_descriptor));
+    }
+  }
+
+  void begin() {
+    hid.begin();
+  }
+
+  // Wheel and pan are in report units, see wheelMultiplier()
+  void move(int8_t x, int8_t y, int8_t wheel = 0, int8_t pan = 0) {
+    uint8_t report[5] = { _buttons, (uint8_t)x, (uint8_t)y, (uint8_t)wheel, (uint8_t)pan };
+    hid.SendReport(HID_REPORT_ID_MOUSE, report, sizeof(report));
+  }
+
+  void press(uint8_t button) {
+    setButtons(_buttons | button);
+  }
+
+  void release(uint8_t button) {
+    setButtons(_buttons & ~button);
+  }
+
+  // Report units per detent as the host last configured them
+  uint8_t wheelMultiplier() const {
+    return (_feature.load(std::memory_order_relaxed) & HIRES_WHEEL_FEATURE) ? HIRES_SCROLL_MULTIPLIER : 1;
+  }
+
+  uint8_t panMultiplier() const {
+    return (_feature.load(std::memory_order_relaxed) & HIRES_PAN_FEATURE) ? HIRES_SCROLL_MULTIPLIER : 1;
+  }
+
+  // A reset device starts at one unit per detent until the host sets the
+  // multipliers again
+  void resetFeature() {
+    _feature.store(0, std::memory_order_relaxed);
+  }
+
+  uint16_t _onGetDescriptor(uint8_t* buffer) override {
+    memcpy(buffer, hires_mouse_report_descriptor, sizeof(hires_mouse_report_descriptor));
+    return sizeof(hires_mouse_report_descriptor);
+  }
+
+  uint16_t _onGetFeature(uint8_t report_id, uint8_t* buffer, uint16_t len) override {
+    if (report_id != HID_REPORT_ID_MOUSE || len < 1) {
+      return 0;
+    }
+    buffer[0] = _feature.load(std::memory_order_relaxed);
+    return 1;
+  }
+
+  // USB task. Depending on the TinyUSB version the data may still start
+  // with the report ID.
+  void _onSetFeature(uint8_t report_id, const uint8_t* buffer, uint16_t len) override {
+    if (report_id != HID_REPORT_ID_MOUSE || len < 1) {
+      return;
+    }
+    uint8_t value = len >= 2 && buffer[0] == report_id ? buffer[1] : buffer[0];
+    _feature.store(value & (HIRES_WHEEL_FEATURE | HIRES_PAN_FEATURE), std::memory_order_relaxed);
+    LOG_INFO("Host set scroll resolution: wheel x%u, pan x%u", wheelMultiplier(), panMultiplier());
+  }
+
+private:
+  void setButtons(uint8_t buttons) {
+    if (buttons != _buttons) {
+      _buttons = buttons;
+      move(0, 0);
+    }
+  }
+
+  USBHID hid;
+  uint8_t _buttons;
+  std::atomic<uint8_t> _feature;
+};
+HiResMouse Mouse;
 
 // Web server
 AsyncWebServer* server;
 
 // Timestamp for last movement
 unsigned long last_move_time = 0;
-unsigned long next_move_time = 0; // Next scheduled movement
+unsigned long next_move_time = 0; // Next scheduled movement of the main settings
+
+// Movement deadlines, one timer for the main settings and one per profile.
+// The wheel belongs to the motion engine in loop(); the web server task asks
+// for new deadlines through reschedule_requested (a bitmask of timer ids).
+const uint8_t MAIN_MOVE_TIMER = 0;
+TimerWheel jiggle_timers;
+uint32_t moves_due = 0;                         // Fired timers still waiting for an idle touchpad
+unsigned long profile_next_move[MAX_PROFILES];  // Reported by /api/status, 0 = not scheduled
+unsigned long next_jiggle_time = 0;             // Earliest deadline of any timer
+std::atomic<uint32_t> reschedule_requested(0);
+
+// Wall clock, set from the browser (/api/time) or by SNTP once the station
+// is up. Local time is UTC plus clock_utc_offset as reported by the browser;
+// the device has no time zone rules of its own.
+#ifndef NTP_SERVER
+#define NTP_SERVER "pool.ntp.org"
+#endif
+enum ClockSource { CLOCK_NONE, CLOCK_BROWSER, CLOCK_SNTP };
+volatile ClockSource clock_source = CLOCK_NONE;
+volatile int clock_utc_offset = 0; // Minutes east of UTC
+bool sntp_started = false;
+
+// Where the weekly schedule stands. loop() works it out again only at the
+// precomputed next change, or when the clock or the schedule changes.
+struct ScheduleState {
+  bool active;             // Inside a window, or no schedule in force
+  time_t next_change;      // Epoch seconds of the next change, 0 = none ahead
+  time_t next_activation;  // Epoch seconds when the jiggler next becomes active, 0 = none
+  unsigned long change_at; // millis() of next_change, 0 = none
+};
+ScheduleState schedule_state = { true, 0, 0, 0 };
+std::atomic<bool> schedule_update_requested(true);
 
 // Session management
 const int MAX_SESSIONS = 10;
@@ -94,46 +536,657 @@ unsigned long session_timeout = 30 * 60 * 1000; // 30 minutes in milliseconds
 // WiFi mode
 bool isAPMode = false;
 
-// Add a new variable for hidden AP option
-bool ap_hidden = false;
-
 // WiFi mode settings
-char* wifi_mode = strdup("ap"); // "ap" or "apsta"
-char* ap_availability = strdup("always"); // "always" or "timeout"
-int ap_timeout = 5; // minutes
+enum WifiModeSetting { WIFI_SETTING_AP, WIFI_SETTING_APSTA };
+enum ApAvailability { AP_ALWAYS, AP_TIMEOUT };
+
+// Settings that can be modified at runtime, defaults from credentials.h are
+// overridden by settings.json if it exists. Strings are held
+// inline so updates never touch the heap; the whole struct is copied by value.
+const size_t SSID_LEN = 33;       // 32 characters + terminator
+const size_t PASSPHRASE_LEN = 65; // 64 characters + terminator
+const size_t NAME_LEN = 33;
+struct Settings {
+  char ap_ssid[SSID_LEN];
+  char ap_password[PASSPHRASE_LEN];
+  bool ap_hidden;
+  char hostname[NAME_LEN];
+  WifiModeSetting wifi_mode; // "ap" or "apsta"
+  ApAvailability ap_availability; // "always" or "timeout"
+  int ap_timeout; // minutes
+  char sta_ssid[SSID_LEN]; // STA mode customizable credentials
+  char sta_password[PASSPHRASE_LEN];
+  bool auth_enabled; // Default to true for backward compatibility
+  char username[NAME_LEN];
+  char auth_password[PASSPHRASE_LEN];
+  int web_port;
+};
+Settings settings = {
+  DEFAULT_AP_SSID, DEFAULT_AP_PASSWORD, false, DEFAULT_HOSTNAME,
+  WIFI_SETTING_AP, AP_ALWAYS, 5,
+  WIFI_SSID, WIFI_PASSWORD,
+  true, DEFAULT_WEB_USERNAME, DEFAULT_WEB_PASSWORD,
+  DEFAULT_WEB_PORT
+};
+
+// Once the web server runs, settings is owned by its task, which publishes a
+// copy after every change. loop() reads the latest copy through a triple
+// buffer, the same way as motion_config.
+const uint32_t SETTINGS_FRESH = 4; // Flag in settings_middle: unread snapshot
+Settings settings_buffers[3];
+std::atomic<uint32_t> settings_middle(1);
+uint32_t settings_back = 0;  // Owned by the writer
+uint32_t settings_front = 2; // Owned by the reader
 unsigned long ap_start_time = 0; // When AP was started
 bool ap_active = true; // Is AP currently active
 
+// Station connection state, driven by WiFi.onEvent callbacks
+enum StaState { STA_IDLE, STA_CONNECTING, STA_CONNECTED, STA_BACKOFF, STA_DISCONNECTING };
+const unsigned long wifi_backoff_min = 2000; // First retry after 2 seconds
+const unsigned long wifi_backoff_max = 5 * 60 * 1000; // Never wait more than 5 minutes between retries
+
+struct WifiManager {
+  StaState sta_state;
+  unsigned long attempt_start;   // When the current WiFi.begin() was issued
+  unsigned long retry_at;        // When the next attempt is due (STA_BACKOFF), or when to stop waiting (STA_DISCONNECTING)
+  unsigned long backoff;         // Current backoff delay in milliseconds
+  unsigned long connected_since; // When the current association got an IP
+  uint32_t connect_attempts;     // Total WiFi.begin() calls
+  uint32_t retries;              // Attempts made after a failure or disconnect
+  uint32_t disconnects;          // Lost connections after a successful association
+  uint32_t last_assoc_ms;        // Time from WiFi.begin() to IP for the last association
+  uint32_t total_assoc_ms;       // Sum of association times, for the average
+  uint32_t associations;         // Successful associations
+  uint8_t last_disconnect_reason;
+  bool fast_attempt;             // Current attempt or connection uses the cached BSSID, channel and IP
+  uint32_t fast_hits;            // Fast attempts that got connected
+  uint32_t fast_misses;          // Fast attempts that fell back to a full scan
+  uint32_t boot_reachable_ms;    // Time from boot to the first IP in this boot
+  bool renewing;                 // DHCP restarted on a fast connection, waiting for its address
+  unsigned long renew_at;        // When to hand the cached address back to DHCP, or give up waiting for it
+};
+WifiManager wifi_manager = { STA_IDLE, 0, 0, wifi_backoff_min, 0, 0, 0, 0, 0, 0, 0, 0, false, 0, 0, 0, false, 0 };
+
+// Last successful association, used to skip the scan and DHCP on reconnect.
+// Kept in RTC memory across soft resets and mirrored to NVS for cold boots.
+const uint32_t WIFI_CACHE_MAGIC = 0x4A474C31; // "JGL1"
+struct WifiFastCache {
+  uint32_t magic;
+  uint32_t ssid_hash;  // Cache only applies to the network it was taken from
+  uint8_t bssid[6];
+  uint8_t channel;
+  uint32_t ip;
+  uint32_t gateway;
+  uint32_t subnet;
+  uint32_t dns;
+  uint32_t checksum;
+};
+RTC_NOINIT_ATTR WifiFastCache wifi_rtc_cache;
+WifiFastCache wifi_cache;
+bool wifi_cache_valid = false;
+
+// Boot-to-reachable times persisted in NVS so the fast path can be compared
+// against the previous full-scan boot
+uint32_t wifi_last_full_boot_ms = 0;
+uint32_t wifi_last_fast_boot_ms = 0;
+Preferences wifi_prefs;
+
+// Events posted by the WiFi event task and consumed in loop(), in the order
+// they happened, so a disconnect right after GOT_IP is not lost. When the
+// queue is full the oldest event is dropped; the newest ones carry the
+// current link state.
+enum WifiEventType : uint8_t { WIFI_EVT_GOT_IP, WIFI_EVT_DISCONNECTED };
+struct WifiEvent {
+  WifiEventType type;
+  uint8_t reason;     // Disconnect reason
+  unsigned long time; // millis() when it was posted
+};
+const uint32_t WIFI_EVENT_QUEUE_SIZE = 8;
+WifiEvent wifi_events[WIFI_EVENT_QUEUE_SIZE];
+uint32_t wifi_event_head = 0; // Next slot to fill
+uint32_t wifi_event_count = 0;
+uint32_t wifi_events_dropped = 0;
+portMUX_TYPE wifi_event_mux = portMUX_INITIALIZER_UNLOCKED;
+
 // Tracking variables for mouse position
 int totalDisplacementX = 0;
 int totalDisplacementY = 0;
 
-// Add this near the top with other global variables
-bool auth_enabled = true; // Default to true for backward compatibility
+// Power governor: CPU clock and modem sleep follow activity
+enum PowerLevel { POWER_OFF_HOURS, POWER_IDLE, POWER_ACTIVE, POWER_INTERACTIVE, POWER_LEVEL_COUNT };
+struct PowerProfile {
+  const char* name;
+  uint32_t cpu_mhz;
+  wifi_ps_type_t wifi_ps;
+  uint16_t est_ma; // Rough datasheet estimate of supply current at this level
+};
+const PowerProfile power_profiles[POWER_LEVEL_COUNT] = {
+  { "off_hours", 80, WIFI_PS_MAX_MODEM, 18 }, // Outside the weekly schedule
+  { "idle", 80, WIFI_PS_MIN_MODEM, 22 },
+  { "active", 160, WIFI_PS_MIN_MODEM, 30 },
+  { "interactive", 240, WIFI_PS_NONE, 70 },
+};
+const unsigned long touchpad_activity_window = 30 * 1000; // Full speed while the touchpad was used recently
+const unsigned long api_activity_window = 10 * 1000;      // Stay responsive after an API call
+const unsigned long jiggle_lead_time = 1000;              // Wake up ahead of a scheduled jiggle
+
+struct PowerGovernor {
+  PowerLevel level;
+  unsigned long level_since;
+  uint64_t time_in_level[POWER_LEVEL_COUNT]; // Milliseconds spent at each level
+  uint32_t switches;
+  uint32_t last_switch_us;      // Cost of the last clock/modem change
+  uint32_t last_wake_latency_us; // Activity to raised level, last upshift
+  uint32_t max_wake_latency_us;
+};
+PowerGovernor power_governor = { POWER_ACTIVE, 0, { 0, 0, 0, 0 }, 0, 0, 0, 0 };
+
+// Written from the web server task, read by the governor in loop()
+volatile unsigned long last_touchpad_activity = 0;
+volatile unsigned long last_api_activity = 0;
+std::atomic<unsigned long> pending_activity_us(0); // First activity not yet seen by the governor, 0 if none
+
+// Scheduler: loop() sleeps until the earliest deadline instead of spinning
+struct SchedulerDeadline {
+  unsigned long now;
+  unsigned long wait; // Milliseconds until the earliest registered deadline
+};
+const unsigned long scheduler_max_wait = 60000; // Upper bound on a single sleep
+const unsigned long session_cleanup_interval = 60000;
+
+struct SchedulerStats {
+  uint32_t wakeups;
+  uint64_t sleep_ms;        // Time loop() spent blocked waiting for a deadline
+  unsigned long next_wait;  // Length of the sleep that is currently in progress
+  uint64_t idle_sample_us;  // Previous CPU idle sample
+  uint64_t idle_sample_runtime;
+  uint8_t cpu_idle_pct;
+};
+SchedulerStats scheduler_stats = { 0, 0, 0, 0, 0, 0 };
+TaskHandle_t loop_task_handle = NULL;
+
+// Restart requested by a web handler; loop() performs it once the response
+// has had time to go out, so the network task never sleeps for it
+const unsigned long restart_delay = 500;
+volatile unsigned long restart_at = 0;
+volatile bool restart_pending = false;
+
+// Heap allocation counters. With HEAP_ALLOC_COUNTING the build wraps
+// malloc/calloc/realloc/free at link time (see platformio.ini); allocations
+// made on the web server task are also counted as the request path.
+// FreeRTOS objects come from heap_caps directly and are not counted.
+struct AllocCounters {
+  std::atomic<uint32_t> allocs;
+  std::atomic<uint32_t> frees;
+  std::atomic<uint32_t> bytes;
+};
+AllocCounters alloc_total;
+AllocCounters alloc_request;
+TaskHandle_t web_task_handle = NULL;
+
+// Touchpad input goes through a queue to the HID sender task, so the web
+// server task never waits on USB. Commands carry esp_timer stamps for each
+// stage. "Received" is taken when the first body chunk arrives, in the same
+// AsyncTCP callback that delivered the segment from lwIP.
+enum HidCommandType : uint8_t {
+  HID_CMD_SEQUENCE,    // Timed HID actions
+  HID_CMD_RESET_STATS, // Clears the latency histograms on the sender task
+  HID_CMD_MACRO_START, // Starts recording touchpad input
+  HID_CMD_MACRO_STOP,  // Ends the recording and hands it to the motion engine to write out
+  HID_CMD_SCROLL,      // Adds wheel and pan distance to the scroll glide
+};
+enum HidActionType : uint8_t {
+  HID_ACTION_MOVE,
+  HID_ACTION_PRESS,
+  HID_ACTION_RELEASE,
+};
+
+// One report of a sequence, due offset_ms after the sender picks the
+// command up. Offsets are absolute, so a double click keeps its spacing even
+// when one report goes out late.
+struct HidAction {
+  uint16_t offset_ms;
+  HidActionType type;
+  uint8_t button;
+  int8_t x;
+  int8_t y;
+  int8_t wheel;
+};
+const int HID_SEQUENCE_STEPS = 4; // Enough for a double click
+struct HidCommand {
+  HidCommandType type;
+  uint8_t step_count;
+  HidAction steps[HID_SEQUENCE_STEPS];
+  int32_t scroll[2];   // HID_CMD_SCROLL: wheel and pan distance in SCROLL_UNITS_PER_DETENT
+  uint16_t glide_ms;   // HID_CMD_SCROLL: time to spread it over
+  uint32_t seq;        // Client probe sequence ID, 0 when the client sent none
+  int64_t received_us;
+  int64_t parsed_us;
+  int64_t enqueued_us;
+};
+const uint32_t HID_TASK_STACK_SIZE = 3072;
+const UBaseType_t HID_TASK_PRIORITY = 4; // Above async_tcp (3) so input is sent right away
+const uint32_t HID_CLICK_HOLD_MS = 8;
+
+// Smooth scrolling. Scroll commands add their distance to one glide, which
+// the sender task pays out every tick (one full-speed USB frame) with the
+// speed easing out to zero. Distances are kept in 1/120 detents, as Windows
+// does, and turned into report units with the multiplier the host chose;
+// what does not make a whole unit yet carries over to the next tick or
+// command. A flick is one command with a long glide.
+const int32_t SCROLL_UNITS_PER_DETENT = 120;
+const uint32_t SCROLL_TICK_US = 1000;
+const uint16_t SCROLL_DEFAULT_GLIDE_MS = 50;
+const uint16_t SCROLL_MAX_GLIDE_MS = 2000;
+const float SCROLL_MAX_DETENTS = 100;
+struct ScrollGlide {
+  int32_t remaining[2]; // Wheel and pan still to pay out
+  int32_t carry[2];     // Paid out but less than one report unit
+  uint32_t ticks_left;
+  int64_t next_us;      // Next tick
+};
+ScrollGlide scroll_glide;
+
+// PIN_TASKS_TO_CORES (esp32-s3-zero env) keeps the network on core 0 and
+// motion plus HID on core 1. WiFi already runs on core 0 and loop() on
+// ARDUINO_RUNNING_CORE (1); platformio.ini pins async_tcp with
+// CONFIG_ASYNC_TCP_RUNNING_CORE, plus CONFIG_ASYNC_TCP_USE_WDT, which AsyncTCP
+// would otherwise drop along with its other defaults. Single-core chips (S2)
+// ignore the option and rely on the task priorities above. The step jitter
+// and input latency with and without pinning have not been measured; the
+// README describes how to compare the two builds.
+#if defined(PIN_TASKS_TO_CORES) && !CONFIG_FREERTOS_UNICORE
+const BaseType_t HID_TASK_CORE = 1;
+#else
+const BaseType_t HID_TASK_CORE = tskNO_AFFINITY;
+#endif
+
+// Commands from the web server task (the only producer) to the sender task
+// (the only consumer). Lock-free, so the two sides never wait on each other
+// across cores; the sender is woken with a task notification.
+const uint32_t HID_RING_SIZE = 32; // Power of two
+struct HidRing {
+  HidCommand slots[HID_RING_SIZE];
+  std::atomic<uint32_t> head; // Next slot to fill, written by the producer
+  std::atomic<uint32_t> tail; // Next slot to read, written by the consumer
+};
+HidRing hid_ring;
+TaskHandle_t hid_task = NULL;
+
+// Touchpad macro recorder. While recording, the sender task appends every
+// report it sends to macro.code as a script (script_vm.h): moves within the
+// same millisecond are merged into one MOVEI and the gaps between reports
+// become WAITs, measured from the first report so rounding never adds up.
+// Replay runs from flash on the motion engine like any other script. The
+// motion engine writes a stopped recording to macro_temp_path; the web server
+// task installs it with the next request, as it does uploads, and leaves the
+// outcome in macro_result for /api/macro/result.
+enum MacroState : uint8_t {
+  MACRO_IDLE,
+  MACRO_RECORDING, // Set by the sender task
+  MACRO_STOPPED,   // Set by the sender task; the motion engine owns the buffer until it sets WRITTEN
+  MACRO_WRITTEN,   // Set by the motion engine; the web server task installs the file
+  MACRO_SAVED,     // Set by the web server task; macro_result holds the outcome
+};
+struct MacroRecorder {
+  ScriptInstruction code[SCRIPT_MAX_INSTRUCTIONS];
+  uint16_t count;
+  uint8_t buttons;        // Held right now, released by the recording's end
+  bool truncated;         // Ran out of room, later input was not recorded
+  int64_t first_event_us; // 0 until the first report, so idle time before it is dropped
+  uint32_t recorded_ms;   // Sum of the WAITs so far
+  int32_t scroll_carry;   // Wheel distance below a whole detent, scripts scroll in detents
+};
+struct MacroResult {
+  char name[PATTERN_NAME_LEN]; // Written by the web server task before the stop command
+  PatternFileEntry info;       // The checked file, once WRITTEN
+  const char* error;           // NULL when saved
+  int code;
+  uint16_t instructions;
+  uint32_t duration_ms;
+  bool truncated;
+};
+MacroRecorder macro;
+MacroResult macro_result;
+std::atomic<uint8_t> macro_state(MACRO_IDLE);
+const char* macro_temp_path = "/patterns/.macro";
+
+// Actions waiting for their due time, earliest first; sender task only. The
+// sender wakes on the tick (1 ms, one full-speed USB frame) the action is due.
+struct PendingHidAction {
+  int64_t due_us;
+  HidAction action;
+};
+const int HID_MAX_PENDING = 16;
+PendingHidAction hid_pending[HID_MAX_PENDING];
+int hid_pending_count = 0;
+
+// Tasks whose stack high-water marks are reported, with their configured
+// stack size in bytes where this firmware chooses it (0 = unknown)
+struct MonitoredTask {
+  const char* name;
+  uint32_t stack_size;
+};
+const MonitoredTask monitored_tasks[] = {
+  { "loopTask", CONFIG_ARDUINO_LOOP_STACK_SIZE },
+#ifdef ASYNC_TCP_STACK_SIZE
+  { "async_tcp", ASYNC_TCP_STACK_SIZE },
+#else
+  { "async_tcp", 0 },
+#endif
+  { "arduino_usb_events", 0 },
+  { "usbd", 0 },
+  { "tiT", 0 },
+  { "wifi", 0 },
+  { "sys_evt", 0 },
+  { "esp_timer", 0 },
+  { "hid_sender", HID_TASK_STACK_SIZE },
+};
+
+// Per-route request metrics, updated and read on the web server task only.
+// Histograms use power-of-two buckets: bucket i counts values up to
+// 1 << (shift + i), the extra last bucket counts everything above.
+const int HISTOGRAM_BUCKETS = 12;
+struct Histogram {
+  uint8_t shift;
+  uint32_t buckets[HISTOGRAM_BUCKETS + 1];
+  uint32_t count;
+  uint64_t sum;
+};
+
+struct RouteMetrics {
+  const char* path;
+  const char* method;
+  uint32_t requests;
+  uint32_t errors; // Responses with status >= 400
+  Histogram handler_us; // 16 us .. 32 ms
+  Histogram response_bytes; // 64 B .. 128 KB
+};
+const int MAX_ROUTES = 40;
+RouteMetrics route_metrics[MAX_ROUTES];
+int route_count = 0;
+
+// Response recorded by the send helpers during the current handler call
+const size_t RESPONSE_SIZE_UNKNOWN = (size_t)-1;
+struct RouteSample {
+  RouteMetrics* route;
+  int64_t start_us;
+  int code;
+  size_t bytes;
+};
+RouteSample route_sample = { NULL, 0, 0, 0 };
+
+// Request bodies of the JSON POST routes are assembled from their TCP
+// chunks into a fixed pool and parsed once, in the request handler, after
+// the session check. Slots are matched by request pointer: _tempObject is
+// free()d by the request destructor, so it cannot point into the pool.
+// Web server task only.
+const int BODY_POOL_SLOTS = 4;
+const size_t BODY_SLOT_SIZE = 1024; // Larger bodies are answered with 413
+struct RequestBody {
+  AsyncWebServerRequest* owner; // NULL while the slot is free
+  size_t length;                // Content-Length
+  size_t received;
+  int64_t received_us;          // First chunk, for the touchpad latency stages
+  uint8_t data[BODY_SLOT_SIZE];
+};
+RequestBody body_pool[BODY_POOL_SLOTS];
+
+// Input latency per stage in microseconds, written by the HID sender task
+enum LatencyStage {
+  LATENCY_PARSE,    // First body chunk -> JSON parsed (includes the rest of the body and the session check)
+  LATENCY_ENQUEUE,  // Parsed -> queued
+  LATENCY_QUEUE,    // Queued -> picked up by the sender
+  LATENCY_SEND,     // Picked up -> first report accepted by the USB stack
+  LATENCY_TOTAL,    // Received -> first report accepted
+  LATENCY_STAGES
+};
+const char* const latency_stage_names[LATENCY_STAGES] = { "parse", "enqueue", "queue_wait", "hid_send", "total" };
+struct InputLatency {
+  Histogram stages[LATENCY_STAGES]; // 8 us .. 16 ms
+  uint32_t last_seq;
+  uint32_t dropped; // Rejected on a full queue; counted by the web server task
+};
+InputLatency input_latency;
+
+// On-device benchmark (/api/bench). A worker pinned to the requesting core
+// runs each operation a fixed number of times and sums the CPU cycle counter
+// around it; cycles count wall time on that core, including any preemption.
+// Motion patterns run at speed 0 into a null HID sink while motion_mutex
+// keeps the motion engine in loop() out of the way.
+struct BenchResult {
+  const char* name;
+  uint32_t ops;
+  uint64_t cycles;
+  int64_t elapsed_us;
+};
+enum BenchState : uint8_t { BENCH_IDLE, BENCH_RUNNING, BENCH_DONE };
+const int BENCH_MAX_RESULTS = 28;
+const uint32_t BENCH_DEFAULT_ITERATIONS = 50;
+const uint32_t BENCH_MAX_ITERATIONS = 500;
+const uint32_t BENCH_MOTION_WAIT_MS = 1000; // Longest wait for the motion engine before skipping patterns
+const uint32_t BENCH_TASK_STACK_SIZE = 8192;
+const UBaseType_t BENCH_TASK_PRIORITY = 1; // Below async_tcp, so requests are served during a run
+struct BenchRun {
+  uint32_t iterations;
+  int movement_size;
+  String cookie;
+  BaseType_t core;
+  BenchResult results[BENCH_MAX_RESULTS];
+  int result_count;
+  bool motion_skipped; // Pattern timings left out: a pattern held motion_mutex past BENCH_MOTION_WAIT_MS
+};
+BenchRun bench_run;
+std::atomic<uint8_t> bench_state(BENCH_IDLE);
+SemaphoreHandle_t motion_mutex = NULL;
+TaskHandle_t hid_null_sink_task = NULL; // Task whose HID reports are dropped
+
+// Per-task CPU time (/api/metrics/tasks). FreeRTOS run-time counters are
+// cumulative, so loop() stores a snapshot every TASK_SAMPLE_MS in a ring that
+// spans the longest window, and a request reports the change from the oldest
+// snapshot inside its window to the counters now. Sampling only runs for
+// TASK_SAMPLING_HOLD_MS after a request, so an unwatched device keeps its
+// light sleep; the request that starts it stores the first snapshot itself.
+const int MAX_TASK_STATS = 28;
+const uint32_t TASK_SAMPLE_MS = 2000;
+const uint32_t TASK_SAMPLING_HOLD_MS = 120000;
+const uint32_t TASK_WINDOW_DEFAULT_MS = 5000;
+const uint32_t TASK_WINDOW_MAX_MS = 60000;
+const int TASK_SNAPSHOTS = TASK_WINDOW_MAX_MS / TASK_SAMPLE_MS + 1;
+struct TaskSnapshot {
+  int64_t timestamp_us;
+  uint8_t count;
+  uint16_t numbers[MAX_TASK_STATS]; // Low bits of xTaskNumber, stable for a task's lifetime
+  uint32_t runtime[MAX_TASK_STATS];
+};
+TaskSnapshot task_snapshots[TASK_SNAPSHOTS]; // Written by loop(), under task_snapshot_mux
+uint32_t task_snapshot_count = 0; // Newest at (task_snapshot_count - 1) % TASK_SNAPSHOTS
+bool task_sampling = false;        // Under task_snapshot_mux, like the two below
+unsigned long task_sampling_until = 0;
+unsigned long task_sample_at = 0;  // loop() only
+bool task_sampler_running = false; // loop() only
+portMUX_TYPE task_snapshot_mux = portMUX_INITIALIZER_UNLOCKED;
+TaskStatus_t task_sample_status[MAX_TASK_STATS]; // loop() only
+TaskStatus_t task_status[MAX_TASK_STATS]; // Web server task only
+
+// Representative request bodies for the JSON benchmarks
+struct BenchPayload {
+  const char* parse_name;
+  const char* serialize_name;
+  const char* json;
+};
+const BenchPayload bench_payloads[] = {
+  { "json_parse:config", "json_serialize:config",
+    "{\"move_interval\":30,\"movement_pattern\":\"circular\",\"movement_size\":50,\"movement_speed\":1000,"
+    "\"jiggler_enabled\":true,\"random_delay\":true,\"movement_trail\":false}" },
+  { "json_parse:settings", "json_serialize:settings",
+    "{\"ap\":{\"ssid\":\"jiggla\",\"password\":\"jiggla-password\",\"hidden\":false},\"hostname\":\"jiggla\","
+    "\"wifi_mode\":\"sta_fallback_ap\",\"ap_availability\":\"fallback\",\"ap_timeout\":300,"
+    "\"sta\":{\"ssid\":\"office-network\",\"password\":\"office-password\"},"
+    "\"auth\":{\"enabled\":true,\"username\":\"admin\",\"password\":\"admin-password\"},\"web_port\":80}" },
+  { "json_parse:login", "json_serialize:login", "{\"username\":\"admin\",\"password\":\"admin-password\"}" },
+  { "json_parse:touchpad", "json_serialize:touchpad", "{\"x\":-12,\"y\":7,\"seq\":123456}" },
+};
+
+// Log streaming over server-sent events. Each /api/logs response reads the
+// ring itself on the web server task, so loop() never touches its clients.
+enum LogReadResult { LOG_READ_OK, LOG_READ_PENDING, LOG_READ_GONE };
+struct LogStreamCursor {
+  uint32_t next; // Next record index to send
+  bool opened;   // Headers and the retry hint have gone out
+};
+std::atomic<int> log_stream_clients(0);
+const uint32_t log_replay_records = 24; // Backlog sent to a newly connected client
+
+// Automatic light sleep needs both no WiFi clients and a suspended USB bus:
+// while the host is awake, light sleep would stop the USB peripheral clock.
+volatile bool usb_suspended = false;
+bool light_sleep_allowed = false;
+bool light_sleep_active = false; // Power management accepted the light sleep request
 
 // Function prototypes
 void loadConfig();
 void saveConfig();
 void loadSettings();
+const char* copySetting(char* dest, size_t size, JsonVariantConst value);
 void saveSettings();
 void setupWiFi();
 void setupAccessPoint();
+void onWiFiEvent(WiFiEvent_t event, WiFiEventInfo_t info);
+void postWifiEvent(WifiEventType type, uint8_t reason);
+bool takeWifiEvent(WifiEvent& event);
+void handleStaGotIp(unsigned long got_ip_time, const Settings& current);
+void handleStaDisconnected(uint8_t reason);
+void beginStaConnect(const Settings& current);
+void scheduleStaRetry();
+void handleWiFi(SchedulerDeadline& next, const Settings& current);
+void loadWifiCache();
+void saveWifiCache(const Settings& current);
+void invalidateWifiCache();
+void recordBootReachable(uint32_t elapsed, bool fast);
+void noteActivity(bool touchpad);
+void applyPowerLevel(PowerLevel level);
+void handlePowerGovernor(SchedulerDeadline& next, const MotionConfig& config);
+void scheduleAt(SchedulerDeadline& next, unsigned long when);
+void wakeScheduler();
+void requestRestart();
+void sleepUntilDeadline(const SchedulerDeadline& next);
+void configureCpu(uint32_t cpu_mhz, bool light_sleep);
+void onUsbEvent(void* arg, esp_event_base_t base, int32_t event_id, void* event_data);
+uint8_t sampleCpuIdle();
+int readTaskSnapshot(TaskStatus_t* status, TaskSnapshot& snapshot);
+void sampleTasks(SchedulerDeadline& next);
+bool findTaskBaseline(int64_t now_us, uint32_t window_ms, TaskSnapshot& baseline);
+const char* taskStateName(eTaskState state);
+void countAlloc(void* ptr, size_t size);
+void countFree(void* ptr);
+const char* wifiModeName(WifiModeSetting mode);
+WifiModeSetting parseWifiMode(const char* name);
+const char* apAvailabilityName(ApAvailability availability);
+ApAvailability parseApAvailability(const char* name);
+const char* staStateName(StaState state);
 void setupWebServer();
+const char* logLevelName(uint8_t level);
+int parseLogLevel(const char* name);
+LogReadResult readLogRecord(uint32_t index, LogRecord& record);
+size_t formatLogRecord(const LogRecord& record, char* out, size_t size);
+size_t fillLogStream(LogStreamCursor& cursor, uint8_t *buffer, size_t maxLen);
+void recordHistogram(Histogram& histogram, uint32_t value);
+RouteMetrics* addRouteMetrics(const char* path, const char* method);
+void beginRouteSample(RouteMetrics* route);
+void endRouteSample();
+void recordResponse(int code, size_t bytes);
+void collectBody(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total);
+RequestBody* findBody(AsyncWebServerRequest *request);
+void releaseBody(AsyncWebServerRequest *request);
+const RequestBody* requestBody(AsyncWebServerRequest *request);
+void onRoute(const char* uri, WebRequestMethodComposite method, ArRequestHandlerFunction onRequest,
+             ArUploadHandlerFunction onUpload = NULL, ArBodyHandlerFunction onBody = NULL);
+void sendText(AsyncWebServerRequest *request, int code, const String& contentType, const String& content);
+void sendFile(AsyncWebServerRequest *request, const String& path, const String& contentType);
+void sendRedirect(AsyncWebServerRequest *request, const String& url);
+void sendResponse(AsyncWebServerRequest *request, AsyncWebServerResponse *response, int code, size_t bytes);
 String generateSessionId();
 bool validateSession(AsyncWebServerRequest *request);
+String sessionIdFromCookie(const String& cookie);
+int findSession(const String& sessionId);
 void initSPIFFS();
 void cleanupExpiredSessions();
-void moveMouseLinear();
-void moveMouseCircular();
-void moveMouseRectangle();
-void moveMouseTriangle();
-void moveMouseZigzag();
-unsigned long calculateMoveInterval();
-void moveMouse();
+unsigned long calculateMoveInterval(const MotionConfig& config);
+void scheduleNextMove(const MotionConfig& config);
+unsigned long profileInterval(const JiggleProfile& profile);
+void scheduleProfile(const MotionConfig& config, int index);
+void deferMoves(const MotionConfig& config, unsigned long live_input);
+bool profileWindowActive(const JiggleProfile& profile);
+int localMinutes();
+bool localTime(struct tm& local);
+void startClockSync();
+void onTimeSync(struct timeval* tv);
+const char* clockSourceName(ClockSource source);
+bool scheduleActiveAt(const MotionConfig& config, int minute);
+int scheduleNextChange(const MotionConfig& config, int minute, bool active);
+void updateSchedule(const MotionConfig& config);
+const char* parseScheduleWindow(JsonObjectConst source, ScheduleWindow& window);
+void writeScheduleWindow(JsonObject target, const ScheduleWindow& window);
+const char* parseProfile(JsonObjectConst source, JiggleProfile& profile);
+void writeProfile(JsonObject target, const JiggleProfile& profile);
+void publishMotionConfig();
+void publishSettings();
+const Settings& latestSettings();
+const MotionConfig& latestMotionConfig();
+void runPattern(const char* pattern, int size, int speed);
+int findPattern(const char* name);
+const char* patternName(int index);
+void patternFilePath(char* path, size_t size, const char* name, PatternFileKind kind);
+bool isValidPatternFileName(const char* name);
+const char* checkPatternFile(const char* path, PatternFileEntry& info);
+void loadPatternFiles();
+bool installPatternFile(const PatternFileEntry& info);
+bool removePatternFile(const char* name);
+void playPatternFile(const PatternFileEntry& entry, int size, int speed);
+void runScriptFile(const PatternFileEntry& entry, int size, int speed);
+const char* storePatternFile(const char* temp_path, const PatternFileEntry& info, int& code);
+void startMacro();
+void stopMacro();
+bool appendMacro(uint8_t op, uint8_t a, int16_t imm);
+void recordMacroAction(const HidAction& action);
+bool writeMacroFile(const char* path);
+void writeMacro();
+void finishMacroSave();
+void handlePatternUpload(AsyncWebServerRequest *request, const String& filename, size_t index, uint8_t *data, size_t len, bool final);
+void endPatternUpload();
+void recordStepInterval();
+uint32_t stepPercentile(const StepHistogram& histogram, uint32_t permille);
+void moveMouse(const MotionConfig& config);
 void saveSessions();
 void loadSessions();
-void cleanupMemory();
 void resetCursorPosition();
+bool patternWait(uint32_t ms);
+void noteLiveInput();
+void hidMove(int8_t x, int8_t y, int8_t wheel = 0);
+void hidPress(uint8_t button);
+void hidRelease(uint8_t button);
+void hidSenderTask(void* arg);
+void startHidSequence(const HidCommand& command);
+void recordInputLatency(const HidCommand& command, int64_t dequeued_us, int64_t sent_us);
+void startScrollGlide(const HidCommand& command);
+bool runScrollGlide();
+void hidScroll(int8_t wheel, int8_t pan);
+void runHidAction(const HidAction& action);
+void scheduleHidAction(int64_t due_us, const HidAction& action);
+void runDueHidActions();
+void addHidAction(HidCommand& command, uint16_t offset_ms, HidActionType type, uint8_t button = 0,
+                  int8_t x = 0, int8_t y = 0, int8_t wheel = 0);
+void resetInputLatency();
+bool queueHidCommand(HidCommand& command);
+bool pushHidCommand(const HidCommand& command);
+bool popHidCommand(HidCommand& command);
+uint32_t hidRingDepth();
+void sendInputAck(AsyncWebServerRequest *request, const HidCommand& command, bool queued);
+uint32_t histogramPercentile(const Histogram& histogram, uint32_t permille);
+bool hidNullSink();
+void benchTask(void* arg);
+void runBenchmarks(BenchRun& run);
 
 // Function to scale movement size based on slider value
 int scaleMovementSize(int rawSize) {
@@ -151,20 +1204,29 @@ int scaleMovementSize(int rawSize) {
 }
 
 void setup() {
+  // loop() blocks on task notifications, remember whom to notify
+  loop_task_handle = xTaskGetCurrentTaskHandle();
+  motion_mutex = xSemaphoreCreateMutex();
+  motion_preempt = xSemaphoreCreateBinary();
+  
   // Initialize USB using the values from platformio.ini
+  USB.onEvent(onUsbEvent);
   USB.begin();
   
   delay(500);
-  DEBUG("\nStarting jiggla");
+  LOG_INFO("Starting jiggla");
 
   // Initialize file system
   initSPIFFS();
   
   // Load settings (auth, AP details)
   loadSettings();
+  publishSettings();
   
   // Load configuration (mouse movement settings)
   loadConfig();
+  loadPatternFiles();
+  publishMotionConfig();
   
   // Initialize sessions
   for (int i = 0; i < MAX_SESSIONS; i++) {
@@ -178,78 +1240,198 @@ void setup() {
   setupWiFi();
   
   // Initialize web server with current port
-  server = new AsyncWebServer(current_webport);
+  server = new AsyncWebServer(settings.web_port);
   
   // Setup web server
   setupWebServer();
   
-  // Initialize mouse
+  // Initialize mouse and the task that sends touchpad input
   Mouse.begin();
+  resetInputLatency();
+  xTaskCreatePinnedToCore(hidSenderTask, "hid_sender", HID_TASK_STACK_SIZE, NULL, HID_TASK_PRIORITY,
+                          &hid_task, HID_TASK_CORE);
+#if defined(PIN_TASKS_TO_CORES) && !CONFIG_FREERTOS_UNICORE
+  if (xPortGetCoreID() != HID_TASK_CORE) {
+    LOG_WARN("loop() runs on core %d, motion and HID will share cores with the network", xPortGetCoreID());
+  }
+#endif
   delay(1000);
   
   // Setup RNG for session IDs
   randomSeed(micros());
   
-  DEBUG("jiggla ready");
+  // First movements one interval after boot
+  timerWheelInit(jiggle_timers, millis());
+  reschedule_requested.store(0);
+  scheduleNextMove(motion_config);
+  for (int i = 0; i < MAX_PROFILES; i++) {
+    scheduleProfile(motion_config, i);
+  }
+  
+  // Start at the middle level, the governor takes over from loop()
+  power_governor.level_since = millis();
+  applyPowerLevel(POWER_ACTIVE);
+  
+  LOG_INFO("jiggla ready");
 }
 
 void loop() {
-  // Check if it's time to move the mouse and if jiggler is enabled
-  if (jiggler_enabled && millis() - last_move_time >= calculateMoveInterval()) {
+  SchedulerDeadline next = { millis(), scheduler_max_wait };
+  
+  // One consistent configuration snapshot for this pass. The web server
+  // publishes before it asks for new deadlines, so take the request first.
+  uint32_t reschedule = reschedule_requested.exchange(0, std::memory_order_acquire);
+  bool schedule_update = schedule_update_requested.exchange(false, std::memory_order_acquire);
+  const MotionConfig& config = latestMotionConfig();
+  const Settings& current_settings = latestSettings();
+  
+  // Weekly schedule: only re-evaluated at its precomputed change. Entering a
+  // window starts every interval afresh.
+  if (schedule_update || (schedule_state.change_at != 0 && (long)(next.now - schedule_state.change_at) >= 0)) {
+    bool was_active = schedule_state.active;
+    updateSchedule(config);
+    if (schedule_state.active && !was_active) {
+      reschedule = ~0U;
+    }
+  }
+  if (schedule_state.change_at != 0) {
+    scheduleAt(next, schedule_state.change_at);
+  }
+  bool jiggling = config.jiggler_enabled && schedule_state.active;
+  if (reschedule & (1UL << MAIN_MOVE_TIMER)) {
+    scheduleNextMove(config);
+  }
+  for (int i = 0; i < MAX_PROFILES; i++) {
+    if (reschedule & (1UL << (i + 1))) {
+      scheduleProfile(config, i);
+    }
+  }
+  
+  // Write out a macro the sender task has stopped recording
+  if (macro_state.load(std::memory_order_acquire) == MACRO_STOPPED) {
+    writeMacro();
+  }
+  
+  // Live touchpad input restarts the intervals and holds the jiggler off
+  // until the touchpad has been idle for a while
+  unsigned long live_input = last_live_input;
+  if (live_input != seen_live_input) {
+    seen_live_input = live_input;
+    deferMoves(config, live_input);
+  }
+  bool input_idle = live_input == 0 || next.now - live_input >= config.input_idle_resume;
+  if (!input_idle) {
+    scheduleAt(next, live_input + config.input_idle_resume);
+  }
+  
+  // Collect the timers that came due. A profile outside its time window
+  // skips this turn and waits for its next interval.
+  moves_due |= timerWheelAdvance(jiggle_timers, next.now);
+  for (int i = 0; i < MAX_PROFILES; i++) {
+    if ((moves_due & (1UL << (i + 1))) && !profileWindowActive(config.profiles[i])) {
+      moves_due &= ~(1UL << (i + 1));
+      scheduleProfile(config, i);
+    }
+  }
+  
+  // Check if it's time to move the mouse and if jiggler is enabled and
+  // inside its schedule. Due timers take turns, the main settings first. A
+  // requested replay is the user's own action, so it doesn't wait for the
+  // touchpad to go idle.
+  uint32_t due = jiggling ? moves_due : 0;
+  bool play = play_requested.load(std::memory_order_acquire);
+  if (((due != 0 || move_requested) && input_idle) || play) {
+    TRACE_SCOPE("jiggle");
     DEBUG("Moving mouse");
+    bool main_move = play || move_requested || (due & (1UL << MAIN_MOVE_TIMER));
+    int profile = main_move ? -1 : __builtin_ctz(due) - 1;
+    move_requested = false;
+    MotionConfig played;
+    if (play) {
+      played = config;
+      strlcpy(played.movement_pattern, play_pattern, PATTERN_NAME_LEN);
+      played.movement_trail = false;
+      play_requested.store(false);
+    } else if (profile >= 0) {
+      const JiggleProfile& source = config.profiles[profile];
+      played = config;
+      strlcpy(played.movement_pattern, source.movement_pattern, PATTERN_NAME_LEN);
+      played.movement_size = source.movement_size;
+      played.movement_speed = source.movement_speed;
+      played.movement_trail = false;
+      DEBUGF("Profile %s", source.name);
+    }
+    
+    // A running benchmark borrows the motion engine while it times the patterns
+    xSemaphoreTake(motion_mutex, portMAX_DELAY);
     
     // Reset cursor position to original position before starting new movement
     resetCursorPosition();
     
     // Perform the movement
-    moveMouse();
+    moveMouse(play || profile >= 0 ? played : config);
+    xSemaphoreGive(motion_mutex);
     
-    // Update last move time
-    last_move_time = millis();
-    
-    // Calculate and store next scheduled movement time
-    next_move_time = millis() + calculateMoveInterval();
+    // Update last move time and draw the next deadline
+    if (main_move) {
+      moves_due &= ~(1UL << MAIN_MOVE_TIMER);
+      scheduleNextMove(config);
+    } else {
+      moves_due &= ~(1UL << (profile + 1));
+      scheduleProfile(config, profile);
+    }
+    next.now = millis();
+  }
+  if (jiggling) {
+    uint32_t tick;
+    if (moves_due != 0 && input_idle) {
+      scheduleAt(next, next.now); // More profiles waiting their turn
+    } else if (timerWheelNextWork(jiggle_timers, tick)) {
+      scheduleAt(next, tick);
+    }
   }
+  uint32_t earliest;
+  next_jiggle_time = moves_due != 0 ? next.now : timerWheelEarliest(jiggle_timers, earliest) ? earliest : 0;
   
-  // Handle AP timeout if configured
-  if (strcmp(ap_availability, "timeout") == 0 && ap_active) {
-    unsigned long ap_elapsed_minutes = (millis() - ap_start_time) / 60000;
-    
-    if (ap_elapsed_minutes >= ap_timeout) {
-      if (strcmp(wifi_mode, "apsta") == 0) {
-        // In AP+STA mode, only turn off the AP part, keep STA running
-        DEBUG("AP timeout reached, turning off AP but keeping station mode");
-        WiFi.mode(WIFI_STA);
-        ap_active = false;
-        DEBUG("AP turned off, device will continue in station mode");
-      } else {
-        // In AP-only mode, turn off WiFi completely
-        DEBUG("AP timeout reached, turning off WiFi completely");
-        WiFi.mode(WIFI_OFF);
-        ap_active = false;
-        DEBUG("WiFi turned off, device will continue as USB mouse jiggler only");
-      }
+  // Station reconnects and AP timeout
+  handleWiFi(next, current_settings);
+  
+  // Adjust CPU clock and modem sleep to current activity
+  handlePowerGovernor(next, config);
+  
+  // Per-task run time for /api/metrics/tasks
+  sampleTasks(next);
+  
+  // Restart requested over the web
+  if (restart_pending) {
+    if ((long)(next.now - restart_at) >= 0) {
+      ESP.restart();
     }
+    scheduleAt(next, restart_at);
   }
   
   // Cleanup expired sessions periodically
   static unsigned long last_cleanup = 0;
-  if (millis() - last_cleanup >= 60000) { // Check every minute
+  if (next.now - last_cleanup >= session_cleanup_interval) { // Check every minute
     cleanupExpiredSessions();
-    last_cleanup = millis();
+    last_cleanup = next.now;
   }
+  scheduleAt(next, last_cleanup + session_cleanup_interval);
+  
+  // Nothing to do until the earliest deadline or an event wakes us
+  sleepUntilDeadline(next);
 }
 
-void moveMouseLinear() {
+void moveMouseLinear(int size, int speed) {
   // Track actual movement
   int totalDeltaX = 0;
   int totalDeltaY = 0;
   
   // Calculate delay between steps to achieve the desired total movement time
-  int stepDelay = movement_speed / (LINE_STEPS * 2); // * 2 for round trip
+  int stepDelay = speed / (LINE_STEPS * 2); // * 2 for round trip
   
   // Scale the movement size
-  int scaledSize = scaleMovementSize(movement_size);
+  int scaledSize = scaleMovementSize(size);
   
   // Move from origin to end point smoothly
   for (int i = 0; i < LINE_STEPS; i++) {
@@ -264,7 +1446,7 @@ void moveMouseLinear() {
     
     // Move to this position
     if (deltaX != 0 || deltaY != 0) {
-      Mouse.move(deltaX, deltaY);
+      hidMove(deltaX, deltaY);
       
       // Update tracking
       totalDeltaX += deltaX;
@@ -275,7 +1457,9 @@ void moveMouseLinear() {
       totalDisplacementY += deltaY;
     }
     
-    delay(stepDelay);
+    if (!patternWait(stepDelay)) {
+      return;
+    }
   }
   
   // Move back to origin smoothly
@@ -291,7 +1475,7 @@ void moveMouseLinear() {
     
     // Move to this position
     if (deltaX != 0 || deltaY != 0) {
-      Mouse.move(deltaX, deltaY);
+      hidMove(deltaX, deltaY);
       
       // Update tracking
       totalDeltaX += deltaX;
@@ -302,12 +1486,14 @@ void moveMouseLinear() {
       totalDisplacementY += deltaY;
     }
     
-    delay(stepDelay);
+    if (!patternWait(stepDelay)) {
+      return;
+    }
   }
   
   // Final compensation if there's any drift
   if (totalDeltaX != 0 || totalDeltaY != 0) {
-    Mouse.move(-totalDeltaX, -totalDeltaY);
+    hidMove(-totalDeltaX, -totalDeltaY);
     
     // Update global tracking
     totalDisplacementX -= totalDeltaX;
@@ -317,12 +1503,12 @@ void moveMouseLinear() {
   }
 }
 
-void moveMouseCircular() {
+void moveMouseCircular(int size, int speed) {
   // Calculate radius based on scaled movement size
-  float radius = scaleMovementSize(movement_size);
+  float radius = scaleMovementSize(size);
   
   // Calculate delay between steps to achieve the desired total movement time
-  int stepDelay = movement_speed / CIRCLE_STEPS;
+  int stepDelay = speed / CIRCLE_STEPS;
   
   // Track total movement to ensure we return to start position
   int totalDeltaX = 0;
@@ -344,7 +1530,7 @@ void moveMouseCircular() {
     // Only move if there's an actual change to avoid unnecessary moves
     if (deltaX != 0 || deltaY != 0) {
       // Move to this position
-      Mouse.move(deltaX, deltaY);
+      hidMove(deltaX, deltaY);
       
       // Keep track of our movement
       totalDeltaX += deltaX;
@@ -359,12 +1545,14 @@ void moveMouseCircular() {
       lastY = y;
     }
     
-    delay(stepDelay);
+    if (!patternWait(stepDelay)) {
+      return;
+    }
   }
   
   // Return to exact starting position by inverting all accumulated movement
   if (totalDeltaX != 0 || totalDeltaY != 0) {
-    Mouse.move(-totalDeltaX, -totalDeltaY);
+    hidMove(-totalDeltaX, -totalDeltaY);
     
     // Update global tracking
     totalDisplacementX -= totalDeltaX;
@@ -374,13 +1562,13 @@ void moveMouseCircular() {
   }
 }
 
-void moveMouseRectangle() {
+void moveMouseRectangle(int size, int speed) {
   // Track total movement
   int totalDeltaX = 0;
   int totalDeltaY = 0;
   
   // Scale the movement size
-  int scaledSize = scaleMovementSize(movement_size);
+  int scaledSize = scaleMovementSize(size);
   
   // Define rectangle dimensions
   int width = scaledSize;
@@ -388,7 +1576,7 @@ void moveMouseRectangle() {
   
   // Calculate delay between steps to achieve the desired total movement time
   int stepsPerSide = RECT_STEPS / 4; // 4 sides
-  int stepDelay = movement_speed / RECT_STEPS;
+  int stepDelay = speed / RECT_STEPS;
   
   // Current position
   int currentX = 0;
@@ -407,7 +1595,7 @@ void moveMouseRectangle() {
     int deltaY = targetY - currentY;
     
     if (deltaX != 0 || deltaY != 0) {
-      Mouse.move(deltaX, deltaY);
+      hidMove(deltaX, deltaY);
       
       // Update tracking
       totalDeltaX += deltaX;
@@ -422,7 +1610,9 @@ void moveMouseRectangle() {
       currentY = targetY;
     }
     
-    delay(stepDelay);
+    if (!patternWait(stepDelay)) {
+      return;
+    }
   }
   
   // Side 2: Move down
@@ -436,7 +1626,7 @@ void moveMouseRectangle() {
     int deltaY = targetY - currentY;
     
     if (deltaX != 0 || deltaY != 0) {
-      Mouse.move(deltaX, deltaY);
+      hidMove(deltaX, deltaY);
       
       // Update tracking
       totalDeltaX += deltaX;
@@ -451,7 +1641,9 @@ void moveMouseRectangle() {
       currentY = targetY;
     }
     
-    delay(stepDelay);
+    if (!patternWait(stepDelay)) {
+      return;
+    }
   }
   
   // Side 3: Move left
@@ -465,7 +1657,7 @@ void moveMouseRectangle() {
     int deltaY = targetY - currentY;
     
     if (deltaX != 0 || deltaY != 0) {
-      Mouse.move(deltaX, deltaY);
+      hidMove(deltaX, deltaY);
       
       // Update tracking
       totalDeltaX += deltaX;
@@ -480,7 +1672,9 @@ void moveMouseRectangle() {
       currentY = targetY;
     }
     
-    delay(stepDelay);
+    if (!patternWait(stepDelay)) {
+      return;
+    }
   }
   
   // Side 4: Move up (completing the rectangle)
@@ -494,7 +1688,7 @@ void moveMouseRectangle() {
     int deltaY = targetY - currentY;
     
     if (deltaX != 0 || deltaY != 0) {
-      Mouse.move(deltaX, deltaY);
+      hidMove(deltaX, deltaY);
       
       // Update tracking
       totalDeltaX += deltaX;
@@ -509,25 +1703,27 @@ void moveMouseRectangle() {
       currentY = targetY;
     }
     
-    delay(stepDelay);
+    if (!patternWait(stepDelay)) {
+      return;
+    }
   }
   
   // Return to exact starting position if there's any drift
   if (totalDeltaX != 0 || totalDeltaY != 0) {
-    Mouse.move(-totalDeltaX, -totalDeltaY);
+    hidMove(-totalDeltaX, -totalDeltaY);
     totalDisplacementX -= totalDeltaX;
     totalDisplacementY -= totalDeltaY;
     DEBUGF("Rectangle compensation: (%d, %d)", -totalDeltaX, -totalDeltaY);
   }
 }
 
-void moveMouseTriangle() {
+void moveMouseTriangle(int size, int speed) {
   // Track total movement
   int totalDeltaX = 0;
   int totalDeltaY = 0;
   
   // Scale the movement size
-  int scaledSize = scaleMovementSize(movement_size);
+  int scaledSize = scaleMovementSize(size);
   
   // Triangle dimensions based on scaled movement size
   int side = scaledSize;
@@ -535,7 +1731,7 @@ void moveMouseTriangle() {
   
   // Calculate delay between steps to achieve the desired total movement time
   int stepsPerSide = TRIANGLE_STEPS / 3; // 3 sides
-  int stepDelay = movement_speed / TRIANGLE_STEPS;
+  int stepDelay = speed / TRIANGLE_STEPS;
   
   // Current position
   int currentX = 0;
@@ -554,7 +1750,7 @@ void moveMouseTriangle() {
     int deltaY = targetY - currentY;
     
     if (deltaX != 0 || deltaY != 0) {
-      Mouse.move(deltaX, deltaY);
+      hidMove(deltaX, deltaY);
       
       // Update tracking
       totalDeltaX += deltaX;
@@ -569,7 +1765,9 @@ void moveMouseTriangle() {
       currentY = targetY;
     }
     
-    delay(stepDelay);
+    if (!patternWait(stepDelay)) {
+      return;
+    }
   }
   
   // Side 2: Move left
@@ -583,7 +1781,7 @@ void moveMouseTriangle() {
     int deltaY = targetY - currentY;
     
     if (deltaX != 0 || deltaY != 0) {
-      Mouse.move(deltaX, deltaY);
+      hidMove(deltaX, deltaY);
       
       // Update tracking
       totalDeltaX += deltaX;
@@ -598,7 +1796,9 @@ void moveMouseTriangle() {
       currentY = targetY;
     }
     
-    delay(stepDelay);
+    if (!patternWait(stepDelay)) {
+      return;
+    }
   }
   
   // Side 3: Move up-right (back to start)
@@ -612,7 +1812,7 @@ void moveMouseTriangle() {
     int deltaY = targetY - currentY;
     
     if (deltaX != 0 || deltaY != 0) {
-      Mouse.move(deltaX, deltaY);
+      hidMove(deltaX, deltaY);
       
       // Update tracking
       totalDeltaX += deltaX;
@@ -627,25 +1827,27 @@ void moveMouseTriangle() {
       currentY = targetY;
     }
     
-    delay(stepDelay);
+    if (!patternWait(stepDelay)) {
+      return;
+    }
   }
   
   // Return to exact starting position if there's any drift
   if (totalDeltaX != 0 || totalDeltaY != 0) {
-    Mouse.move(-totalDeltaX, -totalDeltaY);
+    hidMove(-totalDeltaX, -totalDeltaY);
     totalDisplacementX -= totalDeltaX;
     totalDisplacementY -= totalDeltaY;
     DEBUGF("Triangle compensation: (%d, %d)", -totalDeltaX, -totalDeltaY);
   }
 }
 
-void moveMouseZigzag() {
+void moveMouseZigzag(int size, int speed) {
   // Track total movement
   int totalDeltaX = 0;
   int totalDeltaY = 0;
   
   // Scale the movement size
-  int scaledSize = scaleMovementSize(movement_size);
+  int scaledSize = scaleMovementSize(size);
   
   // Define zigzag dimensions
   int width = scaledSize / 2;
@@ -654,7 +1856,7 @@ void moveMouseZigzag() {
   
   // Calculate delay between steps to achieve the desired total movement time
   int stepsPerZig = ZIGZAG_STEPS / (zigCount * 2); // Each zig and zag
-  int stepDelay = movement_speed / ZIGZAG_STEPS;
+  int stepDelay = speed / ZIGZAG_STEPS;
   
   // Current position
   int currentX = 0;
@@ -673,7 +1875,7 @@ void moveMouseZigzag() {
       int deltaY = targetY - currentY;
       
       if (deltaX != 0 || deltaY != 0) {
-        Mouse.move(deltaX, deltaY);
+        hidMove(deltaX, deltaY);
         
         // Update tracking
         totalDeltaX += deltaX;
@@ -688,7 +1890,9 @@ void moveMouseZigzag() {
         currentY = targetY;
       }
       
-      delay(stepDelay);
+      if (!patternWait(stepDelay)) {
+        return;
+      }
     }
     
     // Zag - move diagonally up and right
@@ -702,7 +1906,7 @@ void moveMouseZigzag() {
       int deltaY = targetY - currentY;
       
       if (deltaX != 0 || deltaY != 0) {
-        Mouse.move(deltaX, deltaY);
+        hidMove(deltaX, deltaY);
         
         // Update tracking
         totalDeltaX += deltaX;
@@ -717,13 +1921,15 @@ void moveMouseZigzag() {
         currentY = targetY;
       }
       
-      delay(stepDelay);
+      if (!patternWait(stepDelay)) {
+        return;
+      }
     }
   }
   
   // Return to start position
   if (totalDeltaX != 0 || totalDeltaY != 0) {
-    Mouse.move(-totalDeltaX, -totalDeltaY);
+    hidMove(-totalDeltaX, -totalDeltaY);
     totalDisplacementX -= totalDeltaX;
     totalDisplacementY -= totalDeltaY;
     DEBUGF("Zigzag compensation: (%d, %d)", -totalDeltaX, -totalDeltaY);
@@ -732,7 +1938,7 @@ void moveMouseZigzag() {
 
 void initSPIFFS() {
   if (!SPIFFS.begin(true)) {
-    DEBUG("An error occurred while mounting SPIFFS");
+    LOG_ERROR("An error occurred while mounting SPIFFS");
     return;
   }
   DEBUG("SPIFFS mounted successfully");
@@ -744,41 +1950,60 @@ void loadConfig() {
   if (SPIFFS.exists(config_file)) {
     File file = SPIFFS.open(config_file, "r");
     if (file) {
-      StaticJsonDocument<512> doc;
+      StaticJsonDocument<2048> doc;
       DeserializationError error = deserializeJson(doc, file);
       
       if (!error) {
-        move_interval = doc["move_interval"] | move_interval;
+        motion_config.move_interval = doc["move_interval"] | motion_config.move_interval;
         
         // Handle movement pattern
         if (doc.containsKey("movement_pattern")) {
-          if (movement_pattern != NULL) free(movement_pattern);
-          movement_pattern = strdup(doc["movement_pattern"].as<const char*>());
+          strlcpy(motion_config.movement_pattern, doc["movement_pattern"] | "linear", PATTERN_NAME_LEN);
         } else {
           // Legacy compatibility - use circular_movement to determine pattern
           bool circular = doc["circular_movement"] | false;
-          if (movement_pattern != NULL) free(movement_pattern);
-          movement_pattern = strdup(circular ? "circular" : "linear");
+          strlcpy(motion_config.movement_pattern, circular ? "circular" : "linear", PATTERN_NAME_LEN);
         }
         
         // Handle movement size (new) or fall back to X/Y values
         if (doc.containsKey("movement_size")) {
-          movement_size = doc["movement_size"] | movement_size;
+          motion_config.movement_size = doc["movement_size"] | motion_config.movement_size;
         } else {
           // Legacy - use max of X and Y for size
           int movement_x = doc["movement_x"] | 5;
           int movement_y = doc["movement_y"] | 5;
-          movement_size = max(abs(movement_x), abs(movement_y));
+          motion_config.movement_size = max(abs(movement_x), abs(movement_y));
+        }
+        
+        motion_config.movement_speed = doc["movement_speed"] | motion_config.movement_speed;
+        motion_config.jiggler_enabled = doc["jiggler_enabled"] | motion_config.jiggler_enabled;
+        motion_config.random_delay = doc["random_delay"] | motion_config.random_delay;
+        motion_config.movement_trail = doc["movement_trail"] | motion_config.movement_trail;
+        long idle_resume = doc["input_idle_resume"] | (long)motion_config.input_idle_resume; // Stored in ms
+        motion_config.input_idle_resume = constrain(idle_resume, 0L, (long)max_input_idle_resume);
+        
+        // Profiles naming a pattern file that is gone fall back to linear when they run
+        motion_config.profile_count = 0;
+        for (JsonObjectConst item : doc["profiles"].as<JsonArrayConst>()) {
+          if (motion_config.profile_count < MAX_PROFILES &&
+              parseProfile(item, motion_config.profiles[motion_config.profile_count]) == NULL) {
+            motion_config.profile_count++;
+          }
         }
         
-        movement_speed = doc["movement_speed"] | movement_speed;
-        jiggler_enabled = doc["jiggler_enabled"] | jiggler_enabled;
-        random_delay = doc["random_delay"] | random_delay;
-        movement_trail = doc["movement_trail"] | movement_trail;
+        motion_config.schedule_enabled = doc["schedule_enabled"] | false;
+        motion_config.schedule_count = 0;
+        for (JsonObjectConst item : doc["schedule"].as<JsonArrayConst>()) {
+          if (motion_config.schedule_count < MAX_SCHEDULE_WINDOWS &&
+              parseScheduleWindow(item, motion_config.schedule[motion_config.schedule_count]) == NULL) {
+            motion_config.schedule_count++;
+          }
+        }
+        clock_utc_offset = doc["utc_offset"] | 0;
         
         DEBUG("Configuration loaded successfully");
       } else {
-        DEBUG("Failed to deserialize config");
+        LOG_WARN("Failed to deserialize config");
       }
       
       file.close();
@@ -790,33 +2015,47 @@ void loadConfig() {
 }
 
 void saveConfig() {
+  TRACE_SCOPE("flash:config");
   DEBUG("Saving configuration");
   
-  StaticJsonDocument<512> doc;
-  doc["move_interval"] = move_interval;
-  doc["movement_pattern"] = movement_pattern;
-  doc["movement_size"] = movement_size;
-  doc["movement_speed"] = movement_speed;
-  doc["jiggler_enabled"] = jiggler_enabled;
+  StaticJsonDocument<2048> doc;
+  doc["move_interval"] = motion_config.move_interval;
+  doc["movement_pattern"] = motion_config.movement_pattern;
+  doc["movement_size"] = motion_config.movement_size;
+  doc["movement_speed"] = motion_config.movement_speed;
+  doc["jiggler_enabled"] = motion_config.jiggler_enabled;
   
   // Legacy compatibility
-  doc["circular_movement"] = (strcmp(movement_pattern, "circular") == 0);
-  doc["movement_x"] = movement_size;
-  doc["movement_y"] = movement_size;
+  doc["circular_movement"] = (strcmp(motion_config.movement_pattern, "circular") == 0);
+  doc["movement_x"] = motion_config.movement_size;
+  doc["movement_y"] = motion_config.movement_size;
   
-  doc["random_delay"] = random_delay;
-  doc["movement_trail"] = movement_trail;
+  doc["random_delay"] = motion_config.random_delay;
+  doc["movement_trail"] = motion_config.movement_trail;
+  doc["input_idle_resume"] = motion_config.input_idle_resume;
+  
+  // Profiles use the API's units (seconds), unlike the fields above
+  JsonArray profiles = doc.createNestedArray("profiles");
+  for (int i = 0; i < motion_config.profile_count; i++) {
+    writeProfile(profiles.createNestedObject(), motion_config.profiles[i]);
+  }
+  doc["schedule_enabled"] = motion_config.schedule_enabled;
+  JsonArray schedule = doc.createNestedArray("schedule");
+  for (int i = 0; i < motion_config.schedule_count; i++) {
+    writeScheduleWindow(schedule.createNestedObject(), motion_config.schedule[i]);
+  }
+  doc["utc_offset"] = clock_utc_offset;
   
   File file = SPIFFS.open(config_file, "w");
   if (file) {
     if (serializeJson(doc, file) == 0) {
-      DEBUG("Failed to write config");
+      LOG_ERROR("Failed to write config");
     } else {
       DEBUG("Configuration saved successfully");
     }
     file.close();
   } else {
-    DEBUG("Failed to open config file for writing");
+    LOG_ERROR("Failed to open config file for writing");
   }
 }
 
@@ -833,73 +2072,63 @@ void loadSettings() {
         // Load AP settings
         if (doc.containsKey("ap")) {
           if (doc["ap"].containsKey("ssid")) {
-            // Free the old string if it exists
-            if (current_ssid != NULL) free(current_ssid);
-            current_ssid = strdup(doc["ap"]["ssid"].as<const char*>());
+            strlcpy(settings.ap_ssid, doc["ap"]["ssid"] | "", sizeof(settings.ap_ssid));
           }
           if (doc["ap"].containsKey("password")) {
-            if (current_password != NULL) free(current_password);
-            current_password = strdup(doc["ap"]["password"].as<const char*>());
+            strlcpy(settings.ap_password, doc["ap"]["password"] | "", sizeof(settings.ap_password));
           }
           if (doc["ap"].containsKey("hidden")) {
-            ap_hidden = doc["ap"]["hidden"].as<bool>();
+            settings.ap_hidden = doc["ap"]["hidden"].as<bool>();
           }
         }
         
         // Load hostname (now at root level)
         if (doc.containsKey("hostname")) {
-          if (current_hostname != NULL) free(current_hostname);
-          current_hostname = strdup(doc["hostname"].as<const char*>());
+          strlcpy(settings.hostname, doc["hostname"] | "", sizeof(settings.hostname));
         }
         
         // Load WiFi mode settings
         if (doc.containsKey("wifi_mode")) {
-          if (wifi_mode != NULL) free(wifi_mode);
-          wifi_mode = strdup(doc["wifi_mode"].as<const char*>());
+          settings.wifi_mode = parseWifiMode(doc["wifi_mode"].as<const char*>());
         }
         
         if (doc.containsKey("ap_availability")) {
-          if (ap_availability != NULL) free(ap_availability);
-          ap_availability = strdup(doc["ap_availability"].as<const char*>());
+          settings.ap_availability = parseApAvailability(doc["ap_availability"].as<const char*>());
         }
         
         if (doc.containsKey("ap_timeout")) {
-          ap_timeout = doc["ap_timeout"].as<int>();
+          settings.ap_timeout = doc["ap_timeout"].as<int>();
         }
         
         // Load STA settings
         if (doc.containsKey("sta")) {
           if (doc["sta"].containsKey("ssid")) {
-            if (sta_ssid != NULL) free(sta_ssid);
-            sta_ssid = strdup(doc["sta"]["ssid"].as<const char*>());
+            strlcpy(settings.sta_ssid, doc["sta"]["ssid"] | "", sizeof(settings.sta_ssid));
           }
           if (doc["sta"].containsKey("password")) {
-            if (sta_password != NULL) free(sta_password);
-            sta_password = strdup(doc["sta"]["password"].as<const char*>());
+            strlcpy(settings.sta_password, doc["sta"]["password"] | "", sizeof(settings.sta_password));
           }
         }
         
         // Load auth settings
         if (doc.containsKey("auth")) {
-          auth_enabled = doc["auth"].containsKey("enabled") ? doc["auth"]["enabled"].as<bool>() : true;
+          settings.auth_enabled = doc["auth"].containsKey("enabled") ? doc["auth"]["enabled"].as<bool>() : true;
           if (doc["auth"].containsKey("username")) {
-            if (current_username != NULL) free(current_username);
-            current_username = strdup(doc["auth"]["username"].as<const char*>());
+            strlcpy(settings.username, doc["auth"]["username"] | "", sizeof(settings.username));
           }
           if (doc["auth"].containsKey("password")) {
-            if (current_auth_password != NULL) free(current_auth_password);
-            current_auth_password = strdup(doc["auth"]["password"].as<const char*>());
+            strlcpy(settings.auth_password, doc["auth"]["password"] | "", sizeof(settings.auth_password));
           }
         }
         
         // Load web port
         if (doc.containsKey("web_port")) {
-          current_webport = doc["web_port"].as<int>();
+          settings.web_port = doc["web_port"].as<int>();
         }
         
         DEBUG("Settings loaded successfully");
       } else {
-        DEBUG("Failed to deserialize settings");
+        LOG_WARN("Failed to deserialize settings");
       }
       
       file.close();
@@ -910,49 +2139,64 @@ void loadSettings() {
   }
 }
 
+// Copy a string setting into its inline buffer. Returns NULL, or why the
+// value was refused: not a string, or too long for the buffer.
+const char* copySetting(char* dest, size_t size, JsonVariantConst value) {
+  if (!value.is<const char*>()) {
+    return "Value must be a string";
+  }
+  const char* text = value.as<const char*>();
+  if (strlen(text) >= size) {
+    return "Value too long";
+  }
+  strlcpy(dest, text, size);
+  return NULL;
+}
+
 void saveSettings() {
+  TRACE_SCOPE("flash:settings");
   DEBUG("Saving settings");
   
   StaticJsonDocument<512> doc;
   
   // AP settings
   JsonObject ap = doc.createNestedObject("ap");
-  ap["ssid"] = current_ssid;
-  ap["password"] = current_password;
-  ap["hidden"] = ap_hidden;
+  ap["ssid"] = settings.ap_ssid;
+  ap["password"] = settings.ap_password;
+  ap["hidden"] = settings.ap_hidden;
   
   // Hostname at root level
-  doc["hostname"] = current_hostname;
+  doc["hostname"] = settings.hostname;
   
   // WiFi mode settings
-  doc["wifi_mode"] = wifi_mode;
-  doc["ap_availability"] = ap_availability;
-  doc["ap_timeout"] = ap_timeout;
+  doc["wifi_mode"] = wifiModeName(settings.wifi_mode);
+  doc["ap_availability"] = apAvailabilityName(settings.ap_availability);
+  doc["ap_timeout"] = settings.ap_timeout;
   
   // STA settings
   JsonObject sta = doc.createNestedObject("sta");
-  sta["ssid"] = sta_ssid;
-  sta["password"] = sta_password;
+  sta["ssid"] = settings.sta_ssid;
+  sta["password"] = settings.sta_password;
   
   // Auth settings
   JsonObject auth = doc.createNestedObject("auth");
-  auth["enabled"] = auth_enabled;
-  auth["username"] = current_username;
-  auth["password"] = current_auth_password;
+  auth["enabled"] = settings.auth_enabled;
+  auth["username"] = settings.username;
+  auth["password"] = settings.auth_password;
   
   // Web port
-  doc["web_port"] = current_webport;
+  doc["web_port"] = settings.web_port;
   
   File file = SPIFFS.open(settings_file, "w");
   if (file) {
     if (serializeJson(doc, file) == 0) {
-      DEBUG("Failed to write settings");
+      LOG_ERROR("Failed to write settings");
     } else {
       DEBUG("Settings saved successfully");
     }
     file.close();
   } else {
-    DEBUG("Failed to open settings file for writing");
+    LOG_ERROR("Failed to open settings file for writing");
   }
 }
 
@@ -961,7 +2205,10 @@ void setupWiFi() {
   ap_start_time = millis(); // Record the time AP is started
   ap_active = true;
   
-  if (strcmp(wifi_mode, "apsta") == 0) {
+  // Connection state changes are handled in loop() from these events
+  WiFi.onEvent(onWiFiEvent);
+  
+  if (settings.wifi_mode == WIFI_SETTING_APSTA) {
     // AP+STA mode
     DEBUG("Setting up WiFi in AP+STA mode");
     
@@ -970,42 +2217,29 @@ void setupWiFi() {
     
     // Configure and start AP
     WiFi.softAPConfig(default_ip, default_ip, IPAddress(255, 255, 255, 0));
-    WiFi.softAP(current_ssid, current_password, 1, ap_hidden);
+    WiFi.softAP(settings.ap_ssid, settings.ap_password, 1, settings.ap_hidden);
     
     DEBUGF("AP IP address: %s", WiFi.softAPIP().toString().c_str());
     
     // Set hostname before connecting to WiFi
-    WiFi.setHostname(current_hostname);
+    WiFi.setHostname(settings.hostname);
     
-    // Try to connect to the preferred STA network
-    WiFi.begin(sta_ssid, sta_password);
+    // Reconnects are driven by our own backoff instead of the core's
+    WiFi.setAutoReconnect(false);
     
-    DEBUG("Connecting to WiFi network: ");
-    DEBUG(sta_ssid);
-    
-    // Wait for connection with timeout
-    unsigned long startAttemptTime = millis();
-    while (WiFi.status() != WL_CONNECTED && millis() - startAttemptTime < wifi_connect_timeout) {
-      delay(500);
-      DEBUG(".");
-    }
-    DEBUG("\n");
+    // Previous BSSID, channel and lease for a direct reconnect
+    loadWifiCache();
     
-    if (WiFi.status() == WL_CONNECTED) {
-      // Successfully connected to preferred network
-      DEBUGF("Connected to WiFi network. IP address: %s", WiFi.localIP().toString().c_str());
-      isAPMode = false;
-    } else {
-      DEBUG("Failed to connect to preferred network, but AP is still active.");
-      isAPMode = true;
-    }
+    // Start connecting in the background, the AP serves clients meanwhile
+    beginStaConnect(settings);
+    isAPMode = true;
   } else {
     // AP Only mode
     DEBUG("Setting up WiFi in AP Only mode");
     
     WiFi.mode(WIFI_AP);
     WiFi.softAPConfig(default_ip, default_ip, IPAddress(255, 255, 255, 0));
-    WiFi.softAP(current_ssid, current_password, 1, ap_hidden);
+    WiFi.softAP(settings.ap_ssid, settings.ap_password, 1, settings.ap_hidden);
     
     DEBUGF("AP IP address: %s", WiFi.softAPIP().toString().c_str());
     
@@ -1013,12 +2247,12 @@ void setupWiFi() {
   }
   
   // Setup mDNS
-  if (!MDNS.begin(current_hostname)) {
-    DEBUG("Error setting up mDNS responder!");
+  if (!MDNS.begin(settings.hostname)) {
+    LOG_ERROR("Error setting up mDNS responder!");
   } else {
     DEBUG("mDNS responder started");
-    MDNS.addService("http", "tcp", current_webport);
-    MDNS.addService("jiggla", "tcp", current_webport);
+    MDNS.addService("http", "tcp", settings.web_port);
+    MDNS.addService("jiggla", "tcp", settings.web_port);
   }
 }
 
@@ -1029,53 +2263,419 @@ void setupAccessPoint() {
   WiFi.softAPConfig(default_ip, default_ip, IPAddress(255, 255, 255, 0));
   
   // Use the hidden parameter if enabled
-  WiFi.softAP(current_ssid, current_password, 1, ap_hidden);
+  WiFi.softAP(settings.ap_ssid, settings.ap_password, 1, settings.ap_hidden);
   
   DEBUGF("AP IP address: %s", WiFi.softAPIP().toString().c_str());
   
-  if (!MDNS.begin(current_hostname)) {
-    DEBUG("Error setting up mDNS responder!");
+  if (!MDNS.begin(settings.hostname)) {
+    LOG_ERROR("Error setting up mDNS responder!");
   } else {
     DEBUG("mDNS responder started");
-    MDNS.addService("http", "tcp", current_webport);
-    MDNS.addService("jiggla", "tcp", current_webport);
+    MDNS.addService("http", "tcp", settings.web_port);
+    MDNS.addService("jiggla", "tcp", settings.web_port);
   }
   
   isAPMode = true;
 }
 
-String generateSessionId() {
-  const char charset[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
-  String sessionId = "";
-  
-  for (int i = 0; i < 32; i++) {
-    sessionId += charset[random(0, sizeof(charset) - 1)];
+// WiFi event callback, runs on the WiFi event task.
+// Only records what happened; the state machine itself runs in handleWiFi().
+void onWiFiEvent(WiFiEvent_t event, WiFiEventInfo_t info) {
+  switch (event) {
+    case ARDUINO_EVENT_WIFI_STA_GOT_IP:
+      traceInstant("wifi:got_ip");
+      postWifiEvent(WIFI_EVT_GOT_IP, 0);
+      break;
+    case ARDUINO_EVENT_WIFI_STA_DISCONNECTED:
+      traceInstant("wifi:disconnected");
+      postWifiEvent(WIFI_EVT_DISCONNECTED, info.wifi_sta_disconnected.reason);
+      break;
+    case ARDUINO_EVENT_WIFI_STA_LOST_IP:
+      traceInstant("wifi:lost_ip");
+      postWifiEvent(WIFI_EVT_DISCONNECTED, 0);
+      break;
+    default:
+      return;
   }
-  
-  return sessionId;
+  wakeScheduler();
 }
 
-bool validateSession(AsyncWebServerRequest *request) {
-  // If authentication is disabled, always return true
-  if (!auth_enabled) {
-    return true;
+// WiFi event task
+void postWifiEvent(WifiEventType type, uint8_t reason) {
+  portENTER_CRITICAL(&wifi_event_mux);
+  wifi_events[wifi_event_head] = { type, reason, millis() };
+  wifi_event_head = (wifi_event_head + 1) % WIFI_EVENT_QUEUE_SIZE;
+  if (wifi_event_count < WIFI_EVENT_QUEUE_SIZE) {
+    wifi_event_count++;
+  } else {
+    wifi_events_dropped++;
   }
-  
-  DEBUG("Validating session");
-  DEBUGF("Request URL: %s, Host: %s", request->url().c_str(), request->host().c_str());
-  
+  portEXIT_CRITICAL(&wifi_event_mux);
+}
+
+// loop(), oldest event first
+bool takeWifiEvent(WifiEvent& event) {
+  bool taken = false;
+  portENTER_CRITICAL(&wifi_event_mux);
+  if (wifi_event_count > 0) {
+    uint32_t tail = (wifi_event_head + WIFI_EVENT_QUEUE_SIZE - wifi_event_count) % WIFI_EVENT_QUEUE_SIZE;
+    event = wifi_events[tail];
+    wifi_event_count--;
+    taken = true;
+  }
+  portEXIT_CRITICAL(&wifi_event_mux);
+  return taken;
+}
+
+// Start a non-blocking connection attempt to the configured network.
+// Tries a direct association with the cached BSSID, channel and IP first;
+// falls back to a full scan with DHCP when there is no cache or it failed.
+void beginStaConnect(const Settings& current) {
+  wifi_manager.sta_state = STA_CONNECTING;
+  wifi_manager.attempt_start = millis();
+  wifi_manager.connect_attempts++;
+  wifi_manager.fast_attempt = wifi_cache_valid;
+  wifi_manager.renewing = false;
+  
+  if (wifi_manager.fast_attempt) {
+    DEBUGF("Fast connecting to WiFi network: %s (channel %d)", current.sta_ssid, wifi_cache.channel);
+    WiFi.config(IPAddress(wifi_cache.ip), IPAddress(wifi_cache.gateway), IPAddress(wifi_cache.subnet), IPAddress(wifi_cache.dns));
+    WiFi.begin(current.sta_ssid, current.sta_password, wifi_cache.channel, wifi_cache.bssid);
+  } else {
+    DEBUGF("Connecting to WiFi network: %s", current.sta_ssid);
+    // A zero address switches the station back to DHCP
+    WiFi.config(IPAddress((uint32_t)0), IPAddress((uint32_t)0), IPAddress((uint32_t)0));
+    WiFi.begin(current.sta_ssid, current.sta_password);
+  }
+}
+
+// Give up on the current attempt and retry later with exponential backoff
+void scheduleStaRetry() {
+  if (wifi_manager.fast_attempt) {
+    // Cached BSSID or lease is stale: drop it and do a full scan right away
+    LOG_WARN("Fast reconnect failed, falling back to full scan");
+    wifi_manager.fast_misses++;
+    wifi_manager.fast_attempt = false;
+    invalidateWifiCache();
+    wifi_manager.sta_state = STA_BACKOFF;
+    wifi_manager.retry_at = millis();
+    isAPMode = true;
+    return;
+  }
+  
+  wifi_manager.sta_state = STA_BACKOFF;
+  wifi_manager.retry_at = millis() + wifi_manager.backoff;
+  
+  DEBUGF("Retrying WiFi connection in %lu ms", wifi_manager.backoff);
+  
+  wifi_manager.backoff = min(wifi_manager.backoff * 2, wifi_backoff_max);
+  isAPMode = true;
+}
+
+// Advance the station state machine and handle the AP timeout
+void handleWiFi(SchedulerDeadline& next, const Settings& current) {
+  WifiEvent event;
+  while (takeWifiEvent(event)) {
+    if (event.type == WIFI_EVT_GOT_IP) {
+      handleStaGotIp(event.time, current);
+    } else {
+      handleStaDisconnected(event.reason);
+    }
+  }
+  
+  unsigned long now = next.now;
+  
+  unsigned long attempt_timeout = wifi_manager.fast_attempt ? wifi_fast_connect_timeout : wifi_connect_timeout;
+  if (wifi_manager.sta_state == STA_CONNECTING && now - wifi_manager.attempt_start >= attempt_timeout) {
+    DEBUG("WiFi connection attempt timed out");
+    // The disconnect posts a DISCONNECTED event of its own. Wait for it, so
+    // it is not taken for a failure of the next attempt.
+    wifi_manager.sta_state = STA_DISCONNECTING;
+    wifi_manager.retry_at = now + wifi_disconnect_timeout;
+    WiFi.disconnect();
+  }
+  
+  if (wifi_manager.sta_state == STA_DISCONNECTING && (long)(now - wifi_manager.retry_at) >= 0) {
+    DEBUG("No disconnect event after the timeout, retrying anyway");
+    scheduleStaRetry();
+  }
+  
+  if (wifi_manager.sta_state == STA_BACKOFF && (long)(now - wifi_manager.retry_at) >= 0) {
+    wifi_manager.retries++;
+    beginStaConnect(current);
+  }
+  
+  // Nothing renews the cached lease a fast connection runs on. Once it may
+  // have run out, hand the address back to DHCP; the association stays up.
+  if (wifi_manager.sta_state == STA_CONNECTED && wifi_manager.fast_attempt && (long)(now - wifi_manager.renew_at) >= 0) {
+    LOG_INFO("Cached address in use for %lu min, renewing it with DHCP", wifi_cached_lease_ms / 60000);
+    wifi_manager.fast_attempt = false;
+    wifi_manager.renewing = true;
+    wifi_manager.renew_at = now + wifi_connect_timeout;
+    WiFi.config(IPAddress((uint32_t)0), IPAddress((uint32_t)0), IPAddress((uint32_t)0));
+  }
+  
+  if (wifi_manager.sta_state == STA_CONNECTED && wifi_manager.renewing && (long)(now - wifi_manager.renew_at) >= 0) {
+    LOG_WARN("No DHCP address after renewing, reconnecting with a full scan");
+    wifi_manager.renewing = false;
+    invalidateWifiCache();
+    wifi_manager.sta_state = STA_DISCONNECTING;
+    wifi_manager.retry_at = now + wifi_disconnect_timeout;
+    WiFi.disconnect();
+  }
+  
+  // Handle AP timeout if configured
+  if (current.ap_availability == AP_TIMEOUT && ap_active && now - ap_start_time >= (unsigned long)current.ap_timeout * 60000) {
+    if (current.wifi_mode == WIFI_SETTING_APSTA) {
+      // In AP+STA mode, only turn off the AP part, keep STA running
+      LOG_INFO("AP timeout reached, turning off AP but keeping station mode");
+      WiFi.mode(WIFI_STA);
+      ap_active = false;
+      DEBUG("AP turned off, device will continue in station mode");
+    } else {
+      // In AP-only mode, turn off WiFi completely
+      LOG_INFO("AP timeout reached, turning off WiFi completely");
+      WiFi.mode(WIFI_OFF);
+      ap_active = false;
+      DEBUG("WiFi turned off, device will continue as USB mouse jiggler only");
+    }
+  }
+  
+  if (wifi_manager.sta_state == STA_CONNECTING) {
+    scheduleAt(next, wifi_manager.attempt_start + attempt_timeout);
+  } else if (wifi_manager.sta_state == STA_BACKOFF || wifi_manager.sta_state == STA_DISCONNECTING) {
+    scheduleAt(next, wifi_manager.retry_at);
+  } else if (wifi_manager.sta_state == STA_CONNECTED && (wifi_manager.fast_attempt || wifi_manager.renewing)) {
+    scheduleAt(next, wifi_manager.renew_at);
+  }
+  if (current.ap_availability == AP_TIMEOUT && ap_active) {
+    scheduleAt(next, ap_start_time + (unsigned long)current.ap_timeout * 60000);
+  }
+}
+
+// An IP means the association succeeded
+void handleStaGotIp(unsigned long got_ip_time, const Settings& current) {
+  if (wifi_manager.renewing) {
+    // DHCP took over from the cached address on the same association
+    wifi_manager.renewing = false;
+    saveWifiCache(current);
+    LOG_INFO("DHCP address: %s", WiFi.localIP().toString().c_str());
+    return;
+  }
+  
+  wifi_manager.sta_state = STA_CONNECTED;
+  wifi_manager.connected_since = got_ip_time;
+  wifi_manager.last_assoc_ms = got_ip_time - wifi_manager.attempt_start;
+  wifi_manager.total_assoc_ms += wifi_manager.last_assoc_ms;
+  wifi_manager.associations++;
+  wifi_manager.backoff = wifi_backoff_min;
+  isAPMode = false;
+  startClockSync();
+  
+  if (wifi_manager.fast_attempt) {
+    wifi_manager.fast_hits++;
+    wifi_manager.renew_at = got_ip_time + wifi_cached_lease_ms;
+  } else {
+    saveWifiCache(current);
+  }
+  
+  if (wifi_manager.boot_reachable_ms == 0) {
+    wifi_manager.boot_reachable_ms = got_ip_time;
+    recordBootReachable(got_ip_time, wifi_manager.fast_attempt);
+  }
+  
+  LOG_INFO("Connected to WiFi network. IP address: %s", WiFi.localIP().toString().c_str());
+}
+
+void handleStaDisconnected(uint8_t reason) {
+  wifi_manager.last_disconnect_reason = reason;
+  
+  if (wifi_manager.sta_state == STA_CONNECTED) {
+    DEBUGF("WiFi connection lost (reason %d)", reason);
+    wifi_manager.disconnects++;
+    // A dropped link says nothing about the cache, keep it for the retry
+    wifi_manager.fast_attempt = false;
+    wifi_manager.renewing = false;
+    scheduleStaRetry();
+  } else if (wifi_manager.sta_state == STA_CONNECTING) {
+    LOG_WARN("WiFi connection attempt failed (reason %d)", reason);
+    scheduleStaRetry();
+  } else if (wifi_manager.sta_state == STA_DISCONNECTING) {
+    // Our own disconnect after a timeout has gone through
+    scheduleStaRetry();
+  }
+}
+
+// Simple FNV-1a hash, used to tie the cache to the configured SSID
+uint32_t hashString(const char* str) {
+  uint32_t hash = 2166136261u;
+  while (*str) {
+    hash = (hash ^ (uint8_t)*str++) * 16777619u;
+  }
+  return hash;
+}
+
+uint32_t wifiCacheChecksum(const WifiFastCache& cache) {
+  const uint8_t* bytes = (const uint8_t*)&cache;
+  uint32_t sum = 0;
+  for (size_t i = 0; i < offsetof(WifiFastCache, checksum); i++) {
+    sum = (sum << 1 | sum >> 31) ^ bytes[i];
+  }
+  return sum;
+}
+
+bool wifiCacheUsable(const WifiFastCache& cache) {
+  return cache.magic == WIFI_CACHE_MAGIC &&
+         cache.checksum == wifiCacheChecksum(cache) &&
+         cache.ssid_hash == hashString(settings.sta_ssid) &&
+         cache.channel > 0 && cache.ip != 0;
+}
+
+// Load the reconnect cache: RTC memory after a soft reset, NVS after a cold boot
+void loadWifiCache() {
+  wifi_prefs.begin("wifi", false);
+  wifi_last_full_boot_ms = wifi_prefs.getUInt("full_boot_ms", 0);
+  wifi_last_fast_boot_ms = wifi_prefs.getUInt("fast_boot_ms", 0);
+  
+  if (wifiCacheUsable(wifi_rtc_cache)) {
+    wifi_cache = wifi_rtc_cache;
+    wifi_cache_valid = true;
+    DEBUG("WiFi cache loaded from RTC memory");
+  } else if (wifi_prefs.getBytes("cache", &wifi_cache, sizeof(wifi_cache)) == sizeof(wifi_cache) &&
+             wifiCacheUsable(wifi_cache)) {
+    wifi_rtc_cache = wifi_cache;
+    wifi_cache_valid = true;
+    DEBUG("WiFi cache loaded from NVS");
+  } else {
+    wifi_cache_valid = false;
+    DEBUG("No usable WiFi cache");
+  }
+}
+
+// Remember the current association; NVS is only written when it changed
+void saveWifiCache(const Settings& current) {
+  TRACE_SCOPE("nvs:wifi_cache");
+  WifiFastCache cache;
+  memset(&cache, 0, sizeof(cache));
+  cache.magic = WIFI_CACHE_MAGIC;
+  cache.ssid_hash = hashString(current.sta_ssid);
+  
+  uint8_t* bssid = WiFi.BSSID();
+  if (bssid == NULL) {
+    return;
+  }
+  memcpy(cache.bssid, bssid, sizeof(cache.bssid));
+  cache.channel = WiFi.channel();
+  cache.ip = WiFi.localIP();
+  cache.gateway = WiFi.gatewayIP();
+  cache.subnet = WiFi.subnetMask();
+  cache.dns = WiFi.dnsIP();
+  cache.checksum = wifiCacheChecksum(cache);
+  
+  wifi_rtc_cache = cache;
+  if (!wifi_cache_valid || memcmp(&cache, &wifi_cache, sizeof(cache)) != 0) {
+    wifi_prefs.putBytes("cache", &cache, sizeof(cache));
+    DEBUG("WiFi cache saved");
+  }
+  wifi_cache = cache;
+  wifi_cache_valid = true;
+}
+
+void invalidateWifiCache() {
+  wifi_cache_valid = false;
+  wifi_rtc_cache.magic = 0;
+  wifi_prefs.remove("cache");
+}
+
+// Persist how long this boot took to become reachable, per connect path
+void recordBootReachable(uint32_t elapsed, bool fast) {
+  if (fast) {
+    wifi_last_fast_boot_ms = elapsed;
+    wifi_prefs.putUInt("fast_boot_ms", elapsed);
+  } else {
+    wifi_last_full_boot_ms = elapsed;
+    wifi_prefs.putUInt("full_boot_ms", elapsed);
+  }
+  DEBUGF("Reachable %lu ms after boot (%s connect)", (unsigned long)elapsed, fast ? "fast" : "full");
+}
+
+const char* resetReasonName(esp_reset_reason_t reason) {
+  switch (reason) {
+    case ESP_RST_POWERON: return "power_on";
+    case ESP_RST_EXT: return "external";
+    case ESP_RST_SW: return "software";
+    case ESP_RST_PANIC: return "panic";
+    case ESP_RST_INT_WDT:
+    case ESP_RST_TASK_WDT:
+    case ESP_RST_WDT: return "watchdog";
+    case ESP_RST_DEEPSLEEP: return "deep_sleep";
+    case ESP_RST_BROWNOUT: return "brownout";
+    default: return "unknown";
+  }
+}
+
+const char* wifiModeName(WifiModeSetting mode) {
+  return mode == WIFI_SETTING_APSTA ? "apsta" : "ap";
+}
+
+WifiModeSetting parseWifiMode(const char* name) {
+  return (name != NULL && strcmp(name, "apsta") == 0) ? WIFI_SETTING_APSTA : WIFI_SETTING_AP;
+}
+
+const char* apAvailabilityName(ApAvailability availability) {
+  return availability == AP_TIMEOUT ? "timeout" : "always";
+}
+
+ApAvailability parseApAvailability(const char* name) {
+  return (name != NULL && strcmp(name, "timeout") == 0) ? AP_TIMEOUT : AP_ALWAYS;
+}
+
+const char* staStateName(StaState state) {
+  switch (state) {
+    case STA_CONNECTING: return "connecting";
+    case STA_CONNECTED: return "connected";
+    case STA_BACKOFF: return "backoff";
+    case STA_DISCONNECTING: return "disconnecting";
+    default: return "idle";
+  }
+}
+
+String generateSessionId() {
+  const char charset[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
+  String sessionId = "";
+  
+  for (int i = 0; i < 32; i++) {
+    sessionId += charset[random(0, sizeof(charset) - 1)];
+  }
+  
+  return sessionId;
+}
+
+bool validateSession(AsyncWebServerRequest *request) {
+  // Every API call passes through here, which makes it our activity signal
+  noteActivity(false);
+  
+  // If authentication is disabled, always return true
+  if (!settings.auth_enabled) {
+    return true;
+  }
+  
+  DEBUG("Validating session");
+  DEBUGF("Request URL: %s, Host: %s", request->url().c_str(), request->host().c_str());
+  
   // Check if we're being accessed on a port other than the configured one
   String hostWithPort = request->host();
   int colonPos = hostWithPort.indexOf(':');
   if (colonPos != -1) {
     String portStr = hostWithPort.substring(colonPos + 1);
     int port = portStr.toInt();
-    DEBUGF("Request port: %d, Configured port: %d", port, current_webport);
+    DEBUGF("Request port: %d, Configured port: %d", port, settings.web_port);
     
     // If the port doesn't match our configured port, we might need to save it
-    if (port != current_webport && port > 0) {
+    if (port != settings.web_port && port > 0) {
       DEBUGF("Detected access on non-standard port %d, updating config", port);
-      current_webport = port;
+      settings.web_port = port;
+      publishSettings();
       saveSettings();
     }
   }
@@ -1084,48 +2684,37 @@ bool validateSession(AsyncWebServerRequest *request) {
     String cookie = request->header("Cookie");
     DEBUGF("Cookie header: %s", cookie.c_str());
     
-    int sessionIndex = cookie.indexOf("session=");
+    String sessionId = sessionIdFromCookie(cookie);
     
-    if (sessionIndex != -1) {
-      sessionIndex += 8; // Move past "session="
-      int endIndex = cookie.indexOf(";", sessionIndex);
-      String sessionId;
-      
-      if (endIndex == -1) {
-        sessionId = cookie.substring(sessionIndex);
-      } else {
-        sessionId = cookie.substring(sessionIndex, endIndex);
-      }
-      
+    if (sessionId.length() > 0) {
       DEBUGF("Found session ID: %s", sessionId.c_str());
       
       // Find session
-      for (int i = 0; i < MAX_SESSIONS; i++) {
-        if (sessions[i].active && sessions[i].id == sessionId) {
-          // Check if session is expired
-          // Handle millis() overflow by using subtraction which works correctly even across overflow
-          if ((long)(sessions[i].expiry - millis()) > 0) {
-            // Update expiry time
-            sessions[i].expiry = millis() + session_timeout;
-            
-            // Save session changes periodically (only every 5 minutes to reduce flash wear)
-            static unsigned long last_save = 0;
-            if (millis() - last_save > 5 * 60 * 1000) {
-              saveSessions();
-              last_save = millis();
-            }
-            
-            DEBUGF("Session validated: id=%s, expiry=%lu, current=%lu", 
-                         sessionId.c_str(), sessions[i].expiry, millis());
-            return true;
-          } else {
-            // Session expired
-            DEBUGF("Session expired: id=%s, expiry=%lu, current=%lu", 
-                         sessionId.c_str(), sessions[i].expiry, millis());
-            sessions[i].active = false;
-            saveSessions(); // Save the change
-            return false;
+      int i = findSession(sessionId);
+      if (i >= 0) {
+        // Check if session is expired
+        // Handle millis() overflow by using subtraction which works correctly even across overflow
+        if ((long)(sessions[i].expiry - millis()) > 0) {
+          // Update expiry time
+          sessions[i].expiry = millis() + session_timeout;
+          
+          // Save session changes periodically (only every 5 minutes to reduce flash wear)
+          static unsigned long last_save = 0;
+          if (millis() - last_save > 5 * 60 * 1000) {
+            saveSessions();
+            last_save = millis();
           }
+          
+          DEBUGF("Session validated: id=%s, expiry=%lu, current=%lu", 
+                       sessionId.c_str(), sessions[i].expiry, millis());
+          return true;
+        } else {
+          // Session expired
+          DEBUGF("Session expired: id=%s, expiry=%lu, current=%lu", 
+                       sessionId.c_str(), sessions[i].expiry, millis());
+          sessions[i].active = false;
+          saveSessions(); // Save the change
+          return false;
         }
       }
     }
@@ -1134,6 +2723,27 @@ bool validateSession(AsyncWebServerRequest *request) {
   return false;
 }
 
+// Value of the session cookie, empty when the header has none
+String sessionIdFromCookie(const String& cookie) {
+  int sessionIndex = cookie.indexOf("session=");
+  if (sessionIndex == -1) {
+    return String();
+  }
+  sessionIndex += 8; // Move past "session="
+  int endIndex = cookie.indexOf(";", sessionIndex);
+  return endIndex == -1 ? cookie.substring(sessionIndex) : cookie.substring(sessionIndex, endIndex);
+}
+
+// Index of the active session with this ID, -1 if there is none
+int findSession(const String& sessionId) {
+  for (int i = 0; i < MAX_SESSIONS; i++) {
+    if (sessions[i].active && sessions[i].id == sessionId) {
+      return i;
+    }
+  }
+  return -1;
+}
+
 void cleanupExpiredSessions() {
   unsigned long now = millis();
   
@@ -1144,172 +2754,632 @@ void cleanupExpiredSessions() {
   }
 }
 
-void setupWebServer() {
-  DEBUG("Setting up web server");
-  
-  // Serve login.js with proper headers
-  server->on("/login.js", HTTP_GET, [](AsyncWebServerRequest *request) {
-    DEBUG("Serving login.js directly");
-    AsyncWebServerResponse *response = request->beginResponse(SPIFFS, "/login.js", "application/javascript");
-    response->addHeader("Cache-Control", "no-store, no-cache, must-revalidate, max-age=0");
-    response->addHeader("Pragma", "no-cache");
-    response->addHeader("Expires", "-1");
-    request->send(response);
-  });
-
-  // Serve main.js with proper headers
-  server->on("/main.js", HTTP_GET, [](AsyncWebServerRequest *request) {
-    DEBUG("Serving main.js directly");
-    AsyncWebServerResponse *response = request->beginResponse(SPIFFS, "/main.js", "application/javascript");
-    response->addHeader("Cache-Control", "no-store, no-cache, must-revalidate, max-age=0");
-    response->addHeader("Pragma", "no-cache");
-    response->addHeader("Expires", "-1");
-    request->send(response);
-  });
-
-  // Serve settings-admin.js with proper headers
-  server->on("/settings-admin.js", HTTP_GET, [](AsyncWebServerRequest *request) {
-    DEBUG("Serving settings-admin.js directly");
-    AsyncWebServerResponse *response = request->beginResponse(SPIFFS, "/settings-admin.js", "application/javascript");
-    response->addHeader("Cache-Control", "no-store, no-cache, must-revalidate, max-age=0");
-    response->addHeader("Pragma", "no-cache");
-    response->addHeader("Expires", "-1");
-    request->send(response);
-  });
+const char* const log_level_names[] = { "none", "error", "warn", "info", "debug", "verbose" };
 
-  // Route to serve static files with cache control
-  class CaptiveRequestHandler : public AsyncWebHandler {
-  public:
-    CaptiveRequestHandler() {}
-    virtual ~CaptiveRequestHandler() {}
+const char* logLevelName(uint8_t level) {
+  return level <= LOG_LEVEL_VERBOSE ? log_level_names[level] : "unknown";
+}
 
-    bool canHandle(AsyncWebServerRequest *request) {
-      return true;
+int parseLogLevel(const char* name) {
+  for (int i = LOG_LEVEL_NONE; i <= LOG_LEVEL_VERBOSE; i++) {
+    if (name != NULL && strcmp(name, log_level_names[i]) == 0) {
+      return i;
     }
+  }
+  return -1;
+}
 
-    void handleRequest(AsyncWebServerRequest *request) {
-      // First check if resource exists
-      String path = request->url();
-      if (path.endsWith("/")) {
-        path += "index.html";
-      }
-
-      // Remove query parameters
-      if (path.indexOf("?") >= 0) {
-        path = path.substring(0, path.indexOf("?"));
-      }
-
-      DEBUG("Handling request for: " + path);
-
-      // Special handling for login.js
-      if (path == "/login.js") {
-        DEBUG("Handling login.js request specifically");
-        if (SPIFFS.exists(path)) {
-          DEBUG("login.js exists in SPIFFS");
-          AsyncWebServerResponse *response = request->beginResponse(SPIFFS, path, "application/javascript");
-          response->addHeader("Cache-Control", "no-store, no-cache, must-revalidate, max-age=0");
-          response->addHeader("Pragma", "no-cache");
-          response->addHeader("Expires", "-1");
-          request->send(response);
-          DEBUG("login.js sent with application/javascript content type");
-          return;
-        } else {
-          DEBUG("login.js not found in SPIFFS!");
-          request->send(404, "text/plain", "Not Found");
-          return;
-        }
-      }
-
-      // Check if file exists in SPIFFS
-      if (SPIFFS.exists(path)) {
-        DEBUG("File exists in SPIFFS");
-        // Get content type based on file extension
-        String contentType = "text/plain";
-        if (path.endsWith(".html")) contentType = "text/html";
-        else if (path.endsWith(".css")) contentType = "text/css";
-        else if (path.endsWith(".js")) contentType = "application/javascript";
-        else if (path.endsWith(".json")) contentType = "application/json";
-        else if (path.endsWith(".png")) contentType = "image/png";
-        else if (path.endsWith(".jpg")) contentType = "image/jpeg";
-        else if (path.endsWith(".ico")) contentType = "image/x-icon";
-        
-        DEBUG("Content type: " + contentType);
-        
-        // Serve the file with no-cache headers
-        AsyncWebServerResponse *response = request->beginResponse(SPIFFS, path, contentType);
-        
-        // Add no-cache headers to all responses
-        response->addHeader("Cache-Control", "no-store, no-cache, must-revalidate, max-age=0");
-        response->addHeader("Pragma", "no-cache");
-        response->addHeader("Expires", "-1");
-        
-        request->send(response);
-        DEBUG("File sent with no-cache headers");
-      } else {
-        DEBUG("File not found in SPIFFS: " + path);
-        if (validateSession(request)) {
-          // Not found, but authenticated
-          request->send(404, "text/plain", "Not Found");
-        } else {
-          // Not found, not authenticated - redirect to login
-          request->redirect("/login");
-        }
-      }
+// Copy record `index` out of the ring. PENDING while it is not published
+// yet, GONE once a newer record has taken its slot. A copy the writer raced
+// with is never returned; the slot is read again.
+LogReadResult readLogRecord(uint32_t index, LogRecord& record) {
+  LogSlot& slot = log_ring[index % LOG_RING_SIZE];
+  while (true) {
+    uint32_t sequence = slot.sequence.load(std::memory_order_acquire);
+    if (sequence != index + 1) {
+      return sequence == 0 || (int32_t)(sequence - (index + 1)) < 0 ? LOG_READ_PENDING : LOG_READ_GONE;
     }
-  };
+    record = slot.record;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (slot.sequence.load(std::memory_order_relaxed) == sequence) {
+      return LOG_READ_OK;
+    }
+  }
+}
 
-  // Register the captive request handler
-  server->addHandler(new CaptiveRequestHandler());
-  
-  // Redirect all requests to login page if not authenticated
-  server->onNotFound([](AsyncWebServerRequest *request) {
-    DEBUGF("Unhandled request for URL: %s", request->url().c_str());
-    
-    if (!validateSession(request)) {
-      request->redirect("/login");
-    } else {
-      request->send(404, "text/plain", "Not Found");
+// Render a record as "[seconds.millis] L message", applying the captured
+// arguments to the format one conversion at a time
+size_t formatLogRecord(const LogRecord& record, char* out, size_t size) {
+  static const char level_letters[] = "-EWIDV";
+  size_t used = snprintf(out, size, "[%lu.%03lu] %c ", (unsigned long)(record.timestamp_ms / 1000),
+                         (unsigned long)(record.timestamp_ms % 1000), level_letters[min((int)record.level, 5)]);
+  int arg = 0;
+  const char* p = record.format;
+  while (*p != '\0' && used + 1 < size) {
+    if (*p != '%') {
+      out[used++] = *p++;
+      continue;
+    }
+    if (p[1] == '%') {
+      out[used++] = '%';
+      p += 2;
+      continue;
     }
-  });
-  
-  // Serve main page (only if authenticated)
-  server->on("/", HTTP_GET, [](AsyncWebServerRequest *request) {
-    DEBUG("Received request for main page");
     
-    if (!validateSession(request)) {
-      request->redirect("/login");
-      return;
+    // Collect one conversion: flags, width, precision, length, type
+    char spec[16];
+    size_t length = 0;
+    spec[length++] = *p++;
+    while (*p != '\0' && strchr("-+ #0123456789.hlzjt", *p) != NULL && length < sizeof(spec) - 2) {
+      spec[length++] = *p++;
     }
+    if (*p == '\0') {
+      break;
+    }
+    char type = *p++;
+    spec[length++] = type;
+    spec[length] = '\0';
+    bool wide = strstr(spec, "ll") != NULL;
     
-    DEBUG("Auth successful, serving index.html");
-    AsyncWebServerResponse *response = request->beginResponse(SPIFFS, "/index.html", "text/html");
-    response->addHeader("Cache-Control", "no-store, no-cache, must-revalidate, max-age=0");
-    response->addHeader("Pragma", "no-cache");
-    response->addHeader("Expires", "-1");
-    request->send(response);
-  });
-  
-  // Serve login page
-  server->on("/login", HTTP_GET, [](AsyncWebServerRequest *request) {
-    if (validateSession(request)) {
-      request->redirect("/");
+    if (arg >= record.arg_count || (wide && arg + 1 >= record.arg_count)) {
+      used += snprintf(out + used, size - used, "%s", spec); // Missing argument, show the conversion
+      continue;
+    }
+    uint32_t value = record.args[arg++];
+    bool is_long = strchr(spec, 'l') != NULL;
+    int written = 0;
+    if (type == 's') {
+      const char* text = value < LOG_TEXT_SIZE ? record.text + value : "...";
+      written = snprintf(out + used, size - used, spec, text);
+    } else if (strchr("fFeEgG", type) != NULL) {
+      float number;
+      memcpy(&number, &value, sizeof(number));
+      written = snprintf(out + used, size - used, spec, (double)number);
+    } else if (wide) {
+      uint64_t number = value | ((uint64_t)record.args[arg++] << 32);
+      written = snprintf(out + used, size - used, spec, number);
+    } else if (type == 'c') {
+      written = snprintf(out + used, size - used, spec, (int)value);
+    } else if (strchr("di", type) != NULL) {
+      written = is_long ? snprintf(out + used, size - used, spec, (long)(int32_t)value)
+                        : snprintf(out + used, size - used, spec, (int)value);
     } else {
-      DEBUG("Serving login.html from SPIFFS with no-cache headers");
-      AsyncWebServerResponse *response = request->beginResponse(SPIFFS, "/login.html", "text/html");
-      response->addHeader("Cache-Control", "no-store, no-cache, must-revalidate, max-age=0");
-      response->addHeader("Pragma", "no-cache");
-      response->addHeader("Expires", "-1");
-      request->send(response);
+      written = is_long ? snprintf(out + used, size - used, spec, (unsigned long)value)
+                        : snprintf(out + used, size - used, spec, (unsigned int)value);
     }
-  });
+    used += max(written, 0);
+  }
+  used = min(used, size - 1);
+  out[used] = '\0';
+  return used;
+}
+
+// Chunked response filler for /api/logs: append whole events for the records
+// published since the last call. A record still being written ends the
+// batch and is picked up on the next ack or poll.
+size_t fillLogStream(LogStreamCursor& cursor, uint8_t *buffer, size_t maxLen) {
+  size_t written = 0;
+  if (!cursor.opened) {
+    // Something to send right away, so the headers go out on a quiet ring
+    written = snprintf((char*)buffer, maxLen, "retry: 2000\n\n");
+    if (written >= maxLen) {
+      return RESPONSE_TRY_AGAIN;
+    }
+    cursor.opened = true;
+  }
   
-  // Block direct access to login.html
-  server->on("/login.html", HTTP_GET, [](AsyncWebServerRequest *request) {
-    request->redirect("/login");
+  uint32_t head = log_head.load();
+  if (head - cursor.next > LOG_RING_SIZE) {
+    cursor.next = head - LOG_RING_SIZE; // Skip what the ring has already overwritten
+  }
+  char line[160];
+  char event[224];
+  for (; cursor.next != head; cursor.next++) {
+    LogRecord record;
+    LogReadResult result = readLogRecord(cursor.next, record);
+    if (result == LOG_READ_PENDING) {
+      break;
+    }
+    if (result == LOG_READ_GONE) {
+      continue;
+    }
+    formatLogRecord(record, line, sizeof(line));
+    for (char* p = line; *p != '\0'; p++) {
+      if (*p == '\n' || *p == '\r') {
+        *p = ' '; // One data line per event
+      }
+    }
+    size_t length = snprintf(event, sizeof(event), "id: %lu\nevent: %s\ndata: %s\n\n",
+                             (unsigned long)(cursor.next + 1), logLevelName(record.level), line);
+    length = min(length, sizeof(event) - 1);
+    if (written + length > maxLen) {
+      break;
+    }
+    memcpy(buffer + written, event, length);
+    written += length;
+  }
+  return written > 0 ? written : RESPONSE_TRY_AGAIN;
+}
+
+// Count a value into its power-of-two bucket
+void recordHistogram(Histogram& histogram, uint32_t value) {
+  int bucket = 0;
+  if (value > (1UL << histogram.shift)) {
+    bucket = min(32 - __builtin_clz(value - 1) - histogram.shift, HISTOGRAM_BUCKETS);
+  }
+  histogram.buckets[bucket]++;
+  histogram.count++;
+  histogram.sum += value;
+}
+
+// Upper bound of the bucket holding the given rank
+uint32_t histogramPercentile(const Histogram& histogram, uint32_t permille) {
+  if (histogram.count == 0) {
+    return 0;
+  }
+  uint32_t rank = max((uint32_t)1, (uint32_t)(((uint64_t)histogram.count * permille + 999) / 1000));
+  uint32_t seen = 0;
+  for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+    seen += histogram.buckets[i];
+    if (seen >= rank) {
+      return 1UL << (histogram.shift + i);
+    }
+  }
+  return 1UL << (histogram.shift + HISTOGRAM_BUCKETS); // Overflow bucket, reported as its floor
+}
+
+RouteMetrics* addRouteMetrics(const char* path, const char* method) {
+  if (route_count >= MAX_ROUTES) {
+    DEBUGF("No metrics slot left for %s", path);
+    return NULL;
+  }
+  RouteMetrics& route = route_metrics[route_count++];
+  route.path = path;
+  route.method = method;
+  route.handler_us.shift = 4;
+  route.response_bytes.shift = 6;
+  return &route;
+}
+
+// Bracket a handler call; the send helpers fill in the response in between.
+// Calls that send nothing (e.g. body chunks before the last) are not counted.
+void beginRouteSample(RouteMetrics* route) {
+  if (route != NULL) {
+    traceBegin(route->path);
+  }
+  route_sample.route = route;
+  route_sample.code = 0;
+  route_sample.bytes = 0;
+  route_sample.start_us = esp_timer_get_time();
+}
+
+void endRouteSample() {
+  RouteMetrics* route = route_sample.route;
+  route_sample.route = NULL;
+  if (route != NULL) {
+    traceEnd(route->path);
+  }
+  if (route == NULL || route_sample.code == 0) {
+    return;
+  }
+  route->requests++;
+  if (route_sample.code >= 400) {
+    route->errors++;
+  }
+  recordHistogram(route->handler_us, (uint32_t)(esp_timer_get_time() - route_sample.start_us));
+  if (route_sample.bytes != RESPONSE_SIZE_UNKNOWN) {
+    recordHistogram(route->response_bytes, route_sample.bytes);
+  }
+}
+
+void recordResponse(int code, size_t bytes) {
+  route_sample.code = code;
+  route_sample.bytes = bytes;
+}
+
+// Register a route with the web server, timing every handler call
+void onRoute(const char* uri, WebRequestMethodComposite method, ArRequestHandlerFunction onRequest,
+             ArUploadHandlerFunction onUpload, ArBodyHandlerFunction onBody) {
+  const char* method_name = method == HTTP_GET ? "GET" : method == HTTP_POST ? "POST" : "ANY";
+  RouteMetrics* route = addRouteMetrics(uri, method_name);
+  
+  ArUploadHandlerFunction upload = NULL;
+  if (onUpload) {
+    upload = [route, onUpload](AsyncWebServerRequest *request, const String& filename, size_t index, uint8_t *data, size_t len, bool final) {
+      beginRouteSample(route);
+      onUpload(request, filename, index, data, len, final);
+      endRouteSample();
+    };
+  }
+  
+  ArBodyHandlerFunction body = NULL;
+  if (onBody) {
+    body = [route, onBody](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
+      beginRouteSample(route);
+      onBody(request, data, len, index, total);
+      endRouteSample();
+    };
+  }
+  
+  server->on(uri, method, [route, onRequest](AsyncWebServerRequest *request) {
+    beginRouteSample(route);
+    finishMacroSave();
+    onRequest(request);
+    releaseBody(request);
+    endRouteSample();
+  }, upload, body);
+}
+
+// Body handler for JSON routes: copies each chunk into the request's slot
+void collectBody(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
+  if (total > BODY_SLOT_SIZE) {
+    return; // requestBody() answers 413
+  }
+  
+  RequestBody* body = findBody(request);
+  if (index == 0 && body == NULL) {
+    for (int i = 0; i < BODY_POOL_SLOTS; i++) {
+      if (body_pool[i].owner == NULL) {
+        body = &body_pool[i];
+        body->owner = request;
+        body->length = total;
+        body->received = 0;
+        body->received_us = esp_timer_get_time();
+        request->onDisconnect([request]() {
+          releaseBody(request);
+        });
+        break;
+      }
+    }
+  }
+  if (body == NULL || index != body->received || index + len > body->length) {
+    return; // Pool exhausted or chunks out of order; requestBody() reports it
+  }
+  memcpy(body->data + index, data, len);
+  body->received += len;
+}
+
+RequestBody* findBody(AsyncWebServerRequest *request) {
+  for (int i = 0; i < BODY_POOL_SLOTS; i++) {
+    if (body_pool[i].owner == request) {
+      return &body_pool[i];
+    }
+  }
+  return NULL;
+}
+
+void releaseBody(AsyncWebServerRequest *request) {
+  RequestBody* body = findBody(request);
+  if (body != NULL) {
+    body->owner = NULL;
+  }
+}
+
+// The complete body of this request, or NULL after sending the error response
+const RequestBody* requestBody(AsyncWebServerRequest *request) {
+  if (request->contentLength() > BODY_SLOT_SIZE) {
+    sendText(request, 413, "application/json", "{\"status\":\"error\",\"message\":\"Body too large\"}");
+    return NULL;
+  }
+  RequestBody* body = findBody(request);
+  if (body == NULL && request->contentLength() > 0) {
+    LOG_WARN("Request body pool exhausted");
+    sendText(request, 503, "application/json", "{\"status\":\"busy\"}");
+    return NULL;
+  }
+  if (body == NULL || body->received != body->length) {
+    sendText(request, 400, "application/json", body == NULL ? "{\"status\":\"error\",\"message\":\"Missing body\"}"
+                                                             : "{\"status\":\"error\",\"message\":\"Incomplete body\"}");
+    return NULL;
+  }
+  return body;
+}
+
+void sendText(AsyncWebServerRequest *request, int code, const String& contentType, const String& content) {
+  recordResponse(code, content.length());
+  request->send(code, contentType, content);
+}
+
+// Serve a SPIFFS file with no-cache headers
+void sendFile(AsyncWebServerRequest *request, const String& path, const String& contentType) {
+  File file = SPIFFS.open(path, "r");
+  if (!file) {
+    sendText(request, 404, "text/plain", "Not Found");
+    return;
+  }
+  recordResponse(200, file.size());
+  AsyncWebServerResponse *response = request->beginResponse(file, path, contentType);
+  response->addHeader("Cache-Control", "no-store, no-cache, must-revalidate, max-age=0");
+  response->addHeader("Pragma", "no-cache");
+  response->addHeader("Expires", "-1");
+  request->send(response);
+}
+
+void sendRedirect(AsyncWebServerRequest *request, const String& url) {
+  recordResponse(302, 0);
+  request->redirect(url);
+}
+
+void sendResponse(AsyncWebServerRequest *request, AsyncWebServerResponse *response, int code, size_t bytes) {
+  recordResponse(code, bytes);
+  request->send(response);
+}
+
+// Prometheus text exposition, generated line by line into the chunks of a
+// chunked response so the whole document never has to be held in memory
+enum MetricKind { METRIC_REQUESTS, METRIC_ERRORS, METRIC_HANDLER_TIME, METRIC_RESPONSE_SIZE, METRIC_KIND_COUNT };
+struct MetricFamily {
+  const char* name;
+  const char* type;
+  const char* help;
+};
+const MetricFamily metric_families[METRIC_KIND_COUNT] = {
+  { "jiggla_http_requests_total", "counter", "Requests answered per route" },
+  { "jiggla_http_errors_total", "counter", "Responses with status 400 or above per route" },
+  { "jiggla_http_handler_seconds", "histogram", "Time spent in the route handler" },
+  { "jiggla_http_response_bytes", "histogram", "Response body size" },
+};
+
+struct MetricsCursor {
+  int kind;
+  int route;  // -1 while the family header is emitted
+  int item;   // Line within a route: buckets, +Inf, sum, count
+  RouteMetrics* self; // The /metrics route, its response size is only known at the end
+  size_t sent;
+  char line[192];
+  size_t length;
+  size_t offset;
+};
+
+// Format microseconds as seconds without floating point
+void formatSeconds(char* out, size_t size, uint64_t us) {
+  snprintf(out, size, "%lu.%06lu", (unsigned long)(us / 1000000), (unsigned long)(us % 1000000));
+}
+
+// Produce the next exposition line into cursor.line, false when done
+bool nextMetricsLine(MetricsCursor& cursor) {
+  while (cursor.kind < METRIC_KIND_COUNT) {
+    const MetricFamily& family = metric_families[cursor.kind];
+    if (cursor.route < 0) {
+      cursor.length = snprintf(cursor.line, sizeof(cursor.line), "# HELP %s %s\n# TYPE %s %s\n",
+                               family.name, family.help, family.name, family.type);
+      cursor.route = 0;
+      cursor.item = 0;
+      return true;
+    }
+    if (cursor.route >= route_count) {
+      cursor.kind++;
+      cursor.route = -1;
+      continue;
+    }
+    
+    const RouteMetrics& route = route_metrics[cursor.route];
+    if (route.requests == 0 && route.errors == 0) {
+      cursor.route++;
+      continue;
+    }
+    
+    char labels[96];
+    snprintf(labels, sizeof(labels), "method=\"%s\",route=\"%s\"", route.method, route.path);
+    
+    if (cursor.kind == METRIC_REQUESTS || cursor.kind == METRIC_ERRORS) {
+      uint32_t value = cursor.kind == METRIC_REQUESTS ? route.requests : route.errors;
+      cursor.length = snprintf(cursor.line, sizeof(cursor.line), "%s{%s} %lu\n", family.name, labels, (unsigned long)value);
+      cursor.route++;
+      return true;
+    }
+    
+    const Histogram& histogram = cursor.kind == METRIC_HANDLER_TIME ? route.handler_us : route.response_bytes;
+    bool seconds = cursor.kind == METRIC_HANDLER_TIME;
+    char value[24];
+    if (cursor.item <= HISTOGRAM_BUCKETS) {
+      // Prometheus buckets are cumulative
+      uint32_t cumulative = 0;
+      for (int i = 0; i <= cursor.item && i <= HISTOGRAM_BUCKETS; i++) {
+        cumulative += histogram.buckets[i];
+      }
+      if (cursor.item == HISTOGRAM_BUCKETS) {
+        strlcpy(value, "+Inf", sizeof(value));
+      } else if (seconds) {
+        formatSeconds(value, sizeof(value), 1ULL << (histogram.shift + cursor.item));
+      } else {
+        snprintf(value, sizeof(value), "%lu", 1UL << (histogram.shift + cursor.item));
+      }
+      cursor.length = snprintf(cursor.line, sizeof(cursor.line), "%s_bucket{%s,le=\"%s\"} %lu\n",
+                               family.name, labels, value, (unsigned long)cumulative);
+    } else if (cursor.item == HISTOGRAM_BUCKETS + 1) {
+      if (seconds) {
+        formatSeconds(value, sizeof(value), histogram.sum);
+      } else {
+        snprintf(value, sizeof(value), "%llu", (unsigned long long)histogram.sum);
+      }
+      cursor.length = snprintf(cursor.line, sizeof(cursor.line), "%s_sum{%s} %s\n", family.name, labels, value);
+    } else {
+      cursor.length = snprintf(cursor.line, sizeof(cursor.line), "%s_count{%s} %lu\n",
+                               family.name, labels, (unsigned long)histogram.count);
+    }
+    
+    cursor.item++;
+    if (cursor.item > HISTOGRAM_BUCKETS + 2) {
+      cursor.item = 0;
+      cursor.route++;
+    }
+    return true;
+  }
+  return false;
+}
+
+// Chunked response filler: copy as many lines as fit, carrying a partly sent line over
+size_t fillPrometheusMetrics(MetricsCursor& cursor, uint8_t *buffer, size_t maxLen) {
+  size_t written = 0;
+  while (written < maxLen) {
+    if (cursor.offset >= cursor.length) {
+      if (!nextMetricsLine(cursor)) {
+        if (cursor.self != NULL) {
+          recordHistogram(cursor.self->response_bytes, cursor.sent + written);
+          cursor.self = NULL;
+        }
+        break;
+      }
+      cursor.length = min(cursor.length, sizeof(cursor.line) - 1);
+      cursor.offset = 0;
+    }
+    size_t chunk = min(cursor.length - cursor.offset, maxLen - written);
+    memcpy(buffer + written, cursor.line + cursor.offset, chunk);
+    cursor.offset += chunk;
+    written += chunk;
+  }
+  cursor.sent += written;
+  return written;
+}
+
+void setupWebServer() {
+  DEBUG("Setting up web server");
+  
+  // Serve login.js with proper headers
+  onRoute("/login.js", HTTP_GET, [](AsyncWebServerRequest *request) {
+    DEBUG("Serving login.js directly");
+    sendFile(request, "/login.js", "application/javascript");
+  });
+
+  // Serve main.js with proper headers
+  onRoute("/main.js", HTTP_GET, [](AsyncWebServerRequest *request) {
+    DEBUG("Serving main.js directly");
+    sendFile(request, "/main.js", "application/javascript");
+  });
+
+  // Serve settings-admin.js with proper headers
+  onRoute("/settings-admin.js", HTTP_GET, [](AsyncWebServerRequest *request) {
+    DEBUG("Serving settings-admin.js directly");
+    sendFile(request, "/settings-admin.js", "application/javascript");
+  });
+
+  // Route to serve static files with cache control
+  class CaptiveRequestHandler : public AsyncWebHandler {
+  public:
+    CaptiveRequestHandler() {}
+    virtual ~CaptiveRequestHandler() {}
+
+    bool canHandle(AsyncWebServerRequest *request) {
+      return true;
+    }
+
+    void handleRequest(AsyncWebServerRequest *request) {
+      beginRouteSample(static_route);
+      serveStatic(request);
+      endRouteSample();
+    }
+
+  private:
+    RouteMetrics* static_route = addRouteMetrics("static", "GET");
+
+    void serveStatic(AsyncWebServerRequest *request) {
+      // First check if resource exists
+      String path = request->url();
+      if (path.endsWith("/")) {
+        path += "index.html";
+      }
+
+      // Remove query parameters
+      if (path.indexOf("?") >= 0) {
+        path = path.substring(0, path.indexOf("?"));
+      }
+
+      DEBUG("Handling request for: " + path);
+
+      // Special handling for login.js
+      if (path == "/login.js") {
+        DEBUG("Handling login.js request specifically");
+        if (SPIFFS.exists(path)) {
+          DEBUG("login.js exists in SPIFFS");
+          sendFile(request, path, "application/javascript");
+          DEBUG("login.js sent with application/javascript content type");
+          return;
+        } else {
+          DEBUG("login.js not found in SPIFFS!");
+          sendText(request, 404, "text/plain", "Not Found");
+          return;
+        }
+      }
+
+      // Check if file exists in SPIFFS
+      if (SPIFFS.exists(path)) {
+        DEBUG("File exists in SPIFFS");
+        // Get content type based on file extension
+        String contentType = "text/plain";
+        if (path.endsWith(".html")) contentType = "text/html";
+        else if (path.endsWith(".css")) contentType = "text/css";
+        else if (path.endsWith(".js")) contentType = "application/javascript";
+        else if (path.endsWith(".json")) contentType = "application/json";
+        else if (path.endsWith(".png")) contentType = "image/png";
+        else if (path.endsWith(".jpg")) contentType = "image/jpeg";
+        else if (path.endsWith(".ico")) contentType = "image/x-icon";
+        
+        DEBUG("Content type: " + contentType);
+        
+        // Serve the file with no-cache headers
+        sendFile(request, path, contentType);
+        DEBUG("File sent with no-cache headers");
+      } else {
+        DEBUG("File not found in SPIFFS: " + path);
+        if (validateSession(request)) {
+          // Not found, but authenticated
+          sendText(request, 404, "text/plain", "Not Found");
+        } else {
+          // Not found, not authenticated - redirect to login
+          sendRedirect(request, "/login");
+        }
+      }
+    }
+  };
+
+  // Register the captive request handler
+  server->addHandler(new CaptiveRequestHandler());
+  
+  // Redirect all requests to login page if not authenticated
+  static RouteMetrics* not_found_route = addRouteMetrics("not_found", "ANY");
+  server->onNotFound([](AsyncWebServerRequest *request) {
+    DEBUGF("Unhandled request for URL: %s", request->url().c_str());
+    beginRouteSample(not_found_route);
+    
+    if (!validateSession(request)) {
+      sendRedirect(request, "/login");
+    } else {
+      sendText(request, 404, "text/plain", "Not Found");
+    }
+    endRouteSample();
+  });
+  
+  // Serve main page (only if authenticated)
+  onRoute("/", HTTP_GET, [](AsyncWebServerRequest *request) {
+    DEBUG("Received request for main page");
+    
+    if (!validateSession(request)) {
+      sendRedirect(request, "/login");
+      return;
+    }
+    
+    DEBUG("Auth successful, serving index.html");
+    sendFile(request, "/index.html", "text/html");
+  });
+  
+  // Serve login page
+  onRoute("/login", HTTP_GET, [](AsyncWebServerRequest *request) {
+    if (validateSession(request)) {
+      sendRedirect(request, "/");
+    } else {
+      DEBUG("Serving login.html from SPIFFS with no-cache headers");
+      sendFile(request, "/login.html", "text/html");
+    }
+  });
+  
+  // Block direct access to login.html
+  onRoute("/login.html", HTTP_GET, [](AsyncWebServerRequest *request) {
+    sendRedirect(request, "/login");
   });
   
   // API endpoint to check authentication
-  server->on("/api/auth/check", HTTP_GET, [](AsyncWebServerRequest *request) {
+  onRoute("/api/auth/check", HTTP_GET, [](AsyncWebServerRequest *request) {
     DEBUG("Auth check request received");
     
     // Debug: Print all headers to see if the cookie is present
@@ -1320,71 +3390,66 @@ void setupWebServer() {
     
     if (validateSession(request)) {
       DEBUG("Auth check passed");
-      request->send(200, "application/json", "{\"status\":\"authenticated\"}");
+      sendText(request, 200, "application/json", "{\"status\":\"authenticated\"}");
     } else {
       DEBUG("Auth check failed");
-      request->send(401, "application/json", "{\"status\":\"unauthorized\"}");
+      sendText(request, 401, "application/json", "{\"status\":\"unauthorized\"}");
     }
   });
   
   // API endpoint to login
-  server->on("/api/auth/login", HTTP_POST, 
-    [](AsyncWebServerRequest *request) {
-      // Empty handler for request
-    }, 
-    NULL,  // Upload handler
-    [](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
-      if (request->_tempObject != NULL) {
-        return;  // Already processed
-      }
-      
-      request->_tempObject = (void*)1;  // Mark as processed
-      
-      StaticJsonDocument<512> doc;
-      DeserializationError error = deserializeJson(doc, data, len);
+  onRoute("/api/auth/login", HTTP_POST, [](AsyncWebServerRequest *request) {
+    const RequestBody* body = requestBody(request);
+    if (body == NULL) {
+      return;
+    }
+    
+    StaticJsonDocument<512> doc;
+    DeserializationError error = deserializeJson(doc, body->data, body->length);
+    
+    if (error) {
+      sendText(request, 400, "application/json", "{\"status\":\"error\",\"message\":\"Invalid JSON\"}");
+      return;
+    }
+    
+    String username = doc["username"].as<String>();
+    String password = doc["password"].as<String>();
+    
+    if (username == settings.username && password == settings.auth_password) {
+      String sessionId = generateSessionId();
+      int slot = -1;
       
-      if (error) {
-        request->send(400, "application/json", "{\"status\":\"error\",\"message\":\"Invalid JSON\"}");
-        return;
+      for (int i = 0; i < MAX_SESSIONS; i++) {
+        if (!sessions[i].active) {
+          slot = i;
+          break;
+        }
       }
       
-      String username = doc["username"].as<String>();
-      String password = doc["password"].as<String>();
-      
-      if (username == current_username && password == current_auth_password) {
-        String sessionId = generateSessionId();
-        int slot = -1;
+      if (slot != -1) {
+        sessions[slot].id = sessionId;
+        sessions[slot].expiry = millis() + session_timeout;
+        sessions[slot].active = true;
+        saveSessions();
         
-        for (int i = 0; i < MAX_SESSIONS; i++) {
-          if (!sessions[i].active) {
-            slot = i;
-            break;
-          }
-        }
+        const char* reply = "{\"status\":\"success\"}";
+        AsyncWebServerResponse *response = request->beginResponse(200, "application/json", reply);
+        String cookieHeader = "session=" + sessionId + "; Path=/; HttpOnly; SameSite=Lax; Max-Age=" + String(session_timeout / 1000);
+        response->addHeader("Set-Cookie", cookieHeader);
+        sendResponse(request, response, 200, strlen(reply));
         
-        if (slot != -1) {
-          sessions[slot].id = sessionId;
-          sessions[slot].expiry = millis() + session_timeout;
-          sessions[slot].active = true;
-          saveSessions();
-          
-          AsyncWebServerResponse *response = request->beginResponse(200, "application/json", "{\"status\":\"success\"}");
-          String cookieHeader = "session=" + sessionId + "; Path=/; HttpOnly; SameSite=Lax; Max-Age=" + String(session_timeout / 1000);
-          response->addHeader("Set-Cookie", cookieHeader);
-          request->send(response);
-          
-          DEBUG("Login successful for user: " + username);
-        } else {
-          request->send(500, "application/json", "{\"status\":\"error\",\"message\":\"No session slots available\"}");
-        }
+        DEBUG("Login successful for user: " + username);
       } else {
-        DEBUG("Login failed: Invalid credentials");
-        request->send(401, "application/json", "{\"status\":\"error\",\"message\":\"Invalid credentials\"}");
+        sendText(request, 500, "application/json", "{\"status\":\"error\",\"message\":\"No session slots available\"}");
       }
-    });
+    } else {
+      LOG_WARN("Login failed: Invalid credentials");
+      sendText(request, 401, "application/json", "{\"status\":\"error\",\"message\":\"Invalid credentials\"}");
+    }
+  }, NULL, collectBody);
   
   // API endpoint to logout
-  server->on("/api/auth/logout", HTTP_POST, [](AsyncWebServerRequest *request) {
+  onRoute("/api/auth/logout", HTTP_POST, [](AsyncWebServerRequest *request) {
     bool sessionFound = false;
     String sessionId = "";
     
@@ -1419,720 +3484,2664 @@ void setupWebServer() {
     }
     
     // Clear cookie with more secure parameters
-    AsyncWebServerResponse *response = request->beginResponse(200, "application/json", 
-      sessionFound ? "{\"status\":\"success\",\"message\":\"Logged out successfully\"}" : 
-                    "{\"status\":\"warning\",\"message\":\"No valid session found\"}");
+    const char* body = sessionFound ? "{\"status\":\"success\",\"message\":\"Logged out successfully\"}" : 
+                                      "{\"status\":\"warning\",\"message\":\"No valid session found\"}";
+    AsyncWebServerResponse *response = request->beginResponse(200, "application/json", body);
     
     response->addHeader("Set-Cookie", "session=; Path=/; HttpOnly; SameSite=Strict; Max-Age=0; Expires=Thu, 01 Jan 1970 00:00:00 GMT");
-    request->send(response);
+    sendResponse(request, response, 200, strlen(body));
   });
   
   // API endpoint to get current configuration
-  server->on("/api/config", HTTP_GET, [](AsyncWebServerRequest *request) {
+  onRoute("/api/config", HTTP_GET, [](AsyncWebServerRequest *request) {
     if (!validateSession(request)) {
-      request->send(401, "application/json", "{\"status\":\"unauthorized\"}");
+      sendText(request, 401, "application/json", "{\"status\":\"unauthorized\"}");
       return;
     }
     
-    StaticJsonDocument<512> doc;
-    doc["move_interval"] = move_interval / 1000; // Convert to seconds for readability
-    doc["movement_pattern"] = movement_pattern;
-    doc["movement_size"] = movement_size;
-    doc["movement_speed"] = movement_speed;
-    doc["jiggler_enabled"] = jiggler_enabled;
-    doc["random_delay"] = random_delay;
-    doc["movement_trail"] = movement_trail;
+    StaticJsonDocument<2048> doc;
+    doc["move_interval"] = motion_config.move_interval / 1000; // Convert to seconds for readability
+    doc["movement_pattern"] = motion_config.movement_pattern;
+    doc["movement_size"] = motion_config.movement_size;
+    doc["movement_speed"] = motion_config.movement_speed;
+    doc["jiggler_enabled"] = motion_config.jiggler_enabled;
+    doc["random_delay"] = motion_config.random_delay;
+    doc["movement_trail"] = motion_config.movement_trail;
+    doc["input_idle_resume"] = motion_config.input_idle_resume / 1000; // Seconds, like move_interval
+    doc["max_profiles"] = MAX_PROFILES;
+    JsonArray profiles = doc.createNestedArray("profiles");
+    for (int i = 0; i < motion_config.profile_count; i++) {
+      writeProfile(profiles.createNestedObject(), motion_config.profiles[i]);
+    }
+    doc["schedule_enabled"] = motion_config.schedule_enabled;
+    doc["max_schedule_windows"] = MAX_SCHEDULE_WINDOWS;
+    JsonArray schedule = doc.createNestedArray("schedule");
+    for (int i = 0; i < motion_config.schedule_count; i++) {
+      writeScheduleWindow(schedule.createNestedObject(), motion_config.schedule[i]);
+    }
     
     String response;
     serializeJson(doc, response);
     
-    request->send(200, "application/json", response);
+    sendText(request, 200, "application/json", response);
   });
   
   // API endpoint to get device status information
-  server->on("/api/status", HTTP_GET, [](AsyncWebServerRequest *request) {
+  onRoute("/api/status", HTTP_GET, [](AsyncWebServerRequest *request) {
     if (!validateSession(request)) {
       return; // Auth handler already sent response
     }
     
-    StaticJsonDocument<512> doc;
-    doc["jiggler_enabled"] = jiggler_enabled;
+    StaticJsonDocument<3072> doc;
+    doc["jiggler_enabled"] = motion_config.jiggler_enabled;
     doc["last_move_time"] = last_move_time;
     doc["next_move_time"] = next_move_time;
     doc["uptime_seconds"] = millis() / 1000;
-    doc["in_ap_mode"] = isAPMode;
     
-    String response;
-    serializeJson(doc, response);
+    // Next deadline of every profile, 0 while disabled
+    JsonArray profiles = doc.createNestedArray("profiles");
+    for (int i = 0; i < motion_config.profile_count; i++) {
+      JsonObject profile = profiles.createNestedObject();
+      profile["name"] = motion_config.profiles[i].name;
+      profile["next_move_time"] = profile_next_move[i];
+    }
     
-    request->send(200, "application/json", response);
-  });
-  
-  // API endpoint to update configuration
-  server->on("/api/config", HTTP_POST, [](AsyncWebServerRequest *request) {
-    // Only validate the session in the first handler, 
-    // but don't send a response here
-    if (!validateSession(request)) {
-      request->send(401, "application/json", "{\"status\":\"unauthorized\"}");
-      request->_tempObject = (void*)1; // Mark as processed
-      return;
-    }
-  }, NULL, [](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
-    // Check if response was already sent
-    if (request->_tempObject != NULL) {
-      return;
+    // Wall clock and weekly schedule; times are epoch seconds, 0 = none
+    JsonObject clock = doc.createNestedObject("clock");
+    clock["source"] = clockSourceName(clock_source);
+    clock["utc_offset"] = clock_utc_offset;
+    struct tm local;
+    if (localTime(local)) {
+      char local_text[20];
+      strftime(local_text, sizeof(local_text), "%Y-%m-%d %H:%M", &local);
+      clock["local_time"] = local_text;
     }
+    JsonObject schedule = doc.createNestedObject("schedule");
+    schedule["enabled"] = motion_config.schedule_enabled;
+    schedule["active"] = schedule_state.active;
+    schedule["next_change"] = (uint32_t)schedule_state.next_change;
+    schedule["next_activation"] = (uint32_t)schedule_state.next_activation;
+    doc["in_ap_mode"] = isAPMode;
     
-    StaticJsonDocument<512> doc;
-    DeserializationError error = deserializeJson(doc, data, len);
+    // WiFi manager state and counters
+    JsonObject wifi = doc.createNestedObject("wifi");
+    wifi["mode"] = wifiModeName(settings.wifi_mode);
+    wifi["ap_active"] = ap_active;
+    wifi["sta_state"] = staStateName(wifi_manager.sta_state);
+    if (wifi_manager.sta_state == STA_CONNECTED) {
+      wifi["rssi"] = WiFi.RSSI();
+      wifi["connected_seconds"] = (millis() - wifi_manager.connected_since) / 1000;
+    }
+    wifi["connect_attempts"] = wifi_manager.connect_attempts;
+    wifi["retries"] = wifi_manager.retries;
+    wifi["disconnects"] = wifi_manager.disconnects;
+    wifi["last_disconnect_reason"] = wifi_manager.last_disconnect_reason;
+    wifi["events_dropped"] = wifi_events_dropped;
+    wifi["last_assoc_ms"] = wifi_manager.last_assoc_ms;
+    wifi["avg_assoc_ms"] = wifi_manager.associations > 0 ? wifi_manager.total_assoc_ms / wifi_manager.associations : 0;
+    wifi["fast_hits"] = wifi_manager.fast_hits;
+    wifi["fast_misses"] = wifi_manager.fast_misses;
+    wifi["reset_reason"] = resetReasonName(esp_reset_reason());
+    wifi["boot_reachable_ms"] = wifi_manager.boot_reachable_ms;
+    wifi["last_full_boot_ms"] = wifi_last_full_boot_ms;
+    wifi["last_fast_boot_ms"] = wifi_last_fast_boot_ms;
+    if (wifi_manager.sta_state == STA_BACKOFF) {
+      wifi["retry_in_ms"] = (long)(wifi_manager.retry_at - millis()) > 0 ? wifi_manager.retry_at - millis() : 0;
+    }
     
-    if (!error) {
-      // Update configuration
-      if (doc.containsKey("jiggler_enabled")) {
-        jiggler_enabled = doc["jiggler_enabled"].as<bool>();
-      }
-      
-      if (doc.containsKey("movement_pattern")) {
-        // Free old pattern string and allocate new one
-        if (movement_pattern != NULL) free(movement_pattern);
-        movement_pattern = strdup(doc["movement_pattern"].as<const char*>());
-      } else if (doc.containsKey("circular_movement")) {
-        // Handle legacy parameter
-        bool circular = doc["circular_movement"].as<bool>();
-        if (movement_pattern != NULL) free(movement_pattern);
-        movement_pattern = strdup(circular ? "circular" : "linear");
-      }
-      
-      if (doc.containsKey("move_interval")) {
-        move_interval = doc["move_interval"].as<int>() * 1000; // Convert from seconds to milliseconds
-      }
-      
-      if (doc.containsKey("movement_size")) {
-        movement_size = doc["movement_size"].as<int>();
-      } else {
-        // For backwards compatibility
-        if (doc.containsKey("movement_x")) {
-          movement_size = abs(doc["movement_x"].as<int>());
-        }
-        if (doc.containsKey("movement_y")) {
-          // Use the larger of X or Y
-          movement_size = max(movement_size, abs(doc["movement_y"].as<int>()));
-        }
-      }
-      
-      if (doc.containsKey("movement_speed")) {
-        movement_speed = doc["movement_speed"].as<int>();
-      }
-      
-      if (doc.containsKey("random_delay")) {
-        random_delay = doc["random_delay"].as<bool>();
-      }
-      
-      if (doc.containsKey("movement_trail")) {
-        movement_trail = doc["movement_trail"].as<bool>();
+    // Power governor state; current figures are estimates from time spent per level
+    JsonObject power = doc.createNestedObject("power");
+    unsigned long now = millis();
+    uint64_t total_ms = 0;
+    uint64_t weighted_ma = 0;
+    JsonObject level_seconds = power.createNestedObject("level_seconds");
+    for (int i = 0; i < POWER_LEVEL_COUNT; i++) {
+      uint64_t ms = power_governor.time_in_level[i];
+      if (i == power_governor.level) {
+        ms += now - power_governor.level_since;
       }
-      
-      // Save configuration
-      saveConfig();
-      
-      // Reset the timer
-      last_move_time = millis();
-      next_move_time = millis() + calculateMoveInterval();
-      
-      DEBUG("Configuration updated via API");
-      request->send(200, "application/json", "{\"status\":\"success\"}");
-    } else {
-      request->send(400, "application/json", "{\"status\":\"error\",\"message\":\"Invalid JSON\"}");
-    }
-  });
-  
-  // API endpoint to trigger mouse movement immediately
-  server->on("/api/move", HTTP_POST, [](AsyncWebServerRequest *request) {
-    if (!validateSession(request)) {
-      request->send(401, "application/json", "{\"status\":\"unauthorized\"}");
-      return;
+      level_seconds[power_profiles[i].name] = (uint32_t)(ms / 1000);
+      total_ms += ms;
+      weighted_ma += ms * power_profiles[i].est_ma;
     }
+    power["level"] = power_profiles[power_governor.level].name;
+    power["cpu_mhz"] = getCpuFrequencyMhz();
+    power["modem_sleep"] = power_profiles[power_governor.level].wifi_ps != WIFI_PS_NONE;
+    power["est_current_ma"] = power_profiles[power_governor.level].est_ma;
+    power["est_avg_current_ma"] = total_ms > 0 ? (uint32_t)(weighted_ma / total_ms) : 0;
+    power["switches"] = power_governor.switches;
+    power["last_switch_us"] = power_governor.last_switch_us;
+    power["last_wake_latency_us"] = power_governor.last_wake_latency_us;
+    power["max_wake_latency_us"] = power_governor.max_wake_latency_us;
     
-    // Move mouse based on current movement pattern
-    moveMouse();
+    // Scheduler state
+    JsonObject scheduler = doc.createNestedObject("scheduler");
+    scheduler["cpu_idle_pct"] = sampleCpuIdle();
+    scheduler["sleep_pct"] = now > 0 ? (uint32_t)(scheduler_stats.sleep_ms * 100 / now) : 0;
+    scheduler["wakeups"] = scheduler_stats.wakeups;
+    scheduler["sleeping_for_ms"] = scheduler_stats.next_wait;
+    scheduler["light_sleep"] = light_sleep_active;
+    scheduler["usb_suspended"] = (bool)usb_suspended;
+    
+    // Spacing between HID reports per pattern, in microseconds
+    JsonObject step_timing = doc.createNestedObject("step_timing");
+    for (int i = 0; i < PATTERN_COUNT + MAX_PATTERN_FILES; i++) {
+      const StepHistogram& histogram = step_histograms[i];
+      if (histogram.count == 0 || step_reset_requested) {
+        continue;
+      }
+      JsonObject entry = step_timing.createNestedObject(patternName(i));
+      entry["count"] = histogram.count;
+      entry["min_us"] = histogram.min_us;
+      entry["p50_us"] = stepPercentile(histogram, 500);
+      entry["p99_us"] = stepPercentile(histogram, 990);
+      entry["max_us"] = histogram.max_us;
+      entry["mean_us"] = (uint32_t)(histogram.sum_us / histogram.count);
+    }
     
-    // Update last move time
-    last_move_time = millis();
-    next_move_time = millis() + calculateMoveInterval();
+    String response;
+    serializeJson(doc, response);
     
-    request->send(200, "application/json", "{\"status\":\"success\"}");
+    sendText(request, 200, "application/json", response);
   });
   
-  // API endpoint to get settings
-  server->on("/api/settings", HTTP_GET, [](AsyncWebServerRequest *request) {
+  // API endpoint for heap, allocation and stack telemetry
+  onRoute("/api/metrics/memory", HTTP_GET, [](AsyncWebServerRequest *request) {
     if (!validateSession(request)) {
-      request->send(401, "application/json", "{\"status\":\"unauthorized\"}");
+      sendText(request, 401, "application/json", "{\"status\":\"unauthorized\"}");
       return;
     }
     
-    StaticJsonDocument<512> doc;
-    
-    // AP settings
-    JsonObject ap = doc.createNestedObject("ap");
-    ap["ssid"] = current_ssid;
-    ap["password"] = current_password;
-    ap["hidden"] = ap_hidden;
-    
-    // Hostname at root level
-    doc["hostname"] = current_hostname;
-    
-    // WiFi mode settings
-    doc["wifi_mode"] = wifi_mode;
-    doc["ap_availability"] = ap_availability;
-    doc["ap_timeout"] = ap_timeout;
+    StaticJsonDocument<1024> doc;
+    doc["uptime_seconds"] = millis() / 1000;
     
-    // STA settings
-    JsonObject sta = doc.createNestedObject("sta");
-    sta["ssid"] = sta_ssid;
-    sta["password"] = sta_password;
+    // Internal heap; fragmentation is the share of free memory outside the largest block
+    multi_heap_info_t info;
+    heap_caps_get_info(&info, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    JsonObject heap = doc.createNestedObject("heap");
+    heap["size"] = heap_caps_get_total_size(MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    heap["free"] = info.total_free_bytes;
+    heap["min_free"] = info.minimum_free_bytes;
+    heap["largest_free_block"] = info.largest_free_block;
+    heap["free_blocks"] = info.free_blocks;
+    heap["allocated_blocks"] = info.allocated_blocks;
+    heap["fragmentation_pct"] = info.total_free_bytes > 0 ? 100 - (uint32_t)((uint64_t)info.largest_free_block * 100 / info.total_free_bytes) : 0;
     
-    // Auth settings
-    JsonObject auth = doc.createNestedObject("auth");
-    auth["enabled"] = auth_enabled;
-    auth["username"] = current_username;
-    auth["password"] = current_auth_password;
+    JsonObject allocations = doc.createNestedObject("allocations");
+#ifdef HEAP_ALLOC_COUNTING
+    allocations["counting"] = true;
+#else
+    allocations["counting"] = false;
+#endif
+    const AllocCounters* counters[] = { &alloc_total, &alloc_request };
+    const char* counter_names[] = { "total", "request_path" };
+    for (int i = 0; i < 2; i++) {
+      JsonObject entry = allocations.createNestedObject(counter_names[i]);
+      uint32_t allocs = counters[i]->allocs.load();
+      uint32_t frees = counters[i]->frees.load();
+      entry["allocs"] = allocs;
+      entry["frees"] = frees;
+      entry["outstanding"] = (int32_t)(allocs - frees);
+      entry["bytes"] = counters[i]->bytes.load();
+    }
     
-    // Web port
-    doc["web_port"] = current_webport;
+    // Stack high-water marks: the least free stack each task has had (bytes)
+    JsonArray tasks = doc.createNestedArray("tasks");
+    for (const MonitoredTask& monitored : monitored_tasks) {
+      TaskHandle_t handle = xTaskGetHandle(monitored.name);
+      if (handle == NULL) {
+        continue;
+      }
+      JsonObject task = tasks.createNestedObject();
+      task["name"] = monitored.name;
+      task["stack_free_min"] = uxTaskGetStackHighWaterMark(handle);
+      if (monitored.stack_size > 0) {
+        task["stack_size"] = monitored.stack_size;
+      }
+    }
     
     String response;
     serializeJson(doc, response);
     
-    request->send(200, "application/json", response);
+    sendText(request, 200, "application/json", response);
   });
   
-  // API endpoint to update settings
-  server->on("/api/settings", HTTP_POST, [](AsyncWebServerRequest *request) {
-    // Only validate the session in the first handler
+  // Per-task CPU share over a sliding window: ?window=seconds (default 5,
+  // max 60). cpu_pct is the share of all cores, so the column sums to 100
+  // including the idle tasks. Sorted busiest first.
+  onRoute("/api/metrics/tasks", HTTP_GET, [](AsyncWebServerRequest *request) {
     if (!validateSession(request)) {
-      request->send(401, "application/json", "{\"status\":\"unauthorized\"}");
-      request->_tempObject = (void*)1; // Mark as processed
+      sendText(request, 401, "application/json", "{\"status\":\"unauthorized\"}");
       return;
     }
-  }, NULL, [](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
-    // Check if response was already sent
-    if (request->_tempObject != NULL) {
+    
+#if CONFIG_FREERTOS_USE_TRACE_FACILITY && CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS && CONFIG_FREERTOS_RUN_TIME_STATS_USING_ESP_TIMER
+    uint32_t window_ms = TASK_WINDOW_DEFAULT_MS;
+    if (request->hasParam("window")) {
+      long seconds = request->getParam("window")->value().toInt();
+      window_ms = constrain(seconds, (long)(TASK_SAMPLE_MS / 1000), (long)(TASK_WINDOW_MAX_MS / 1000)) * 1000;
+    }
+    
+    TaskSnapshot current;
+    int count = readTaskSnapshot(task_status, current);
+    if (count == 0) {
+      sendText(request, 500, "application/json", "{\"status\":\"error\",\"message\":\"Too many tasks\"}");
       return;
     }
     
-    StaticJsonDocument<512> doc;
-    DeserializationError error = deserializeJson(doc, data, len);
+    // Keep the sampler running; when it was idle, start the ring afresh with
+    // this snapshot and let the client come back for a window
+    portENTER_CRITICAL(&task_snapshot_mux);
+    bool sampling = task_sampling;
+    task_sampling_until = millis() + TASK_SAMPLING_HOLD_MS;
+    if (!sampling) {
+      task_snapshots[0] = current;
+      task_snapshot_count = 1;
+      task_sampling = true;
+    }
+    portEXIT_CRITICAL(&task_snapshot_mux);
+    if (!sampling) {
+      wakeScheduler();
+      sendText(request, 202, "application/json", "{\"status\":\"sampling\",\"retry_ms\":" + String(TASK_SAMPLE_MS) + "}");
+      return;
+    }
     
-    if (!error) {
-      bool changed = false;
-      
-      // Update AP settings
-      if (doc.containsKey("ap")) {
-        if (doc["ap"].containsKey("ssid")) {
-          if (current_ssid != NULL) free(current_ssid);
-          current_ssid = strdup(doc["ap"]["ssid"].as<const char*>());
-          changed = true;
-        }
-        if (doc["ap"].containsKey("password")) {
-          if (current_password != NULL) free(current_password);
-          current_password = strdup(doc["ap"]["password"].as<const char*>());
-          changed = true;
-        }
-        if (doc["ap"].containsKey("hidden")) {
-          ap_hidden = doc["ap"]["hidden"].as<bool>();
-          changed = true;
-        }
-      }
-      
-      // Update hostname (now at root level)
-      if (doc.containsKey("hostname")) {
-        if (current_hostname != NULL) free(current_hostname);
-        current_hostname = strdup(doc["hostname"].as<const char*>());
-        changed = true;
-      }
-      
-      // Update WiFi mode settings
-      if (doc.containsKey("wifi_mode")) {
-        if (wifi_mode != NULL) free(wifi_mode);
-        wifi_mode = strdup(doc["wifi_mode"].as<const char*>());
-        changed = true;
-      }
-      
-      if (doc.containsKey("ap_availability")) {
-        if (ap_availability != NULL) free(ap_availability);
-        ap_availability = strdup(doc["ap_availability"].as<const char*>());
-        changed = true;
-      }
-      
-      if (doc.containsKey("ap_timeout")) {
-        ap_timeout = doc["ap_timeout"].as<int>();
-        changed = true;
-      }
-      
-      // Update STA settings
-      if (doc.containsKey("sta")) {
-        if (doc["sta"].containsKey("ssid")) {
-          if (sta_ssid != NULL) free(sta_ssid);
-          sta_ssid = strdup(doc["sta"]["ssid"].as<const char*>());
-          changed = true;
-        }
-        if (doc["sta"].containsKey("password")) {
-          if (sta_password != NULL) free(sta_password);
-          sta_password = strdup(doc["sta"]["password"].as<const char*>());
-          changed = true;
-        }
-      }
-      
-      // Update Auth settings
-      if (doc.containsKey("auth")) {
-        if (doc["auth"].containsKey("enabled")) {
-          auth_enabled = doc["auth"]["enabled"].as<bool>();
-          changed = true;
-        }
-        if (doc["auth"].containsKey("username")) {
-          if (current_username != NULL) free(current_username);
-          current_username = strdup(doc["auth"]["username"].as<const char*>());
-          changed = true;
-        }
-        if (doc["auth"].containsKey("password") && doc["auth"]["password"].as<String>().length() > 0) {
-          if (current_auth_password != NULL) free(current_auth_password);
-          current_auth_password = strdup(doc["auth"]["password"].as<const char*>());
-          changed = true;
+    TaskSnapshot baseline;
+    if (!findTaskBaseline(current.timestamp_us, window_ms, baseline)) {
+      sendText(request, 503, "application/json", "{\"status\":\"error\",\"message\":\"No samples yet\"}");
+      return;
+    }
+    uint64_t window_us = current.timestamp_us - baseline.timestamp_us;
+    
+    // Run time spent in the window; a task created since then counts from zero
+    uint32_t busy[MAX_TASK_STATS];
+    int order[MAX_TASK_STATS];
+    for (int i = 0; i < count; i++) {
+      uint32_t start = 0;
+      for (int j = 0; j < baseline.count; j++) {
+        if (baseline.numbers[j] == current.numbers[i]) {
+          start = baseline.runtime[j];
+          break;
         }
       }
+      busy[i] = current.runtime[i] - start; // 32-bit counters, wrap-safe
       
-      // Update web port
-      if (doc.containsKey("web_port")) {
-        current_webport = doc["web_port"].as<int>();
-        changed = true;
+      // Insertion sort, busiest first
+      int k = i;
+      while (k > 0 && busy[order[k - 1]] < busy[i]) {
+        order[k] = order[k - 1];
+        k--;
       }
-      
-      if (changed) {
-        // Save settings
-        saveSettings();
-        
-        request->send(200, "application/json", "{\"status\":\"success\",\"message\":\"Settings updated successfully\"}");
+      order[k] = i;
+    }
+    
+    StaticJsonDocument<4096> doc;
+    doc["window_ms"] = (uint32_t)(window_us / 1000);
+    doc["cores"] = portNUM_PROCESSORS;
+    JsonArray tasks = doc.createNestedArray("tasks");
+    for (int n = 0; n < count; n++) {
+      const TaskStatus_t& status = task_status[order[n]];
+      JsonObject task = tasks.createNestedObject();
+      task["name"] = status.pcTaskName;
+      task["cpu_pct"] = window_us > 0 ? roundf(busy[order[n]] * 1000.0f / (window_us * portNUM_PROCESSORS)) / 10 : 0;
+      BaseType_t affinity = xTaskGetAffinity(status.xHandle);
+      if (affinity == tskNO_AFFINITY) {
+        task["core"] = "any";
       } else {
-        request->send(200, "application/json", "{\"status\":\"warning\",\"message\":\"No changes were made\"}");
+        task["core"] = affinity;
       }
-    } else {
-      request->send(400, "application/json", "{\"status\":\"error\",\"message\":\"Invalid JSON\"}");
+      task["state"] = taskStateName(status.eCurrentState);
+      task["priority"] = status.uxCurrentPriority;
+      task["stack_free_min"] = status.usStackHighWaterMark;
     }
+    
+    String response;
+    serializeJson(doc, response);
+    
+    sendText(request, 200, "application/json", response);
+#else
+    sendText(request, 501, "application/json", "{\"status\":\"error\",\"message\":\"FreeRTOS run-time stats are disabled\"}");
+#endif
   });
   
-  // API endpoint to reboot device
-  server->on("/api/reboot", HTTP_POST, [](AsyncWebServerRequest *request) {
+  // Touchpad input latency by stage, in microseconds. Percentiles are bucket
+  // upper bounds; buckets[i] counts values up to first_bucket_us << i and the
+  // last entry everything above.
+  onRoute("/api/metrics/latency", HTTP_GET, [](AsyncWebServerRequest *request) {
     if (!validateSession(request)) {
-      request->send(401, "application/json", "{\"status\":\"unauthorized\"}");
+      sendText(request, 401, "application/json", "{\"status\":\"unauthorized\"}");
       return;
     }
     
-    // Send response before rebooting
-    request->send(200, "application/json", "{\"status\":\"success\",\"message\":\"Rebooting device\"}");
+    StaticJsonDocument<2048> doc;
+    doc["last_seq"] = input_latency.last_seq;
+    doc["dropped"] = input_latency.dropped;
+    doc["queue_depth"] = hidRingDepth();
+    JsonObject stages = doc.createNestedObject("stages");
+    for (int i = 0; i < LATENCY_STAGES; i++) {
+      const Histogram& histogram = input_latency.stages[i];
+      JsonObject stage = stages.createNestedObject(latency_stage_names[i]);
+      stage["count"] = histogram.count;
+      stage["mean_us"] = histogram.count > 0 ? (uint32_t)(histogram.sum / histogram.count) : 0;
+      stage["p50_us"] = histogramPercentile(histogram, 500);
+      stage["p99_us"] = histogramPercentile(histogram, 990);
+      stage["first_bucket_us"] = 1UL << histogram.shift;
+      JsonArray buckets = stage.createNestedArray("buckets");
+      for (int b = 0; b <= HISTOGRAM_BUCKETS; b++) {
+        buckets.add(histogram.buckets[b]);
+      }
+    }
     
-    // Schedule reboot after sending response
-    delay(500);
-    ESP.restart();
+    String response;
+    serializeJson(doc, response);
+    
+    sendText(request, 200, "application/json", response);
   });
   
-  // Serve the OTA update page with authentication
-  server->on("/ota.html", HTTP_GET, [](AsyncWebServerRequest *request) {
+  // The sender task owns the histograms, so the reset travels through its ring
+  onRoute("/api/metrics/latency/reset", HTTP_POST, [](AsyncWebServerRequest *request) {
     if (!validateSession(request)) {
-      request->redirect("/login");
+      sendText(request, 401, "application/json", "{\"status\":\"unauthorized\"}");
       return;
     }
     
-    AsyncWebServerResponse *response = request->beginResponse(SPIFFS, "/ota.html", "text/html");
-    response->addHeader("Cache-Control", "no-store, no-cache, must-revalidate, max-age=0");
-    response->addHeader("Pragma", "no-cache");
-    response->addHeader("Expires", "-1");
-    request->send(response);
-  });
-  
-  // Handle redirect from /update to /ota.html
-  server->on("/update", HTTP_GET, [](AsyncWebServerRequest *request) {
-    if (!validateSession(request)) {
-      request->redirect("/login");
+    HidCommand command = {};
+    command.type = HID_CMD_RESET_STATS;
+    if (!pushHidCommand(command)) {
+      sendText(request, 503, "application/json", "{\"status\":\"busy\"}");
       return;
     }
-    request->redirect("/ota.html");
+    sendText(request, 200, "application/json", "{\"status\":\"success\"}");
   });
   
-  // Handle OTA update file upload
-  server->on("/update", HTTP_POST, [](AsyncWebServerRequest *request) {
-    // Send the response first
-    AsyncWebServerResponse *response = request->beginResponse(200, "text/plain", 
-      (Update.hasError()) ? "Update failed!" : "Update success! Rebooting...");
-    response->addHeader("Connection", "close");
-    request->send(response);
-    
-    // Wait a bit and then restart
-    delay(500);
-    ESP.restart();
-  }, [](AsyncWebServerRequest *request, String filename, size_t index, uint8_t *data, size_t len, bool final) {
-    // Check authentication
+  // Results of the last self-benchmark: 202 while it runs, 404 before the first.
+  // Registered ahead of /api/bench, which would also match this path.
+  onRoute("/api/bench/result", HTTP_GET, [](AsyncWebServerRequest *request) {
     if (!validateSession(request)) {
+      sendText(request, 401, "application/json", "{\"status\":\"unauthorized\"}");
       return;
     }
     
-    // Get update type parameter (firmware or filesystem)
-    String updateType = "firmware"; // Default to firmware
-    if (request->hasParam("update_type", true)) {
-      updateType = request->getParam("update_type", true)->value();
+    uint8_t state = bench_state.load(std::memory_order_acquire);
+    if (state == BENCH_RUNNING) {
+      sendText(request, 202, "application/json", "{\"status\":\"running\"}");
+      return;
     }
-    
-    // First chunk received
-    if (index == 0) {
-      DEBUGF("OTA Update started: %s (Type: %s)", filename.c_str(), updateType.c_str());
-      
-      // Start update with appropriate command based on type
-      int cmd = (updateType == "filesystem") ? U_SPIFFS : U_FLASH;
-      
-      if (!Update.begin(UPDATE_SIZE_UNKNOWN, cmd)) {
-        DEBUG(String("OTA error: ") + Update.errorString());
-      }
+    if (state != BENCH_DONE) {
+      sendText(request, 404, "application/json", "{\"status\":\"none\"}");
+      return;
     }
     
-    // Write chunk to flash
-    if (Update.write(data, len) != len) {
-      DEBUG(String("OTA error: ") + Update.errorString());
+    StaticJsonDocument<2560> doc;
+    doc["status"] = "done";
+    doc["chip"] = ESP.getChipModel();
+    doc["cpu_mhz"] = getCpuFrequencyMhz();
+    doc["core"] = bench_run.core;
+    doc["iterations"] = bench_run.iterations;
+    if (bench_run.motion_skipped) {
+      doc["motion_skipped"] = true;
     }
-    
-    // Final chunk - finish update
-    if (final) {
-      if (Update.end(true)) {
-        DEBUG("OTA update successful. Rebooting...");
-      } else {
-        DEBUG(String("OTA error: ") + Update.errorString());
-      }
+    JsonArray results = doc.createNestedArray("results");
+    for (int i = 0; i < bench_run.result_count; i++) {
+      const BenchResult& result = bench_run.results[i];
+      JsonObject entry = results.createNestedObject();
+      entry["name"] = result.name;
+      entry["ops"] = result.ops;
+      entry["cycles_per_op"] = (uint32_t)(result.cycles / result.ops);
+      entry["us_per_op"] = (float)result.elapsed_us / result.ops;
     }
+    
+    String response;
+    serializeJson(doc, response);
+    
+    sendText(request, 200, "application/json", response);
   });
   
-  // API endpoint for touchpad mouse movement
-  server->on("/api/touchpad/move", HTTP_POST, [](AsyncWebServerRequest *request) {
-    // Only validate the session in the first handler
+  // Self-benchmark: cycles per operation for the motion engine, API JSON,
+  // session lookup and SPIFFS reads. ?iterations=N (default 50, max 500);
+  // patterns and file reads run N/10 times. Starts a run and answers 202
+  // right away; the results are fetched from /api/bench/result.
+  onRoute("/api/bench", HTTP_GET, [](AsyncWebServerRequest *request) {
     if (!validateSession(request)) {
-      request->send(401, "application/json", "{\"status\":\"unauthorized\"}");
-      request->_tempObject = (void*)1; // Mark as processed
+      sendText(request, 401, "application/json", "{\"status\":\"unauthorized\"}");
       return;
     }
-  }, NULL, [](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
-    // Check if response was already sent
-    if (request->_tempObject != NULL) {
+    
+    uint8_t expected = bench_state.load();
+    if (expected == BENCH_RUNNING || !bench_state.compare_exchange_strong(expected, BENCH_RUNNING)) {
+      sendText(request, 503, "application/json", "{\"status\":\"busy\"}");
       return;
     }
     
-    StaticJsonDocument<128> doc;
-    DeserializationError error = deserializeJson(doc, data, len);
+    uint32_t iterations = BENCH_DEFAULT_ITERATIONS;
+    if (request->hasParam("iterations")) {
+      iterations = constrain(request->getParam("iterations")->value().toInt(), 1, (long)BENCH_MAX_ITERATIONS);
+    }
+    bench_run.iterations = iterations;
+    bench_run.movement_size = motion_config.movement_size;
+    bench_run.cookie = request->hasHeader("Cookie") ? request->header("Cookie") : String();
+    bench_run.result_count = 0;
+    bench_run.motion_skipped = false;
     
-    if (!error) {
-      int x = doc["x"].as<int>();
-      int y = doc["y"].as<int>();
-      
-      // Move mouse by the specified amount
-      Mouse.move(x, y);
-      
-      // Update last move time
-      last_move_time = millis();
-      next_move_time = millis() + calculateMoveInterval();
-      
-      request->send(200, "application/json", "{\"status\":\"success\"}");
-    } else {
-      request->send(400, "application/json", "{\"status\":\"error\",\"message\":\"Invalid JSON\"}");
+    // Pinned to one core so the cycle counter is read on one CPU throughout
+    bench_run.core = xPortGetCoreID();
+    if (xTaskCreatePinnedToCore(benchTask, "bench", BENCH_TASK_STACK_SIZE, NULL,
+                                BENCH_TASK_PRIORITY, NULL, bench_run.core) != pdPASS) {
+      bench_state.store(BENCH_IDLE);
+      sendText(request, 500, "application/json", "{\"status\":\"error\",\"message\":\"Cannot start benchmark\"}");
+      return;
     }
+    sendText(request, 202, "application/json", "{\"status\":\"running\",\"result\":\"/api/bench/result\"}");
   });
   
-  // API endpoint for touchpad mouse clicks
-  server->on("/api/touchpad/click", HTTP_POST, [](AsyncWebServerRequest *request) {
-    // Only validate the session in the first handler
+  // Prometheus scrape endpoint with per-route request metrics. Left outside
+  // the session check so monitoring can scrape it; it exposes no settings.
+  onRoute("/metrics", HTTP_GET, [](AsyncWebServerRequest *request) {
+    MetricsCursor cursor = {};
+    cursor.route = -1;
+    cursor.self = route_sample.route;
+    recordResponse(200, RESPONSE_SIZE_UNKNOWN);
+    request->send(request->beginChunkedResponse("text/plain; version=0.0.4",
+      [cursor](uint8_t *buffer, size_t maxLen, size_t index) mutable -> size_t {
+        return fillPrometheusMetrics(cursor, buffer, maxLen);
+      }));
+  });
+  
+  // API endpoint to get the log level and ring state
+  onRoute("/api/logs/level", HTTP_GET, [](AsyncWebServerRequest *request) {
     if (!validateSession(request)) {
-      request->send(401, "application/json", "{\"status\":\"unauthorized\"}");
-      request->_tempObject = (void*)1; // Mark as processed
-      return;
-    }
-  }, NULL, [](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
-    // Check if response was already sent
-    if (request->_tempObject != NULL) {
+      sendText(request, 401, "application/json", "{\"status\":\"unauthorized\"}");
       return;
     }
     
-    StaticJsonDocument<128> doc;
-    DeserializationError error = deserializeJson(doc, data, len);
+    StaticJsonDocument<256> doc;
+    doc["level"] = logLevelName(log_level);
+    doc["records_written"] = log_head.load();
+    doc["ring_size"] = LOG_RING_SIZE;
+    doc["clients"] = log_stream_clients.load();
     
-    if (!error) {
-      String button = doc["button"].as<String>();
-      String clickType = doc["clickType"].as<String>();
-      
-      if (button == "left") {
-        if (clickType == "double") {
-          // Double click (press-release-press-release)
-          DEBUG("Mouse double-click");
-          Mouse.press(MOUSE_LEFT);
-          delay(8);
-          Mouse.release(MOUSE_LEFT);
-          delay(8);
-          Mouse.press(MOUSE_LEFT);
-          delay(8);
-          Mouse.release(MOUSE_LEFT);
-        } else {
-          // Normal click (press and release)
-          DEBUG("Mouse single-click");
-          Mouse.press(MOUSE_LEFT);
-          delay(8);
-          Mouse.release(MOUSE_LEFT);
-        }
-      } else if (button == "right") {
-        // Right click (press and release)
-        DEBUG("Mouse right-click");
-        Mouse.press(MOUSE_RIGHT);
-        delay(8);
-        Mouse.release(MOUSE_RIGHT);
-      }
-      
-      // Update last move time
-      last_move_time = millis();
-      next_move_time = millis() + calculateMoveInterval();
-      
-      request->send(200, "application/json", "{\"status\":\"success\"}");
-    } else {
-      request->send(400, "application/json", "{\"status\":\"error\",\"message\":\"Invalid JSON\"}");
-    }
+    String response;
+    serializeJson(doc, response);
+    
+    sendText(request, 200, "application/json", response);
   });
   
-  // API endpoint for touchpad button state (pressed/released)
-  server->on("/api/touchpad/button", HTTP_POST, [](AsyncWebServerRequest *request) {
-    // Only validate the session in the first handler
+  // API endpoint to change the log level at run time
+  onRoute("/api/logs/level", HTTP_POST, [](AsyncWebServerRequest *request) {
     if (!validateSession(request)) {
-      request->send(401, "application/json", "{\"status\":\"unauthorized\"}");
-      request->_tempObject = (void*)1; // Mark as processed
+      sendText(request, 401, "application/json", "{\"status\":\"unauthorized\"}");
       return;
     }
-  }, NULL, [](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
-    // Check if response was already sent
-    if (request->_tempObject != NULL) {
+    const RequestBody* body = requestBody(request);
+    if (body == NULL) {
       return;
     }
     
     StaticJsonDocument<128> doc;
-    DeserializationError error = deserializeJson(doc, data, len);
+    DeserializationError error = deserializeJson(doc, body->data, body->length);
+    int level = error ? -1 : parseLogLevel(doc["level"] | "");
     
-    if (!error) {
-      String button = doc["button"].as<String>();
-      String state = doc["state"].as<String>();
-      
-      if (button == "left") {
-        if (state == "press") {
-          // Press left button without releasing
-          DEBUG("Mouse left button pressed");
-          Mouse.press(MOUSE_LEFT);
-        } else if (state == "release") {
-          // Release left button
-          DEBUG("Mouse left button released");
-          Mouse.release(MOUSE_LEFT);
-        }
-      } else if (button == "right") {
-        if (state == "press") {
-          // Press right button without releasing
-          DEBUG("Mouse right button pressed");
-          Mouse.press(MOUSE_RIGHT);
-        } else if (state == "release") {
-          // Release right button
-          DEBUG("Mouse right button released");
-          Mouse.release(MOUSE_RIGHT);
-        }
-      }
-      
-      // Update last move time
-      last_move_time = millis();
-      next_move_time = millis() + calculateMoveInterval();
-      
-      request->send(200, "application/json", "{\"status\":\"success\"}");
+    if (level >= 0) {
+      log_level = level;
+      LOG_INFO("Log level set to %s", logLevelName(level));
+      sendText(request, 200, "application/json", "{\"status\":\"success\"}");
     } else {
-      request->send(400, "application/json", "{\"status\":\"error\",\"message\":\"Invalid JSON\"}");
+      sendText(request, 400, "application/json", "{\"status\":\"error\",\"message\":\"Unknown log level\"}");
     }
-  });
+  }, NULL, collectBody);
   
-  // API endpoint for touchpad mouse scroll
-  server->on("/api/touchpad/scroll", HTTP_POST, [](AsyncWebServerRequest *request) {
-    // Only validate the session in the first handler
+  // Live log stream (server-sent events), registered after /api/logs/level
+  // so the prefix match does not take it. A new client first gets the recent
+  // backlog, or what it missed when reconnecting with Last-Event-ID.
+  onRoute("/api/logs", HTTP_GET, [](AsyncWebServerRequest *request) {
     if (!validateSession(request)) {
-      request->send(401, "application/json", "{\"status\":\"unauthorized\"}");
-      request->_tempObject = (void*)1; // Mark as processed
+      sendText(request, 401, "application/json", "{\"status\":\"unauthorized\"}");
       return;
     }
-  }, NULL, [](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
-    // Check if response was already sent
-    if (request->_tempObject != NULL) {
+    
+    uint32_t head = log_head.load();
+    LogStreamCursor cursor;
+    cursor.next = head > log_replay_records ? head - log_replay_records : 0;
+    cursor.opened = false;
+    if (request->hasHeader("Last-Event-ID")) {
+      uint32_t last_id = strtoul(request->header("Last-Event-ID").c_str(), NULL, 10);
+      if (last_id > cursor.next && last_id <= head) {
+        cursor.next = last_id;
+      }
+    }
+    log_stream_clients++;
+    request->onDisconnect([]() {
+      log_stream_clients--;
+    });
+    recordResponse(200, RESPONSE_SIZE_UNKNOWN);
+    AsyncWebServerResponse *response = request->beginChunkedResponse("text/event-stream",
+      [cursor](uint8_t *buffer, size_t maxLen, size_t index) mutable -> size_t {
+        return fillLogStream(cursor, buffer, maxLen);
+      });
+    response->addHeader("Cache-Control", "no-cache");
+    request->send(response);
+  });
+  
+  // Download the trace ring as Chrome trace-event JSON. Recording pauses while
+  // the export runs and resumes when it finishes or the client goes away; a
+  // second export meanwhile gets 409.
+  onRoute("/api/trace", HTTP_GET, [](AsyncWebServerRequest *request) {
+    if (!validateSession(request)) {
+      sendText(request, 401, "application/json", "{\"status\":\"unauthorized\"}");
+      return;
+    }
+    
+    TraceExport cursor;
+    if (!traceExportBegin(cursor)) {
+      sendText(request, 409, "application/json", "{\"status\":\"error\",\"message\":\"Another trace export is running\"}");
+      return;
+    }
+    uint32_t export_id = cursor.id;
+    request->onDisconnect([export_id]() {
+      traceExportEnd(export_id);
+    });
+    recordResponse(200, RESPONSE_SIZE_UNKNOWN);
+    AsyncWebServerResponse *response = request->beginChunkedResponse("application/json",
+      [cursor](uint8_t *buffer, size_t maxLen, size_t index) mutable -> size_t {
+        return traceExport(cursor, buffer, maxLen);
+      });
+    response->addHeader("Content-Disposition", "attachment; filename=\"jiggla-trace.json\"");
+    request->send(response);
+  });
+  
+  // API endpoint to reset the step timing histograms in /api/status. The
+  // motion engine clears them before its next pattern.
+  onRoute("/api/status/step_timing/reset", HTTP_POST, [](AsyncWebServerRequest *request) {
+    if (!validateSession(request)) {
+      sendText(request, 401, "application/json", "{\"status\":\"unauthorized\"}");
+      return;
+    }
+    step_reset_requested = true;
+    sendText(request, 200, "application/json", "{\"status\":\"success\"}");
+  });
+  
+  // API endpoint listing the movement patterns, built-in and installed
+  onRoute("/api/patterns", HTTP_GET, [](AsyncWebServerRequest *request) {
+    if (!validateSession(request)) {
+      sendText(request, 401, "application/json", "{\"status\":\"unauthorized\"}");
+      return;
+    }
+    
+    StaticJsonDocument<1536> doc;
+    JsonArray list = doc.createNestedArray("patterns");
+    for (int i = 0; i < PATTERN_COUNT; i++) {
+      JsonObject pattern = list.createNestedObject();
+      pattern["name"] = patterns[i].name;
+      pattern["builtin"] = true;
+    }
+    for (const PatternFileEntry& entry : pattern_files) {
+      if (entry.name[0] == '\0') {
+        continue;
+      }
+      JsonObject pattern = list.createNestedObject();
+      pattern["name"] = entry.name;
+      pattern["builtin"] = false;
+      pattern["type"] = entry.kind == PATTERN_FILE_SCRIPT ? "script" : "path";
+      if (entry.kind == PATTERN_FILE_SCRIPT) {
+        pattern["instructions"] = entry.step_count;
+      } else {
+        pattern["segments"] = entry.segment_count;
+        pattern["steps"] = entry.step_count;
+      }
+      pattern["bytes"] = entry.size;
+    }
+    doc["max_files"] = MAX_PATTERN_FILES;
+    doc["max_bytes"] = PATTERN_FILE_MAX_SIZE;
+    
+    String response;
+    serializeJson(doc, response);
+    
+    sendText(request, 200, "application/json", response);
+  });
+  
+  // Remove an installed pattern file; a config naming it falls back to linear.
+  // Registered before the upload route, which also matches /api/patterns/*.
+  onRoute("/api/patterns/delete", HTTP_POST, [](AsyncWebServerRequest *request) {
+    if (!validateSession(request)) {
+      sendText(request, 401, "application/json", "{\"status\":\"unauthorized\"}");
+      return;
+    }
+    const RequestBody* body = requestBody(request);
+    if (body == NULL) {
+      return;
+    }
+    
+    StaticJsonDocument<128> doc;
+    DeserializationError error = deserializeJson(doc, body->data, body->length);
+    const char* name = error ? "" : (doc["name"] | "");
+    if (findPattern(name) < PATTERN_COUNT) {
+      sendText(request, 404, "application/json", "{\"status\":\"error\",\"message\":\"No such pattern file\"}");
+      return;
+    }
+    if (xSemaphoreTake(motion_mutex, pdMS_TO_TICKS(100)) != pdTRUE) {
+      sendText(request, 503, "application/json", "{\"status\":\"error\",\"message\":\"A pattern is running, try again\"}");
+      return;
+    }
+    removePatternFile(name);
+    xSemaphoreGive(motion_mutex);
+    LOG_INFO("Pattern %s deleted", name);
+    sendText(request, 200, "application/json", "{\"status\":\"success\"}");
+  }, NULL, collectBody);
+  
+  // Install a pattern file (multipart upload, optional "name" field, else the
+  // file name without extension). The file is validated before it replaces
+  // an installed pattern of the same name.
+  onRoute("/api/patterns", HTTP_POST, [](AsyncWebServerRequest *request) {
+    if (!validateSession(request)) {
+      sendText(request, 401, "application/json", "{\"status\":\"unauthorized\"}");
+      return;
+    }
+    if (pattern_upload.owner != request) {
+      sendText(request, pattern_upload.owner != NULL ? 409 : 400, "application/json",
+               "{\"status\":\"error\",\"message\":\"No pattern file received, or another upload is in progress\"}");
+      return;
+    }
+    bool failed = pattern_upload.failed;
+    bool too_large = pattern_upload.too_large;
+    uint32_t size = pattern_upload.size;
+    char name[PATTERN_NAME_LEN];
+    if (request->hasParam("name", true)) {
+      strlcpy(name, request->getParam("name", true)->value().c_str(), sizeof(name));
+    } else {
+      strlcpy(name, pattern_upload.filename, sizeof(name));
+      char* extension = strrchr(name, '.');
+      if (extension != NULL) {
+        *extension = '\0';
+      }
+    }
+    endPatternUpload();
+    
+    const char* error = NULL;
+    int code = 400;
+    PatternFileEntry info = {};
+    if (failed) {
+      error = too_large ? "Pattern file too large" : "Could not store the upload";
+      code = too_large ? 413 : 500;
+    } else if (!isValidPatternFileName(name)) {
+      error = "Pattern names are 1-16 characters of a-z, 0-9, '-' or '_' and may not replace a built-in pattern";
+    } else {
+      error = checkPatternFile(pattern_upload_path, info);
+      strlcpy(info.name, name, sizeof(info.name));
+    }
+    
+    if (error == NULL) {
+      error = storePatternFile(pattern_upload_path, info, code);
+    }
+    SPIFFS.remove(pattern_upload_path);
+    
+    StaticJsonDocument<384> doc;
+    if (error != NULL) {
+      LOG_WARN("Pattern upload %s rejected: %s", name, error);
+      doc["status"] = "error";
+      doc["message"] = error;
+    } else {
+      LOG_INFO("Pattern %s installed (%u steps, %u bytes)", name, (unsigned)info.step_count, (unsigned)size);
+      doc["status"] = "success";
+      doc["name"] = name;
+      doc["type"] = info.kind == PATTERN_FILE_SCRIPT ? "script" : "path";
+      if (info.kind == PATTERN_FILE_SCRIPT) {
+        doc["instructions"] = info.step_count;
+      } else {
+        doc["segments"] = info.segment_count;
+        doc["steps"] = info.step_count;
+      }
+      doc["bytes"] = size;
+      code = 200;
+    }
+    String response;
+    serializeJson(doc, response);
+    sendText(request, code, "application/json", response);
+  }, handlePatternUpload);
+  
+  // Touchpad macro recording; the sender task records, so start and stop
+  // travel through its ring like the input itself.
+  //
+  // Outcome of the last /api/macro/stop: 202 until the macro is saved, 404
+  // before the first. Registered ahead of /api/macro, which would also match.
+  onRoute("/api/macro/result", HTTP_GET, [](AsyncWebServerRequest *request) {
+    if (!validateSession(request)) {
+      sendText(request, 401, "application/json", "{\"status\":\"unauthorized\"}");
+      return;
+    }
+    
+    uint8_t state = macro_state.load(std::memory_order_acquire);
+    if (state == MACRO_RECORDING || state == MACRO_STOPPED || state == MACRO_WRITTEN) {
+      sendText(request, 202, "application/json", "{\"status\":\"saving\"}");
+      return;
+    }
+    if (state != MACRO_SAVED) {
+      sendText(request, 404, "application/json", "{\"status\":\"none\"}");
+      return;
+    }
+    
+    StaticJsonDocument<256> reply;
+    if (macro_result.error != NULL) {
+      reply["status"] = "error";
+      reply["message"] = macro_result.error;
+    } else {
+      reply["status"] = "success";
+      reply["name"] = macro_result.name;
+      reply["instructions"] = macro_result.instructions;
+      reply["duration_ms"] = macro_result.duration_ms;
+      reply["truncated"] = macro_result.truncated;
+    }
+    String response;
+    serializeJson(reply, response);
+    sendText(request, macro_result.code, "application/json", response);
+  });
+  
+  onRoute("/api/macro", HTTP_GET, [](AsyncWebServerRequest *request) {
+    if (!validateSession(request)) {
+      sendText(request, 401, "application/json", "{\"status\":\"unauthorized\"}");
+      return;
+    }
+    
+    StaticJsonDocument<192> doc;
+    uint8_t state = macro_state.load();
+    doc["recording"] = state == MACRO_RECORDING;
+    doc["instructions"] = state == MACRO_RECORDING ? macro.count : 0;
+    doc["max_instructions"] = SCRIPT_MAX_INSTRUCTIONS;
+    doc["duration_ms"] = state == MACRO_RECORDING ? macro.recorded_ms : 0;
+    doc["truncated"] = state == MACRO_RECORDING && macro.truncated;
+    
+    String response;
+    serializeJson(doc, response);
+    
+    sendText(request, 200, "application/json", response);
+  });
+  
+  onRoute("/api/macro/record", HTTP_POST, [](AsyncWebServerRequest *request) {
+    if (!validateSession(request)) {
+      sendText(request, 401, "application/json", "{\"status\":\"unauthorized\"}");
+      return;
+    }
+    uint8_t state = macro_state.load();
+    if (state == MACRO_STOPPED || state == MACRO_WRITTEN) {
+      sendText(request, 409, "application/json", "{\"status\":\"error\",\"message\":\"The last macro is still being saved\"}");
+      return;
+    }
+    HidCommand command = {};
+    command.type = HID_CMD_MACRO_START;
+    if (!pushHidCommand(command)) {
+      sendText(request, 503, "application/json", "{\"status\":\"busy\"}");
+      return;
+    }
+    LOG_INFO("Macro recording started");
+    sendText(request, 200, "application/json", "{\"status\":\"success\"}");
+  });
+  
+  // Stop recording and save the macro as a script pattern named in the body.
+  // Answers 202 right away; the motion engine saves it and the outcome is
+  // fetched from /api/macro/result.
+  onRoute("/api/macro/stop", HTTP_POST, [](AsyncWebServerRequest *request) {
+    if (!validateSession(request)) {
+      sendText(request, 401, "application/json", "{\"status\":\"unauthorized\"}");
+      return;
+    }
+    const RequestBody* body = requestBody(request);
+    if (body == NULL) {
+      return;
+    }
+    
+    StaticJsonDocument<128> doc;
+    DeserializationError parse_error = deserializeJson(doc, body->data, body->length);
+    char name[PATTERN_NAME_LEN];
+    strlcpy(name, parse_error ? "" : (doc["name"] | ""), sizeof(name));
+    if (macro_state.load() != MACRO_RECORDING) {
+      sendText(request, 409, "application/json", "{\"status\":\"error\",\"message\":\"Not recording\"}");
+      return;
+    }
+    if (!isValidPatternFileName(name)) {
+      sendText(request, 400, "application/json",
+               "{\"status\":\"error\",\"message\":\"Macro names are 1-16 characters of a-z, 0-9, '-' or '_'\"}");
+      return;
+    }
+    
+    strlcpy(macro_result.name, name, sizeof(macro_result.name));
+    HidCommand command = {};
+    command.type = HID_CMD_MACRO_STOP;
+    if (!pushHidCommand(command)) {
+      sendText(request, 503, "application/json", "{\"status\":\"busy\"}");
+      return;
+    }
+    sendText(request, 202, "application/json", "{\"status\":\"saving\",\"result\":\"/api/macro/result\"}");
+  }, NULL, collectBody);
+  
+  // Run an installed pattern or macro once now, from flash on the motion engine
+  onRoute("/api/macro/play", HTTP_POST, [](AsyncWebServerRequest *request) {
+    if (!validateSession(request)) {
+      sendText(request, 401, "application/json", "{\"status\":\"unauthorized\"}");
+      return;
+    }
+    const RequestBody* body = requestBody(request);
+    if (body == NULL) {
+      return;
+    }
+    
+    StaticJsonDocument<128> doc;
+    DeserializationError error = deserializeJson(doc, body->data, body->length);
+    const char* name = error ? "" : (doc["name"] | "");
+    if (findPattern(name) < 0) {
+      sendText(request, 404, "application/json", "{\"status\":\"error\",\"message\":\"No such pattern\"}");
+      return;
+    }
+    if (play_requested.load()) {
+      sendText(request, 503, "application/json", "{\"status\":\"busy\"}");
+      return;
+    }
+    strlcpy(play_pattern, name, sizeof(play_pattern));
+    play_requested.store(true, std::memory_order_release);
+    wakeScheduler();
+    sendText(request, 200, "application/json", "{\"status\":\"success\"}");
+  }, NULL, collectBody);
+  
+  // API endpoint to update configuration
+  onRoute("/api/config", HTTP_POST, [](AsyncWebServerRequest *request) {
+    if (!validateSession(request)) {
+      sendText(request, 401, "application/json", "{\"status\":\"unauthorized\"}");
+      return;
+    }
+    const RequestBody* body = requestBody(request);
+    if (body == NULL) {
+      return;
+    }
+    
+    StaticJsonDocument<2048> doc;
+    DeserializationError error = deserializeJson(doc, body->data, body->length);
+    
+    if (!error) {
+      // Update a copy, the motion engine keeps its snapshot until we publish
+      MotionConfig config = motion_config;
+      
+      // A profile list replaces all profiles, a window list the whole
+      // schedule. The main timer restarts only when something else changed.
+      uint32_t reschedule = 0;
+      size_t own_keys = 0;
+      const char* problem = NULL;
+      if (doc.containsKey("profiles")) {
+        own_keys++;
+        JsonArrayConst list = doc["profiles"];
+        problem = list.isNull() || list.size() > (size_t)MAX_PROFILES ? "Too many profiles" : NULL;
+        config.profile_count = 0;
+        for (JsonObjectConst item : list) {
+          if (problem != NULL) {
+            break;
+          }
+          JiggleProfile& profile = config.profiles[config.profile_count++];
+          problem = parseProfile(item, profile);
+          if (problem == NULL && findPattern(profile.movement_pattern) < 0) {
+            problem = "Unknown pattern";
+          }
+        }
+        for (int i = 0; i < MAX_PROFILES; i++) {
+          reschedule |= 1UL << (i + 1);
+        }
+      }
+      if (doc.containsKey("schedule_enabled")) {
+        own_keys++;
+        config.schedule_enabled = doc["schedule_enabled"].as<bool>();
+      }
+      if (doc.containsKey("schedule") && problem == NULL) {
+        own_keys++;
+        JsonArrayConst list = doc["schedule"];
+        problem = list.isNull() || list.size() > (size_t)MAX_SCHEDULE_WINDOWS ? "Too many schedule windows" : NULL;
+        config.schedule_count = 0;
+        for (JsonObjectConst item : list) {
+          if (problem != NULL) {
+            break;
+          }
+          problem = parseScheduleWindow(item, config.schedule[config.schedule_count++]);
+        }
+      }
+      if (problem != NULL) {
+        StaticJsonDocument<128> reply;
+        reply["status"] = "error";
+        reply["message"] = problem;
+        String response;
+        serializeJson(reply, response);
+        sendText(request, 400, "application/json", response);
+        return;
+      }
+      if (doc.size() > own_keys) {
+        reschedule |= 1UL << MAIN_MOVE_TIMER;
+      }
+      
+      // Update configuration
+      if (doc.containsKey("jiggler_enabled")) {
+        config.jiggler_enabled = doc["jiggler_enabled"].as<bool>();
+      }
+      
+      if (doc.containsKey("movement_pattern")) {
+        strlcpy(config.movement_pattern, doc["movement_pattern"] | "linear", PATTERN_NAME_LEN);
+      } else if (doc.containsKey("circular_movement")) {
+        // Handle legacy parameter
+        bool circular = doc["circular_movement"].as<bool>();
+        strlcpy(config.movement_pattern, circular ? "circular" : "linear", PATTERN_NAME_LEN);
+      }
+      
+      if (doc.containsKey("move_interval")) {
+        config.move_interval = doc["move_interval"].as<int>() * 1000; // Convert from seconds to milliseconds
+      }
+      
+      if (doc.containsKey("movement_size")) {
+        config.movement_size = doc["movement_size"].as<int>();
+      } else {
+        // For backwards compatibility
+        if (doc.containsKey("movement_x")) {
+          config.movement_size = abs(doc["movement_x"].as<int>());
+        }
+        if (doc.containsKey("movement_y")) {
+          // Use the larger of X or Y
+          config.movement_size = max(config.movement_size, abs(doc["movement_y"].as<int>()));
+        }
+      }
+      
+      if (doc.containsKey("movement_speed")) {
+        config.movement_speed = doc["movement_speed"].as<int>();
+      }
+      
+      if (doc.containsKey("random_delay")) {
+        config.random_delay = doc["random_delay"].as<bool>();
+      }
+      
+      if (doc.containsKey("movement_trail")) {
+        config.movement_trail = doc["movement_trail"].as<bool>();
+      }
+      
+      if (doc.containsKey("input_idle_resume")) {
+        // Clamp the seconds before scaling them, so a huge value cannot overflow
+        long seconds = doc["input_idle_resume"].as<long>();
+        config.input_idle_resume = constrain(seconds, 0L, (long)(max_input_idle_resume / 1000)) * 1000;
+      }
+      
+      // Publish and save configuration
+      motion_config = config;
+      publishMotionConfig();
+      saveConfig();
+      
+      // The motion engine draws the new deadlines
+      reschedule_requested.fetch_or(reschedule, std::memory_order_release);
+      if (doc.containsKey("schedule_enabled") || doc.containsKey("schedule")) {
+        schedule_update_requested.store(true, std::memory_order_release);
+      }
+      wakeScheduler();
+      
+      DEBUG("Configuration updated via API");
+      sendText(request, 200, "application/json", "{\"status\":\"success\"}");
+    } else {
+      sendText(request, 400, "application/json", "{\"status\":\"error\",\"message\":\"Invalid JSON\"}");
+    }
+  }, NULL, collectBody);
+  
+  // Set the clock from the browser: {"epoch": seconds, "utc_offset": minutes
+  // east of UTC}. SNTP time wins over the browser's, the offset is kept.
+  onRoute("/api/time", HTTP_POST, [](AsyncWebServerRequest *request) {
+    if (!validateSession(request)) {
+      sendText(request, 401, "application/json", "{\"status\":\"unauthorized\"}");
+      return;
+    }
+    const RequestBody* body = requestBody(request);
+    if (body == NULL) {
+      return;
+    }
+    
+    StaticJsonDocument<128> doc;
+    if (deserializeJson(doc, body->data, body->length)) {
+      sendText(request, 400, "application/json", "{\"status\":\"error\",\"message\":\"Invalid JSON\"}");
+      return;
+    }
+    int offset = constrain(doc["utc_offset"] | (int)clock_utc_offset, -12 * 60, 14 * 60);
+    uint32_t epoch = doc["epoch"] | 0UL;
+    if (clock_source != CLOCK_SNTP && epoch >= 1600000000UL) {
+      struct timeval now = { (time_t)epoch, 0 };
+      settimeofday(&now, NULL);
+      clock_source = CLOCK_BROWSER;
+    }
+    if (offset != clock_utc_offset) {
+      clock_utc_offset = offset;
+      saveConfig();
+    }
+    schedule_update_requested.store(true, std::memory_order_release);
+    wakeScheduler();
+    
+    StaticJsonDocument<96> reply;
+    reply["status"] = "success";
+    reply["source"] = clockSourceName(clock_source);
+    String response;
+    serializeJson(reply, response);
+    sendText(request, 200, "application/json", response);
+  }, NULL, collectBody);
+  
+  // API endpoint to trigger mouse movement immediately
+  onRoute("/api/move", HTTP_POST, [](AsyncWebServerRequest *request) {
+    if (!validateSession(request)) {
+      sendText(request, 401, "application/json", "{\"status\":\"unauthorized\"}");
+      return;
+    }
+    
+    // Let the motion engine move the mouse based on current movement pattern
+    move_requested = true;
+    wakeScheduler();
+    
+    sendText(request, 200, "application/json", "{\"status\":\"success\"}");
+  });
+  
+  // API endpoint to get settings
+  onRoute("/api/settings", HTTP_GET, [](AsyncWebServerRequest *request) {
+    if (!validateSession(request)) {
+      sendText(request, 401, "application/json", "{\"status\":\"unauthorized\"}");
+      return;
+    }
+    
+    StaticJsonDocument<512> doc;
+    
+    // AP settings
+    JsonObject ap = doc.createNestedObject("ap");
+    ap["ssid"] = settings.ap_ssid;
+    ap["password"] = settings.ap_password;
+    ap["hidden"] = settings.ap_hidden;
+    
+    // Hostname at root level
+    doc["hostname"] = settings.hostname;
+    
+    // WiFi mode settings
+    doc["wifi_mode"] = wifiModeName(settings.wifi_mode);
+    doc["ap_availability"] = apAvailabilityName(settings.ap_availability);
+    doc["ap_timeout"] = settings.ap_timeout;
+    
+    // STA settings
+    JsonObject sta = doc.createNestedObject("sta");
+    sta["ssid"] = settings.sta_ssid;
+    sta["password"] = settings.sta_password;
+    
+    // Auth settings
+    JsonObject auth = doc.createNestedObject("auth");
+    auth["enabled"] = settings.auth_enabled;
+    auth["username"] = settings.username;
+    auth["password"] = settings.auth_password;
+    
+    // Web port
+    doc["web_port"] = settings.web_port;
+    
+    String response;
+    serializeJson(doc, response);
+    
+    sendText(request, 200, "application/json", response);
+  });
+  
+  // API endpoint to update settings
+  onRoute("/api/settings", HTTP_POST, [](AsyncWebServerRequest *request) {
+    if (!validateSession(request)) {
+      sendText(request, 401, "application/json", "{\"status\":\"unauthorized\"}");
+      return;
+    }
+    const RequestBody* body = requestBody(request);
+    if (body == NULL) {
+      return;
+    }
+    
+    StaticJsonDocument<512> doc;
+    DeserializationError error = deserializeJson(doc, body->data, body->length);
+    
+    if (!error) {
+      // Edit a copy so a rejected request leaves the settings untouched
+      Settings updated = settings;
+      bool changed = false;
+      const char* problem = NULL; // First refused value
+      
+      // Update AP settings
+      if (doc.containsKey("ap")) {
+        if (doc["ap"].containsKey("ssid")) {
+          if (problem == NULL) {
+            problem = copySetting(updated.ap_ssid, sizeof(updated.ap_ssid), doc["ap"]["ssid"]);
+          }
+          changed = true;
+        }
+        if (doc["ap"].containsKey("password")) {
+          if (problem == NULL) {
+            problem = copySetting(updated.ap_password, sizeof(updated.ap_password), doc["ap"]["password"]);
+          }
+          changed = true;
+        }
+        if (doc["ap"].containsKey("hidden")) {
+          updated.ap_hidden = doc["ap"]["hidden"].as<bool>();
+          changed = true;
+        }
+      }
+      
+      // Update hostname (now at root level)
+      if (doc.containsKey("hostname")) {
+        if (problem == NULL) {
+          problem = copySetting(updated.hostname, sizeof(updated.hostname), doc["hostname"]);
+        }
+        changed = true;
+      }
+      
+      // Update WiFi mode settings
+      if (doc.containsKey("wifi_mode")) {
+        updated.wifi_mode = parseWifiMode(doc["wifi_mode"].as<const char*>());
+        changed = true;
+      }
+      
+      if (doc.containsKey("ap_availability")) {
+        updated.ap_availability = parseApAvailability(doc["ap_availability"].as<const char*>());
+        changed = true;
+      }
+      
+      if (doc.containsKey("ap_timeout")) {
+        updated.ap_timeout = doc["ap_timeout"].as<int>();
+        changed = true;
+      }
+      
+      // Update STA settings
+      if (doc.containsKey("sta")) {
+        if (doc["sta"].containsKey("ssid")) {
+          if (problem == NULL) {
+            problem = copySetting(updated.sta_ssid, sizeof(updated.sta_ssid), doc["sta"]["ssid"]);
+          }
+          changed = true;
+        }
+        if (doc["sta"].containsKey("password")) {
+          if (problem == NULL) {
+            problem = copySetting(updated.sta_password, sizeof(updated.sta_password), doc["sta"]["password"]);
+          }
+          changed = true;
+        }
+      }
+      
+      // Update Auth settings
+      if (doc.containsKey("auth")) {
+        if (doc["auth"].containsKey("enabled")) {
+          updated.auth_enabled = doc["auth"]["enabled"].as<bool>();
+          changed = true;
+        }
+        if (doc["auth"].containsKey("username")) {
+          if (problem == NULL) {
+            problem = copySetting(updated.username, sizeof(updated.username), doc["auth"]["username"]);
+          }
+          changed = true;
+        }
+        if (doc["auth"].containsKey("password") && doc["auth"]["password"].as<String>().length() > 0) {
+          if (problem == NULL) {
+            problem = copySetting(updated.auth_password, sizeof(updated.auth_password), doc["auth"]["password"]);
+          }
+          changed = true;
+        }
+      }
+      
+      // Update web port
+      if (doc.containsKey("web_port")) {
+        updated.web_port = doc["web_port"].as<int>();
+        changed = true;
+      }
+      
+      if (problem != NULL) {
+        StaticJsonDocument<128> reply;
+        reply["status"] = "error";
+        reply["message"] = problem;
+        String response;
+        serializeJson(reply, response);
+        sendText(request, 400, "application/json", response);
+      } else if (changed) {
+        // Save settings and hand them to loop()
+        settings = updated;
+        publishSettings();
+        saveSettings();
+        wakeScheduler(); // handleWiFi() redraws the AP timeout
+        
+        sendText(request, 200, "application/json", "{\"status\":\"success\",\"message\":\"Settings updated successfully\"}");
+      } else {
+        sendText(request, 200, "application/json", "{\"status\":\"warning\",\"message\":\"No changes were made\"}");
+      }
+    } else {
+      sendText(request, 400, "application/json", "{\"status\":\"error\",\"message\":\"Invalid JSON\"}");
+    }
+  }, NULL, collectBody);
+  
+  // API endpoint to reboot device
+  onRoute("/api/reboot", HTTP_POST, [](AsyncWebServerRequest *request) {
+    if (!validateSession(request)) {
+      sendText(request, 401, "application/json", "{\"status\":\"unauthorized\"}");
+      return;
+    }
+    
+    // Send response before rebooting
+    sendText(request, 200, "application/json", "{\"status\":\"success\",\"message\":\"Rebooting device\"}");
+    
+    // Reboot from loop() once the response is out
+    requestRestart();
+  });
+  
+  // Serve the OTA update page with authentication
+  onRoute("/ota.html", HTTP_GET, [](AsyncWebServerRequest *request) {
+    if (!validateSession(request)) {
+      sendRedirect(request, "/login");
+      return;
+    }
+    
+    sendFile(request, "/ota.html", "text/html");
+  });
+  
+  // Handle redirect from /update to /ota.html
+  onRoute("/update", HTTP_GET, [](AsyncWebServerRequest *request) {
+    if (!validateSession(request)) {
+      sendRedirect(request, "/login");
+      return;
+    }
+    sendRedirect(request, "/ota.html");
+  });
+  
+  // Handle OTA update file upload
+  onRoute("/update", HTTP_POST, [](AsyncWebServerRequest *request) {
+    // Send the response first
+    const char* body = (Update.hasError()) ? "Update failed!" : "Update success! Rebooting...";
+    AsyncWebServerResponse *response = request->beginResponse(200, "text/plain", body);
+    response->addHeader("Connection", "close");
+    sendResponse(request, response, 200, strlen(body));
+    
+    // Restart from loop() once the response is out
+    requestRestart();
+  }, [](AsyncWebServerRequest *request, String filename, size_t index, uint8_t *data, size_t len, bool final) {
+    // Check authentication
+    if (!validateSession(request)) {
+      return;
+    }
+    
+    // Get update type parameter (firmware or filesystem)
+    String updateType = "firmware"; // Default to firmware
+    if (request->hasParam("update_type", true)) {
+      updateType = request->getParam("update_type", true)->value();
+    }
+    
+    // First chunk received
+    if (index == 0) {
+      LOG_INFO("OTA Update started: %s (Type: %s)", filename.c_str(), updateType.c_str());
+      
+      // Start update with appropriate command based on type
+      int cmd = (updateType == "filesystem") ? U_SPIFFS : U_FLASH;
+      
+      if (!Update.begin(UPDATE_SIZE_UNKNOWN, cmd)) {
+        LOG_ERROR("OTA error: %s", Update.errorString());
+      }
+    }
+    
+    // Write chunk to flash
+    if (Update.write(data, len) != len) {
+      LOG_ERROR("OTA error: %s", Update.errorString());
+    }
+    
+    // Final chunk - finish update
+    if (final) {
+      if (Update.end(true)) {
+        LOG_INFO("OTA update successful. Rebooting...");
+      } else {
+        LOG_ERROR("OTA error: %s", Update.errorString());
+      }
+    }
+  });
+  
+  // API endpoint for touchpad mouse movement
+  onRoute("/api/touchpad/move", HTTP_POST, [](AsyncWebServerRequest *request) {
+    if (!validateSession(request)) {
+      sendText(request, 401, "application/json", "{\"status\":\"unauthorized\"}");
+      return;
+    }
+    const RequestBody* body = requestBody(request);
+    if (body == NULL) {
+      return;
+    }
+    
+    HidCommand command = {};
+    command.received_us = body->received_us;
+    StaticJsonDocument<128> doc;
+    DeserializationError error = deserializeJson(doc, body->data, body->length);
+    
+    if (!error) {
+      command.parsed_us = esp_timer_get_time();
+      command.seq = doc["seq"].as<uint32_t>();
+      
+      // Move mouse by the specified amount
+      addHidAction(command, 0, HID_ACTION_MOVE, 0, doc["x"].as<int>(), doc["y"].as<int>());
+      bool queued = queueHidCommand(command);
+      
+      noteActivity(true);
+      
+      sendInputAck(request, command, queued);
+    } else {
+      sendText(request, 400, "application/json", "{\"status\":\"error\",\"message\":\"Invalid JSON\"}");
+    }
+  }, NULL, collectBody);
+  
+  // API endpoint for touchpad mouse clicks
+  onRoute("/api/touchpad/click", HTTP_POST, [](AsyncWebServerRequest *request) {
+    if (!validateSession(request)) {
+      sendText(request, 401, "application/json", "{\"status\":\"unauthorized\"}");
+      return;
+    }
+    const RequestBody* body = requestBody(request);
+    if (body == NULL) {
+      return;
+    }
+    
+    HidCommand command = {};
+    command.received_us = body->received_us;
+    StaticJsonDocument<128> doc;
+    DeserializationError error = deserializeJson(doc, body->data, body->length);
+    
+    if (!error) {
+      command.parsed_us = esp_timer_get_time();
+      command.seq = doc["seq"].as<uint32_t>();
+      String button = doc["button"].as<String>();
+      String clickType = doc["clickType"].as<String>();
+      
+      uint8_t mouseButton = 0;
+      int clicks = 1;
+      if (button == "left") {
+        mouseButton = MOUSE_LEFT;
+        if (clickType == "double") {
+          DEBUG("Mouse double-click");
+          clicks = 2;
+        } else {
+          DEBUG("Mouse single-click");
+        }
+      } else if (button == "right") {
+        DEBUG("Mouse right-click");
+        mouseButton = MOUSE_RIGHT;
+      }
+      
+      // Press and release every HID_CLICK_HOLD_MS; the sender times the reports
+      if (mouseButton != 0) {
+        for (int i = 0; i < clicks; i++) {
+          addHidAction(command, (2 * i) * HID_CLICK_HOLD_MS, HID_ACTION_PRESS, mouseButton);
+          addHidAction(command, (2 * i + 1) * HID_CLICK_HOLD_MS, HID_ACTION_RELEASE, mouseButton);
+        }
+      }
+      bool queued = command.step_count == 0 || queueHidCommand(command);
+      
+      noteActivity(true);
+      
+      sendInputAck(request, command, queued);
+    } else {
+      sendText(request, 400, "application/json", "{\"status\":\"error\",\"message\":\"Invalid JSON\"}");
+    }
+  }, NULL, collectBody);
+  
+  // API endpoint for touchpad button state (pressed/released)
+  onRoute("/api/touchpad/button", HTTP_POST, [](AsyncWebServerRequest *request) {
+    if (!validateSession(request)) {
+      sendText(request, 401, "application/json", "{\"status\":\"unauthorized\"}");
+      return;
+    }
+    const RequestBody* body = requestBody(request);
+    if (body == NULL) {
+      return;
+    }
+    
+    HidCommand command = {};
+    command.received_us = body->received_us;
+    StaticJsonDocument<128> doc;
+    DeserializationError error = deserializeJson(doc, body->data, body->length);
+    
+    if (!error) {
+      command.parsed_us = esp_timer_get_time();
+      command.seq = doc["seq"].as<uint32_t>();
+      String button = doc["button"].as<String>();
+      String state = doc["state"].as<String>();
+      
+      uint8_t mouseButton = 0;
+      if (button == "left") {
+        mouseButton = MOUSE_LEFT;
+      } else if (button == "right") {
+        mouseButton = MOUSE_RIGHT;
+      }
+      
+      bool queued = true;
+      if (mouseButton != 0 && (state == "press" || state == "release")) {
+        // Press holds the button until a matching release (dragging)
+        DEBUGF("Mouse %s button %s", button.c_str(), state == "press" ? "pressed" : "released");
+        addHidAction(command, 0, state == "press" ? HID_ACTION_PRESS : HID_ACTION_RELEASE, mouseButton);
+        queued = queueHidCommand(command);
+      }
+      
+      noteActivity(true);
+      
+      sendInputAck(request, command, queued);
+    } else {
+      sendText(request, 400, "application/json", "{\"status\":\"error\",\"message\":\"Invalid JSON\"}");
+    }
+  }, NULL, collectBody);
+  
+  // API endpoint for touchpad mouse scroll
+  onRoute("/api/touchpad/scroll", HTTP_POST, [](AsyncWebServerRequest *request) {
+    if (!validateSession(request)) {
+      sendText(request, 401, "application/json", "{\"status\":\"unauthorized\"}");
+      return;
+    }
+    const RequestBody* body = requestBody(request);
+    if (body == NULL) {
+      return;
+    }
+    
+    HidCommand command = {};
+    command.received_us = body->received_us;
+    StaticJsonDocument<128> doc;
+    DeserializationError error = deserializeJson(doc, body->data, body->length);
+    
+    if (!error) {
+      command.parsed_us = esp_timer_get_time();
+      command.seq = doc["seq"].as<uint32_t>();
+      // Detents, fractions allowed: wheel positive = up (away from the user),
+      // pan positive = right. The older "amount" scrolls down by whole detents.
+      float wheel = doc.containsKey("wheel") ? doc["wheel"].as<float>() : -doc["amount"].as<float>();
+      float pan = doc["pan"] | 0.0f;
+      float glide_ms = doc["glide_ms"] | (float)SCROLL_DEFAULT_GLIDE_MS;
+      command.type = HID_CMD_SCROLL;
+      command.scroll[0] = lroundf(constrain(wheel, -SCROLL_MAX_DETENTS, SCROLL_MAX_DETENTS) * SCROLL_UNITS_PER_DETENT);
+      command.scroll[1] = lroundf(constrain(pan, -SCROLL_MAX_DETENTS, SCROLL_MAX_DETENTS) * SCROLL_UNITS_PER_DETENT);
+      command.glide_ms = (uint16_t)constrain(glide_ms, 0.0f, (float)SCROLL_MAX_GLIDE_MS);
+      bool queued = queueHidCommand(command);
+      
+      noteActivity(true);
+      
+      sendInputAck(request, command, queued);
+    } else {
+      sendText(request, 400, "application/json", "{\"status\":\"error\",\"message\":\"Invalid JSON\"}");
+    }
+  }, NULL, collectBody);
+  
+  // Serve touchpad.html with proper authentication
+  onRoute("/touchpad.html", HTTP_GET, [](AsyncWebServerRequest *request) {
+    DEBUG("Received request for touchpad page");
+    
+    if (!validateSession(request)) {
+      return; // Auth handler already sent response
+    }
+    
+    DEBUG("Auth successful, serving touchpad.html");
+    sendFile(request, "/touchpad.html", "text/html");
+  });
+  
+  // Serve settings-admin.html with proper authentication
+  onRoute("/settings-admin.html", HTTP_GET, [](AsyncWebServerRequest *request) {
+    DEBUG("Received request for settings page");
+    
+    if (!validateSession(request)) {
+      return; // Auth handler already sent response
+    }
+    
+    DEBUG("Auth successful, serving settings-admin.html");
+    sendFile(request, "/settings-admin.html", "text/html");
+  });
+  
+  // Serve touchpad.js with proper headers
+  onRoute("/touchpad.js", HTTP_GET, [](AsyncWebServerRequest *request) {
+    DEBUG("Serving touchpad.js directly");
+    sendFile(request, "/touchpad.js", "application/javascript");
+  });
+  
+  // Serve settings-admin.js with proper headers
+  onRoute("/settings-admin.js", HTTP_GET, [](AsyncWebServerRequest *request) {
+    DEBUG("Serving settings-admin.js directly");
+    sendFile(request, "/settings-admin.js", "application/javascript");
+  });
+  
+  // Start server
+  server->begin();
+  DEBUG("Web server started");
+  
+  // AsyncTCP starts its task on the first begin(); allocations made there
+  // are counted as the request path
+  web_task_handle = xTaskGetHandle("async_tcp");
+}
+
+// Record user or API activity for the power governor
+void noteActivity(bool touchpad) {
+  unsigned long now = millis();
+  if (touchpad) {
+    last_touchpad_activity = now;
+  }
+  last_api_activity = now;
+  unsigned long none = 0;
+  if (pending_activity_us.compare_exchange_strong(none, micros() | 1)) {
+    wakeScheduler();
+  }
+}
+
+// Switch CPU clock and WiFi modem sleep to the given level
+void applyPowerLevel(PowerLevel level) {
+  const PowerProfile& profile = power_profiles[level];
+  unsigned long start = micros();
+  
+  configureCpu(profile.cpu_mhz, light_sleep_allowed);
+  // Only affects the station interface, the soft AP never sleeps
+  WiFi.setSleep(profile.wifi_ps);
+  
+  power_governor.last_switch_us = micros() - start;
+  power_governor.level = level;
+  DEBUGF("Power level %s: %lu MHz", profile.name, (unsigned long)profile.cpu_mhz);
+}
+
+// Pick the power level from recent activity and the jiggle schedule
+void handlePowerGovernor(SchedulerDeadline& next, const MotionConfig& config) {
+  unsigned long now = next.now;
+  PowerLevel target = schedule_state.active ? POWER_IDLE : POWER_OFF_HOURS;
+  bool jiggling = config.jiggler_enabled && schedule_state.active;
+  
+  if (last_touchpad_activity != 0 && now - last_touchpad_activity < touchpad_activity_window) {
+    target = POWER_INTERACTIVE;
+    scheduleAt(next, last_touchpad_activity + touchpad_activity_window);
+  } else if (last_api_activity != 0 && now - last_api_activity < api_activity_window) {
+    target = POWER_ACTIVE;
+    scheduleAt(next, last_api_activity + api_activity_window);
+  } else if (jiggling && next_jiggle_time != 0 && (long)(next_jiggle_time - now) < (long)jiggle_lead_time) {
+    target = POWER_ACTIVE;
+  } else if (jiggling && next_jiggle_time != 0) {
+    scheduleAt(next, next_jiggle_time - jiggle_lead_time);
+  }
+  
+  // Take and clear in one step, so activity noted meanwhile is not lost
+  unsigned long activity_us = pending_activity_us.exchange(0);
+  
+  if (target == power_governor.level) {
+    return;
+  }
+  
+  power_governor.time_in_level[power_governor.level] += now - power_governor.level_since;
+  power_governor.level_since = now;
+  power_governor.switches++;
+  
+  bool upshift = target > power_governor.level;
+  applyPowerLevel(target);
+  
+  if (upshift && activity_us != 0) {
+    power_governor.last_wake_latency_us = micros() - activity_us;
+    power_governor.max_wake_latency_us = max(power_governor.max_wake_latency_us, power_governor.last_wake_latency_us);
+  }
+}
+
+// Register a deadline for the current loop() pass
+void scheduleAt(SchedulerDeadline& next, unsigned long when) {
+  long remaining = (long)(when - next.now);
+  next.wait = min(next.wait, remaining > 0 ? (unsigned long)remaining : 0UL);
+}
+
+// Wake loop() early, e.g. after a WiFi event or a configuration change
+void wakeScheduler() {
+  if (loop_task_handle != NULL) {
+    xTaskNotifyGive(loop_task_handle);
+  }
+}
+
+void requestRestart() {
+  restart_at = millis() + restart_delay;
+  restart_pending = true;
+  wakeScheduler();
+}
+
+// Block loop() until the earliest deadline, allowing light sleep when idle
+void sleepUntilDeadline(const SchedulerDeadline& next) {
+  bool allow = usb_suspended && power_governor.level <= POWER_IDLE && WiFi.softAPgetStationNum() == 0;
+  if (allow != light_sleep_allowed) {
+    light_sleep_allowed = allow;
+    configureCpu(power_profiles[power_governor.level].cpu_mhz, allow);
+  }
+  
+  if (next.wait == 0) {
+    return;
+  }
+  
+  scheduler_stats.next_wait = next.wait;
+  unsigned long start = millis();
+  TRACE_SCOPE("loop_sleep");
+  ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(next.wait));
+  scheduler_stats.sleep_ms += millis() - start;
+  scheduler_stats.next_wait = 0;
+  scheduler_stats.wakeups++;
+}
+
+// Set the CPU clock; with power management available this also controls
+// automatic light sleep, which then takes over between deadlines
+void configureCpu(uint32_t cpu_mhz, bool light_sleep) {
+#if CONFIG_PM_ENABLE
+#if CONFIG_IDF_TARGET_ESP32S3
+  esp_pm_config_esp32s3_t pm_config;
+#else
+  esp_pm_config_esp32s2_t pm_config;
+#endif
+  pm_config.max_freq_mhz = cpu_mhz;
+  pm_config.min_freq_mhz = cpu_mhz;
+  pm_config.light_sleep_enable = light_sleep;
+  if (esp_pm_configure(&pm_config) == ESP_OK) {
+    light_sleep_active = light_sleep;
+    return;
+  }
+#endif
+  light_sleep_active = false;
+  if (getCpuFrequencyMhz() != cpu_mhz) {
+    setCpuFrequencyMhz(cpu_mhz);
+  }
+}
+
+// Track USB bus suspend/resume, light sleep is only safe while suspended.
+// Unmount, and a new configuration after a bus reset, drop the scroll
+// resolution. The mount event is posted while the USB task handles
+// SET_CONFIGURATION and runs once that task blocks, ahead of the host's next
+// control transfer, so the multipliers it sets afterwards are kept.
+void onUsbEvent(void* arg, esp_event_base_t base, int32_t event_id, void* event_data) {
+  if (event_id == ARDUINO_USB_STARTED_EVENT || event_id == ARDUINO_USB_STOPPED_EVENT) {
+    Mouse.resetFeature();
+  }
+  if (event_id == ARDUINO_USB_SUSPEND_EVENT) {
+    traceInstant("usb:suspend");
+    usb_suspended = true;
+  } else if (event_id == ARDUINO_USB_RESUME_EVENT || event_id == ARDUINO_USB_STARTED_EVENT) {
+    traceInstant("usb:resume");
+    usb_suspended = false;
+  } else {
+    return;
+  }
+  wakeScheduler();
+}
+
+// CPU idle percentage since the previous sample. Uses the idle tasks' run
+// time when FreeRTOS run-time stats are available, otherwise the share of
+// time loop() spent sleeping.
+uint8_t sampleCpuIdle() {
+  uint64_t now_us = esp_timer_get_time();
+  uint64_t elapsed = now_us - scheduler_stats.idle_sample_us;
+  if (elapsed < 1000000 && scheduler_stats.idle_sample_us != 0) {
+    return scheduler_stats.cpu_idle_pct;
+  }
+  
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS && CONFIG_FREERTOS_RUN_TIME_STATS_USING_ESP_TIMER
+  uint64_t idle_runtime = 0;
+  for (int core = 0; core < portNUM_PROCESSORS; core++) {
+    TaskStatus_t status;
+    vTaskGetInfo(xTaskGetIdleTaskHandleForCPU(core), &status, pdFALSE, eInvalid);
+    idle_runtime += status.ulRunTimeCounter;
+  }
+  uint64_t capacity = elapsed * portNUM_PROCESSORS;
+#else
+  uint64_t idle_runtime = scheduler_stats.sleep_ms * 1000;
+  uint64_t capacity = elapsed;
+#endif
+  
+  if (scheduler_stats.idle_sample_us != 0 && capacity > 0) {
+    // Run-time counters are 32-bit on the target, so take the delta in 32 bits
+    uint32_t idle_delta = (uint32_t)idle_runtime - (uint32_t)scheduler_stats.idle_sample_runtime;
+    scheduler_stats.cpu_idle_pct = min((uint64_t)100, (uint64_t)idle_delta * 100 / capacity);
+  }
+  scheduler_stats.idle_sample_us = now_us;
+  scheduler_stats.idle_sample_runtime = idle_runtime;
+  return scheduler_stats.cpu_idle_pct;
+}
+
+// Read every task's status and run time; 0 when there are more tasks than
+// MAX_TASK_STATS
+int readTaskSnapshot(TaskStatus_t* status, TaskSnapshot& snapshot) {
+#if CONFIG_FREERTOS_USE_TRACE_FACILITY
+  UBaseType_t count = uxTaskGetSystemState(status, MAX_TASK_STATS, NULL);
+#else
+  UBaseType_t count = 0;
+#endif
+  snapshot.timestamp_us = esp_timer_get_time();
+  snapshot.count = count;
+  for (UBaseType_t i = 0; i < count; i++) {
+    snapshot.numbers[i] = status[i].xTaskNumber;
+    snapshot.runtime[i] = status[i].ulRunTimeCounter;
+  }
+  return count;
+}
+
+// Store a snapshot in the ring every TASK_SAMPLE_MS while a request has
+// asked for sampling in the last TASK_SAMPLING_HOLD_MS
+void sampleTasks(SchedulerDeadline& next) {
+#if CONFIG_FREERTOS_USE_TRACE_FACILITY && CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS && CONFIG_FREERTOS_RUN_TIME_STATS_USING_ESP_TIMER
+  portENTER_CRITICAL(&task_snapshot_mux);
+  if (task_sampling && (long)(next.now - task_sampling_until) >= 0) {
+    task_sampling = false;
+  }
+  bool sampling = task_sampling;
+  portEXIT_CRITICAL(&task_snapshot_mux);
+  if (!sampling) {
+    task_sampler_running = false;
+    return;
+  }
+  if (!task_sampler_running) {
+    // The request that started sampling stored the first snapshot
+    task_sampler_running = true;
+    task_sample_at = next.now + TASK_SAMPLE_MS;
+  }
+  
+  if ((long)(next.now - task_sample_at) >= 0) {
+    TaskSnapshot snapshot;
+    if (readTaskSnapshot(task_sample_status, snapshot) > 0) {
+      portENTER_CRITICAL(&task_snapshot_mux);
+      task_snapshots[task_snapshot_count % TASK_SNAPSHOTS] = snapshot;
+      task_snapshot_count++;
+      portEXIT_CRITICAL(&task_snapshot_mux);
+    }
+    task_sample_at = next.now + TASK_SAMPLE_MS;
+  }
+  scheduleAt(next, task_sample_at);
+#endif
+}
+
+// Oldest stored snapshot taken within the last window_ms, or the newest one
+// when the window is shorter than the sample period. The scan only reads
+// timestamps; the one snapshot picked is the only copy made with the lock held.
+bool findTaskBaseline(int64_t now_us, uint32_t window_ms, TaskSnapshot& baseline) {
+  portENTER_CRITICAL(&task_snapshot_mux);
+  uint32_t stored = min(task_snapshot_count, (uint32_t)TASK_SNAPSHOTS);
+  uint32_t pick = 0;
+  for (uint32_t i = 1; i <= stored; i++) {
+    int64_t timestamp_us = task_snapshots[(task_snapshot_count - i) % TASK_SNAPSHOTS].timestamp_us;
+    if (pick != 0 && now_us - timestamp_us > (int64_t)window_ms * 1000) {
+      break;
+    }
+    pick = i;
+  }
+  if (pick != 0) {
+    baseline = task_snapshots[(task_snapshot_count - pick) % TASK_SNAPSHOTS];
+  }
+  portEXIT_CRITICAL(&task_snapshot_mux);
+  return pick != 0;
+}
+
+const char* taskStateName(eTaskState state) {
+  switch (state) {
+    case eRunning: return "running";
+    case eReady: return "ready";
+    case eBlocked: return "blocked";
+    case eSuspended: return "suspended";
+    case eDeleted: return "deleted";
+    default: return "unknown";
+  }
+}
+
+// Count a heap allocation, attributing it to the request path when it is
+// made on the web server task
+void countAlloc(void* ptr, size_t size) {
+  if (ptr == NULL) {
+    return;
+  }
+  alloc_total.allocs++;
+  alloc_total.bytes += size;
+  if (web_task_handle != NULL && xTaskGetCurrentTaskHandle() == web_task_handle) {
+    alloc_request.allocs++;
+    alloc_request.bytes += size;
+  }
+}
+
+void countFree(void* ptr) {
+  if (ptr == NULL) {
+    return;
+  }
+  alloc_total.frees++;
+  if (web_task_handle != NULL && xTaskGetCurrentTaskHandle() == web_task_handle) {
+    alloc_request.frees++;
+  }
+}
+
+#ifdef HEAP_ALLOC_COUNTING
+extern "C" {
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+void __real_free(void* ptr);
+
+void* __wrap_malloc(size_t size) {
+  void* ptr = __real_malloc(size);
+  countAlloc(ptr, size);
+  return ptr;
+}
+
+void* __wrap_calloc(size_t count, size_t size) {
+  void* ptr = __real_calloc(count, size);
+  countAlloc(ptr, count * size);
+  return ptr;
+}
+
+void* __wrap_realloc(void* ptr, size_t size) {
+  void* result = __real_realloc(ptr, size);
+  // A successful realloc releases the old block and hands out a new one
+  if (result != NULL || size == 0) {
+    countFree(ptr);
+  }
+  countAlloc(result, size);
+  return result;
+}
+
+void __wrap_free(void* ptr) {
+  countFree(ptr);
+  __real_free(ptr);
+}
+}
+#endif
+
+// Calculate movement interval, applying randomization if enabled.
+// Draws a new random factor on every call, so call it once per cycle.
+unsigned long calculateMoveInterval(const MotionConfig& config) {
+  // Random variation of ±30%, uniform over 0.700 .. 1.300 in 0.1% steps
+  return jitterInterval(config.move_interval, config.random_delay ? RANDOM_DELAY_SPREAD_PERMILLE : 0,
+                        [](long low, long high) { return random(low, high); });
+}
+
+// Start a new movement cycle: the jittered interval is drawn once here and
+// kept as an absolute deadline, which is also what /api/status reports
+void scheduleNextMove(const MotionConfig& config) {
+  moves_due &= ~(1UL << MAIN_MOVE_TIMER);
+  last_move_time = millis();
+  next_move_time = last_move_time + calculateMoveInterval(config);
+  timerWheelSet(jiggle_timers, MAIN_MOVE_TIMER, next_move_time);
+}
+
+// Profile interval with its own +/- jitter, drawn once per cycle
+unsigned long profileInterval(const JiggleProfile& profile) {
+  return jitterInterval(profile.move_interval, profile.jitter * 10,
+                        [](long low, long high) { return random(low, high); });
+}
+
+// Draw the next deadline of profile `index`, or stop its timer when the
+// profile is gone or disabled (motion engine only)
+void scheduleProfile(const MotionConfig& config, int index) {
+  moves_due &= ~(1UL << (index + 1));
+  if (index >= config.profile_count || !config.profiles[index].enabled) {
+    timerWheelCancel(jiggle_timers, index + 1);
+    profile_next_move[index] = 0;
+    return;
+  }
+  profile_next_move[index] = millis() + profileInterval(config.profiles[index]);
+  timerWheelSet(jiggle_timers, index + 1, profile_next_move[index]);
+}
+
+// Push every deadline to at least one interval after live input; a move
+// that came due but hasn't run yet is put off the same way
+void deferMoves(const MotionConfig& config, unsigned long live_input) {
+  unsigned long after_input = live_input + calculateMoveInterval(config);
+  if ((long)(after_input - next_move_time) > 0) {
+    next_move_time = after_input;
+    moves_due &= ~(1UL << MAIN_MOVE_TIMER);
+    timerWheelSet(jiggle_timers, MAIN_MOVE_TIMER, next_move_time);
+  }
+  for (int i = 0; i < config.profile_count; i++) {
+    if (profile_next_move[i] == 0) {
+      continue;
+    }
+    after_input = live_input + profileInterval(config.profiles[i]);
+    if ((long)(after_input - profile_next_move[i]) > 0) {
+      profile_next_move[i] = after_input;
+      moves_due &= ~(1UL << (i + 1));
+      timerWheelSet(jiggle_timers, i + 1, after_input);
+    }
+  }
+}
+
+// Local wall-clock time; false while the clock is not set
+bool localTime(struct tm& local) {
+  time_t now = time(NULL);
+  if (clock_source == CLOCK_NONE || now < 1600000000) { // Still counting from 1970
+    return false;
+  }
+  now += (time_t)clock_utc_offset * 60;
+  gmtime_r(&now, &local);
+  return true;
+}
+
+// Minutes since local midnight, or -1 while the clock is not set
+int localMinutes() {
+  struct tm local;
+  if (!localTime(local)) {
+    return -1;
+  }
+  return local.tm_hour * 60 + local.tm_min;
+}
+
+// Ask SNTP for the time once the station has an address
+void startClockSync() {
+  if (sntp_started) {
+    return;
+  }
+  sntp_started = true;
+  sntp_set_time_sync_notification_cb(onTimeSync);
+  configTime(0, 0, NTP_SERVER);
+  DEBUGF("SNTP started (%s)", NTP_SERVER);
+}
+
+// SNTP task: the system clock was just set
+void onTimeSync(struct timeval* tv) {
+  clock_source = CLOCK_SNTP;
+  schedule_update_requested.store(true, std::memory_order_release);
+  wakeScheduler();
+}
+
+const char* clockSourceName(ClockSource source) {
+  switch (source) {
+    case CLOCK_BROWSER: return "browser";
+    case CLOCK_SNTP: return "sntp";
+    default: return "none";
+  }
+}
+
+// Whether minute `minute` of the week (0 = Monday 00:00) is inside a window
+bool scheduleActiveAt(const MotionConfig& config, int minute) {
+  for (int i = 0; i < config.schedule_count; i++) {
+    const ScheduleWindow& window = config.schedule[i];
+    int length = window.end > window.start ? window.end - window.start : window.end + MINUTES_PER_DAY - window.start;
+    for (int day = 0; day < 7; day++) {
+      if (!(window.days & (1 << day))) {
+        continue;
+      }
+      int offset = (minute - (day * MINUTES_PER_DAY + window.start) + MINUTES_PER_WEEK) % MINUTES_PER_WEEK;
+      if (offset < length) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+// Minutes from `minute` to the next window edge where the state stops being
+// `active`, or -1 if it never does. Only window edges can change the state,
+// so those are the only candidates.
+int scheduleNextChange(const MotionConfig& config, int minute, bool active) {
+  int best = -1;
+  for (int i = 0; i < config.schedule_count; i++) {
+    const ScheduleWindow& window = config.schedule[i];
+    for (int day = 0; day < 7; day++) {
+      if (!(window.days & (1 << day))) {
+        continue;
+      }
+      int edges[2] = { day * MINUTES_PER_DAY + window.start, day * MINUTES_PER_DAY + window.end };
+      if (window.end <= window.start) {
+        edges[1] += MINUTES_PER_DAY;
+      }
+      for (int edge : edges) {
+        int ahead = (edge - minute + 2 * MINUTES_PER_WEEK) % MINUTES_PER_WEEK;
+        if (ahead == 0 || (best >= 0 && ahead >= best)) {
+          continue;
+        }
+        if (scheduleActiveAt(config, (minute + ahead) % MINUTES_PER_WEEK) != active) {
+          best = ahead;
+        }
+      }
+    }
+  }
+  return best;
+}
+
+// Work out whether the jiggler may run and when that next changes (motion
+// engine only). Without a clock the schedule is not enforced.
+void updateSchedule(const MotionConfig& config) {
+  ScheduleState state = { true, 0, 0, 0 };
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  if (config.schedule_enabled && clock_source != CLOCK_NONE) {
+    struct tm local;
+    time_t local_seconds = now.tv_sec + (time_t)clock_utc_offset * 60;
+    gmtime_r(&local_seconds, &local);
+    int minute = ((local.tm_wday + 6) % 7) * MINUTES_PER_DAY + local.tm_hour * 60 + local.tm_min;
+    time_t minute_start = now.tv_sec - local.tm_sec;
+    
+    state.active = scheduleActiveAt(config, minute);
+    int change = scheduleNextChange(config, minute, state.active);
+    if (change > 0) {
+      state.next_change = minute_start + (time_t)change * 60;
+      int64_t wait_ms = (int64_t)(state.next_change - now.tv_sec) * 1000 - now.tv_usec / 1000;
+      state.change_at = millis() + (unsigned long)max((int64_t)0, wait_ms);
+      if (state.change_at == 0) {
+        state.change_at = 1;
+      }
+      if (!state.active) {
+        state.next_activation = state.next_change;
+      } else {
+        int reopen = scheduleNextChange(config, (minute + change) % MINUTES_PER_WEEK, false);
+        state.next_activation = reopen > 0 ? state.next_change + (time_t)reopen * 60 : 0;
+      }
+    }
+  }
+  if (state.active != schedule_state.active) {
+    LOG_INFO("Schedule: jiggler %s", state.active ? "active" : "off hours");
+  }
+  schedule_state = state;
+}
+
+// Schedule window from its JSON form; NULL or what is wrong
+const char* parseScheduleWindow(JsonObjectConst source, ScheduleWindow& window) {
+  int days = source["days"] | 0;
+  int start = source["start"] | -1;
+  int end = source["end"] | -1;
+  if (days <= 0 || days > 0x7f) {
+    return "Schedule days are a bitmask, Monday = 1 .. Sunday = 64";
+  }
+  if (start < 0 || start >= MINUTES_PER_DAY || end < 0 || end >= MINUTES_PER_DAY) {
+    return "Schedule times are minutes after midnight (0-1439)";
+  }
+  window.days = (uint8_t)days;
+  window.start = (uint16_t)start;
+  window.end = (uint16_t)end;
+  return NULL;
+}
+
+void writeScheduleWindow(JsonObject target, const ScheduleWindow& window) {
+  target["days"] = window.days;
+  target["start"] = window.start;
+  target["end"] = window.end;
+}
+
+// Whether a profile may move right now. Windows are not enforced until the
+// device knows the time of day.
+bool profileWindowActive(const JiggleProfile& profile) {
+  if (profile.window_start == profile.window_end) {
+    return true;
+  }
+  int minutes = localMinutes();
+  if (minutes < 0) {
+    return true;
+  }
+  if (profile.window_start < profile.window_end) {
+    return minutes >= profile.window_start && minutes < profile.window_end;
+  }
+  return minutes >= profile.window_start || minutes < profile.window_end; // Across midnight
+}
+
+// Profile from its JSON form (interval in seconds); NULL or what is wrong
+const char* parseProfile(JsonObjectConst source, JiggleProfile& profile) {
+  const char* name = source["name"] | "";
+  if (name[0] == '\0' || strlen(name) >= (size_t)PROFILE_NAME_LEN) {
+    return "Profile names are 1-15 characters";
+  }
+  long interval = source["move_interval"] | 0L;
+  if (interval < 1 || interval > 86400) {
+    return "Profile interval must be 1-86400 seconds";
+  }
+  strlcpy(profile.name, name, sizeof(profile.name));
+  strlcpy(profile.movement_pattern, source["movement_pattern"] | "linear", sizeof(profile.movement_pattern));
+  profile.enabled = source["enabled"] | true;
+  profile.move_interval = interval * 1000;
+  profile.movement_size = constrain(source["movement_size"] | 10, 1, 400);
+  profile.movement_speed = constrain(source["movement_speed"] | 1000, 1, 3000);
+  profile.jitter = constrain(source["jitter"] | 0, 0, MAX_PROFILE_JITTER);
+  profile.window_start = constrain(source["window_start"] | 0, 0, 1439);
+  profile.window_end = constrain(source["window_end"] | 0, 0, 1439);
+  return NULL;
+}
+
+void writeProfile(JsonObject target, const JiggleProfile& profile) {
+  target["name"] = profile.name;
+  target["enabled"] = profile.enabled;
+  target["move_interval"] = profile.move_interval / 1000;
+  target["movement_pattern"] = profile.movement_pattern;
+  target["movement_size"] = profile.movement_size;
+  target["movement_speed"] = profile.movement_speed;
+  target["jitter"] = profile.jitter;
+  target["window_start"] = profile.window_start;
+  target["window_end"] = profile.window_end;
+}
+
+// Publish motion_config to the motion engine (web server task and setup only)
+void publishMotionConfig() {
+  motion_config_buffers[motion_config_back] = motion_config;
+  uint32_t previous = motion_config_middle.exchange(motion_config_back | MOTION_CONFIG_FRESH);
+  motion_config_back = previous & 3;
+}
+
+// Publish settings for loop() (web server task, or setup() before it starts)
+void publishSettings() {
+  settings_buffers[settings_back] = settings;
+  uint32_t previous = settings_middle.exchange(settings_back | SETTINGS_FRESH);
+  settings_back = previous & 3;
+}
+
+// Latest published settings (loop() only), untouched until the next call
+const Settings& latestSettings() {
+  if (settings_middle.load() & SETTINGS_FRESH) {
+    uint32_t previous = settings_middle.exchange(settings_front);
+    settings_front = previous & 3;
+  }
+  return settings_buffers[settings_front];
+}
+
+// Latest published configuration (motion engine in loop() only). The returned
+// snapshot stays untouched until the next call.
+const MotionConfig& latestMotionConfig() {
+  if (motion_config_middle.load() & MOTION_CONFIG_FRESH) {
+    uint32_t previous = motion_config_middle.exchange(motion_config_front);
+    motion_config_front = previous & 3;
+  }
+  return motion_config_buffers[motion_config_front];
+}
+
+// Run a single pattern at the given size
+void runPattern(const char* pattern, int size, int speed) {
+  int index = findPattern(pattern);
+  if (index < 0) {
+    index = 0; // Default to linear
+  }
+  
+  if (step_reset_requested) {
+    memset(step_histograms, 0, sizeof(step_histograms));
+    step_reset_requested = false;
+  }
+  
+  step_pattern = index;
+  step_last_report_us = 0;
+  if (index < PATTERN_COUNT) {
+    TRACE_SCOPE(patterns[index].trace_name);
+    patterns[index].run(size, speed);
+  } else if (pattern_files[index - PATTERN_COUNT].kind == PATTERN_FILE_SCRIPT) {
+    TRACE_SCOPE("pattern:script");
+    runScriptFile(pattern_files[index - PATTERN_COUNT], size, speed);
+  } else {
+    TRACE_SCOPE("pattern:file");
+    playPatternFile(pattern_files[index - PATTERN_COUNT], size, speed);
+  }
+  step_pattern = -1;
+}
+
+// Built-in patterns first, then pattern file slots; -1 if not installed
+int findPattern(const char* name) {
+  for (int i = 0; i < PATTERN_COUNT; i++) {
+    if (strcmp(name, patterns[i].name) == 0) {
+      return i;
+    }
+  }
+  for (int i = 0; i < MAX_PATTERN_FILES; i++) {
+    if (pattern_files[i].name[0] != '\0' && strcmp(name, pattern_files[i].name) == 0) {
+      return PATTERN_COUNT + i;
+    }
+  }
+  return -1;
+}
+
+const char* patternName(int index) {
+  return index < PATTERN_COUNT ? patterns[index].name : pattern_files[index - PATTERN_COUNT].name;
+}
+
+void patternFilePath(char* path, size_t size, const char* name, PatternFileKind kind) {
+  snprintf(path, size, "%s%s%s", pattern_dir, name, pattern_extensions[kind]);
+}
+
+// Lowercase letters, digits, '-' and '_', and not the name of a built-in
+bool isValidPatternFileName(const char* name) {
+  size_t length = strlen(name);
+  if (length == 0 || length > PATTERN_FILE_NAME_MAX) {
+    return false;
+  }
+  for (size_t i = 0; i < length; i++) {
+    char c = name[i];
+    if (!((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '-' || c == '_')) {
+      return false;
+    }
+  }
+  int index = findPattern(name);
+  return index < 0 || index >= PATTERN_COUNT;
+}
+
+// NULL if the file is a valid path or script, otherwise why not. Fills in
+// everything but the name; the magic decides the kind.
+const char* checkPatternFile(const char* path, PatternFileEntry& info) {
+  PatternFileSource source = {};
+  source.file = SPIFFS.open(path, "r");
+  if (!source.file) {
+    return "Cannot open file";
+  }
+  info.size = source.file.size();
+  if (info.size > PATTERN_FILE_MAX_SIZE) {
+    return "File too large";
+  }
+  uint8_t magic[4] = {};
+  source.file.read(magic, sizeof(magic));
+  source.file.seek(0);
+  
+  if (memcmp(magic, SCRIPT_FILE_MAGIC, sizeof(magic)) == 0) {
+    uint16_t count = 0;
+    const char* error = scriptValidate(source, count);
+    info.kind = PATTERN_FILE_SCRIPT;
+    info.segment_count = 0;
+    info.step_count = count;
+    info.duration_units = 0;
+    return error;
+  }
+  PatternFileHeader header = {};
+  const char* error = patternValidate(source, header);
+  info.kind = PATTERN_FILE_PATH;
+  info.segment_count = header.segment_count;
+  info.step_count = header.step_count;
+  info.duration_units = header.duration_units;
+  return error;
+}
+
+// Index the pattern files on SPIFFS, skipping anything that does not validate
+void loadPatternFiles() {
+  memset(pattern_files, 0, sizeof(pattern_files));
+  SPIFFS.remove(pattern_upload_path); // Left over from an interrupted upload
+  
+  File dir = SPIFFS.open("/patterns");
+  if (!dir || !dir.isDirectory()) {
+    return;
+  }
+  size_t dir_length = strlen(pattern_dir);
+  for (File file = dir.openNextFile(); file; file = dir.openNextFile()) {
+    char path[40];
+    strlcpy(path, file.path(), sizeof(path));
+    file.close();
+    
+    // The extension must match the kind the contents turn out to be
+    const char* extension = strrchr(path, '.');
+    int kind = -1;
+    for (int k = 0; extension != NULL && k < 2; k++) {
+      if (strcmp(extension, pattern_extensions[k]) == 0) {
+        kind = k;
+      }
+    }
+    if (kind < 0 || strncmp(path, pattern_dir, dir_length) != 0 || extension <= path + dir_length) {
+      continue;
+    }
+    char name[PATTERN_NAME_LEN];
+    strlcpy(name, path + dir_length, min(sizeof(name), (size_t)(extension - path) - dir_length + 1));
+    
+    PatternFileEntry info = {};
+    const char* error = isValidPatternFileName(name) ? checkPatternFile(path, info) : "Bad file name";
+    strlcpy(info.name, name, sizeof(info.name));
+    if (error == NULL && info.kind != kind) {
+      error = "Extension does not match the contents";
+    }
+    if (error != NULL) {
+      LOG_WARN("Skipping pattern file %s: %s", path, error);
+      continue;
+    }
+    if (!installPatternFile(info)) {
+      LOG_WARN("Skipping pattern file %s: at most %d pattern files", path, MAX_PATTERN_FILES);
+      continue;
+    }
+    DEBUGF("Pattern file %s: %u steps, %u bytes", info.name, (unsigned)info.step_count, (unsigned)info.size);
+  }
+}
+
+// Add or replace an index entry. Callers hold motion_mutex once loop() runs.
+bool installPatternFile(const PatternFileEntry& info) {
+  int index = findPattern(info.name);
+  int slot = index >= PATTERN_COUNT ? index - PATTERN_COUNT : -1;
+  for (int i = 0; slot < 0 && i < MAX_PATTERN_FILES; i++) {
+    if (pattern_files[i].name[0] == '\0') {
+      slot = i;
+    }
+  }
+  if (slot < 0) {
+    return false;
+  }
+  pattern_files[slot] = info;
+  memset(&step_histograms[PATTERN_COUNT + slot], 0, sizeof(StepHistogram));
+  return true;
+}
+
+// Move a checked file from temp_path into place as info.name and index it.
+// Returns NULL, or an error with its HTTP status in code. Web server task
+// only: uploads and finishMacroSave() call it, never the motion engine.
+const char* storePatternFile(const char* temp_path, const PatternFileEntry& info, int& code) {
+  // The motion engine may be mid-pattern; don't hold up the web server for it
+  if (xSemaphoreTake(motion_mutex, pdMS_TO_TICKS(100)) != pdTRUE) {
+    code = 503;
+    return "A pattern is running, try again";
+  }
+  const char* error = NULL;
+  char path[40];
+  patternFilePath(path, sizeof(path), info.name, info.kind);
+  int index = findPattern(info.name);
+  bool slot_free = index >= PATTERN_COUNT;
+  for (const PatternFileEntry& entry : pattern_files) {
+    slot_free = slot_free || entry.name[0] == '\0';
+  }
+  if (!slot_free) {
+    error = "All pattern slots are in use, delete one first";
+    code = 507;
+  } else {
+    SPIFFS.remove(path);
+    if (SPIFFS.rename(temp_path, path)) {
+      // A script replacing a path of the same name, or the reverse
+      if (index >= PATTERN_COUNT && pattern_files[index - PATTERN_COUNT].kind != info.kind) {
+        char old_path[40];
+        patternFilePath(old_path, sizeof(old_path), info.name, pattern_files[index - PATTERN_COUNT].kind);
+        SPIFFS.remove(old_path);
+      }
+      installPatternFile(info);
+    } else {
+      error = "Could not store the pattern";
+      code = 500;
+    }
+  }
+  xSemaphoreGive(motion_mutex);
+  return error;
+}
+
+// Drop an index entry and its file. Callers hold motion_mutex.
+bool removePatternFile(const char* name) {
+  int index = findPattern(name);
+  if (index < PATTERN_COUNT) {
+    return false;
+  }
+  PatternFileEntry& entry = pattern_files[index - PATTERN_COUNT];
+  char path[40];
+  patternFilePath(path, sizeof(path), entry.name, entry.kind);
+  SPIFFS.remove(path);
+  memset(&entry, 0, sizeof(PatternFileEntry));
+  memset(&step_histograms[index], 0, sizeof(StepHistogram));
+  return true;
+}
+
+// Stream a pattern file to the mouse. Positions are scaled from file units to
+// the movement size and each step's delay is taken from the running total, so
+// rounding never accumulates; every file plays at the same per-step cost.
+void playPatternFile(const PatternFileEntry& entry, int size, int speed) {
+  char path[40];
+  patternFilePath(path, sizeof(path), entry.name, entry.kind);
+  PatternFileSource source = {};
+  source.file = SPIFFS.open(path, "r");
+  PatternFileHeader header;
+  if (!source.file || !patternReadHeader(source, header) || header.duration_units == 0) {
+    LOG_WARN("Cannot play pattern file %s", path);
+    return;
+  }
+  
+  int scaledSize = scaleMovementSize(size);
+  int32_t fileX = 0;
+  int32_t fileY = 0;
+  int totalDeltaX = 0;
+  int totalDeltaY = 0;
+  uint64_t elapsedUnits = 0;
+  uint32_t waitedMs = 0;
+  
+  for (uint16_t s = 0; s < header.segment_count; s++) {
+    PatternSegment segment;
+    if (!patternReadSegment(source, segment)) {
+      break;
+    }
+    for (uint16_t i = 0; i < segment.step_count; i++) {
+      int32_t dx, dy;
+      if (!patternReadDelta(source, segment.encoding, dx, dy)) {
+        s = header.segment_count; // File changed under us, stop and compensate
+        break;
+      }
+      fileX += dx;
+      fileY += dy;
+      
+      // Reports carry int8 deltas; anything clipped is caught up next step
+      int targetX = (fileX * scaledSize + (fileX < 0 ? -PATTERN_FILE_UNIT / 2 : PATTERN_FILE_UNIT / 2)) / PATTERN_FILE_UNIT;
+      int targetY = (fileY * scaledSize + (fileY < 0 ? -PATTERN_FILE_UNIT / 2 : PATTERN_FILE_UNIT / 2)) / PATTERN_FILE_UNIT;
+      int deltaX = constrain(targetX - totalDeltaX, -127, 127);
+      int deltaY = constrain(targetY - totalDeltaY, -127, 127);
+      if (deltaX != 0 || deltaY != 0) {
+        hidMove(deltaX, deltaY);
+        totalDeltaX += deltaX;
+        totalDeltaY += deltaY;
+        totalDisplacementX += deltaX;
+        totalDisplacementY += deltaY;
+      }
+      
+      elapsedUnits += segment.step_units;
+      uint32_t dueMs = (uint32_t)(elapsedUnits * (uint32_t)speed / header.duration_units);
+      if (!patternWait(dueMs - waitedMs)) {
+        return;
+      }
+      waitedMs = dueMs;
+    }
+  }
+  
+  // Return toward the starting position; resetCursorPosition() takes care
+  // of anything beyond one report
+  int backX = constrain(-totalDeltaX, -127, 127);
+  int backY = constrain(-totalDeltaY, -127, 127);
+  if (backX != 0 || backY != 0) {
+    hidMove(backX, backY);
+    totalDisplacementX += backX;
+    totalDisplacementY += backY;
+    DEBUGF("Pattern file compensation: (%d, %d)", backX, backY);
+  }
+}
+
+// Script host for the motion engine: reports go through the usual HID
+// helpers and count towards the displacement moveMouse() undoes
+struct ScriptHidHost {
+  void move(int8_t x, int8_t y) {
+    hidMove(x, y);
+    totalDisplacementX += x;
+    totalDisplacementY += y;
+  }
+  void press(uint8_t buttons) { hidPress(buttons); }
+  void release(uint8_t buttons) { hidRelease(buttons); }
+  void scroll(int8_t wheel) { hidMove(0, 0, wheel); }
+  uint32_t random(uint32_t max) { return (uint32_t)::random(0, (long)max + 1); }
+};
+
+// Load a verified script and run it in budgeted slices. Buttons still held
+// when it ends, is cut off or is preempted are released. The benchmark (null
+// sink) skips the waits. Called with motion_mutex held, which is given back
+// for each wait; the index entry may change meanwhile.
+void runScriptFile(const PatternFileEntry& entry, int size, int speed) {
+  char name[PATTERN_FILE_NAME_MAX + 1];
+  strlcpy(name, entry.name, sizeof(name));
+  char path[40];
+  patternFilePath(path, sizeof(path), name, entry.kind);
+  PatternFileSource source = {};
+  source.file = SPIFFS.open(path, "r");
+  uint16_t count = 0;
+  if (!source.file || !scriptReadHeader(source, count) || count != entry.step_count) {
+    LOG_WARN("Cannot run script %s", path);
+    return;
+  }
+  uint32_t max_run_ms = SCRIPT_RUN_MARGIN_MS;
+  for (uint16_t i = 0; i < count; i++) {
+    if (!scriptReadInstruction(source, script_code[i])) {
+      LOG_WARN("Cannot run script %s", path);
+      return;
+    }
+    if (script_code[i].op == SCRIPT_OP_WAIT) {
+      max_run_ms += script_code[i].imm;
+    }
+  }
+  source.file.close();
+  uint32_t loaded = ++script_loads;
+  max_run_ms = max(max_run_ms, SCRIPT_MIN_RUN_MS);
+  
+  ScriptHidHost host;
+  ScriptVM vm = {};
+  vm.regs[SCRIPT_REG_SIZE] = scaleMovementSize(size);
+  vm.regs[SCRIPT_REG_SPEED] = speed;
+  bool null_sink = hidNullSink();
+  unsigned long started = millis();
+  while (true) {
+    ScriptStatus status = scriptRunSlice(vm, script_code, SCRIPT_TICK_BUDGET, host);
+    if (status == SCRIPT_DONE) {
+      break;
+    }
+    if (millis() - started > max_run_ms) {
+      LOG_WARN("Script %s stopped after %lu ms", name, (unsigned long)max_run_ms);
+      break;
+    }
+    if (null_sink) {
+      if (vm.executed >= SCRIPT_BENCH_MAX_INSTRUCTIONS) {
+        break;
+      }
+      continue;
+    }
+    xSemaphoreGive(motion_mutex);
+    bool waited = patternWait(vm.wait_ms);
+    xSemaphoreTake(motion_mutex, portMAX_DELAY);
+    if (!waited) {
+      break;
+    }
+    if (script_loads != loaded) {
+      LOG_WARN("Script %s stopped, the benchmark took the motion engine", name);
+      break;
+    }
+    if (strcmp(entry.name, name) != 0) {
+      LOG_INFO("Script %s stopped, it was deleted", name);
+      break;
+    }
+  }
+  if (vm.buttons != 0) {
+    hidRelease(vm.buttons);
+  }
+}
+
+// Upload handler for /api/patterns: streams the file to pattern_upload_path.
+// A second upload while one is running is ignored and refused in onRequest.
+void handlePatternUpload(AsyncWebServerRequest *request, const String& filename, size_t index, uint8_t *data, size_t len, bool final) {
+  if (!validateSession(request)) {
+    return;
+  }
+  if (index == 0) {
+    if (pattern_upload.owner != NULL) {
       return;
     }
-    
-    StaticJsonDocument<128> doc;
-    DeserializationError error = deserializeJson(doc, data, len);
-    
-    if (!error) {
-      int amount = doc["amount"].as<int>();
-      
-      // Further amplify scroll amount for large screens
-      int scrollMultiplier = 10; // Additional server-side multiplier (increased from 5 to 10)
-      int scaledAmount = amount * scrollMultiplier;
-      
-      // Scroll the mouse wheel (positive = down, negative = up)
-      Mouse.move(0, 0, scaledAmount);
-      
-      // Update last move time
-      last_move_time = millis();
-      next_move_time = millis() + calculateMoveInterval();
-      
-      request->send(200, "application/json", "{\"status\":\"success\"}");
-    } else {
-      request->send(400, "application/json", "{\"status\":\"error\",\"message\":\"Invalid JSON\"}");
-    }
-  });
-  
-  // Serve touchpad.html with proper authentication
-  server->on("/touchpad.html", HTTP_GET, [](AsyncWebServerRequest *request) {
-    DEBUG("Received request for touchpad page");
-    
-    if (!validateSession(request)) {
-      return; // Auth handler already sent response
+    pattern_upload.owner = request;
+    pattern_upload.size = 0;
+    pattern_upload.too_large = false;
+    pattern_upload.failed = false;
+    strlcpy(pattern_upload.filename, filename.c_str(), sizeof(pattern_upload.filename));
+    pattern_upload.file = SPIFFS.open(pattern_upload_path, "w");
+    if (!pattern_upload.file) {
+      pattern_upload.failed = true;
     }
-    
-    DEBUG("Auth successful, serving touchpad.html");
-    AsyncWebServerResponse *response = request->beginResponse(SPIFFS, "/touchpad.html", "text/html");
-    response->addHeader("Cache-Control", "no-store, no-cache, must-revalidate, max-age=0");
-    response->addHeader("Pragma", "no-cache");
-    response->addHeader("Expires", "-1");
-    request->send(response);
-  });
-  
-  // Serve settings-admin.html with proper authentication
-  server->on("/settings-admin.html", HTTP_GET, [](AsyncWebServerRequest *request) {
-    DEBUG("Received request for settings page");
-    
-    if (!validateSession(request)) {
-      return; // Auth handler already sent response
+    request->onDisconnect([request]() {
+      if (pattern_upload.owner == request) {
+        endPatternUpload();
+        SPIFFS.remove(pattern_upload_path);
+      }
+    });
+  }
+  if (pattern_upload.owner != request || pattern_upload.failed) {
+    return;
+  }
+  if (pattern_upload.size + len > PATTERN_FILE_MAX_SIZE) {
+    pattern_upload.too_large = true;
+    pattern_upload.failed = true;
+    return;
+  }
+  if (pattern_upload.file.write(data, len) != len) {
+    pattern_upload.failed = true;
+    return;
+  }
+  pattern_upload.size += len;
+}
+
+void endPatternUpload() {
+  pattern_upload.file.close();
+  pattern_upload.owner = NULL;
+}
+
+// Record the time since the previous HID report of the running pattern
+void recordStepInterval() {
+  int64_t now = esp_timer_get_time();
+  if (step_last_report_us != 0) {
+    StepHistogram& histogram = step_histograms[step_pattern];
+    uint32_t interval = (uint32_t)(now - step_last_report_us);
+    histogram.buckets[min(interval / 1000, (uint32_t)STEP_BUCKETS)]++;
+    if (histogram.count == 0 || interval < histogram.min_us) {
+      histogram.min_us = interval;
     }
-    
-    DEBUG("Auth successful, serving settings-admin.html");
-    AsyncWebServerResponse *response = request->beginResponse(SPIFFS, "/settings-admin.html", "text/html");
-    response->addHeader("Cache-Control", "no-store, no-cache, must-revalidate, max-age=0");
-    response->addHeader("Pragma", "no-cache");
-    response->addHeader("Expires", "-1");
-    request->send(response);
-  });
-  
-  // Serve touchpad.js with proper headers
-  server->on("/touchpad.js", HTTP_GET, [](AsyncWebServerRequest *request) {
-    DEBUG("Serving touchpad.js directly");
-    AsyncWebServerResponse *response = request->beginResponse(SPIFFS, "/touchpad.js", "application/javascript");
-    response->addHeader("Cache-Control", "no-store, no-cache, must-revalidate, max-age=0");
-    response->addHeader("Pragma", "no-cache");
-    response->addHeader("Expires", "-1");
-    request->send(response);
-  });
-  
-  // Serve settings-admin.js with proper headers
-  server->on("/settings-admin.js", HTTP_GET, [](AsyncWebServerRequest *request) {
-    DEBUG("Serving settings-admin.js directly");
-    AsyncWebServerResponse *response = request->beginResponse(SPIFFS, "/settings-admin.js", "application/javascript");
-    response->addHeader("Cache-Control", "no-store, no-cache, must-revalidate, max-age=0");
-    response->addHeader("Pragma", "no-cache");
-    response->addHeader("Expires", "-1");
-    request->send(response);
-  });
-  
-  // Start server
-  server->begin();
-  DEBUG("Web server started");
+    histogram.max_us = max(histogram.max_us, interval);
+    histogram.count++;
+    histogram.sum_us += interval;
+  }
+  step_last_report_us = now;
 }
 
-// Calculate movement interval, applying randomization if enabled
-unsigned long calculateMoveInterval() {
-  if (!random_delay) {
-    return move_interval;
+// Interval below which `permille` of the samples fall, to bucket resolution
+uint32_t stepPercentile(const StepHistogram& histogram, uint32_t permille) {
+  if (histogram.count == 0) {
+    return 0;
   }
-  
-  // Add random variation of ±30%
-  float variation = 0.3; // 30%
-  float randomFactor = 1.0 - variation + (random(0, 2000) / 1000.0 * variation * 2);
-  
-  return (unsigned long)(move_interval * randomFactor);
+  uint32_t rank = max((uint32_t)1, (uint32_t)(((uint64_t)histogram.count * permille + 999) / 1000));
+  uint32_t seen = 0;
+  for (int i = 0; i <= STEP_BUCKETS; i++) {
+    seen += histogram.buckets[i];
+    if (seen >= rank) {
+      // Middle of the bucket, kept within the observed range
+      uint32_t value = i < STEP_BUCKETS ? i * 1000 + 500 : histogram.max_us;
+      return constrain(value, histogram.min_us, histogram.max_us);
+    }
+  }
+  return histogram.max_us;
 }
 
 // Perform mouse movement based on settings
-void moveMouse() {
-  // For tracking the overall displacement from the starting position
-  static int totalDisplacementX = 0;
-  static int totalDisplacementY = 0;
+void moveMouse(const MotionConfig& config) {
+  // Input from before the pattern started is handled by the idle window
+  xSemaphoreTake(motion_preempt, 0);
+  pattern_preempted = false;
   
-  if (movement_trail) {
-    // Create a movement trail with multiple movements
-    int trailMovementX = 0;
-    int trailMovementY = 0;
-    
-    // Perform multiple movements to create a trail
+  if (config.movement_trail) {
+    // Create a movement trail with multiple movements at half size
     for (int i = 0; i < 3; i++) {
-      // Store current displacement before this movement
-      int beforeX = totalDisplacementX;
-      int beforeY = totalDisplacementY;
-      
-      // Capture the current values of movement_size
-      int originalMovementSize = movement_size;
-      
-      // Adjust for this iteration of the trail (making each step smaller)
-      movement_size = movement_size / 2;
-      
-      // Perform the movement based on pattern
-      if (strcmp(movement_pattern, "circular") == 0) {
-        moveMouseCircular();
-      } else if (strcmp(movement_pattern, "rectangle") == 0) {
-        moveMouseRectangle();
-      } else if (strcmp(movement_pattern, "triangle") == 0) {
-        moveMouseTriangle();
-      } else if (strcmp(movement_pattern, "zigzag") == 0) {
-        moveMouseZigzag();
-      } else {
-        // Default to linear
-        moveMouseLinear();
+      runPattern(config.movement_pattern, config.movement_size / 2, config.movement_speed);
+      if (pattern_preempted) {
+        break;
       }
       
-      // Restore original movement values
-      movement_size = originalMovementSize;
-      
-      // Track any change in displacement that didn't perfectly return to start
-      trailMovementX += (totalDisplacementX - beforeX);
-      trailMovementY += (totalDisplacementY - beforeY);
-      
       // Ensure cursor returns to initial position after each movement
       resetCursorPosition();
       
-      delay(100); // Brief pause between trail movements
+      patternWait(100); // Brief pause between trail movements
     }
   } else {
     // Single movement based on selected pattern
-    if (strcmp(movement_pattern, "circular") == 0) {
-      moveMouseCircular();
-    } else if (strcmp(movement_pattern, "rectangle") == 0) {
-      moveMouseRectangle();
-    } else if (strcmp(movement_pattern, "triangle") == 0) {
-      moveMouseTriangle();
-    } else if (strcmp(movement_pattern, "zigzag") == 0) {
-      moveMouseZigzag();
-    } else {
-      // Default to linear
-      moveMouseLinear();
-    }
+    runPattern(config.movement_pattern, config.movement_size, config.movement_speed);
     
     // Always reset cursor position after movement
-    resetCursorPosition();
+    if (!pattern_preempted) {
+      resetCursorPosition();
+    }
+  }
+  
+  if (pattern_preempted) {
+    // The user has the cursor now; moving it back to where the pattern
+    // started would fight them, so forget the pattern's displacement
+    DEBUGF("Pattern preempted by live input at (%d, %d)", totalDisplacementX, totalDisplacementY);
+    totalDisplacementX = 0;
+    totalDisplacementY = 0;
+    return;
   }
   
   // Add a delay based on the movement_speed setting
-  delay(movement_speed);
+  patternWait(config.movement_speed);
+}
+
+// Step delay of a running pattern; false once live input has preempted it.
+// Only the motion engine in loop() is preemptible, the benchmark just waits.
+bool patternWait(uint32_t ms) {
+  if (xTaskGetCurrentTaskHandle() != loop_task_handle) {
+    delay(ms);
+    return true;
+  }
+  if (pattern_preempted) {
+    return false;
+  }
+  if (xSemaphoreTake(motion_preempt, pdMS_TO_TICKS(ms)) == pdTRUE) {
+    pattern_preempted = true;
+    traceInstant("pattern_preempted");
+    return false;
+  }
+  return true;
+}
+
+// Touchpad input arrived: stop any running pattern and restart the idle window
+void noteLiveInput() {
+  last_live_input = millis() | 1;
+  if (motion_preempt != NULL) {
+    xSemaphoreGive(motion_preempt);
+  }
 }
 
 // Save sessions to flash
 void saveSessions() {
+  TRACE_SCOPE("flash:sessions");
   DEBUG("Saving sessions");
   
   StaticJsonDocument<2048> doc;
@@ -2150,13 +6159,13 @@ void saveSessions() {
   File file = SPIFFS.open("/sessions.json", "w");
   if (file) {
     if (serializeJson(doc, file) == 0) {
-      DEBUG("Failed to write sessions");
+      LOG_ERROR("Failed to write sessions");
     } else {
       DEBUG("Sessions saved successfully");
     }
     file.close();
   } else {
-    DEBUG("Failed to open sessions file for writing");
+    LOG_ERROR("Failed to open sessions file for writing");
   }
 }
 
@@ -2205,7 +6214,7 @@ void loadSessions() {
           }
         }
       } else {
-        DEBUG("Failed to deserialize sessions");
+        LOG_WARN("Failed to deserialize sessions");
       }
       
       file.close();
@@ -2215,25 +6224,595 @@ void loadSessions() {
   }
 }
 
-// Function to free allocated memory
-void cleanupMemory() {
-  // Free memory
-  if (current_ssid != NULL) free(current_ssid);
-  if (current_password != NULL) free(current_password);
-  if (current_hostname != NULL) free(current_hostname);
-  if (current_username != NULL) free(current_username);
-  if (current_auth_password != NULL) free(current_auth_password);
-  if (wifi_mode != NULL) free(wifi_mode);
-  if (ap_availability != NULL) free(ap_availability);
-  if (sta_ssid != NULL) free(sta_ssid);
-  if (sta_password != NULL) free(sta_password);
+// HID report submission, traced so USB timing shows up on the timeline.
+// The wheel is in whole detents here, as patterns and scripts expect. At 12
+// units per detent more than 10 detents overflow one report, so the rest
+// follows in further reports rather than being clamped away.
+void hidMove(int8_t x, int8_t y, int8_t wheel) {
+  if (hidNullSink()) {
+    return;
+  }
+  TRACE_SCOPE("hid_report");
+  int32_t units = wheel * Mouse.wheelMultiplier();
+  do {
+    int8_t part = scriptClamp8(units);
+    Mouse.move(x, y, part);
+    units -= part;
+    x = 0;
+    y = 0;
+  } while (units != 0);
+  if (step_pattern >= 0 && xTaskGetCurrentTaskHandle() == loop_task_handle) {
+    recordStepInterval();
+  }
+}
+
+// Wheel and pan in report units, for the scroll glide
+void hidScroll(int8_t wheel, int8_t pan) {
+  if (hidNullSink()) {
+    return;
+  }
+  TRACE_SCOPE("hid_report");
+  Mouse.move(0, 0, wheel, pan);
+}
+
+void hidPress(uint8_t button) {
+  if (hidNullSink()) {
+    return;
+  }
+  TRACE_SCOPE("hid_report");
+  Mouse.press(button);
+}
+
+void hidRelease(uint8_t button) {
+  if (hidNullSink()) {
+    return;
+  }
+  TRACE_SCOPE("hid_report");
+  Mouse.release(button);
+}
+
+// True on the benchmark worker, whose reports go nowhere
+bool hidNullSink() {
+  return hid_null_sink_task != NULL && xTaskGetCurrentTaskHandle() == hid_null_sink_task;
+}
+
+// Sends queued touchpad input. Between commands it sleeps until the next
+// timed action or scroll tick is due, so held buttons never block later input.
+void hidSenderTask(void* arg) {
+  HidCommand command;
+  while (true) {
+    while (popHidCommand(command)) {
+      switch (command.type) {
+        case HID_CMD_SEQUENCE:
+          startHidSequence(command);
+          break;
+        case HID_CMD_RESET_STATS:
+          resetInputLatency();
+          break;
+        case HID_CMD_MACRO_START:
+          startMacro();
+          break;
+        case HID_CMD_MACRO_STOP:
+          stopMacro();
+          break;
+        case HID_CMD_SCROLL:
+          startScrollGlide(command);
+          break;
+      }
+      runDueHidActions();
+    }
+    runDueHidActions();
+    runScrollGlide();
+    TickType_t wait = portMAX_DELAY;
+    int64_t due_us = hid_pending_count > 0 ? hid_pending[0].due_us : INT64_MAX;
+    if (scroll_glide.ticks_left > 0 && scroll_glide.next_us < due_us) {
+      due_us = scroll_glide.next_us;
+    }
+    if (due_us != INT64_MAX) {
+      int64_t remaining_us = due_us - esp_timer_get_time();
+      wait = remaining_us > 0 ? pdMS_TO_TICKS((remaining_us + 999) / 1000) : 0;
+    }
+    // A push between the empty pop and this call leaves the notification
+    // pending, so it returns at once
+    ulTaskNotifyTake(pdTRUE, wait);
+  }
+}
+
+// Send the actions due now, schedule the rest and record the stage latencies.
+// The first report's send time is taken when USBHID accepts it, which waits
+// for the previous report to complete, so it tracks the bus.
+void startHidSequence(const HidCommand& command) {
+  if (command.step_count == 0) {
+    return;
+  }
+  int64_t dequeued_us = esp_timer_get_time();
+  int64_t sent_us = 0;
+  for (uint8_t i = 0; i < command.step_count; i++) {
+    const HidAction& action = command.steps[i];
+    if (action.offset_ms == 0) {
+      runHidAction(action);
+      if (sent_us == 0) {
+        sent_us = esp_timer_get_time();
+      }
+    } else {
+      scheduleHidAction(dequeued_us + action.offset_ms * 1000LL, action);
+    }
+  }
+  if (sent_us == 0) {
+    return; // Nothing went out yet; not a latency sample
+  }
+  recordInputLatency(command, dequeued_us, sent_us);
+}
+
+void recordInputLatency(const HidCommand& command, int64_t dequeued_us, int64_t sent_us) {
+  Histogram* stages = input_latency.stages;
+  recordHistogram(stages[LATENCY_PARSE], (uint32_t)(command.parsed_us - command.received_us));
+  recordHistogram(stages[LATENCY_ENQUEUE], (uint32_t)(command.enqueued_us - command.parsed_us));
+  recordHistogram(stages[LATENCY_QUEUE], (uint32_t)(dequeued_us - command.enqueued_us));
+  recordHistogram(stages[LATENCY_SEND], (uint32_t)(sent_us - dequeued_us));
+  recordHistogram(stages[LATENCY_TOTAL], (uint32_t)(sent_us - command.received_us));
+  if (command.seq != 0) {
+    input_latency.last_seq = command.seq;
+  }
+}
+
+// Add a scroll command to the glide and pay out its first tick right away.
+// Commands arriving during a glide merge into it, so a stream of small
+// scrolls flows on without restarting the easing.
+void startScrollGlide(const HidCommand& command) {
+  int64_t dequeued_us = esp_timer_get_time();
+  ScrollGlide& glide = scroll_glide;
+  if (macro_state.load(std::memory_order_relaxed) == MACRO_RECORDING) {
+    // Scripts scroll in whole detents and have no pan
+    macro.scroll_carry += command.scroll[0];
+    int32_t detents = constrain(macro.scroll_carry / SCROLL_UNITS_PER_DETENT, -127, 127);
+    if (detents != 0) {
+      macro.scroll_carry -= detents * SCROLL_UNITS_PER_DETENT;
+      HidAction action = { 0, HID_ACTION_MOVE, 0, 0, 0, (int8_t)detents };
+      recordMacroAction(action);
+    }
+  }
+  for (int axis = 0; axis < 2; axis++) {
+    glide.remaining[axis] += command.scroll[axis];
+  }
+  uint32_t ticks = max((uint32_t)1, (uint32_t)(command.glide_ms * 1000UL / SCROLL_TICK_US));
+  if (glide.ticks_left == 0) {
+    glide.next_us = dequeued_us;
+  }
+  if (ticks > glide.ticks_left) {
+    glide.ticks_left = ticks;
+  }
+  if (runScrollGlide()) {
+    recordInputLatency(command, dequeued_us, esp_timer_get_time());
+  }
+}
+
+// Pay out the ticks that are due. The speed falls linearly over the glide:
+// with n ticks left, the next k take k(2n-k+1)/(n(n+1)) of the remaining
+// distance, so ticks missed while the task was busy are caught up in one
+// report instead of being dropped. Returns true when a report went out.
+bool runScrollGlide() {
+  ScrollGlide& glide = scroll_glide;
+  int64_t now = esp_timer_get_time();
+  if (glide.ticks_left == 0 || now < glide.next_us) {
+    return false;
+  }
+  int64_t n = glide.ticks_left;
+  int64_t k = min(n, (now - glide.next_us) / SCROLL_TICK_US + 1);
+  glide.next_us += k * SCROLL_TICK_US;
+  glide.ticks_left -= (uint32_t)k;
+  
+  const uint8_t multipliers[2] = { Mouse.wheelMultiplier(), Mouse.panMultiplier() };
+  int8_t report[2];
+  for (int axis = 0; axis < 2; axis++) {
+    int32_t step = k == n ? glide.remaining[axis]
+                          : (int32_t)(glide.remaining[axis] * k * (2 * n - k + 1) / (n * (n + 1)));
+    glide.remaining[axis] -= step;
+    glide.carry[axis] += step;
+    int32_t unit = SCROLL_UNITS_PER_DETENT / multipliers[axis];
+    int32_t units = constrain(glide.carry[axis] / unit, -127, 127);
+    glide.carry[axis] -= units * unit;
+    report[axis] = (int8_t)units;
+    if (glide.ticks_left == 0 && abs(glide.carry[axis]) >= unit) {
+      glide.ticks_left = 1; // More than one report's worth, finish on the next tick
+    }
+  }
+  if (report[0] == 0 && report[1] == 0) {
+    return false;
+  }
+  hidScroll(report[0], report[1]);
+  return true;
+}
+
+void runHidAction(const HidAction& action) {
+  if (macro_state.load(std::memory_order_relaxed) == MACRO_RECORDING) {
+    recordMacroAction(action);
+  }
+  switch (action.type) {
+    case HID_ACTION_MOVE:
+      hidMove(action.x, action.y, action.wheel);
+      break;
+    case HID_ACTION_PRESS:
+      hidPress(action.button);
+      break;
+    case HID_ACTION_RELEASE:
+      hidRelease(action.button);
+      break;
+  }
+}
+
+// Sender task: begin a new recording, dropping any unsaved one. A stopped
+// recording is kept until it is saved.
+void startMacro() {
+  uint8_t state = macro_state.load();
+  if (state == MACRO_STOPPED || state == MACRO_WRITTEN) {
+    return;
+  }
+  macro.count = 0;
+  macro.buttons = 0;
+  macro.truncated = false;
+  macro.first_event_us = 0;
+  macro.recorded_ms = 0;
+  macro.scroll_carry = 0;
+  macro_state.store(MACRO_RECORDING);
+}
+
+// Sender task: release what the recording left held, end it with HALT and
+// hand the buffer over. appendMacro() kept two slots free for this.
+void stopMacro() {
+  if (macro_state.load() != MACRO_RECORDING) {
+    return;
+  }
+  if (macro.buttons != 0) {
+    macro.code[macro.count++] = { SCRIPT_OP_RELEASE, macro.buttons, 0 };
+  }
+  macro.code[macro.count++] = { SCRIPT_OP_HALT, 0, 0 };
+  macro_state.store(MACRO_STOPPED, std::memory_order_release);
+  wakeScheduler();
+}
+
+bool appendMacro(uint8_t op, uint8_t a, int16_t imm) {
+  if (macro.truncated || macro.count >= SCRIPT_MAX_INSTRUCTIONS - 2) {
+    macro.truncated = true;
+    return false;
+  }
+  macro.code[macro.count++] = { op, a, imm };
+  return true;
+}
+
+// Sender task, called with each report just before it is sent
+void recordMacroAction(const HidAction& action) {
+  int64_t now = esp_timer_get_time();
+  if (macro.first_event_us == 0) {
+    macro.first_event_us = now;
+  }
+  uint32_t due_ms = (uint32_t)((now - macro.first_event_us + 500) / 1000);
+  bool waited = false;
+  while (due_ms > macro.recorded_ms) {
+    uint32_t wait = min(due_ms - macro.recorded_ms, (uint32_t)INT16_MAX);
+    if (!appendMacro(SCRIPT_OP_WAIT, 0, (int16_t)wait)) {
+      return;
+    }
+    macro.recorded_ms += wait;
+    waited = true;
+  }
+  
+  switch (action.type) {
+    case HID_ACTION_MOVE:
+      if (action.x != 0 || action.y != 0) {
+        // Merge into the previous move when nothing came between them
+        ScriptInstruction* last = macro.count > 0 ? &macro.code[macro.count - 1] : NULL;
+        if (!waited && last != NULL && last->op == SCRIPT_OP_MOVEI) {
+          int x = (int8_t)(last->imm & 0xff) + action.x;
+          int y = (int8_t)(last->imm >> 8) + action.y;
+          if (x >= -127 && x <= 127 && y >= -127 && y <= 127) {
+            last->imm = (int16_t)(uint16_t)(((y & 0xff) << 8) | (x & 0xff));
+            break;
+          }
+        }
+        appendMacro(SCRIPT_OP_MOVEI, 0, (int16_t)(uint16_t)(((action.y & 0xff) << 8) | (action.x & 0xff)));
+      }
+      if (action.wheel != 0) {
+        appendMacro(SCRIPT_OP_SCROLLI, 0, action.wheel);
+      }
+      break;
+    case HID_ACTION_PRESS:
+      if (appendMacro(SCRIPT_OP_PRESS, action.button & SCRIPT_BUTTON_MASK, 0)) {
+        macro.buttons |= action.button & SCRIPT_BUTTON_MASK;
+      }
+      break;
+    case HID_ACTION_RELEASE:
+      if (appendMacro(SCRIPT_OP_RELEASE, action.button & SCRIPT_BUTTON_MASK, 0)) {
+        macro.buttons &= ~(action.button & SCRIPT_BUTTON_MASK);
+      }
+      break;
+  }
+}
+
+// Motion engine, once the recording is MACRO_STOPPED
+bool writeMacroFile(const char* path) {
+  File file = SPIFFS.open(path, "w");
+  if (!file) {
+    return false;
+  }
+  uint8_t buffer[SCRIPT_FILE_HEADER_SIZE + 64 * SCRIPT_INSTRUCTION_SIZE];
+  size_t length = scriptWriteHeader(buffer, macro.count);
+  bool ok = true;
+  for (uint16_t i = 0; i < macro.count && ok; i++) {
+    length += scriptWriteInstruction(buffer + length, macro.code[i]);
+    if (length + SCRIPT_INSTRUCTION_SIZE > sizeof(buffer) || i + 1 == macro.count) {
+      ok = file.write(buffer, length) == length;
+      length = 0;
+    }
+  }
+  file.close();
+  return ok;
+}
+
+// Motion engine: write a stopped recording to macro_temp_path and check it,
+// then hand it to the web server task
+void writeMacro() {
+  const char* error = NULL;
+  int code = 400;
+  PatternFileEntry info = {};
+  if (macro.count <= 1) {
+    error = "Nothing was recorded";
+  } else if (!writeMacroFile(macro_temp_path)) {
+    error = "Could not store the macro";
+    code = 500;
+  } else {
+    error = checkPatternFile(macro_temp_path, info);
+    code = 500;
+    strlcpy(info.name, macro_result.name, sizeof(info.name));
+  }
+  if (error != NULL) {
+    SPIFFS.remove(macro_temp_path);
+  }
+  macro_result.info = info;
+  macro_result.error = error;
+  macro_result.code = code;
+  macro_result.instructions = info.step_count;
+  macro_result.duration_ms = macro.recorded_ms;
+  macro_result.truncated = macro.truncated;
+  macro_state.store(MACRO_WRITTEN, std::memory_order_release);
+}
+
+// Web server task, before every request: install a macro the motion engine
+// has written, so the pattern index only ever changes on this task. While a
+// pattern holds motion_mutex it stays WRITTEN for the next request.
+void finishMacroSave() {
+  if (macro_state.load(std::memory_order_acquire) != MACRO_WRITTEN) {
+    return;
+  }
+  if (macro_result.error == NULL) {
+    int code = 500;
+    const char* error = storePatternFile(macro_temp_path, macro_result.info, code);
+    if (error != NULL && code == 503) {
+      return;
+    }
+    SPIFFS.remove(macro_temp_path);
+    macro_result.error = error;
+    macro_result.code = error != NULL ? code : 200;
+  }
+  if (macro_result.error != NULL) {
+    LOG_WARN("Macro %s not saved: %s", macro_result.name, macro_result.error);
+  } else {
+    LOG_INFO("Macro %s saved (%u instructions, %u ms)", macro_result.name,
+             (unsigned)macro_result.instructions, (unsigned)macro_result.duration_ms);
+  }
+  macro_state.store(MACRO_SAVED, std::memory_order_release);
+}
+
+// Insert by due time; with no room left the action runs now rather than
+// being lost, so a release never goes missing
+void scheduleHidAction(int64_t due_us, const HidAction& action) {
+  if (hid_pending_count >= HID_MAX_PENDING) {
+    LOG_WARN("HID action queue full, sending early");
+    runHidAction(action);
+    return;
+  }
+  int i = hid_pending_count++;
+  while (i > 0 && hid_pending[i - 1].due_us > due_us) {
+    hid_pending[i] = hid_pending[i - 1];
+    i--;
+  }
+  hid_pending[i].due_us = due_us;
+  hid_pending[i].action = action;
+}
+
+void runDueHidActions() {
+  int due = 0;
+  int64_t now = esp_timer_get_time();
+  while (due < hid_pending_count && hid_pending[due].due_us <= now) {
+    runHidAction(hid_pending[due].action);
+    due++;
+  }
+  if (due > 0) {
+    memmove(hid_pending, hid_pending + due, (hid_pending_count - due) * sizeof(PendingHidAction));
+    hid_pending_count -= due;
+  }
+}
+
+// Append a step to a touchpad command; extra steps beyond HID_SEQUENCE_STEPS are dropped
+void addHidAction(HidCommand& command, uint16_t offset_ms, HidActionType type, uint8_t button,
+                  int8_t x, int8_t y, int8_t wheel) {
+  if (command.step_count >= HID_SEQUENCE_STEPS) {
+    return;
+  }
+  command.type = HID_CMD_SEQUENCE;
+  HidAction& action = command.steps[command.step_count++];
+  action.offset_ms = offset_ms;
+  action.type = type;
+  action.button = button;
+  action.x = x;
+  action.y = y;
+  action.wheel = wheel;
+}
+
+void resetInputLatency() {
+  for (int i = 0; i < LATENCY_STAGES; i++) {
+    memset(&input_latency.stages[i], 0, sizeof(Histogram));
+    input_latency.stages[i].shift = 3;
+  }
+  input_latency.last_seq = 0;
+  input_latency.dropped = 0;
+}
+
+// Called from a touchpad body handler once the command is filled in
+bool queueHidCommand(HidCommand& command) {
+  command.enqueued_us = esp_timer_get_time();
+  if (!pushHidCommand(command)) {
+    input_latency.dropped++;
+    return false;
+  }
+  noteLiveInput();
+  return true;
+}
+
+// Producer side, web server task only; false when the ring is full
+bool pushHidCommand(const HidCommand& command) {
+  if (hid_task == NULL) {
+    return false;
+  }
+  uint32_t head = hid_ring.head.load(std::memory_order_relaxed);
+  if (head - hid_ring.tail.load(std::memory_order_acquire) >= HID_RING_SIZE) {
+    return false;
+  }
+  hid_ring.slots[head % HID_RING_SIZE] = command;
+  hid_ring.head.store(head + 1, std::memory_order_release);
+  xTaskNotifyGive(hid_task);
+  return true;
+}
+
+// Consumer side, sender task only
+bool popHidCommand(HidCommand& command) {
+  uint32_t tail = hid_ring.tail.load(std::memory_order_relaxed);
+  if (tail == hid_ring.head.load(std::memory_order_acquire)) {
+    return false;
+  }
+  command = hid_ring.slots[tail % HID_RING_SIZE];
+  hid_ring.tail.store(tail + 1, std::memory_order_release);
+  return true;
+}
+
+uint32_t hidRingDepth() {
+  return hid_ring.head.load(std::memory_order_relaxed) - hid_ring.tail.load(std::memory_order_relaxed);
+}
+
+// Echoes the probe sequence ID so the client can match round trips. Sent
+// once the command is queued, before the report goes out; the remaining
+// stages are in input_latency (/api/metrics/latency).
+void sendInputAck(AsyncWebServerRequest *request, const HidCommand& command, bool queued) {
+  char response[64];
+  if (queued) {
+    snprintf(response, sizeof(response), "{\"status\":\"success\",\"seq\":%lu}", (unsigned long)command.seq);
+    sendText(request, 200, "application/json", response);
+  } else {
+    snprintf(response, sizeof(response), "{\"status\":\"busy\",\"seq\":%lu}", (unsigned long)command.seq);
+    sendText(request, 503, "application/json", response);
+  }
+}
+
+// Time `ops` calls of `op`, summing the cycle counter around each one
+template <typename Op>
+void benchOperation(BenchRun& run, const char* name, uint32_t ops, Op op) {
+  if (run.result_count >= BENCH_MAX_RESULTS) {
+    return;
+  }
+  BenchResult& result = run.results[run.result_count++];
+  result.name = name;
+  result.ops = ops;
+  result.cycles = 0;
+  int64_t start_us = esp_timer_get_time();
+  for (uint32_t i = 0; i < ops; i++) {
+    uint32_t start = ESP.getCycleCount();
+    op();
+    result.cycles += (uint32_t)(ESP.getCycleCount() - start);
+  }
+  result.elapsed_us = esp_timer_get_time() - start_us;
+}
+
+void runBenchmarks(BenchRun& run) {
+  uint32_t iterations = run.iterations;
+  
+  // JSON bodies of the API handlers
+  for (const BenchPayload& payload : bench_payloads) {
+    benchOperation(run, payload.parse_name, iterations, [&payload]() {
+      StaticJsonDocument<512> doc;
+      deserializeJson(doc, payload.json);
+    });
+    StaticJsonDocument<512> parsed;
+    deserializeJson(parsed, payload.json);
+    benchOperation(run, payload.serialize_name, iterations, [&parsed]() {
+      char out[512];
+      serializeJson(parsed, out, sizeof(out));
+    });
+  }
+  
+  // Session lookup as validateSession does it, with the caller's cookie (a miss without auth)
+  String cookie = run.cookie.length() > 0 ? run.cookie : String("session=none");
+  benchOperation(run, "session_validate", iterations, [&cookie]() {
+    findSession(sessionIdFromCookie(cookie));
+  });
+  
+  // SPIFFS reads of the stored config and the largest page we serve
+  const char* const files[][2] = { { "spiffs_read:config", config_file }, { "spiffs_read:index", "/index.html" } };
+  for (const auto& file : files) {
+    benchOperation(run, file[0], max(iterations / 10, (uint32_t)1), [&file]() {
+      File handle = SPIFFS.open(file[1], "r");
+      uint8_t buffer[512];
+      while (handle && handle.read(buffer, sizeof(buffer)) > 0) {
+      }
+      handle.close();
+    });
+  }
+  
+  // Motion patterns at speed 0 into the null sink
+  if (xSemaphoreTake(motion_mutex, pdMS_TO_TICKS(BENCH_MOTION_WAIT_MS)) != pdTRUE) {
+    run.motion_skipped = true;
+    return;
+  }
+  int saved_x = totalDisplacementX;
+  int saved_y = totalDisplacementY;
+  hid_null_sink_task = xTaskGetCurrentTaskHandle();
+  for (int i = 0; i < PATTERN_COUNT; i++) {
+    int size = run.movement_size;
+    benchOperation(run, patterns[i].trace_name, max(iterations / 10, (uint32_t)1), [i, size]() {
+      patterns[i].run(size, 0);
+    });
+  }
+  for (const PatternFileEntry& entry : pattern_files) {
+    if (entry.name[0] == '\0') {
+      continue;
+    }
+    int size = run.movement_size;
+    benchOperation(run, entry.name, max(iterations / 10, (uint32_t)1), [&entry, size]() {
+      if (entry.kind == PATTERN_FILE_SCRIPT) {
+        runScriptFile(entry, size, 0);
+      } else {
+        playPatternFile(entry, size, 0);
+      }
+    });
+  }
+  hid_null_sink_task = NULL;
+  totalDisplacementX = saved_x;
+  totalDisplacementY = saved_y;
+  xSemaphoreGive(motion_mutex);
+}
+
+void benchTask(void* arg) {
+  runBenchmarks(bench_run);
+  
+  // Publish the results for /api/bench/result
+  bench_state.store(BENCH_DONE, std::memory_order_release);
+  vTaskDelete(NULL);
 }
 
 // Reset cursor to initial position
 void resetCursorPosition() {
   if (totalDisplacementX != 0 || totalDisplacementY != 0) {
     // Move back to the original position
-    Mouse.move(-totalDisplacementX, -totalDisplacementY);
+    hidMove(-totalDisplacementX, -totalDisplacementY);
     DEBUGF("Reset cursor to initial position: (%d, %d)", -totalDisplacementX, -totalDisplacementY);
     
     // Reset displacement tracking
@@ -0,0 +1,104 @@
+// Host tests for the random_delay interval: run with `pio test -e native`
+#include <unity.h>
+#include <math.h>
+#include <random>
+#include "jiggle_interval.h"
+#include "timer_wheel.h"
+
+static std::mt19937 rng;
+
+// Stand-in for Arduino's random(low, high): uniform in [low, high)
+static long hostRandom(long low, long high) {
+  return std::uniform_int_distribution<long>(low, high - 1)(rng);
+}
+
+void setUp(void) {
+  rng.seed(12345);
+}
+
+void tearDown(void) {
+}
+
+void test_no_spread_returns_interval(void) {
+  TEST_ASSERT_EQUAL_UINT32(30000, jitterInterval(30000, 0, hostRandom));
+}
+
+void test_spread_stays_within_30_percent(void) {
+  uint32_t lowest = UINT32_MAX;
+  uint32_t highest = 0;
+  for (int i = 0; i < 100000; i++) {
+    uint32_t interval = jitterInterval(10000, RANDOM_DELAY_SPREAD_PERMILLE, hostRandom);
+    lowest = interval < lowest ? interval : lowest;
+    highest = interval > highest ? interval : highest;
+  }
+  TEST_ASSERT_EQUAL_UINT32(7000, lowest);
+  TEST_ASSERT_EQUAL_UINT32(13000, highest);
+}
+
+void test_long_intervals_do_not_overflow(void) {
+  // 24 hours at +30% is past 2^32 / 1000, computed in 64 bits
+  uint32_t day = 24UL * 60 * 60 * 1000;
+  for (int i = 0; i < 1000; i++) {
+    uint32_t interval = jitterInterval(day, RANDOM_DELAY_SPREAD_PERMILLE, hostRandom);
+    TEST_ASSERT_TRUE(interval >= day / 10 * 7 && interval <= day / 10 * 13);
+  }
+}
+
+// Drive the scheduler the way loop() does: draw the interval once per
+// cycle, keep the deadline on the timer wheel, wake up at arbitrary points
+// on a virtual clock and fire when the wheel says so. Every cycle must fire
+// exactly on the deadline it reported, and the fired intervals must be
+// spread evenly over 0.7 .. 1.3 of the setting.
+void test_fired_intervals_are_uniform_on_virtual_clock(void) {
+  const uint32_t interval = 10000;
+  const int cycles = 12000;
+  const int bins = 12;
+  const uint32_t bin_permille = 2 * RANDOM_DELAY_SPREAD_PERMILLE / bins;
+  int counts[bins] = {};
+  double sum = 0;
+  
+  TimerWheel wheel;
+  uint32_t now = 0xfffff000UL; // Wraps during the run, like millis()
+  timerWheelInit(wheel, now);
+  std::uniform_int_distribution<uint32_t> wake(1, 2000);
+  for (int cycle = 0; cycle < cycles; cycle++) {
+    uint32_t start = now;
+    uint32_t deadline = start + jitterInterval(interval, RANDOM_DELAY_SPREAD_PERMILLE, hostRandom);
+    timerWheelSet(wheel, 0, deadline);
+    while (true) {
+      // Other work wakes the loop early; otherwise it sleeps until the wheel's next tick
+      uint32_t tick;
+      TEST_ASSERT_TRUE(timerWheelNextWork(wheel, tick));
+      uint32_t step = wake(rng);
+      now = (int32_t)(tick - now) < (int32_t)step ? tick : now + step;
+      if (timerWheelAdvance(wheel, now) & 1) {
+        break;
+      }
+    }
+    TEST_ASSERT_EQUAL_UINT32(deadline, now);
+    uint32_t permille = (now - start) * 1000 / interval;
+    int bin = (int)((permille - 700) / bin_permille);
+    counts[bin < bins ? bin : bins - 1]++;
+    sum += now - start;
+  }
+  
+  // Chi-square against the exact expectation: 601 permille values, the
+  // last bin also holds 1300
+  double chi2 = 0;
+  for (int bin = 0; bin < bins; bin++) {
+    double values = bin == bins - 1 ? bin_permille + 1 : bin_permille;
+    double expected = cycles * values / 601.0;
+    chi2 += (counts[bin] - expected) * (counts[bin] - expected) / expected;
+  }
+  TEST_ASSERT_LESS_THAN(31.26, chi2); // 11 degrees of freedom, p = 0.001
+  TEST_ASSERT_FLOAT_WITHIN(0.01 * interval, (double)interval, sum / cycles);
+}
+
+int main(void) {
+  UNITY_BEGIN();
+  RUN_TEST(test_no_spread_returns_interval);
+  RUN_TEST(test_spread_stays_within_30_percent);
+  RUN_TEST(test_long_intervals_do_not_overflow);
+  RUN_TEST(test_fired_intervals_are_uniform_on_virtual_clock);
+  return UNITY_END();
+}
@@ -0,0 +1,144 @@
+// Host tests for pattern file encoding: patternEncode() output must pass
+// patternValidate() and decode back to the same points
+#include <unity.h>
+#include <vector>
+#include "pattern_file.h"
+
+struct BufferSource {
+  const uint8_t* data;
+  size_t length;
+  size_t offset = 0;
+  int read() { return offset < length ? data[offset++] : -1; }
+};
+
+void setUp(void) {
+}
+
+void tearDown(void) {
+}
+
+static std::vector<uint8_t> encode(const std::vector<PatternPoint>& points, const char** error) {
+  std::vector<uint8_t> bytes(PATTERN_FILE_MAX_SIZE);
+  size_t length = patternEncode(points.data(), points.size(), bytes.data(), bytes.size(), error);
+  bytes.resize(length);
+  return bytes;
+}
+
+// Decode a validated file back into absolute points
+static std::vector<PatternPoint> decode(const std::vector<uint8_t>& bytes, PatternFileHeader& header,
+                                        std::vector<uint8_t>* encodings) {
+  BufferSource check = { bytes.data(), bytes.size() };
+  TEST_ASSERT_NULL(patternValidate(check, header));
+
+  std::vector<PatternPoint> points;
+  BufferSource source = { bytes.data(), bytes.size(), PATTERN_FILE_HEADER_SIZE };
+  int32_t x = 0;
+  int32_t y = 0;
+  for (uint16_t s = 0; s < header.segment_count; s++) {
+    PatternSegment segment;
+    TEST_ASSERT_TRUE(patternReadSegment(source, segment));
+    if (encodings != NULL) {
+      encodings->push_back(segment.encoding);
+    }
+    for (uint16_t i = 0; i < segment.step_count; i++) {
+      int32_t dx, dy;
+      TEST_ASSERT_TRUE(patternReadDelta(source, segment.encoding, dx, dy));
+      x += dx;
+      y += dy;
+      points.push_back({ x, y, segment.step_units });
+    }
+  }
+  return points;
+}
+
+static void assertSamePoints(const std::vector<PatternPoint>& expected, const std::vector<PatternPoint>& actual) {
+  TEST_ASSERT_EQUAL(expected.size(), actual.size());
+  for (size_t i = 0; i < expected.size(); i++) {
+    TEST_ASSERT_EQUAL(expected[i].x, actual[i].x);
+    TEST_ASSERT_EQUAL(expected[i].y, actual[i].y);
+    TEST_ASSERT_EQUAL(expected[i].units, actual[i].units);
+  }
+}
+
+void test_round_trip_small_steps(void) {
+  std::vector<PatternPoint> points = {
+    { 10, 0, 1 }, { 20, -5, 1 }, { 30, -5, 2 }, { 0, 0, 2 }, { -200, 127, 1 },
+  };
+  const char* error;
+  std::vector<uint8_t> bytes = encode(points, &error);
+  TEST_ASSERT_NULL(error);
+
+  PatternFileHeader header;
+  std::vector<uint8_t> encodings;
+  assertSamePoints(points, decode(bytes, header, &encodings));
+  TEST_ASSERT_EQUAL(5, header.step_count);
+  TEST_ASSERT_EQUAL(3, header.segment_count); // Units 1, 2, 1
+  TEST_ASSERT_EQUAL(7, header.duration_units);
+  TEST_ASSERT_EQUAL(PATTERN_ENCODING_INT8, encodings[0]);
+  TEST_ASSERT_EQUAL(PATTERN_ENCODING_INT8, encodings[1]);
+  TEST_ASSERT_EQUAL(PATTERN_ENCODING_VARINT, encodings[2]); // dx -200
+}
+
+void test_round_trip_large_steps_use_varints(void) {
+  std::vector<PatternPoint> points = {
+    { 5, 5, 3 }, { 10000, -10000, 3 }, { -10000, 10000, 3 }, { 0, 0, 3 },
+  };
+  const char* error;
+  std::vector<uint8_t> bytes = encode(points, &error);
+  TEST_ASSERT_NULL(error);
+
+  PatternFileHeader header;
+  std::vector<uint8_t> encodings;
+  assertSamePoints(points, decode(bytes, header, &encodings));
+  TEST_ASSERT_EQUAL(1, header.segment_count);
+  TEST_ASSERT_EQUAL(12, header.duration_units);
+  TEST_ASSERT_EQUAL(PATTERN_ENCODING_VARINT, encodings[0]);
+}
+
+void test_round_trip_long_path(void) {
+  // A zigzag with a jump every 200 steps and durations alternating every 16
+  const uint32_t steps = PATTERN_FILE_MAX_STEPS / 2;
+  std::vector<PatternPoint> points;
+  int32_t x = 0;
+  for (uint32_t i = 0; i < steps; i++) {
+    x += (i / 64) % 2 == 0 ? 1 : -1;
+    points.push_back({ x, (int32_t)(i % 200) - 100, (uint16_t)(1 + (i / 16) % 2) });
+  }
+  const char* error;
+  std::vector<uint8_t> bytes = encode(points, &error);
+  TEST_ASSERT_NULL(error);
+
+  PatternFileHeader header;
+  assertSamePoints(points, decode(bytes, header, NULL));
+  TEST_ASSERT_EQUAL(steps / 16, header.segment_count);
+}
+
+void test_rejects_what_the_device_would(void) {
+  const char* error;
+  TEST_ASSERT_EQUAL(0, encode({}, &error).size());
+  TEST_ASSERT_NOT_NULL(error);
+  TEST_ASSERT_EQUAL(0, encode({ { 1, 1, 0 } }, &error).size());
+  TEST_ASSERT_EQUAL_STRING("Zero step duration", error);
+  TEST_ASSERT_EQUAL(0, encode({ { PATTERN_FILE_MAX_COORD + 1, 0, 1 } }, &error).size());
+  TEST_ASSERT_EQUAL_STRING("Position out of range", error);
+  std::vector<PatternPoint> too_long(PATTERN_FILE_MAX_STEPS + 1, PatternPoint{ 0, 0, 1 });
+  TEST_ASSERT_EQUAL(0, encode(too_long, &error).size());
+  TEST_ASSERT_EQUAL_STRING("Bad step count", error);
+
+  // Varint steps past the size limit
+  std::vector<PatternPoint> wide;
+  for (uint32_t i = 0; i < PATTERN_FILE_MAX_STEPS; i++) {
+    wide.push_back({ i % 2 == 0 ? 10000 : -10000, i % 2 == 0 ? -10000 : 10000, 1 });
+  }
+  TEST_ASSERT_EQUAL(0, encode(wide, &error).size());
+  TEST_ASSERT_EQUAL_STRING("File too large", error);
+}
+
+int main(void) {
+  UNITY_BEGIN();
+  RUN_TEST(test_round_trip_small_steps);
+  RUN_TEST(test_round_trip_large_steps_use_varints);
+  RUN_TEST(test_round_trip_long_path);
+  RUN_TEST(test_rejects_what_the_device_would);
+  return UNITY_END();
+}
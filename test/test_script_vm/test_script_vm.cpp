@@ -0,0 +1,212 @@
+// Host tests for the script verifier and interpreter: what scriptValidate()
+// refuses, and how scriptRun() and scriptRunSlice() spend their budget
+#include <unity.h>
+#include <vector>
+#include "script_vm.h"
+
+struct BufferSource {
+  const uint8_t* data;
+  size_t length;
+  size_t offset = 0;
+  int read() { return offset < length ? data[offset++] : -1; }
+};
+
+// Records reports; random() returns its maximum
+struct RecordingHost {
+  int moves = 0;
+  int32_t x = 0;
+  int32_t y = 0;
+  int32_t wheel = 0;
+  uint8_t pressed = 0;
+  void move(int8_t dx, int8_t dy) {
+    moves++;
+    x += dx;
+    y += dy;
+  }
+  void press(uint8_t buttons) { pressed |= buttons; }
+  void release(uint8_t buttons) { pressed &= ~buttons; }
+  void scroll(int8_t amount) { wheel += amount; }
+  uint32_t random(uint32_t max) { return max; }
+};
+
+void setUp(void) {
+}
+
+void tearDown(void) {
+}
+
+static const char* validate(const std::vector<ScriptInstruction>& code) {
+  std::vector<uint8_t> bytes(SCRIPT_FILE_HEADER_SIZE + code.size() * SCRIPT_INSTRUCTION_SIZE);
+  size_t length = scriptWriteHeader(bytes.data(), (uint16_t)code.size());
+  for (const ScriptInstruction& instruction : code) {
+    length += scriptWriteInstruction(bytes.data() + length, instruction);
+  }
+  BufferSource source = { bytes.data(), length };
+  uint16_t count;
+  return scriptValidate(source, count);
+}
+
+void test_verifier_accepts_a_valid_script(void) {
+  TEST_ASSERT_NULL(validate({
+    { SCRIPT_OP_SET, 0, 3 },
+    { SCRIPT_OP_MOVEI, 0, (int16_t)((uint8_t)-4 << 8 | 10) },
+    { SCRIPT_OP_DIV, 0, -1 },
+    { SCRIPT_OP_WAITR, SCRIPT_REG_SPEED, 0 },
+    { SCRIPT_OP_LOOP, 0, 1 },
+    { SCRIPT_OP_HALT, 0, 0 },
+  }));
+}
+
+void test_verifier_rejects_bad_jump_targets(void) {
+  TEST_ASSERT_EQUAL_STRING("Bad operand", validate({ { SCRIPT_OP_JMP, 0, 2 }, { SCRIPT_OP_HALT, 0, 0 } }));
+  TEST_ASSERT_EQUAL_STRING("Bad operand", validate({ { SCRIPT_OP_JMP, 0, -1 }, { SCRIPT_OP_HALT, 0, 0 } }));
+  TEST_ASSERT_EQUAL_STRING("Bad operand", validate({ { SCRIPT_OP_LOOP, 0, 5 }, { SCRIPT_OP_HALT, 0, 0 } }));
+  TEST_ASSERT_NULL(validate({ { SCRIPT_OP_JMP, 0, 1 }, { SCRIPT_OP_JMP, 0, 0 } }));
+}
+
+void test_verifier_rejects_bad_operands(void) {
+  TEST_ASSERT_EQUAL_STRING("Bad operand", validate({ { SCRIPT_OP_DIV, 0, 0 }, { SCRIPT_OP_HALT, 0, 0 } }));
+  TEST_ASSERT_EQUAL_STRING("Bad operand", validate({ { SCRIPT_OP_SET, SCRIPT_REGISTERS, 1 }, { SCRIPT_OP_HALT, 0, 0 } }));
+  TEST_ASSERT_EQUAL_STRING("Bad operand", validate({ { SCRIPT_OP_MOV, 0, SCRIPT_REGISTERS }, { SCRIPT_OP_HALT, 0, 0 } }));
+  TEST_ASSERT_EQUAL_STRING("Bad operand", validate({ { SCRIPT_OP_RAND, 0, -1 }, { SCRIPT_OP_HALT, 0, 0 } }));
+  TEST_ASSERT_EQUAL_STRING("Bad operand", validate({ { SCRIPT_OP_PRESS, 0x20, 0 }, { SCRIPT_OP_HALT, 0, 0 } }));
+  TEST_ASSERT_EQUAL_STRING("Bad operand", validate({ { SCRIPT_OP_SCROLLI, 0, 128 }, { SCRIPT_OP_HALT, 0, 0 } }));
+  TEST_ASSERT_EQUAL_STRING("Bad operand", validate({ { SCRIPT_OP_WAIT, 0, -1 }, { SCRIPT_OP_HALT, 0, 0 } }));
+  TEST_ASSERT_EQUAL_STRING("Unknown opcode", validate({ { SCRIPT_OP_COUNT, 0, 0 }, { SCRIPT_OP_HALT, 0, 0 } }));
+}
+
+void test_verifier_requires_a_final_halt_or_jmp(void) {
+  TEST_ASSERT_EQUAL_STRING("Script must end with HALT or JMP", validate({ { SCRIPT_OP_SET, 0, 1 } }));
+  TEST_ASSERT_EQUAL_STRING("Script must end with HALT or JMP",
+                           validate({ { SCRIPT_OP_SET, 0, 1 }, { SCRIPT_OP_LOOP, 0, 0 } }));
+  TEST_ASSERT_EQUAL_STRING("Bad instruction count", validate({}));
+}
+
+void test_verifier_rejects_truncated_and_trailing_data(void) {
+  uint8_t bytes[SCRIPT_FILE_HEADER_SIZE + 2 * SCRIPT_INSTRUCTION_SIZE + 1];
+  size_t length = scriptWriteHeader(bytes, 1);
+  length += scriptWriteInstruction(bytes + length, { SCRIPT_OP_HALT, 0, 0 });
+  bytes[length++] = 0;
+  uint16_t count;
+  BufferSource trailing = { bytes, length };
+  TEST_ASSERT_EQUAL_STRING("Trailing data after the last instruction", scriptValidate(trailing, count));
+  scriptWriteHeader(bytes, 2);
+  BufferSource truncated = { bytes, length };
+  TEST_ASSERT_EQUAL_STRING("Truncated script", scriptValidate(truncated, count));
+}
+
+void test_run_arithmetic_and_reports(void) {
+  const ScriptInstruction code[] = {
+    { SCRIPT_OP_SET, 0, -7 },
+    { SCRIPT_OP_DIV, 0, 2 },        // -3, toward zero
+    { SCRIPT_OP_SET, 1, 300 },
+    { SCRIPT_OP_MOVE, 1, 0 },       // x clamped to 127
+    { SCRIPT_OP_SCROLLI, 0, -5 },
+    { SCRIPT_OP_PRESS, 1, 0 },
+    { SCRIPT_OP_RAND, 2, 9 },
+    { SCRIPT_OP_HALT, 0, 0 },
+  };
+  ScriptVM vm = {};
+  RecordingHost host;
+  TEST_ASSERT_EQUAL(SCRIPT_DONE, scriptRun(vm, code, 64, host));
+  TEST_ASSERT_EQUAL(-3, vm.regs[0]);
+  TEST_ASSERT_EQUAL(9, vm.regs[2]);
+  TEST_ASSERT_EQUAL(127, host.x);
+  TEST_ASSERT_EQUAL(-3, host.y);
+  TEST_ASSERT_EQUAL(-5, host.wheel);
+  TEST_ASSERT_EQUAL(1, vm.buttons);
+  TEST_ASSERT_EQUAL(8, vm.executed);
+
+  // HALT stays put
+  TEST_ASSERT_EQUAL(SCRIPT_DONE, scriptRun(vm, code, 64, host));
+  TEST_ASSERT_EQUAL(7, vm.pc);
+}
+
+void test_run_stops_at_the_budget(void) {
+  const ScriptInstruction code[] = {
+    { SCRIPT_OP_MOVEI, 0, 1 },
+    { SCRIPT_OP_JMP, 0, 0 },
+  };
+  ScriptVM vm = {};
+  RecordingHost host;
+  TEST_ASSERT_EQUAL(SCRIPT_YIELD, scriptRun(vm, code, 64, host));
+  TEST_ASSERT_EQUAL(64, vm.executed);
+  TEST_ASSERT_EQUAL(32, host.moves);
+  TEST_ASSERT_EQUAL(SCRIPT_YIELD, scriptRun(vm, code, 64, host));
+  TEST_ASSERT_EQUAL(64, host.moves);
+}
+
+void test_waitr_is_clamped(void) {
+  const ScriptInstruction code[] = {
+    { SCRIPT_OP_WAITR, 0, 0 },
+    { SCRIPT_OP_WAITR, 1, 0 },
+    { SCRIPT_OP_WAIT, 0, 250 },
+    { SCRIPT_OP_HALT, 0, 0 },
+  };
+  ScriptVM vm = {};
+  vm.regs[0] = -50;
+  vm.regs[1] = SCRIPT_MAX_WAIT_MS + 1;
+  RecordingHost host;
+  TEST_ASSERT_EQUAL(SCRIPT_WAIT, scriptRun(vm, code, 64, host));
+  TEST_ASSERT_EQUAL(0, vm.wait_ms);
+  TEST_ASSERT_EQUAL(SCRIPT_WAIT, scriptRun(vm, code, 64, host));
+  TEST_ASSERT_EQUAL(SCRIPT_MAX_WAIT_MS, vm.wait_ms);
+  TEST_ASSERT_EQUAL(SCRIPT_WAIT, scriptRun(vm, code, 64, host));
+  TEST_ASSERT_EQUAL(250, vm.wait_ms);
+  TEST_ASSERT_EQUAL(SCRIPT_DONE, scriptRun(vm, code, 64, host));
+}
+
+void test_slice_carries_the_budget_across_zero_waits(void) {
+  // loop: WAIT 0 / JMP loop must still end its slice with a real wait
+  const ScriptInstruction code[] = {
+    { SCRIPT_OP_WAIT, 0, 0 },
+    { SCRIPT_OP_JMP, 0, 0 },
+  };
+  ScriptVM vm = {};
+  RecordingHost host;
+  for (int slice = 1; slice <= 3; slice++) {
+    TEST_ASSERT_EQUAL(SCRIPT_WAIT, scriptRunSlice(vm, code, 64, host));
+    TEST_ASSERT_EQUAL(1, vm.wait_ms);
+    TEST_ASSERT_EQUAL(64 * slice, vm.executed);
+  }
+
+  // WAITR of a negative register is a zero wait too
+  const ScriptInstruction waitr[] = {
+    { SCRIPT_OP_WAITR, 0, 0 },
+    { SCRIPT_OP_JMP, 0, 0 },
+  };
+  vm = {};
+  vm.regs[0] = -1;
+  TEST_ASSERT_EQUAL(SCRIPT_WAIT, scriptRunSlice(vm, waitr, 64, host));
+  TEST_ASSERT_EQUAL(1, vm.wait_ms);
+  TEST_ASSERT_EQUAL(64, vm.executed);
+}
+
+void test_slice_returns_real_waits_and_halt(void) {
+  const ScriptInstruction code[] = {
+    { SCRIPT_OP_WAIT, 0, 0 },
+    { SCRIPT_OP_WAIT, 0, 20 },
+    { SCRIPT_OP_HALT, 0, 0 },
+  };
+  ScriptVM vm = {};
+  RecordingHost host;
+  TEST_ASSERT_EQUAL(SCRIPT_WAIT, scriptRunSlice(vm, code, 64, host));
+  TEST_ASSERT_EQUAL(20, vm.wait_ms);
+  TEST_ASSERT_EQUAL(2, vm.executed);
+  TEST_ASSERT_EQUAL(SCRIPT_DONE, scriptRunSlice(vm, code, 64, host));
+}
+
+int main(void) {
+  UNITY_BEGIN();
+  RUN_TEST(test_verifier_accepts_a_valid_script);
+  RUN_TEST(test_verifier_rejects_bad_jump_targets);
+  RUN_TEST(test_verifier_rejects_bad_operands);
+  RUN_TEST(test_verifier_requires_a_final_halt_or_jmp);
+  RUN_TEST(test_verifier_rejects_truncated_and_trailing_data);
+  RUN_TEST(test_run_arithmetic_and_reports);
+  RUN_TEST(test_run_stops_at_the_budget);
+  RUN_TEST(test_waitr_is_clamped);
+  RUN_TEST(test_slice_carries_the_budget_across_zero_waits);
+  RUN_TEST(test_slice_returns_real_waits_and_halt);
+  return UNITY_END();
+}
@@ -0,0 +1,145 @@
+// Host tests for the timer wheel: cascading between levels, the 32-bit tick
+// wrap, re-arming and cancelling parked timers, and timers sharing a tick
+#include <unity.h>
+#include "timer_wheel.h"
+
+static TimerWheel wheel;
+
+void setUp(void) {
+}
+
+void tearDown(void) {
+}
+
+static int levelOf(uint8_t id) {
+  return wheel.timers[id].slot / TIMER_WHEEL_SLOTS;
+}
+
+static bool wheelEmpty() {
+  for (int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+    if (wheel.occupied[level] != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void test_higher_levels_cascade_into_level_0(void) {
+  timerWheelInit(wheel, 0);
+  timerWheelSet(wheel, 0, 100);     // Level 1
+  timerWheelSet(wheel, 1, 5000);    // Level 2
+  timerWheelSet(wheel, 2, 300000);  // Level 3
+  TEST_ASSERT_EQUAL(1, levelOf(0));
+  TEST_ASSERT_EQUAL(2, levelOf(1));
+  TEST_ASSERT_EQUAL(3, levelOf(2));
+
+  // Tick 64 starts level 1 slot 1, which moves timer 0 down without firing it
+  uint32_t tick;
+  TEST_ASSERT_TRUE(timerWheelNextWork(wheel, tick));
+  TEST_ASSERT_EQUAL_UINT32(64, tick);
+  TEST_ASSERT_EQUAL_UINT32(0, timerWheelAdvance(wheel, 64));
+  TEST_ASSERT_EQUAL(0, levelOf(0));
+  TEST_ASSERT_EQUAL_UINT32(0, timerWheelAdvance(wheel, 99));
+  TEST_ASSERT_EQUAL_UINT32(1 << 0, timerWheelAdvance(wheel, 100));
+
+  // Level 2 goes through level 1 on its way down
+  TEST_ASSERT_EQUAL_UINT32(0, timerWheelAdvance(wheel, 4096));
+  TEST_ASSERT_EQUAL(1, levelOf(1));
+  TEST_ASSERT_EQUAL_UINT32(0, timerWheelAdvance(wheel, 4999));
+  TEST_ASSERT_EQUAL(0, levelOf(1));
+  TEST_ASSERT_EQUAL_UINT32(1 << 1, timerWheelAdvance(wheel, 5000));
+
+  TEST_ASSERT_EQUAL_UINT32(0, timerWheelAdvance(wheel, 299999));
+  TEST_ASSERT_EQUAL_UINT32(1 << 2, timerWheelAdvance(wheel, 300000));
+  TEST_ASSERT_TRUE(wheelEmpty());
+  TEST_ASSERT_FALSE(timerWheelNextWork(wheel, tick));
+}
+
+void test_ticks_wrap_around_32_bits(void) {
+  timerWheelInit(wheel, 0xFFFFFF00);
+  timerWheelSet(wheel, 0, 0x00000040);  // 320 ticks ahead, past the wrap
+  timerWheelSet(wheel, 1, 0xFFFFFFF0);
+  timerWheelSet(wheel, 2, 0x00010000);  // Level 2, past the wrap
+
+  TEST_ASSERT_EQUAL_UINT32(1 << 1, timerWheelAdvance(wheel, 0xFFFFFFFF));
+  TEST_ASSERT_EQUAL_UINT32(0, timerWheelAdvance(wheel, 0x0000003F));
+  uint32_t tick;
+  TEST_ASSERT_TRUE(timerWheelNextWork(wheel, tick));
+  TEST_ASSERT_EQUAL_UINT32(0x00000040, tick);
+  TEST_ASSERT_EQUAL_UINT32(1 << 0, timerWheelAdvance(wheel, 0x00000040));
+  TEST_ASSERT_EQUAL_UINT32(0, timerWheelAdvance(wheel, 0x0000FFFF));
+  TEST_ASSERT_EQUAL_UINT32(1 << 2, timerWheelAdvance(wheel, 0x00010000));
+
+  // A deadline already behind a wrapped clock fires on the next tick
+  timerWheelSet(wheel, 3, 0xFFFFFFFE);
+  TEST_ASSERT_EQUAL_UINT32(1 << 3, timerWheelAdvance(wheel, 0x00010001));
+}
+
+void test_parked_timers_rearm_and_cancel(void) {
+  const uint32_t start = 1000;
+  const uint32_t far = start + TIMER_WHEEL_SPAN + 5000;
+  timerWheelInit(wheel, start);
+
+  // Past the span the timer waits at the edge and is placed again there
+  timerWheelSet(wheel, 0, far);
+  TEST_ASSERT_EQUAL(TIMER_WHEEL_LEVELS - 1, levelOf(0));
+  TEST_ASSERT_EQUAL_UINT32(0, timerWheelAdvance(wheel, start + TIMER_WHEEL_SPAN));
+  TEST_ASSERT_TRUE(wheel.timers[0].armed);
+  TEST_ASSERT_EQUAL_UINT32(0, timerWheelAdvance(wheel, far - 1));
+  TEST_ASSERT_EQUAL_UINT32(1 << 0, timerWheelAdvance(wheel, far));
+
+  // Re-arming a parked timer closer fires it there, and only there
+  uint32_t now = far;
+  timerWheelSet(wheel, 1, now + TIMER_WHEEL_SPAN * 2);
+  timerWheelSet(wheel, 1, now + 50);
+  TEST_ASSERT_EQUAL(0, levelOf(1));
+  TEST_ASSERT_EQUAL_UINT32(1 << 1, timerWheelAdvance(wheel, now + 50));
+  TEST_ASSERT_TRUE(wheelEmpty());
+
+  // Cancelling a parked timer clears its slot
+  now += 50;
+  timerWheelSet(wheel, 2, now + TIMER_WHEEL_SPAN + 1);
+  TEST_ASSERT_FALSE(wheelEmpty());
+  timerWheelCancel(wheel, 2);
+  timerWheelCancel(wheel, 2); // Twice is harmless
+  TEST_ASSERT_FALSE(wheel.timers[2].armed);
+  TEST_ASSERT_TRUE(wheelEmpty());
+  uint32_t tick;
+  TEST_ASSERT_FALSE(timerWheelNextWork(wheel, tick));
+  TEST_ASSERT_EQUAL_UINT32(0, timerWheelAdvance(wheel, now + TIMER_WHEEL_SPAN * 2));
+}
+
+void test_timers_due_in_the_same_tick_fire_together(void) {
+  timerWheelInit(wheel, 0);
+
+  // Armed from three levels for tick 4200, with neighbours on either side
+  timerWheelSet(wheel, 0, 4200);
+  timerWheelSet(wheel, 5, 4199);
+  timerWheelSet(wheel, 6, 4201);
+  TEST_ASSERT_EQUAL_UINT32(0, timerWheelAdvance(wheel, 4100));
+  timerWheelSet(wheel, 1, 4200);
+  TEST_ASSERT_EQUAL_UINT32(0, timerWheelAdvance(wheel, 4190));
+  timerWheelSet(wheel, 2, 4200);
+  TEST_ASSERT_EQUAL(0, levelOf(2));
+
+  // Stepping one tick at a time fires in deadline order, and the shared
+  // tick fires every timer due there in one call
+  TEST_ASSERT_EQUAL_UINT32(0, timerWheelAdvance(wheel, 4198));
+  TEST_ASSERT_EQUAL_UINT32(1 << 5, timerWheelAdvance(wheel, 4199));
+  TEST_ASSERT_EQUAL_UINT32((1 << 0) | (1 << 1) | (1 << 2), timerWheelAdvance(wheel, 4200));
+  TEST_ASSERT_EQUAL_UINT32(1 << 6, timerWheelAdvance(wheel, 4201));
+
+  // Skipping ahead reports everything that came due in between
+  timerWheelSet(wheel, 3, 4300);
+  timerWheelSet(wheel, 4, 4310);
+  TEST_ASSERT_EQUAL_UINT32((1 << 3) | (1 << 4), timerWheelAdvance(wheel, 5000));
+}
+
+int main(void) {
+  UNITY_BEGIN();
+  RUN_TEST(test_higher_levels_cascade_into_level_0);
+  RUN_TEST(test_ticks_wrap_around_32_bits);
+  RUN_TEST(test_parked_timers_rearm_and_cancel);
+  RUN_TEST(test_timers_due_in_the_same_tick_fire_together);
+  return UNITY_END();
+}
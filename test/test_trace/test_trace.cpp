@@ -0,0 +1,141 @@
+// Host tests for the trace ring and its Chrome trace-event export
+#define TRACE_IMPLEMENTATION
+#include <unity.h>
+#include <string>
+#include <thread>
+#include "trace.h"
+
+void setUp(void) {
+  trace_state.head.store(0);
+  trace_state.paused.store(false);
+  trace_state.exporter.store(0);
+  for (TraceThread& thread : trace_state.threads) {
+    thread.id.store(0);
+  }
+}
+
+void tearDown(void) {
+}
+
+// Run a whole export through a small buffer, as the web server's chunked
+// response does
+static std::string exportTrace(size_t chunk) {
+  TraceExport cursor;
+  traceExportBegin(cursor);
+  std::string json;
+  uint8_t buffer[64];
+  size_t length;
+  while ((length = traceExport(cursor, buffer, chunk)) > 0) {
+    json.append((const char*)buffer, length);
+  }
+  return json;
+}
+
+static int countOf(const std::string& text, const std::string& needle) {
+  int count = 0;
+  for (size_t at = text.find(needle); at != std::string::npos; at = text.find(needle, at + 1)) {
+    count++;
+  }
+  return count;
+}
+
+void test_export_is_chrome_trace_json(void) {
+  {
+    TRACE_SCOPE("step");
+    traceInstant("wifi:got_ip");
+    traceCounter("heap", 1234);
+  }
+  std::string json = exportTrace(7);
+  TEST_ASSERT_EQUAL(0, json.find("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"));
+  TEST_ASSERT_EQUAL(json.size() - 3, json.rfind("]}\n"));
+  TEST_ASSERT_EQUAL(1, countOf(json, "\"name\":\"thread_name\",\"ph\":\"M\""));
+  TEST_ASSERT_EQUAL(1, countOf(json, "\"name\":\"step\",\"ph\":\"B\",\"ts\":0,"));
+  TEST_ASSERT_EQUAL(1, countOf(json, "\"name\":\"step\",\"ph\":\"E\""));
+  TEST_ASSERT_EQUAL(1, countOf(json, "\"name\":\"wifi:got_ip\",\"ph\":\"i\""));
+  TEST_ASSERT_EQUAL(1, countOf(json, "\"args\":{\"value\":1234}"));
+  TEST_ASSERT_EQUAL(countOf(json, "{"), countOf(json, "}"));
+  TEST_ASSERT_EQUAL(countOf(json, "\n") - 3, countOf(json, ",{")); // All but header, first entry and footer
+}
+
+void test_export_keeps_newest_events_in_order(void) {
+  for (int i = 0; i < TRACE_RING_SIZE + 10; i++) {
+    traceCounter("n", i);
+  }
+  std::string json = exportTrace(64);
+  TEST_ASSERT_EQUAL(TRACE_RING_SIZE, countOf(json, "\"ph\":\"C\""));
+  TEST_ASSERT_EQUAL(0, countOf(json, "\"value\":9}"));
+  TEST_ASSERT_EQUAL(1, countOf(json, "\"value\":10}"));
+  TEST_ASSERT_EQUAL(1, countOf(json, "\"value\":" + std::to_string(TRACE_RING_SIZE + 9) + "}"));
+  
+  // Values and timestamps come out oldest first
+  long last_value = -1;
+  long last_ts = -1;
+  for (size_t at = json.find("\"ts\":"); at != std::string::npos; at = json.find("\"ts\":", at + 1)) {
+    long ts = strtol(json.c_str() + at + 5, NULL, 10);
+    long value = strtol(json.c_str() + json.find("\"value\":", at) + 8, NULL, 10);
+    TEST_ASSERT_TRUE(ts >= last_ts);
+    TEST_ASSERT_EQUAL(last_value < 0 ? 10 : last_value + 1, value);
+    last_ts = ts;
+    last_value = value;
+  }
+}
+
+void test_recording_pauses_during_export(void) {
+  traceInstant("before");
+  TraceExport cursor;
+  traceExportBegin(cursor);
+  traceInstant("during");
+  uint8_t buffer[64];
+  std::string json;
+  size_t length;
+  while ((length = traceExport(cursor, buffer, sizeof(buffer))) > 0) {
+    json.append((const char*)buffer, length);
+  }
+  TEST_ASSERT_EQUAL(1, countOf(json, "\"before\""));
+  TEST_ASSERT_EQUAL(0, countOf(json, "\"during\""));
+  
+  // A finished export resumes recording
+  traceInstant("after");
+  TEST_ASSERT_EQUAL(1, countOf(exportTrace(64), "\"after\""));
+}
+
+void test_one_export_at_a_time(void) {
+  TraceExport first;
+  TraceExport second;
+  TEST_ASSERT_TRUE(traceExportBegin(first));
+  TEST_ASSERT_FALSE(traceExportBegin(second));
+  
+  // A late end for the first export, as from its disconnect handler, must
+  // not resume recording under the next one
+  traceExportEnd(first.id);
+  TEST_ASSERT_TRUE(traceExportBegin(second));
+  traceExportEnd(first.id);
+  traceInstant("during");
+  TEST_ASSERT_TRUE(trace_state.paused.load());
+  traceExportEnd(second.id);
+  traceInstant("after");
+  std::string json = exportTrace(64);
+  TEST_ASSERT_EQUAL(0, countOf(json, "\"during\""));
+  TEST_ASSERT_EQUAL(1, countOf(json, "\"after\""));
+}
+
+void test_threads_get_their_own_track(void) {
+  traceInstant("main");
+  std::thread worker([] { traceInstant("worker"); });
+  worker.join();
+  std::string json = exportTrace(64);
+  TEST_ASSERT_EQUAL(2, countOf(json, "\"name\":\"thread_name\""));
+  TEST_ASSERT_EQUAL(1, countOf(json, "\"name\":\"main\",\"ph\":\"i\",\"ts\":0,\"pid\":1,\"tid\":0"));
+  TEST_ASSERT_EQUAL(1, countOf(json, "\"name\":\"worker\",\"ph\":\"i\""));
+  TEST_ASSERT_EQUAL(1, countOf(json, "\"tid\":1,\"s\":\"t\""));
+}
+
+int main(void) {
+  UNITY_BEGIN();
+  RUN_TEST(test_export_is_chrome_trace_json);
+  RUN_TEST(test_export_keeps_newest_events_in_order);
+  RUN_TEST(test_recording_pauses_during_export);
+  RUN_TEST(test_one_export_at_a_time);
+  RUN_TEST(test_threads_get_their_own_track);
+  return UNITY_END();
+}
@@ -0,0 +1,303 @@
+// jasm: assembler and dry runner for jiggla movement scripts (script_vm.h)
+//
+// Build: g++ -std=c++17 -O2 -Iinclude tools/jasm.cpp -o jasm
+//
+//   jasm wiggle.jas wiggle.jvm         assemble, verify and write a script file
+//   jasm --run wiggle.jas [options]    assemble and run on the host, printing
+//                                      every HID report with its virtual time
+//     --size N    movement size register preset in pixels (default 100)
+//     --speed N   movement speed register preset in ms (default 1000)
+//     --seed N    random seed (default 1)
+//     --limit N   stop after N instructions (default 100000)
+//
+// Source syntax, one instruction per line, ';' or '#' starts a comment:
+//
+//   label:  set r0, 5          ; registers r0-r7, r6/r7 preset to size/speed
+//           movei 10, -4
+//           rand r1, 20
+//           add r1, 40
+//           waitr r1
+//           click left         ; press, wait 8 ms, release
+//           loop r0, label
+//           halt
+//
+// Buttons are left, right, middle, back, forward or a number, combined with '|'.
+
+#include "script_vm.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+struct SourceLine {
+  int number;
+  std::string mnemonic;
+  std::vector<std::string> operands;
+};
+
+struct Mnemonic {
+  const char* name;
+  uint8_t op;
+  const char* operands; // r register, i immediate, b buttons, t target, x/y int8 immediates
+};
+
+const Mnemonic mnemonics[] = {
+  { "halt", SCRIPT_OP_HALT, "" },
+  { "set", SCRIPT_OP_SET, "ri" },
+  { "add", SCRIPT_OP_ADD, "ri" },
+  { "mul", SCRIPT_OP_MUL, "ri" },
+  { "div", SCRIPT_OP_DIV, "ri" },
+  { "mov", SCRIPT_OP_MOV, "rr" },
+  { "addr", SCRIPT_OP_ADDR, "rr" },
+  { "rand", SCRIPT_OP_RAND, "ri" },
+  { "move", SCRIPT_OP_MOVE, "rr" },
+  { "movei", SCRIPT_OP_MOVEI, "xy" },
+  { "press", SCRIPT_OP_PRESS, "b" },
+  { "release", SCRIPT_OP_RELEASE, "b" },
+  { "scroll", SCRIPT_OP_SCROLL, "r" },
+  { "scrolli", SCRIPT_OP_SCROLLI, "i" },
+  { "wait", SCRIPT_OP_WAIT, "i" },
+  { "waitr", SCRIPT_OP_WAITR, "r" },
+  { "loop", SCRIPT_OP_LOOP, "rt" },
+  { "jmp", SCRIPT_OP_JMP, "t" },
+};
+
+const uint32_t CLICK_HOLD_MS = 8; // Matches the touchpad click
+
+[[noreturn]] void fail(int line, const std::string& message) {
+  if (line > 0) {
+    fprintf(stderr, "line %d: ", line);
+  }
+  fprintf(stderr, "%s\n", message.c_str());
+  exit(1);
+}
+
+std::string trim(const std::string& text) {
+  size_t start = text.find_first_not_of(" \t\r");
+  size_t end = text.find_last_not_of(" \t\r");
+  return start == std::string::npos ? "" : text.substr(start, end - start + 1);
+}
+
+bool parseNumber(const std::string& text, long& value) {
+  char* end = NULL;
+  value = strtol(text.c_str(), &end, 0);
+  return !text.empty() && *end == '\0';
+}
+
+long parseImmediate(const SourceLine& line, const std::string& text, long min, long max) {
+  long value;
+  if (!parseNumber(text, value) || value < min || value > max) {
+    fail(line.number, "expected a number in [" + std::to_string(min) + ", " + std::to_string(max) + "], got '" + text + "'");
+  }
+  return value;
+}
+
+uint8_t parseRegister(const SourceLine& line, const std::string& text) {
+  if (text.size() == 2 && (text[0] == 'r' || text[0] == 'R') && text[1] >= '0' && text[1] < '0' + SCRIPT_REGISTERS) {
+    return (uint8_t)(text[1] - '0');
+  }
+  fail(line.number, "expected a register r0-r" + std::to_string(SCRIPT_REGISTERS - 1) + ", got '" + text + "'");
+}
+
+uint8_t parseButtons(const SourceLine& line, const std::string& text) {
+  static const std::map<std::string, uint8_t> names = {
+    { "left", 1 }, { "right", 2 }, { "middle", 4 }, { "back", 8 }, { "forward", 16 },
+  };
+  uint8_t mask = 0;
+  std::stringstream parts(text);
+  std::string part;
+  while (std::getline(parts, part, '|')) {
+    part = trim(part);
+    auto named = names.find(part);
+    mask |= named != names.end() ? named->second : (uint8_t)parseImmediate(line, part, 1, SCRIPT_BUTTON_MASK);
+  }
+  return mask;
+}
+
+// Instructions a source line expands to
+size_t lineLength(const SourceLine& line) {
+  return line.mnemonic == "click" ? 3 : 1;
+}
+
+std::vector<ScriptInstruction> assemble(const char* path) {
+  FILE* file = fopen(path, "r");
+  if (file == NULL) {
+    perror(path);
+    exit(1);
+  }
+
+  // Pass 1: split lines and place labels
+  std::vector<SourceLine> lines;
+  std::map<std::string, size_t> labels;
+  size_t address = 0;
+  char buffer[512];
+  for (int number = 1; fgets(buffer, sizeof(buffer), file) != NULL; number++) {
+    std::string text = buffer;
+    text = trim(text.substr(0, text.find_first_of(";#\n")));
+    size_t colon = text.find(':');
+    if (colon != std::string::npos) {
+      std::string label = trim(text.substr(0, colon));
+      if (label.empty() || labels.count(label)) {
+        fail(number, "empty or duplicate label '" + label + "'");
+      }
+      labels[label] = address;
+      text = trim(text.substr(colon + 1));
+    }
+    if (text.empty()) {
+      continue;
+    }
+    SourceLine line = { number, "", {} };
+    size_t space = text.find_first_of(" \t");
+    line.mnemonic = text.substr(0, space);
+    std::stringstream operands(space == std::string::npos ? "" : text.substr(space));
+    std::string operand;
+    while (std::getline(operands, operand, ',')) {
+      line.operands.push_back(trim(operand));
+    }
+    address += lineLength(line);
+    lines.push_back(line);
+  }
+  fclose(file);
+
+  // Pass 2: encode
+  std::vector<ScriptInstruction> code;
+  for (const SourceLine& line : lines) {
+    if (line.mnemonic == "click") {
+      if (line.operands.size() != 1) {
+        fail(line.number, "click takes one button operand");
+      }
+      uint8_t buttons = parseButtons(line, line.operands[0]);
+      code.push_back({ SCRIPT_OP_PRESS, buttons, 0 });
+      code.push_back({ SCRIPT_OP_WAIT, 0, (int16_t)CLICK_HOLD_MS });
+      code.push_back({ SCRIPT_OP_RELEASE, buttons, 0 });
+      continue;
+    }
+    const Mnemonic* mnemonic = NULL;
+    for (const Mnemonic& candidate : mnemonics) {
+      if (line.mnemonic == candidate.name) {
+        mnemonic = &candidate;
+      }
+    }
+    if (mnemonic == NULL) {
+      fail(line.number, "unknown instruction '" + line.mnemonic + "'");
+    }
+    if (line.operands.size() != strlen(mnemonic->operands)) {
+      fail(line.number, std::string(mnemonic->name) + " takes " + std::to_string(strlen(mnemonic->operands)) + " operands");
+    }
+    ScriptInstruction instruction = { mnemonic->op, 0, 0 };
+    int x = 0;
+    for (size_t i = 0; i < line.operands.size(); i++) {
+      const std::string& operand = line.operands[i];
+      switch (mnemonic->operands[i]) {
+        case 'r':
+          if (i == 0) {
+            instruction.a = parseRegister(line, operand);
+          } else {
+            instruction.imm = parseRegister(line, operand);
+          }
+          break;
+        case 'i':
+          instruction.imm = (int16_t)parseImmediate(line, operand, INT16_MIN, INT16_MAX);
+          break;
+        case 'b':
+          instruction.a = parseButtons(line, operand);
+          break;
+        case 't': {
+          auto label = labels.find(operand);
+          if (label == labels.end()) {
+            fail(line.number, "unknown label '" + operand + "'");
+          }
+          instruction.imm = (int16_t)label->second;
+          break;
+        }
+        case 'x':
+          x = (int)parseImmediate(line, operand, -127, 127);
+          break;
+        case 'y':
+          instruction.imm = (int16_t)(uint16_t)(((int)parseImmediate(line, operand, -127, 127) << 8) | (x & 0xff));
+          break;
+      }
+    }
+    code.push_back(instruction);
+  }
+
+  if (code.empty() || code.size() > SCRIPT_MAX_INSTRUCTIONS) {
+    fail(0, "scripts have 1-" + std::to_string(SCRIPT_MAX_INSTRUCTIONS) + " instructions, got " + std::to_string(code.size()));
+  }
+  for (size_t i = 0; i < code.size(); i++) {
+    const char* error = scriptCheckInstruction(code[i], (uint16_t)i, (uint16_t)code.size());
+    if (error != NULL) {
+      fail(0, "instruction " + std::to_string(i) + ": " + error);
+    }
+  }
+  return code;
+}
+
+// Prints each report with the virtual time of the run
+struct PrintHost {
+  uint64_t now_ms = 0;
+  std::mt19937 rng;
+  void move(int8_t x, int8_t y) { printf("%8llu ms  move %d %d\n", (unsigned long long)now_ms, x, y); }
+  void press(uint8_t buttons) { printf("%8llu ms  press 0x%02x\n", (unsigned long long)now_ms, buttons); }
+  void release(uint8_t buttons) { printf("%8llu ms  release 0x%02x\n", (unsigned long long)now_ms, buttons); }
+  void scroll(int8_t wheel) { printf("%8llu ms  scroll %d\n", (unsigned long long)now_ms, wheel); }
+  uint32_t random(uint32_t max) { return std::uniform_int_distribution<uint32_t>(0, max)(rng); }
+};
+
+int run(const std::vector<ScriptInstruction>& code, int32_t size, int32_t speed, uint32_t seed, uint32_t limit) {
+  PrintHost host;
+  host.rng.seed(seed);
+  ScriptVM vm = {};
+  vm.regs[SCRIPT_REG_SIZE] = size;
+  vm.regs[SCRIPT_REG_SPEED] = speed;
+  while (vm.executed < limit) {
+    uint32_t budget = limit - vm.executed < 64 ? limit - vm.executed : 64;
+    ScriptStatus status = scriptRunSlice(vm, code.data(), budget, host);
+    if (status == SCRIPT_DONE) {
+      printf("halt after %u instructions, %llu ms\n", vm.executed, (unsigned long long)host.now_ms);
+      return 0;
+    }
+    host.now_ms += vm.wait_ms;
+  }
+  printf("stopped after %u instructions, %llu ms (buttons held: 0x%02x)\n",
+         vm.executed, (unsigned long long)host.now_ms, vm.buttons);
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  if (argc >= 3 && strcmp(argv[1], "--run") == 0) {
+    long size = 100, speed = 1000, seed = 1, limit = 100000;
+    for (int i = 3; i + 1 < argc; i += 2) {
+      long* target = strcmp(argv[i], "--size") == 0 ? &size : strcmp(argv[i], "--speed") == 0 ? &speed :
+                     strcmp(argv[i], "--seed") == 0 ? &seed : strcmp(argv[i], "--limit") == 0 ? &limit : NULL;
+      if (target == NULL || !parseNumber(argv[i + 1], *target)) {
+        fprintf(stderr, "bad option %s\n", argv[i]);
+        return 2;
+      }
+    }
+    return run(assemble(argv[2]), (int32_t)size, (int32_t)speed, (uint32_t)seed, (uint32_t)limit);
+  }
+  if (argc != 3) {
+    fprintf(stderr, "usage: jasm input.jas output.jvm\n       jasm --run input.jas [--size N] [--speed N] [--seed N] [--limit N]\n");
+    return 2;
+  }
+
+  std::vector<ScriptInstruction> code = assemble(argv[1]);
+  std::vector<uint8_t> bytes(SCRIPT_FILE_HEADER_SIZE + code.size() * SCRIPT_INSTRUCTION_SIZE);
+  size_t length = scriptWriteHeader(bytes.data(), (uint16_t)code.size());
+  for (const ScriptInstruction& instruction : code) {
+    length += scriptWriteInstruction(bytes.data() + length, instruction);
+  }
+  FILE* out = fopen(argv[2], "wb");
+  if (out == NULL || fwrite(bytes.data(), 1, length, out) != length || fclose(out) != 0) {
+    perror(argv[2]);
+    return 1;
+  }
+  printf("%s: %zu instructions, %zu bytes\n", argv[2], code.size(), length);
+  return 0;
+}
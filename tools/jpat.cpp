@@ -0,0 +1,168 @@
+// jpat: pattern file encoder for jiggla (pattern_file.h)
+//
+// Build: g++ -std=c++17 -O2 -Iinclude tools/jpat.cpp -o jpat
+//
+//   jpat wave.csv wave.jpat     encode a point list, validate and write it
+//   jpat --dump wave.jpat       print a pattern file back as a point list
+//
+// Input, one step per line, '#' starts a comment:
+//
+//   x, y[, units]
+//
+// x and y are the absolute position after the step in file units (100 = the
+// movement size), starting from 0, 0. units is the step's share of the
+// movement speed (default 1); the pattern takes units / total of the speed
+// after each step.
+
+#include "pattern_file.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+// Byte source over a buffer for the pattern_file.h readers
+struct BufferSource {
+  const uint8_t* data;
+  size_t length;
+  size_t offset = 0;
+  int read() { return offset < length ? data[offset++] : -1; }
+};
+
+[[noreturn]] void fail(int line, const std::string& message) {
+  if (line > 0) {
+    fprintf(stderr, "line %d: ", line);
+  }
+  fprintf(stderr, "%s\n", message.c_str());
+  exit(1);
+}
+
+bool parseField(const char*& cursor, long& value) {
+  char* end;
+  value = strtol(cursor, &end, 10);
+  if (end == cursor) {
+    return false;
+  }
+  cursor = end;
+  while (*cursor == ' ' || *cursor == '\t') {
+    cursor++;
+  }
+  return true;
+}
+
+std::vector<PatternPoint> readPoints(const char* path) {
+  FILE* in = fopen(path, "r");
+  if (in == NULL) {
+    perror(path);
+    exit(1);
+  }
+  std::vector<PatternPoint> points;
+  char text[256];
+  int number = 0;
+  while (fgets(text, sizeof(text), in) != NULL) {
+    number++;
+    char* comment = strchr(text, '#');
+    if (comment != NULL) {
+      *comment = '\0';
+    }
+    const char* cursor = text;
+    while (*cursor == ' ' || *cursor == '\t') {
+      cursor++;
+    }
+    if (*cursor == '\0' || *cursor == '\n' || *cursor == '\r') {
+      continue;
+    }
+    long x, y, units = 1;
+    if (!parseField(cursor, x) || *cursor++ != ',' || !parseField(cursor, y)) {
+      fail(number, "expected x, y[, units]");
+    }
+    if (*cursor == ',') {
+      cursor++;
+      if (!parseField(cursor, units)) {
+        fail(number, "expected x, y[, units]");
+      }
+    }
+    if (*cursor != '\0' && *cursor != '\n' && *cursor != '\r') {
+      fail(number, "unexpected text after the point");
+    }
+    if (x < -PATTERN_FILE_MAX_COORD || x > PATTERN_FILE_MAX_COORD ||
+        y < -PATTERN_FILE_MAX_COORD || y > PATTERN_FILE_MAX_COORD) {
+      fail(number, "position out of range");
+    }
+    if (units < 1 || units > 65535) {
+      fail(number, "units out of range 1..65535");
+    }
+    points.push_back({ (int32_t)x, (int32_t)y, (uint16_t)units });
+  }
+  fclose(in);
+  return points;
+}
+
+int dump(const char* path) {
+  FILE* in = fopen(path, "rb");
+  if (in == NULL) {
+    perror(path);
+    return 1;
+  }
+  std::vector<uint8_t> bytes(PATTERN_FILE_MAX_SIZE + 1);
+  size_t length = fread(bytes.data(), 1, bytes.size(), in);
+  fclose(in);
+  if (length > PATTERN_FILE_MAX_SIZE) {
+    fail(0, "file too large");
+  }
+
+  BufferSource check = { bytes.data(), length };
+  PatternFileHeader header;
+  const char* error = patternValidate(check, header);
+  if (error != NULL) {
+    fail(0, error);
+  }
+  printf("# %u steps in %u segments, %u units\n", header.step_count, header.segment_count, header.duration_units);
+  BufferSource source = { bytes.data(), length, PATTERN_FILE_HEADER_SIZE };
+  int32_t x = 0;
+  int32_t y = 0;
+  for (uint16_t s = 0; s < header.segment_count; s++) {
+    PatternSegment segment = {};
+    patternReadSegment(source, segment);
+    for (uint16_t i = 0; i < segment.step_count; i++) {
+      int32_t dx = 0, dy = 0;
+      patternReadDelta(source, segment.encoding, dx, dy); // Validated above
+      x += dx;
+      y += dy;
+      printf("%d, %d, %u\n", x, y, segment.step_units);
+    }
+  }
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  if (argc == 3 && strcmp(argv[1], "--dump") == 0) {
+    return dump(argv[2]);
+  }
+  if (argc != 3) {
+    fprintf(stderr, "usage: jpat input.csv output.jpat\n       jpat --dump input.jpat\n");
+    return 2;
+  }
+
+  std::vector<PatternPoint> points = readPoints(argv[1]);
+  std::vector<uint8_t> bytes(PATTERN_FILE_MAX_SIZE);
+  const char* error;
+  size_t length = patternEncode(points.data(), points.size(), bytes.data(), bytes.size(), &error);
+  if (length == 0) {
+    fail(0, error);
+  }
+  BufferSource check = { bytes.data(), length };
+  PatternFileHeader header;
+  error = patternValidate(check, header);
+  if (error != NULL) {
+    fail(0, error);
+  }
+  FILE* out = fopen(argv[2], "wb");
+  if (out == NULL || fwrite(bytes.data(), 1, length, out) != length || fclose(out) != 0) {
+    perror(argv[2]);
+    return 1;
+  }
+  printf("%s: %u steps in %u segments, %zu bytes\n", argv[2], header.step_count, header.segment_count, length);
+  return 0;
+}